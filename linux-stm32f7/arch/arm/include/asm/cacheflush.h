@@ -300,6 +300,20 @@ static inline void v7m_dma_unmap_area(const void *s, size_t l, int f) { }
 
 #endif
 
+#if defined(CONFIG_CPU_CACHE_V7M)
+/*
+ * DMA range maintenance at or above this size is done by set/way
+ */
+extern unsigned long v7m_dma_setway_threshold;
+
+#if defined(CONFIG_V7M_DMA_NOCACHE)
+/*
+ * Set up the non-cacheable MPU window for coherent DMA memory
+ */
+extern void v7m_dma_nocache_init(void);
+#endif
+#endif
+
 #define __cpuc_flush_kern_all		__glue(_CACHE,_flush_kern_cache_all)
 #define __cpuc_flush_user_all		__glue(_CACHE,_flush_user_cache_all)
 #define __cpuc_flush_user_range		__glue(_CACHE,_flush_user_cache_range)
@@ -11,6 +11,16 @@
 
 #include <linux/in6.h>
 
+#if defined(CONFIG_HAVE_TCM) && defined(CONFIG_CPU_V7M)
+/*
+ * csum_partial() and csum_partial_copy_nocheck() run from ITCM,
+ * out of BL range of the kernel text
+ */
+#define __csum_call	__attribute__((long_call))
+#else
+#define __csum_call
+#endif
+
 /*
  * computes the checksum of a memory block at buff, length len,
  * and adds in "sum" (32-bit)
@@ -23,7 +33,7 @@
  *
  * it's best to have buff aligned on a 32-bit boundary
  */
-__wsum csum_partial(const void *buff, int len, __wsum sum);
+__wsum __csum_call csum_partial(const void *buff, int len, __wsum sum);
 
 /*
  * the same as csum_partial, but copies from src while it
@@ -33,7 +43,7 @@ __wsum csum_partial(const void *buff, int len, __wsum sum);
  * better 64-bit) boundary
  */
 
-__wsum
+__wsum __csum_call
 csum_partial_copy_nocheck(const void *src, void *dst, int len, __wsum sum);
 
 __wsum
@@ -54,6 +54,9 @@ union vfp_state {
 
 extern void vfp_flush_thread(union vfp_state *);
 extern void vfp_release_thread(union vfp_state *);
+#ifdef CONFIG_VFPM
+extern int vfpm_nocp_trap(void);
+#endif
 
 #define FP_HARD_SIZE 35
 
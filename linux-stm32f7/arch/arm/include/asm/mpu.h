@@ -19,6 +19,11 @@
  */
 extern void mpu_region_define(unsigned long b, unsigned long t);
 
+/*
+ * Reserve the MPU regions from a given index up for boot-time mappings
+ */
+extern int mpu_reserve_top(int n);
+
 /*
  * Prepare to allocate "the MPU page tables".
  * Enable the hardware MPU.
@@ -10,11 +10,10 @@
 #ifndef __ASMARM_TCM_H
 #define __ASMARM_TCM_H
 
-#ifndef CONFIG_HAVE_TCM
-#error "You should not be including tcm.h unless you have a TCM!"
-#endif
-
 #include <linux/compiler.h>
+#include <linux/types.h>
+
+#ifdef CONFIG_HAVE_TCM
 
 /* Tag variables with this */
 #define __tcmdata __section(.tcm.data)
@@ -28,4 +27,26 @@
 void *tcm_alloc(size_t len);
 void tcm_free(void *addr, size_t len);
 
+#else
+
+/*
+ * No TCM: tagged code and data stay in normal memory, so that drivers
+ * shared with other platforms can tag their hot paths unconditionally
+ */
+#define __tcmdata
+#define __tcmconst
+#define __tcmfunc
+#define __tcmlocalfunc
+
+static inline void *tcm_alloc(size_t len)
+{
+	return NULL;
+}
+
+static inline void tcm_free(void *addr, size_t len)
+{
+}
+
+#endif /* CONFIG_HAVE_TCM */
+
 #endif
@@ -48,6 +48,7 @@ static struct resource itcm_res = {
 	.flags = IORESOURCE_MEM
 };
 
+#ifdef CONFIG_MMU
 static struct map_desc dtcm_iomap[] __initdata = {
 	{
 		.virtual	= DTCM_OFFSET,
@@ -65,6 +66,30 @@ static struct map_desc itcm_iomap[] __initdata = {
 		.type		= MT_UNCACHED
 	}
 };
+#endif
+
+#ifdef CONFIG_CPU_V7M
+/* Cortex-M7 ITCM and DTCM Control Registers */
+#define V7M_ITCMCR		(*(volatile u32 *)0xE000EF90)
+#define V7M_DTCMCR		(*(volatile u32 *)0xE000EF94)
+#define V7M_TCMCR_EN		(1 << 0)
+#define V7M_TCMCR_SZ(x)		(((x) >> 3) & 0xf)
+
+/* The Cortex-M7 TCMs are at fixed addresses */
+#define V7M_ITCM_BASE		0x00000000
+#define V7M_DTCM_BASE		0x20000000
+
+/*
+ * TCMs enabled, in the format of the ARM TCM Status Register
+ */
+static u32 tcm_status(void)
+{
+	return (V7M_ITCMCR & V7M_TCMCR_EN ? 1 : 0) |
+	       (V7M_DTCMCR & V7M_TCMCR_EN ? 1 << 16 : 0);
+}
+#else
+#define tcm_status()		read_cpuid_tcmstatus()
+#endif
 
 /*
  * Allocate a chunk of TCM memory
@@ -94,6 +119,28 @@ void tcm_free(void *addr, size_t len)
 EXPORT_SYMBOL(tcm_free);
 
 
+#ifdef CONFIG_CPU_V7M
+/*
+ * The Cortex-M7 TCMs cannot be moved, and the kernel may use only
+ * a part of them: check that this part fits in the TCM
+ */
+static void __init setup_tcm_bank(u8 type, u32 offset, u32 expected_size)
+{
+	u32 cr = type ? V7M_ITCMCR : V7M_DTCMCR;
+	u32 base = type ? V7M_ITCM_BASE : V7M_DTCM_BASE;
+	int tcm_size;
+
+	/* SZ is 0 when there is no TCM, else log2 of the size in KB + 1 */
+	tcm_size = V7M_TCMCR_SZ(cr) < 3 ? 0 : 1 << (V7M_TCMCR_SZ(cr) - 1);
+
+	pr_info("CPU: found %sTCM %dk @ %08x, kernel uses %dk @ %08x\n",
+		type ? "I" : "D", tcm_size, base, expected_size, offset);
+
+	if (offset - base + (expected_size << 10) > (tcm_size << 10))
+		pr_crit("CPU: %sTCM of %dk is too small!\n",
+			type ? "I" : "D", tcm_size);
+}
+#else
 static void __init setup_tcm_bank(u8 type, u32 offset, u32 expected_size)
 {
 	const int tcm_sizes[16] = { 0, -1, -1, 4, 8, 16, 32, 64, 128,
@@ -146,19 +193,20 @@ static void __init setup_tcm_bank(u8 type, u32 offset, u32 expected_size)
 		 tcm_size,
 		 (tcm_region & 0xfffff000U));
 }
+#endif /* CONFIG_CPU_V7M */
 
 /*
  * This initializes the TCM memory
  */
 void __init tcm_init(void)
 {
-	u32 tcm_status = read_cpuid_tcmstatus();
+	u32 status = tcm_status();
 	char *start;
 	char *end;
 	char *ram;
 
 	/* Setup DTCM if present */
-	if (tcm_status & (1 << 16)) {
+	if (status & (1 << 16)) {
 		setup_tcm_bank(0, DTCM_OFFSET,
 			       (DTCM_END - DTCM_OFFSET + 1) >> 10);
 		request_resource(&iomem_resource, &dtcm_res);
@@ -172,7 +220,7 @@ void __init tcm_init(void)
 	}
 
 	/* Setup ITCM if present */
-	if (tcm_status & 1) {
+	if (status & 1) {
 		setup_tcm_bank(1, ITCM_OFFSET,
 			       (ITCM_END - ITCM_OFFSET + 1) >> 10);
 		request_resource(&iomem_resource, &itcm_res);
@@ -182,6 +230,11 @@ void __init tcm_init(void)
 		end   = &__eitcm_text;
 		ram   = &__itcm_start;
 		memcpy(start, ram, (end-start));
+#ifdef CONFIG_CPU_V7M
+		/* Make the code visible to instruction fetches */
+		asm("dsb");
+		asm("isb");
+#endif
 		pr_debug("CPU ITCM: copied code from %p - %p\n", start, end);
 	}
 }
@@ -193,7 +246,7 @@ void __init tcm_init(void)
  */
 static int __init setup_tcm_pool(void)
 {
-	u32 tcm_status = read_cpuid_tcmstatus();
+	u32 status = tcm_status();
 	u32 dtcm_pool_start = (u32) &__edtcm_data;
 	u32 itcm_pool_start = (u32) &__eitcm_text;
 	int ret;
@@ -208,7 +261,7 @@ static int __init setup_tcm_pool(void)
 	pr_debug("Setting up TCM memory pool\n");
 
 	/* Add the rest of DTCM to the TCM pool */
-	if (tcm_status & (1 << 16)) {
+	if (status & (1 << 16)) {
 		if (dtcm_pool_start < DTCM_END) {
 			ret = gen_pool_add(tcm_pool, dtcm_pool_start,
 					   DTCM_END - dtcm_pool_start + 1, -1);
@@ -225,7 +278,7 @@ static int __init setup_tcm_pool(void)
 	}
 
 	/* Add the rest of ITCM to the TCM pool */
-	if (tcm_status & 1) {
+	if (status & 1) {
 		if (itcm_pool_start < ITCM_END) {
 			ret = gen_pool_add(tcm_pool, itcm_pool_start,
 					   ITCM_END - itcm_pool_start + 1, -1);
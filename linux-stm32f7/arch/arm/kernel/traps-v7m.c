@@ -221,6 +221,14 @@ asmlinkage void __exception do_busfault(struct pt_regs *regs)
  */
 asmlinkage void __exception do_usagefault(struct pt_regs *regs)
 {
+#ifdef CONFIG_VFPM
+	/* First FP instruction of a thread that does not own the FPU */
+	if (readl(&NVIC->local_fault_status) & NOCP && user_mode(regs) &&
+			vfpm_nocp_trap()) {
+		writel(NOCP, &NVIC->local_fault_status);
+		return;
+	}
+#endif
 	traps_v7m_common(regs, USAGEFAULT);
 }
 
@@ -21,6 +21,7 @@
 #include <linux/init.h>
 #include <linux/string.h>
 #include <linux/sched.h>
+#include <linux/debugfs.h>
 
 #include <asm/thread_notify.h>
 
@@ -39,17 +40,108 @@
 #define MVFR0_SP	0x20		/* Single precision supported in VFPv3 */
 #define MVFR0_SP_MASK	0xf0		/* Single precision supported in VFPv3: Bitmask */
 
+/*
+ * The FPU registers are switched lazily. last_vfp_context[] is the
+ * owner of the registers, the thread whose s16-s31 are in them; its
+ * s0-s15 are in them too, or pending in its exception frame
+ * (FPCCR.LSPACT). The FPU is enabled in CPACR only
+ * while the owner runs; any other thread traps on its first FP
+ * instruction (UsageFault, NOCP), and takes the registers over then.
+ *
+ * A thread switched to with an FP exception frame (EXC_RETURN
+ * 0xffffffed) takes the registers over at once, since the exception
+ * return unstacks s0-s15 and needs the FPU enabled.
+ */
+static union vfp_state *last_vfp_context[NR_CPUS];
 
-static union vfp_state *last_vfp_context;
+/* Statistics, in debugfs under vfpm/ */
+static u32 vfpm_switches;	/* Context switches */
+static u32 vfpm_traps;		/* NOCP traps on first FP use */
+static u32 vfpm_reloads;	/* Register set changes of owner */
+
+/* s0-s15 of a thread that has not used the FPU yet */
+static const u32 vfpm_zero[16];
 
 static void save_vfp_context(union vfp_state *vfp)
 {
-	asm("	stc	p11, cr8, [%0], #16*4\n" : : "r" (vfp) : "cc");
+	asm volatile("	stc	p11, cr8, [%0], #16*4\n"
+		     : "+r" (vfp) : : "memory");
 }
 
 static void load_vfp_context(union vfp_state *vfp)
 {
-	asm("	ldc	p11, cr8, [%0], #16*4\n" : : "r" (vfp) : "cc");
+	asm volatile("	ldc	p11, cr8, [%0], #16*4\n"
+		     : "+r" (vfp) : : "memory");
+}
+
+static void clear_vfp_low(void)
+{
+	const u32 *p = vfpm_zero;
+
+	asm volatile("	ldc	p11, cr0, [%0], #16*4\n"
+		     : "+r" (p) : : "memory");
+}
+
+/*
+ * Enable or disable FPU access
+ */
+static void vfpm_access(int on)
+{
+	volatile u32 *cpacr = (u32 *)CPACR_ADDR;
+	u32 v = *cpacr;
+
+	if (on)
+		v |= CPACR_CP0_FULL | CPACR_CP1_FULL;
+	else
+		v &= ~(CPACR_CP0_FULL | CPACR_CP1_FULL);
+
+	if (v != *cpacr) {
+		*cpacr = v;
+		asm volatile("dsb\n\tisb" : : : "memory");
+	}
+}
+
+/*
+ * Hand the FPU registers over to @vfp. The FPU must be enabled.
+ * Saving the old owner's s16-s31 is an FP instruction, so it also
+ * completes the lazy save of its s0-s15 into its exception frame.
+ */
+static void vfpm_take(unsigned int cpu, union vfp_state *vfp)
+{
+	if (last_vfp_context[cpu])
+		save_vfp_context(last_vfp_context[cpu]);
+	load_vfp_context(vfp);
+	last_vfp_context[cpu] = vfp;
+	vfpm_reloads++;
+}
+
+/*
+ * NOCP UsageFault from user mode: first FP instruction of a thread
+ * since it was switched to. Called from do_usagefault().
+ * @ret		1 -> handled, the instruction is to be restarted; 0 otherwise
+ */
+int vfpm_nocp_trap(void)
+{
+	union vfp_state *vfp = &current_thread_info()->vfpstate;
+	unsigned int cpu;
+
+	if (!(elf_hwcap & HWCAP_VFP))
+		return 0;
+
+	cpu = get_cpu();
+	vfpm_traps++;
+	vfpm_access(1);
+	if (last_vfp_context[cpu] != vfp) {
+		vfpm_take(cpu, vfp);
+		/*
+		 * The thread has no FP exception frame, so s0-s15 are not
+		 * live; don't leave the previous owner's in them.
+		 */
+		clear_vfp_low();
+	}
+	put_cpu();
+
+	return 1;
 }
 
 static int vfpm_notifier(struct notifier_block *self, unsigned long cmd,
@@ -63,36 +155,34 @@ static int vfpm_notifier(struct notifier_block *self, unsigned long cmd,
 	struct pt_regs *regs_to = task_pt_regs(thread_to->task);
 	int used_fpu = !!(regs_from->ARM_EXC_lr == 0xffffffed);
 	int will_use_fpu = !!(regs_to->ARM_EXC_lr == 0xffffffed);
+	unsigned int cpu = smp_processor_id();
 
 	u32 *fpccr = (u32 *)FPCCR_ADDR;
-	u32 *fpcar = (u32 *)FPCAR_ADDR;
-
-	int deferred_fpu_stacking = *fpccr & FPCCR_LSPACT;
 
 	switch (cmd) {
 	case THREAD_NOTIFY_FLUSH:
 		memset(vfp_to, 0, sizeof(*vfp_to));
-		will_use_fpu = 0;
 		/* fall through */
 
 	case THREAD_NOTIFY_EXIT:
-		if (last_vfp_context == vfp_to) {
+		if (last_vfp_context[cpu] == vfp_to) {
 			/* disable deferred FPU stacking */
 			*fpccr &= ~FPCCR_LSPACT;
-			last_vfp_context = NULL;
+			last_vfp_context[cpu] = NULL;
 		}
+		if (thread_to == thread_from)
+			vfpm_access(0);
 		break;
 
 	case THREAD_NOTIFY_SWITCH:
-		if (deferred_fpu_stacking) {
-			save_vfp_context(vfp_from);
-			vfp_from->hard.fpcar = *fpcar;
-			last_vfp_context = vfp_from;
-		}
-		if (will_use_fpu && last_vfp_context != vfp_to) {
-			load_vfp_context(vfp_to);
-			*fpcar = vfp_to->hard.fpcar;
-			last_vfp_context = vfp_to;
+		vfpm_switches++;
+		if (last_vfp_context[cpu] == vfp_to) {
+			vfpm_access(1);
+		} else if (will_use_fpu) {
+			vfpm_access(1);
+			vfpm_take(cpu, vfp_to);
+		} else {
+			vfpm_access(0);
 		}
 		break;
 
@@ -101,9 +191,15 @@ static int vfpm_notifier(struct notifier_block *self, unsigned long cmd,
 			/* {s8-s15, FPSCR, 4-byte pad */
 			int fp_stack_size = (16 + 1 + 1) * 4;
 
+			/*
+			 * The parent owns the registers: it used the FPU.
+			 * Saving them also completes any pending lazy save
+			 * of its s0-s15 into its exception frame. FPCAR may
+			 * point to another thread's frame if the parent
+			 * slept, so take the frame from the parent's regs.
+			 */
 			save_vfp_context(vfp_from);
-			vfp_from->hard.fpcar = *fpcar;
-			last_vfp_context = vfp_from;
+			vfp_from->hard.fpcar = regs_from->ARM_sp + 32;
 
 			/* Copy s8-s15 and FPSCR from thread ctx */
 			memcpy(vfp_to, vfp_from, sizeof(*vfp_to));
@@ -128,9 +224,9 @@ static struct notifier_block vfpm_notifier_block = {
 
 static int __init vfpm_init(void)
 {
-	u32 *cpacr = (u32 *)0xe000ed88;
 	u32 *mvfr0 = (u32 *)0xe000ef40;
 	u32 *fpccr = (u32 *)0xe000ef34;
+	struct dentry *dir;
 
 	/* check for single-precision VFP operations */
 	if ((*mvfr0 & 0xf0) != 0x20)
@@ -138,12 +234,24 @@ static int __init vfpm_init(void)
 
 	printk(KERN_INFO "ARMv7-M VFP Extension supported\n");
 
-	*cpacr |= 0xf << 20;		/* coprocessor access */
 	*fpccr |= 3 << 30;		/* automatic lazy state preservation */
 
 	elf_hwcap |= HWCAP_VFP;
 	thread_register_notifier(&vfpm_notifier_block);
 
+	/* Coprocessor access is given to the owner of the registers only */
+	vfpm_access(0);
+
+	dir = debugfs_create_dir("vfpm", NULL);
+	if (dir) {
+		debugfs_create_u32("switches", S_IRUGO | S_IWUSR, dir,
+				   &vfpm_switches);
+		debugfs_create_u32("traps", S_IRUGO | S_IWUSR, dir,
+				   &vfpm_traps);
+		debugfs_create_u32("reloads", S_IRUGO | S_IWUSR, dir,
+				   &vfpm_reloads);
+	}
+
 	return 0;
 }
 
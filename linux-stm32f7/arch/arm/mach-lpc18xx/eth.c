@@ -60,7 +60,7 @@ static struct resource eth_resources[] = {
  */
 static struct stm32_eth_data hitex_lpc4350_eth_data = {
 	.frame_max_size	= 2044,
-	.tx_buf_num	= 24,
+	.tx_buf_num	= 16,
 	.rx_buf_num	= 32,
 	.phy_id		= 1,
 };
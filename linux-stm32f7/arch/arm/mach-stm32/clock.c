@@ -115,6 +115,8 @@
 
 #define STM32_RCC_ENR_LTDCEN		(1 << 26)
 
+#define STM32_RCC_ENR_DMA2DEN		(1 << 23)
+
 /*
  * STM32 ENR bit for GPIOs
  */
@@ -262,6 +264,22 @@ static void ltdc_clk_disable(struct clk *clk)
 	STM32_RCC->apb2enr &= ~STM32_RCC_ENR_LTDCEN;
 }
 
+/*
+ * Enable the DMA2D (Chrom-ART) clock
+ */
+static void dma2d_clk_enable(struct clk *clk)
+{
+	STM32_RCC->ahb1enr |= STM32_RCC_ENR_DMA2DEN;
+}
+
+/*
+ * Disable the DMA2D (Chrom-ART) clock
+ */
+static void dma2d_clk_disable(struct clk *clk)
+{
+	STM32_RCC->ahb1enr &= ~STM32_RCC_ENR_DMA2DEN;
+}
+
 #define RCC_DCKCFGR_PLLSAIDIVR	(3 << 16)
 #define RCC_PLLSAIDivR_Div8	(2 << 16)
 
@@ -327,6 +345,11 @@ static struct clk clk_ltdc = {
 	.clk_disable = ltdc_clk_disable,
 };
 
+static struct clk clk_dma2d = {
+	.clk_enable = dma2d_clk_enable,
+	.clk_disable = dma2d_clk_disable,
+};
+
 static struct clk clk_sai_r = {
 	.rate = 9000000,
 	.clk_enable = sai_r_clk_enable,
@@ -513,6 +536,7 @@ static struct clk_lookup stm32_clkregs[] = {
 	INIT_CLKREG(&clk_mci, "mmci-pl18x", NULL),
 	INIT_CLKREG(&clk_ltdc, "stm32f4-ltdc.0", NULL),
 	INIT_CLKREG(&clk_sai_r, NULL, "sai_r_clk"),
+	INIT_CLKREG(&clk_dma2d, NULL, "dma2d"),
 	INIT_CLKREG(&clk_gpioa, NULL, "gpioa"),
 	INIT_CLKREG(&clk_gpiob, NULL, "gpiob"),
 	INIT_CLKREG(&clk_gpioc, NULL, "gpioc"),
@@ -106,6 +106,20 @@ static void stm32_dma_clear_irq_flags(int ch, u32 flags)
 	*dma_ifcr = flags << (((ch & 2) << 3) | ((ch & 1) * 6));
 }
 
+/*
+ * Read interrupt flags of a DMA channel
+ */
+static u32 stm32_dma_get_irq_flags(int ch)
+{
+	volatile struct stm32_dma_regs *dma_regs =
+		ch < STM32F2_DMA_CH_NUM_DMA1 ? STM32_DMA1 : STM32_DMA2;
+	u32 isr = (ch & 4) ? dma_regs->hisr : dma_regs->lisr;
+
+	return (isr >> (((ch & 2) << 3) | ((ch & 1) * 6))) &
+		(STM32_DMA_IRQF_TC | STM32_DMA_IRQF_HT | STM32_DMA_IRQF_TE |
+		 STM32_DMA_IRQF_DME | STM32_DMA_IRQF_FE);
+}
+
 /*
  * Handle IRQ for a particular DMA channel (0..15). Each DMA channel has
  * its own IRQ.
@@ -116,6 +130,22 @@ static irqreturn_t stm32_dma_isr(int irq, void *dev_id)
 	int ch = (int)dev_id;
 
 	unsigned long fl;
+	unsigned long flags = 0;
+	u32 irqf;
+
+	/*
+	 * Clear the IRQ flags before calling the handler, so that the flags
+	 * of a new transfer started by the handler are not lost.
+	 */
+	irqf = stm32_dma_get_irq_flags(ch);
+	stm32_dma_clear_irq_flags(ch, irqf);
+
+	if (irqf & STM32_DMA_IRQF_TC)
+		flags |= STM32_DMA_INTCOMPLETE;
+	if (irqf & STM32_DMA_IRQF_HT)
+		flags |= STM32_DMA_INTHALF;
+	if (irqf & STM32_DMA_IRQF_TE)
+		flags |= STM32_DMA_INTERROR;
 
 	/*
 	 * "irq_handler" must be accessed with "irq_lock" taken,
@@ -129,7 +159,7 @@ static irqreturn_t stm32_dma_isr(int irq, void *dev_id)
 	spin_lock_irqsave(&dma_ch[ch].irq_lock, fl);
 
 	if (dma_ch[ch].irq_handler) {
-		dma_ch[ch].irq_handler(ch, 0, dma_ch[ch].irq_data);
+		dma_ch[ch].irq_handler(ch, flags, dma_ch[ch].irq_data);
 	} else {
 		/* IRQ for an unregistered DMA channel */
 		pr_warning("Spurious IRQ for DMA channel %d\n", ch);
@@ -137,11 +167,6 @@ static irqreturn_t stm32_dma_isr(int irq, void *dev_id)
 
 	spin_unlock_irqrestore(&dma_ch[ch].irq_lock, fl);
 
-	/* Clear all possible DMA channel IRQ flags */
-	stm32_dma_clear_irq_flags(ch,
-		STM32_DMA_IRQF_TC | STM32_DMA_IRQF_HT | STM32_DMA_IRQF_TE |
-		STM32_DMA_IRQF_DME | STM32_DMA_IRQF_FE);
-
 	return IRQ_HANDLED;
 }
 
@@ -289,6 +314,23 @@ int stm32_dma_ch_disable(int ch)
 }
 EXPORT_SYMBOL(stm32_dma_ch_disable);
 
+/*
+ * Check if a DMA channel (by index ch: 0..15) is still running a transfer.
+ * The DMA controller clears DMA_SxCR[EN] when the transfer is over,
+ * including the flush of the DMA FIFO to the destination.
+ *
+ * Returns 1 if the channel is enabled, 0 if it is not, or a negative
+ * error code.
+ */
+int stm32_dma_ch_busy(int ch)
+{
+	if (!stm32_dma_ch_valid(ch))
+		return -EINVAL;
+
+	return (dma_ch_regs(ch)->cr & STM32_DMA_CR_EN) ? 1 : 0;
+}
+EXPORT_SYMBOL(stm32_dma_ch_busy);
+
 /*
  * DMA channel to IRQ mapping. Every DMA channel ("stream" in terms of STM32F2)
  * has a dedicated IRQ.
@@ -302,9 +344,10 @@ static const int stm32f2_dma_irq[STM32F2_DMA_CH_NUM] = {
 
 /*
  * Register an interrupt handler for a channel. The data argument will be
- * passed to the handler. In flags, one can pass STM32_DMA_INTCOMPLETE
- * and/or STM32_DMA_INTHALF to request interrupts on DMA buffer completion or
- * half-completion.
+ * passed to the handler. In flags, one can pass STM32_DMA_INTCOMPLETE,
+ * STM32_DMA_INTHALF and/or STM32_DMA_INTERROR to request interrupts on DMA
+ * buffer completion, half-completion or transfer error. The handler gets
+ * the same flags for the events which caused the interrupt.
  *
  * The DMA driver code will clear the interrupt request flag
  * for the corresponding DMA channel.
@@ -367,6 +410,12 @@ int stm32_dma_ch_request_irq(
 	else
 		ch_regs->cr &= ~STM32_DMA_CR_HTIE;
 
+	/* Enable or disable DMA transfer error interrupt */
+	if (flags & STM32_DMA_INTERROR)
+		ch_regs->cr |= STM32_DMA_CR_TEIE;
+	else
+		ch_regs->cr &= ~STM32_DMA_CR_TEIE;
+
 	rv = 0;
 	goto unlock;
 
@@ -420,8 +469,9 @@ int stm32_dma_ch_free_irq(int ch, void *data)
 	dma_ch[ch].irq_handler = NULL;
 	dma_ch[ch].irq_data = NULL;
 
-	/* Disable DMA buffer completion and half-completion interrupts */
-	dma_ch_regs(ch)->cr &= ~(STM32_DMA_CR_TCIE | STM32_DMA_CR_HTIE);
+	/* Disable DMA buffer completion, half-completion and error interrupts */
+	dma_ch_regs(ch)->cr &=
+		~(STM32_DMA_CR_TCIE | STM32_DMA_CR_HTIE | STM32_DMA_CR_TEIE);
 
 	/*
 	 * Always call free_irq(), because a DMA channel is the only user
@@ -485,8 +535,8 @@ int stm32_dma_ch_init(int ch, u8 dir, u8 fpctrl, u8 pl, u8 dbm, u8 circ)
 	ch_regs->m1ar = 0;
 	ch_regs->fcr = 0;
 	/*
-	 * Do not clear CR[TCIE] and CR[HTIE] flags, because someone might call
-	 * stm32_dma_ch_request_irq() before stm32_dma_init().
+	 * Do not clear CR[TCIE], CR[HTIE] and CR[TEIE] flags, because someone
+	 * might call stm32_dma_ch_request_irq() before stm32_dma_init().
 	 *
 	 * Always disable CR[PINCOS], we currently do not support it.
 	 */
@@ -660,6 +710,86 @@ int stm32_dma_ch_set_nitems(int ch, u16 nitems)
 }
 EXPORT_SYMBOL(stm32_dma_ch_set_nitems);
 
+/*
+ * Return the number of items left to transfer (DMA_SxNDTR),
+ * or a negative error code.
+ */
+int stm32_dma_ch_get_nitems(int ch)
+{
+	if (!stm32_dma_ch_valid(ch))
+		return -EINVAL;
+
+	return dma_ch_regs(ch)->ndtr & STM32_DMA_NDTR_NDT_MSK;
+}
+EXPORT_SYMBOL(stm32_dma_ch_get_nitems);
+
+/*
+ * Select the request (DMA_SxCR[CHSEL]) the channel serves, that is
+ * the peripheral it is connected to.
+ *
+ * @req = 0..7. Request number, as per the DMA request mapping tables
+ * of the Reference Manual.
+ */
+int stm32_dma_ch_set_request(int ch, u8 req)
+{
+	volatile struct stm32_dma_ch_regs *ch_regs;
+	DMAAPI_LOCKED_BEGIN
+
+	/* Check function arguments */
+	if (req > 7) {
+		rv = -EINVAL;
+		goto unlock;
+	}
+
+	ch_regs = dma_ch_regs(ch);
+
+	/* Cannot change parameters of an enabled DMA channel */
+	if (ch_regs->cr & STM32_DMA_CR_EN) {
+		rv = -EBUSY;
+		goto unlock;
+	}
+
+	ch_regs->cr = (ch_regs->cr & ~(7 << STM32_DMA_CR_CHSEL_BIT)) |
+		((u32)req << STM32_DMA_CR_CHSEL_BIT);
+
+	DMAAPI_LOCKED_END
+}
+EXPORT_SYMBOL(stm32_dma_ch_set_request);
+
+/*
+ * Set the address of the memory buffer @target (0 or 1) of a channel
+ * in the Double Buffer Mode (DMA_SxM0AR or DMA_SxM1AR). While the channel
+ * is enabled, only the buffer which is not the current target can be set.
+ */
+int stm32_dma_ch_set_dbm_memory(int ch, int target, u32 addr)
+{
+	volatile struct stm32_dma_ch_regs *ch_regs;
+	DMAAPI_LOCKED_BEGIN
+
+	/* Check function arguments */
+	if (target > 1 || target < 0) {
+		rv = -EINVAL;
+		goto unlock;
+	}
+
+	ch_regs = dma_ch_regs(ch);
+
+	/* Cannot change the buffer the channel is working on */
+	if ((ch_regs->cr & STM32_DMA_CR_EN) &&
+	    !!(ch_regs->cr & STM32_DMA_CR_CT) == target) {
+		rv = -EBUSY;
+		goto unlock;
+	}
+
+	if (target)
+		ch_regs->m1ar = (volatile void *)addr;
+	else
+		ch_regs->m0ar = (volatile void *)addr;
+
+	DMAAPI_LOCKED_END
+}
+EXPORT_SYMBOL(stm32_dma_ch_set_dbm_memory);
+
 /*
  * Initialize the DMA controller driver
  */
@@ -25,6 +25,8 @@
 #include <linux/init.h>
 #include <linux/kernel.h>
 #include <linux/errno.h>
+#include <linux/platform_device.h>
+#include <linux/dma-mapping.h>
 
 #include <mach/stm32.h>
 #include <mach/dmainit.h>
@@ -58,6 +60,18 @@ enum stm32_dma_map_codes {
 	UART6_TX,
 	UART7_TX,
 	UART8_TX,
+	SPI1_RX,
+	SPI2_RX,
+	SPI3_RX,
+	SPI4_RX,
+	SPI5_RX,
+	SPI6_RX,
+	SPI1_TX,
+	SPI2_TX,
+	SPI3_TX,
+	SPI4_TX,
+	SPI5_TX,
+	SPI6_TX,
 	NOTSUP,		/* not supported by software */
 	NOTDEF,		/* not defined by hardware */
 };
@@ -71,35 +85,35 @@ struct stm32f2_dma_ch_config {
 static enum stm32_dma_map_codes request_map[16][8] =
 {
 	/* DMA1-stream 0 */
-	{ NOTSUP, I2C1_RX, NOTSUP,  NOTDEF, UART5_RX, UART8_TX, NOTSUP, NOTSUP },
+	{ SPI3_RX, I2C1_RX, NOTSUP,  NOTDEF, UART5_RX, UART8_TX, NOTSUP, NOTSUP },
 	/* DMA1-stream 1 */
 	{ NOTSUP, I2C3_RX, NOTDEF, NOTSUP, UART3_RX, UART7_TX, NOTSUP, NOTSUP },
 	/* DMA1-stream 2 */
-	{ NOTSUP, NOTSUP, I2C4_RX, I2C3_RX, UART4_RX, NOTSUP, NOTSUP, I2C2_RX },
+	{ SPI3_RX, NOTSUP, I2C4_RX, I2C3_RX, UART4_RX, NOTSUP, NOTSUP, I2C2_RX },
 	/* DMA1-stream 3 */
-	{ NOTSUP, NOTDEF, NOTSUP, NOTDEF, UART3_TX, UART7_RX, NOTSUP, I2C2_RX },
+	{ SPI2_RX, NOTDEF, NOTSUP, NOTDEF, UART3_TX, UART7_RX, NOTSUP, I2C2_RX },
 	/* DMA1-stream 4 */
-	{ NOTSUP, NOTSUP, NOTDEF, I2C3_TX, UART4_TX, NOTSUP, NOTSUP, UART3_TX },
+	{ SPI2_TX, NOTSUP, NOTDEF, I2C3_TX, UART4_TX, NOTSUP, NOTSUP, UART3_TX },
 	/* DMA1-stream 5 */
-	{ NOTSUP, I2C1_RX, I2C4_TX, NOTSUP, UART2_RX, NOTSUP, NOTDEF, NOTSUP },
+	{ SPI3_TX, I2C1_RX, I2C4_TX, NOTSUP, UART2_RX, NOTSUP, NOTDEF, NOTSUP },
 	/* DMA1-stream 6 */
 	{ NOTSUP, I2C1_TX, NOTSUP, NOTSUP, UART2_TX, UART8_RX, NOTSUP, NOTSUP },
 	/* DMA1-stream 7 */
-	{ NOTSUP, I2C1_TX, NOTSUP, NOTSUP, UART5_TX, NOTSUP, NOTDEF, I2C2_TX },
+	{ SPI3_TX, I2C1_TX, NOTSUP, NOTSUP, UART5_TX, NOTSUP, NOTDEF, I2C2_TX },
 	/* DMA2-stream 0 */
-	{ NOTSUP, NOTDEF, NOTSUP, NOTSUP, NOTSUP, NOTDEF, NOTSUP, NOTDEF },
+	{ NOTSUP, NOTDEF, NOTSUP, SPI1_RX, SPI4_RX, NOTDEF, NOTSUP, NOTDEF },
 	/* DMA2-stream 1 */
-	{ NOTSUP, NOTSUP, NOTSUP, NOTDEF, NOTSUP, UART6_RX, NOTSUP, NOTSUP },
+	{ NOTSUP, NOTSUP, NOTSUP, NOTDEF, SPI4_TX, UART6_RX, NOTSUP, NOTSUP },
 	/* DMA2-stream 2 */
-	{ NOTSUP, NOTSUP, NOTDEF, NOTSUP, UART1_RX, UART6_RX, NOTSUP, NOTSUP },
+	{ NOTSUP, NOTSUP, NOTDEF, SPI1_RX, UART1_RX, UART6_RX, NOTSUP, NOTSUP },
 	/* DMA2-stream 3 */
-	{ NOTSUP, NOTSUP, NOTSUP, NOTSUP, SDMMC, NOTSUP, NOTSUP, NOTSUP },
+	{ NOTSUP, NOTSUP, SPI5_RX, SPI1_TX, SDMMC, SPI4_RX, NOTSUP, NOTSUP },
 	/* DMA2-stream 4 */
-	{ NOTSUP, NOTSUP, NOTSUP, NOTSUP, NOTDEF, NOTSUP, NOTSUP, NOTSUP },
+	{ NOTSUP, NOTSUP, SPI5_TX, NOTSUP, NOTDEF, SPI4_TX, NOTSUP, NOTSUP },
 	/* DMA2-stream 5 */
-	{ NOTSUP, NOTSUP, NOTSUP, NOTSUP, UART1_RX, NOTDEF, NOTSUP, NOTSUP },
+	{ NOTSUP, SPI6_TX, NOTSUP, SPI1_TX, UART1_RX, NOTDEF, NOTSUP, NOTSUP },
 	/* DMA2-stream 6 */
-	{ NOTSUP, NOTSUP, NOTSUP, NOTSUP, SDMMC, UART6_TX, NOTSUP, NOTSUP },
+	{ NOTSUP, SPI6_RX, NOTSUP, NOTSUP, SDMMC, UART6_TX, NOTSUP, NOTSUP },
 	/* DMA2-stream 7 */
 	{ NOTSUP, NOTSUP, NOTSUP, NOTSUP, UART1_TX, UART6_TX, NOTDEF, NOTSUP },
 };
@@ -206,7 +220,50 @@ static const struct stm32f2_dma_ch_config stm32f2_dmamux_table[] = {
 	/* SDIO Tx/Rx: {DMA2-stream3, channel4} or {DMA2-stream6, channel4} */
 	{STM32F2_DMACH_SDIO, SDMMC},
 #endif /* CONFIG_MMC_ARMMMCI */
+	/*
+	 * SPI controllers (DMA1 and DMA2)
+	 */
+#if defined(CONFIG_STM32_SPI1_DMA)
+	{STM32_DMACH_SPI1_RX, SPI1_RX},
+	{STM32_DMACH_SPI1_TX, SPI1_TX},
+#endif
+#if defined(CONFIG_STM32_SPI2_DMA)
+	{STM32_DMACH_SPI2_RX, SPI2_RX},
+	{STM32_DMACH_SPI2_TX, SPI2_TX},
+#endif
+#if defined(CONFIG_STM32_SPI3_DMA)
+	{STM32_DMACH_SPI3_RX, SPI3_RX},
+	{STM32_DMACH_SPI3_TX, SPI3_TX},
+#endif
+#if defined(CONFIG_STM32_SPI4_DMA)
+	{STM32_DMACH_SPI4_RX, SPI4_RX},
+	{STM32_DMACH_SPI4_TX, SPI4_TX},
+#endif
+#if defined(CONFIG_STM32_SPI5_DMA)
+	{STM32_DMACH_SPI5_RX, SPI5_RX},
+	{STM32_DMACH_SPI5_TX, SPI5_TX},
+#endif
+#if defined(CONFIG_STM32_SPI6_DMA)
+	{STM32_DMACH_SPI6_RX, SPI6_RX},
+	{STM32_DMACH_SPI6_TX, SPI6_TX},
+#endif
+};
+
+#if defined(CONFIG_STM32_DMAENGINE)
+/*
+ * dmaengine driver device
+ */
+static u64 stm32_dmaengine_dmamask = DMA_BIT_MASK(32);
+
+static struct platform_device stm32_dmaengine_dev = {
+	.name		= "stm32-dma",
+	.id		= -1,
+	.dev		= {
+		.dma_mask		= &stm32_dmaengine_dmamask,
+		.coherent_dma_mask	= DMA_BIT_MASK(32),
+	},
 };
+#endif
 
 /*
  * Initialize the IOMUX Alternative Functions of the STM32F2 MCU
@@ -221,4 +278,17 @@ void __init stm32_dma_init(void)
 
 	/* Initialize the DMA controller driver API */
 	stm32_dmac_init();
+
+#if defined(CONFIG_STM32_DMAENGINE)
+	/*
+	 * Streams of both controllers can be given to dmaengine clients
+	 * at run time, so have both clocked
+	 */
+	STM32_RCC->ahb1enr |=
+		STM32_RCC_AHB1ENR_DMA1_MSK | STM32_RCC_AHB1ENR_DMA2_MSK;
+	platform_device_register(&stm32_dmaengine_dev);
+#elif defined(CONFIG_MTD_STM32F4_DMA)
+	/* The NOR Flash map reads with any free DMA2 stream */
+	STM32_RCC->ahb1enr |= STM32_RCC_AHB1ENR_DMA2_MSK;
+#endif
 }
@@ -179,3 +179,17 @@ void stm32_exti_clear_pending(unsigned int line)
 #endif
 }
 EXPORT_SYMBOL(stm32_exti_clear_pending);
+
+/*
+ * clear the pending state of several EXTI events at once
+ * @mask	bit mask of EXTI lines
+ */
+void stm32_exti_clear_pending_mask(unsigned long mask)
+{
+	writel(mask, &STM32_EXTI->pr);
+
+#if defined(DEBUG)
+	printk("%s:%lx=%x\n", __func__, mask, readl(&STM32_EXTI->pr));
+#endif
+}
+EXPORT_SYMBOL(stm32_exti_clear_pending_mask);
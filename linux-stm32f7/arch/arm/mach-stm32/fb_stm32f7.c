@@ -21,6 +21,8 @@
 #include <linux/dma-mapping.h>
 #include <linux/delay.h>
 #include <linux/gpio.h>
+#include <linux/fb.h>
+#include <linux/clk.h>
 
 #include <mach/stm32.h>
 #include <mach/fb.h>
@@ -31,19 +33,86 @@ static struct resource stm32f7_fb_resources[] = {
 		.start	= STM32F4_LTDC_BASE,
 		.end	= STM32F4_LTDC_BASE + STM32F4_LTDC_LENGTH - 1,
 		.flags	= IORESOURCE_MEM,
+		.name	= "ltdc",
+	},
+	{
+		.start	= STM32F7_DMA2D_BASE,
+		.end	= STM32F7_DMA2D_BASE + STM32F7_DMA2D_LENGTH - 1,
+		.flags	= IORESOURCE_MEM,
+		.name	= "dma2d",
+	},
+	{
+		.start	= STM32F7_DMA2D_IRQ,
+		.flags	= IORESOURCE_IRQ,
+		.name	= "dma2d",
 	},
-	/*
 	{
 		.start	= STM32F4_LTDC_IRQ,
 		.flags	= IORESOURCE_IRQ,
+		.name	= "ltdc",
+	},
+	{
+		.start	= STM32F4_LTDC_ERR_IRQ,
+		.flags	= IORESOURCE_IRQ,
+		.name	= "ltdc_er",
+	},
+};
+
+/*
+ * RK043FN48H panel of the STM32F7-Discovery
+ */
+static struct fb_videomode stm32f7_disco_modes[] = {
+	{
+		.name		= "rk043fn48h",
+		.refresh	= 60,
+		.xres		= 480,
+		.yres		= 272,
+		.pixclock	= KHZ2PICOS(9000),
+		.left_margin	= 13,
+		.right_margin	= 32,
+		.upper_margin	= 2,
+		.lower_margin	= 2,
+		.hsync_len	= 41,
+		.vsync_len	= 10,
+		.sync		= 0,
+		.vmode		= FB_VMODE_NONINTERLACED,
 	},
-	*/
+};
+
+/*
+ * Power up the panel: LCD_DISP (PI12) and the backlight (PK3)
+ */
+static int stm32f7_disco_lcd_init(int on)
+{
+	static const char * const gpio_clks[] = {
+		"gpioe", "gpiog", "gpioi", "gpioj", "gpiok",
+	};
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(gpio_clks); i++)
+		clk_enable(clk_get_sys(NULL, gpio_clks[i]));
+
+	gpio_direction_output(STM32_GPIO_PORTPIN2NUM(8, 12), on);
+	gpio_direction_output(STM32_GPIO_PORTPIN2NUM(10, 3), on);
+
+	return 0;
+}
+
+static struct stm32f7_fb_platform_data stm32f7_fb_data = {
+	.modes		= stm32f7_disco_modes,
+	.modes_size	= ARRAY_SIZE(stm32f7_disco_modes),
+	.mode_str	= "480x272-32",
+	.init		= stm32f7_disco_lcd_init,
 };
 
 static struct platform_device fb_pdev = {
 	.name = "stm32f7-ltdc",
 	.num_resources = ARRAY_SIZE(stm32f7_fb_resources),
 	.resource = stm32f7_fb_resources,
+	.dev = {
+		.coherent_dma_mask = 0xFFFFFFFF,
+		.platform_data = &stm32f7_fb_data,
+	},
 };
 
 void __init stm32f7_fb_init(void)
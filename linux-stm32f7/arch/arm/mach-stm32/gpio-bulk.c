@@ -0,0 +1,258 @@
+/*
+ * arch/arm/mach-stm32/gpio-bulk.c
+ *
+ * STM32 batched GPIO port access.
+ *
+ * The /dev/gpio_bulk misc device runs arrays of port-wide GPIO commands
+ * (write through BSRR, read, delay, wait for levels) in one ioctl, so
+ * that user space can generate and sample waveforms without a system
+ * call per edge. See <linux/stm32_gpio_bulk.h>.
+ *
+ * Pins are driven as they are configured: the device does not change
+ * pin modes, and does not check that pins are owned by anyone, so it
+ * is reserved to CAP_SYS_RAWIO. Delays and waits are timed with the DWT
+ * cycle counter.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/fs.h>
+#include <linux/miscdevice.h>
+#include <linux/slab.h>
+#include <linux/sched.h>
+#include <linux/capability.h>
+#include <linux/irqflags.h>
+#include <linux/stm32_gpio_bulk.h>
+#include <asm/uaccess.h>
+#include <mach/gpio.h>
+#include <mach/clock.h>
+#include <mach/dwt.h>
+
+/*
+ * CPU clock, in MHz
+ */
+static u32 gpio_bulk_mhz;
+
+/*
+ * Check a batch before running it
+ * @ret		0 -> valid; error code otherwise
+ */
+static int gpio_bulk_check(struct stm32_gpio_bulk_cmd *cmds, u32 n,
+			   u32 flags)
+{
+	u64 ns = 0;
+	u32 i;
+
+	for (i = 0; i < n; i++) {
+		switch (cmds[i].cmd) {
+		case STM32_GPIO_BULK_WRITE:
+		case STM32_GPIO_BULK_READ:
+			break;
+		case STM32_GPIO_BULK_DELAY:
+			if (cmds[i].value > STM32_GPIO_BULK_DELAY_MAX_NS) {
+				return -EINVAL;
+			}
+			ns += cmds[i].value;
+			break;
+		case STM32_GPIO_BULK_WAIT:
+			ns += STM32_GPIO_BULK_WAIT_MAX_NS;
+			break;
+		default:
+			return -EINVAL;
+		}
+
+		if (cmds[i].port >= STM32_GPIO_PORTS) {
+			return -EINVAL;
+		}
+	}
+
+	if ((flags & STM32_GPIO_BULK_ATOMIC) &&
+	    ns > STM32_GPIO_BULK_ATOMIC_MAX_NS) {
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+/*
+ * CPU cycles in @ns nanoseconds, at most STM32_GPIO_BULK_DELAY_MAX_NS
+ */
+static u32 gpio_bulk_cycles(u32 ns)
+{
+	return DIV_ROUND_UP(ns * gpio_bulk_mhz, 1000);
+}
+
+/*
+ * Busy-wait for @ns nanoseconds
+ */
+static void gpio_bulk_delay(u32 ns)
+{
+	u32 t0 = DWT_CYCCNT;
+	u32 cycles = gpio_bulk_cycles(ns);
+
+	while (DWT_CYCCNT - t0 < cycles);
+}
+
+/*
+ * Busy-wait, for at most STM32_GPIO_BULK_WAIT_MAX_NS, until the @mask
+ * pins of @port read as @value
+ * @ret		0 -> levels matched; -ETIMEDOUT otherwise
+ */
+static int gpio_bulk_wait(u8 port, u16 mask, u32 value)
+{
+	u32 t0 = DWT_CYCCNT;
+	u32 cycles = gpio_bulk_cycles(STM32_GPIO_BULK_WAIT_MAX_NS);
+
+	while ((stm32_gpio_port_get(port) & mask) != (value & mask)) {
+		if (DWT_CYCCNT - t0 >= cycles) {
+			return -ETIMEDOUT;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Run a checked batch
+ * @ret		0 -> success; error code otherwise
+ */
+static int gpio_bulk_exec(struct stm32_gpio_bulk_cmd *cmds, u32 n,
+			  u32 flags)
+{
+	struct stm32_gpio_bulk_cmd *c;
+	int ret;
+	u32 i;
+
+	for (i = 0; i < n; i++) {
+		c = &cmds[i];
+
+		switch (c->cmd) {
+		case STM32_GPIO_BULK_WRITE:
+			stm32_gpio_port_write(c->port, c->mask, c->value);
+			break;
+		case STM32_GPIO_BULK_READ:
+			c->value = stm32_gpio_port_get(c->port) & c->mask;
+			break;
+		case STM32_GPIO_BULK_DELAY:
+			gpio_bulk_delay(c->value);
+			break;
+		case STM32_GPIO_BULK_WAIT:
+			ret = gpio_bulk_wait(c->port, c->mask, c->value);
+			c->value = stm32_gpio_port_get(c->port) & c->mask;
+			if (ret) {
+				return ret;
+			}
+			break;
+		}
+
+		/*
+		 * A batch may delay for a second in all; let others run
+		 */
+		if (!(flags & STM32_GPIO_BULK_ATOMIC)) {
+			cond_resched();
+		}
+	}
+
+	return 0;
+}
+
+static long gpio_bulk_ioctl(struct file *file, unsigned int cmd,
+			    unsigned long arg)
+{
+	struct stm32_gpio_bulk_run run;
+	struct stm32_gpio_bulk_cmd *cmds;
+	void __user *ucmds;
+	unsigned long flags;
+	size_t len;
+	int ret;
+
+	if (cmd != STM32_GPIO_BULK_IOC_RUN) {
+		return -ENOTTY;
+	}
+
+	/* Drives any pin, whoever owns it */
+	if (!capable(CAP_SYS_RAWIO)) {
+		return -EPERM;
+	}
+
+	if (copy_from_user(&run, (void __user *) arg, sizeof(run))) {
+		return -EFAULT;
+	}
+	if (!run.ncmds) {
+		return 0;
+	}
+	if (run.ncmds > STM32_GPIO_BULK_MAX_CMDS ||
+	    (run.flags & ~STM32_GPIO_BULK_ATOMIC)) {
+		return -EINVAL;
+	}
+
+	ucmds = (void __user *) (unsigned long) run.cmds;
+	len = run.ncmds * sizeof(*cmds);
+	cmds = kmalloc(len, GFP_KERNEL);
+	if (!cmds) {
+		return -ENOMEM;
+	}
+	if (copy_from_user(cmds, ucmds, len)) {
+		ret = -EFAULT;
+		goto out;
+	}
+
+	ret = gpio_bulk_check(cmds, run.ncmds, run.flags);
+	if (ret) {
+		goto out;
+	}
+
+	if (run.flags & STM32_GPIO_BULK_ATOMIC) {
+		local_irq_save(flags);
+		ret = gpio_bulk_exec(cmds, run.ncmds, run.flags);
+		local_irq_restore(flags);
+	} else {
+		ret = gpio_bulk_exec(cmds, run.ncmds, run.flags);
+	}
+
+	/*
+	 * Hand back the values read, also after a WAIT timeout
+	 */
+	if (copy_to_user(ucmds, cmds, len) && !ret) {
+		ret = -EFAULT;
+	}
+
+out:
+	kfree(cmds);
+	return ret;
+}
+
+static const struct file_operations gpio_bulk_fops = {
+	.owner		= THIS_MODULE,
+	.unlocked_ioctl	= gpio_bulk_ioctl,
+};
+
+static struct miscdevice gpio_bulk_dev = {
+	.minor		= MISC_DYNAMIC_MINOR,
+	.name		= "gpio_bulk",
+	.fops		= &gpio_bulk_fops,
+};
+
+static int __init gpio_bulk_init(void)
+{
+	gpio_bulk_mhz = stm32_clock_get(CLOCK_HCLK) / 1000000;
+	stm32_dwt_cyccnt_enable();
+
+	return misc_register(&gpio_bulk_dev);
+}
+
+static void __exit gpio_bulk_exit(void)
+{
+	misc_deregister(&gpio_bulk_dev);
+}
+
+module_init(gpio_bulk_init);
+module_exit(gpio_bulk_exit);
+
+MODULE_DESCRIPTION("STM32 batched GPIO port access");
+MODULE_LICENSE("GPL");
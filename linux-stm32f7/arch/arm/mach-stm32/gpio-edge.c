@@ -0,0 +1,251 @@
+/*
+ * arch/arm/mach-stm32/gpio-edge.c
+ *
+ * STM32 GPIO edge timestamps.
+ *
+ * The /dev/gpio_edges misc device captures edges of GPIO inputs with
+ * fast EXTI handlers: each edge is stamped with the CPU cycle counter
+ * in the EXTI vector and queued to a FIFO, which user space read(2)s
+ * as struct stm32_gpio_edge records. GPIOs are added and removed with
+ * the ioctls in <linux/stm32_gpio_edge.h>, and are released when the
+ * device is closed. The device can be opened by one process at a time.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/fs.h>
+#include <linux/miscdevice.h>
+#include <linux/poll.h>
+#include <linux/sched.h>
+#include <linux/spinlock.h>
+#include <linux/irq.h>
+#include <linux/stm32_gpio_edge.h>
+#include <asm/uaccess.h>
+#include <mach/gpio.h>
+#include <mach/clock.h>
+
+/*
+ * FIFO length, in edges; must be a power of 2
+ */
+#define GPIO_EDGE_FIFO_LEN	512
+
+/*
+ * Edges copied to user space per lock hold
+ */
+#define GPIO_EDGE_READ_BATCH	32
+
+static struct stm32_gpio_edge gpio_edge_fifo[GPIO_EDGE_FIFO_LEN];
+static unsigned int gpio_edge_head;	/* Next record to write */
+static unsigned int gpio_edge_tail;	/* Next record to read */
+static u32 gpio_edge_overruns;
+static DEFINE_SPINLOCK(gpio_edge_lock);
+static DECLARE_WAIT_QUEUE_HEAD(gpio_edge_wait);
+
+/* GPIOs captured by the current opener */
+static DECLARE_BITMAP(gpio_edge_gpios, STM32_GPIO_LEN);
+static unsigned long gpio_edge_busy;
+
+/*
+ * Fast EXTI handler: queue the edge
+ */
+static void gpio_edge_handler(unsigned int gpio, u32 cycles, void *data)
+{
+	struct stm32_gpio_edge *e;
+
+	spin_lock(&gpio_edge_lock);
+
+	if (gpio_edge_head - gpio_edge_tail >= GPIO_EDGE_FIFO_LEN) {
+		gpio_edge_overruns++;
+		spin_unlock(&gpio_edge_lock);
+		return;
+	}
+
+	e = &gpio_edge_fifo[gpio_edge_head & (GPIO_EDGE_FIFO_LEN - 1)];
+	e->cycles = cycles;
+	e->gpio = gpio;
+	gpio_edge_head++;
+
+	spin_unlock(&gpio_edge_lock);
+
+	if (waitqueue_active(&gpio_edge_wait)) {
+		wake_up_interruptible(&gpio_edge_wait);
+	}
+}
+
+static int gpio_edge_open(struct inode *inode, struct file *file)
+{
+	unsigned long flags;
+
+	if (test_and_set_bit(0, &gpio_edge_busy)) {
+		return -EBUSY;
+	}
+
+	spin_lock_irqsave(&gpio_edge_lock, flags);
+	gpio_edge_head = gpio_edge_tail = 0;
+	gpio_edge_overruns = 0;
+	spin_unlock_irqrestore(&gpio_edge_lock, flags);
+
+	return nonseekable_open(inode, file);
+}
+
+static int gpio_edge_release(struct inode *inode, struct file *file)
+{
+	int gpio;
+
+	for_each_bit(gpio, gpio_edge_gpios, STM32_GPIO_LEN) {
+		stm32_gpio_free_fast_irq(gpio);
+	}
+	bitmap_zero(gpio_edge_gpios, STM32_GPIO_LEN);
+
+	clear_bit(0, &gpio_edge_busy);
+	return 0;
+}
+
+static ssize_t gpio_edge_read(struct file *file, char __user *buf,
+			      size_t count, loff_t *ppos)
+{
+	struct stm32_gpio_edge batch[GPIO_EDGE_READ_BATCH];
+	unsigned long flags;
+	size_t done = 0;
+	unsigned int n;
+	int ret;
+
+	if (count < sizeof(batch[0])) {
+		return -EINVAL;
+	}
+
+	while (gpio_edge_head == gpio_edge_tail) {
+		if (file->f_flags & O_NONBLOCK) {
+			return -EAGAIN;
+		}
+		ret = wait_event_interruptible(gpio_edge_wait,
+				gpio_edge_head != gpio_edge_tail);
+		if (ret) {
+			return ret;
+		}
+	}
+
+	while (count - done >= sizeof(batch[0])) {
+		spin_lock_irqsave(&gpio_edge_lock, flags);
+		for (n = 0; n < GPIO_EDGE_READ_BATCH &&
+			    gpio_edge_tail != gpio_edge_head &&
+			    count - done - n * sizeof(batch[0]) >=
+					sizeof(batch[0]); n++) {
+			batch[n] = gpio_edge_fifo[gpio_edge_tail &
+						  (GPIO_EDGE_FIFO_LEN - 1)];
+			gpio_edge_tail++;
+		}
+		spin_unlock_irqrestore(&gpio_edge_lock, flags);
+
+		if (!n) {
+			break;
+		}
+		if (copy_to_user(buf + done, batch, n * sizeof(batch[0]))) {
+			return done ? done : -EFAULT;
+		}
+		done += n * sizeof(batch[0]);
+	}
+
+	return done;
+}
+
+static unsigned int gpio_edge_poll(struct file *file, poll_table *wait)
+{
+	poll_wait(file, &gpio_edge_wait, wait);
+
+	return gpio_edge_head != gpio_edge_tail ? POLLIN | POLLRDNORM : 0;
+}
+
+static long gpio_edge_ioctl(struct file *file, unsigned int cmd,
+			    unsigned long arg)
+{
+	struct stm32_gpio_edge_req req;
+	unsigned long flags;
+	u32 v;
+	int ret;
+
+	switch (cmd) {
+	case STM32_GPIO_EDGE_IOC_ADD:
+		if (copy_from_user(&req, (void __user *) arg, sizeof(req))) {
+			return -EFAULT;
+		}
+		if (req.gpio >= STM32_GPIO_LEN || !req.edges ||
+		    (req.edges & ~(STM32_GPIO_EDGE_RISING |
+				   STM32_GPIO_EDGE_FALLING))) {
+			return -EINVAL;
+		}
+		if (test_bit(req.gpio, gpio_edge_gpios)) {
+			return -EBUSY;
+		}
+		ret = stm32_gpio_request_fast_irq(req.gpio,
+			((req.edges & STM32_GPIO_EDGE_RISING) ?
+				IRQ_TYPE_EDGE_RISING : 0) |
+			((req.edges & STM32_GPIO_EDGE_FALLING) ?
+				IRQ_TYPE_EDGE_FALLING : 0),
+			gpio_edge_handler, NULL);
+		if (!ret) {
+			set_bit(req.gpio, gpio_edge_gpios);
+		}
+		return ret;
+
+	case STM32_GPIO_EDGE_IOC_DEL:
+		if (get_user(v, (u32 __user *) arg)) {
+			return -EFAULT;
+		}
+		if (v >= STM32_GPIO_LEN || !test_bit(v, gpio_edge_gpios)) {
+			return -EINVAL;
+		}
+		stm32_gpio_free_fast_irq(v);
+		clear_bit(v, gpio_edge_gpios);
+		return 0;
+
+	case STM32_GPIO_EDGE_IOC_HZ:
+		return put_user(stm32_clock_get(CLOCK_HCLK),
+				(u32 __user *) arg);
+
+	case STM32_GPIO_EDGE_IOC_OVERRUNS:
+		spin_lock_irqsave(&gpio_edge_lock, flags);
+		v = gpio_edge_overruns;
+		gpio_edge_overruns = 0;
+		spin_unlock_irqrestore(&gpio_edge_lock, flags);
+		return put_user(v, (u32 __user *) arg);
+	}
+
+	return -ENOTTY;
+}
+
+static const struct file_operations gpio_edge_fops = {
+	.owner		= THIS_MODULE,
+	.open		= gpio_edge_open,
+	.release	= gpio_edge_release,
+	.read		= gpio_edge_read,
+	.poll		= gpio_edge_poll,
+	.unlocked_ioctl	= gpio_edge_ioctl,
+};
+
+static struct miscdevice gpio_edge_dev = {
+	.minor		= MISC_DYNAMIC_MINOR,
+	.name		= "gpio_edges",
+	.fops		= &gpio_edge_fops,
+};
+
+static int __init gpio_edge_init(void)
+{
+	return misc_register(&gpio_edge_dev);
+}
+
+static void __exit gpio_edge_exit(void)
+{
+	misc_deregister(&gpio_edge_dev);
+}
+
+module_init(gpio_edge_init);
+module_exit(gpio_edge_exit);
+
+MODULE_DESCRIPTION("STM32 GPIO edge timestamps");
+MODULE_LICENSE("GPL");
@@ -26,6 +26,7 @@
 #include <mach/iomux.h>
 #include <mach/gpio.h>
 #include <mach/exti.h>
+#include <mach/dwt.h>
 #include <linux/spinlock.h>
 #include <linux/io.h>
 #include <linux/irq.h>
@@ -59,7 +60,20 @@ static const unsigned long stm32_gpio_base[] = {
 /*
  * Number of EXTI lines -> there are more of those than EXTI IRQ lines
  */
-#define	STM32_EXTI_LINES_LEN		15
+#define	STM32_EXTI_LINES_LEN		16
+
+#if defined(CONFIG_STM32_GPIO_INT)
+
+/*
+ * EXTI line served by a fast handler
+ */
+struct stm32_exti_fast {
+	stm32_gpio_fast_handler_t handler;	/* Handler, NULL if none */
+	void *data;				/* Handler argument */
+	unsigned int gpio;			/* GPIO on the line */
+};
+
+#endif /* CONFIG_STM32_GPIO_INT */
 
 /*
  * STM32-specific GPIO chip data structure definition
@@ -72,12 +86,17 @@ struct stm32_gpio_chip {
 	spinlock_t irq_lock;			/* GPIO interrupt lock */
 	unsigned irq_base;			/* GPIO IRQ base number */
 	int exti_irqs[STM32_EXTI_IRQS_LEN];	/* NVIC EXTI IRQ numbers */
+	unsigned long exti_lines[STM32_EXTI_IRQS_LEN];	/* Their lines */
 	int exti_2_gpio[STM32_EXTI_LINES_LEN];	/* GPI0 assigned to EXTI */
+	struct stm32_exti_fast fast[STM32_EXTI_LINES_LEN]; /* Fast handlers */
 #endif
 };
 
+static struct stm32_gpio_chip stm32_gpio_chip;
+
 /*
- * Set the state of a GPIO output pin
+ * Set the state of a GPIO output pin. BSRR makes this atomic
+ * without the lock.
  * @chip	GPIO chip
  * @gpio	GPIO
  * @v		New state of the GPIO signal
@@ -85,22 +104,14 @@ struct stm32_gpio_chip {
 static void stm32_gpio_set_value(
 	struct gpio_chip *chip, unsigned gpio, int v)
 {
-	struct stm32_gpio_chip *stm32_chip
-		= container_of(chip, struct stm32_gpio_chip, chip);
 	int port = STM32_GPIO_GETPORT(gpio);
 	int pin = STM32_GPIO_GETPIN(gpio);
-	volatile struct stm32f2_gpio_regs *gpio_regs =
-		(struct stm32f2_gpio_regs *) stm32_gpio_base[port];
-	unsigned long f, l;
-
-	spin_lock_irqsave(&stm32_chip->lock, f);
-
-	l = readl(&gpio_regs->odr);
-	l &=  ~(1 << pin);
-	l |= (v << pin);
-	writel(l, &gpio_regs->odr);
 
-	spin_unlock_irqrestore(&stm32_chip->lock, f);
+	if (v) {
+		stm32_gpio_port_set(port, 1 << pin, 0);
+	} else {
+		stm32_gpio_port_set(port, 0, 1 << pin);
+	}
 
 #if defined(DEBUG)
 	printk("%s:%d[%d,%d]=%d\n", __func__, gpio, port, pin, v);
@@ -115,20 +126,11 @@ static void stm32_gpio_set_value(
  */
 static int stm32_gpio_get_value(struct gpio_chip *chip, unsigned gpio)
 {
-	struct stm32_gpio_chip *stm32_chip
-		= container_of(chip, struct stm32_gpio_chip, chip);
 	int port = STM32_GPIO_GETPORT(gpio);
 	int pin = STM32_GPIO_GETPIN(gpio);
-	volatile struct stm32f2_gpio_regs *gpio_regs =
-		(struct stm32f2_gpio_regs *) stm32_gpio_base[port];
-	unsigned long f;
 	int ret;
 
-	spin_lock_irqsave(&stm32_chip->lock, f);
-
-	ret = (readl(&gpio_regs->idr) & (1 << pin)) ? 1 : 0;
-
-	spin_unlock_irqrestore(&stm32_chip->lock, f);
+	ret = (stm32_gpio_port_get(port) & (1 << pin)) ? 1 : 0;
 
 #if defined(DEBUG)
 	printk("%s:%d[%d,%d]=%d\n", __func__, gpio, port, pin, ret);
@@ -185,6 +187,11 @@ static int stm32_gpio_direction_output(
 		(struct stm32f2_gpio_regs *) stm32_gpio_base[port];
 	unsigned long f, l;
 
+	/*
+	 * Set the level first, so that the pin does not glitch
+	 */
+	stm32_gpio_set_value(chip, gpio, level);
+
 	spin_lock_irqsave(&stm32_chip->lock, f);
 
 	l = readl(&gpio_regs->moder);
@@ -192,8 +199,6 @@ static int stm32_gpio_direction_output(
 	l |= (1 << shf);
 	writel(l, &gpio_regs->moder);
 
-	gpio_set_value(gpio, level);
-
 	spin_unlock_irqrestore(&stm32_chip->lock, f);
 
 #if defined(DEBUG)
@@ -214,17 +219,33 @@ static void stm32_exti_irq_handler(unsigned irq, struct irq_desc *desc)
 	int line, pin;
 	unsigned long pending;
 	struct stm32_gpio_chip *stm32_chip = get_irq_chip_data(irq);
+	struct stm32_exti_fast *fast;
+	u32 cycles = DWT_CYCCNT;
 
 	desc->chip->ack(irq);
 
+	/*
+	 * Only look at the lines of this vector, and clear them all with
+	 * one write before calling the handlers, so that an edge that
+	 * comes in meanwhile raises the interrupt again
+	 */
+	pending = stm32_exti_get_pending() & (unsigned long) desc->handler_data;
+	stm32_exti_clear_pending_mask(pending);
+
 	/*
 	 * Call handler for all pending EXTI interrupts
 	 */
-	pending = stm32_exti_get_pending();
 	for_each_bit(line, &pending, STM32_EXTI_LINES_LEN) {
+		fast = &stm32_chip->fast[line];
+		if (fast->handler) {
+			fast->handler(fast->gpio, cycles, fast->data);
+			continue;
+		}
+
 		pin = stm32_chip->exti_2_gpio[line];
-		generic_handle_irq(stm32_chip->irq_base + pin);
-		stm32_exti_clear_pending(line);
+		if (pin != -1) {
+			generic_handle_irq(stm32_chip->irq_base + pin);
+		}
 #if defined(DEBUG)
 		printk("%s:%d=%d,%d\n", __func__, irq, line, pin);
 #endif
@@ -233,6 +254,96 @@ static void stm32_exti_irq_handler(unsigned irq, struct irq_desc *desc)
 	desc->chip->unmask(irq);
 }
 
+/*
+ * Register a fast handler for edges on a GPIO. The handler is called
+ * from the EXTI vector, bypassing the generic IRQ layer, with the DWT
+ * cycle count read on entry to the vector.
+ * @gpio	GPIO
+ * @trigger	IRQ_TYPE_EDGE_RISING and/or IRQ_TYPE_EDGE_FALLING
+ * @handler	handler
+ * @data	handler argument
+ * @ret		0 -> success; error code otherwise
+ */
+int stm32_gpio_request_fast_irq(unsigned int gpio, unsigned int trigger,
+				stm32_gpio_fast_handler_t handler, void *data)
+{
+	struct stm32_gpio_chip *stm32_chip = &stm32_gpio_chip;
+	int line = STM32_GPIO_GETPIN(gpio);
+	int pin = STM32_GPIO_GETPORT(gpio);
+	unsigned long flags;
+	int ret = 0;
+
+	if (gpio >= STM32_GPIO_LEN || !handler ||
+	    !(trigger & IRQ_TYPE_EDGE_BOTH) ||
+	    (trigger & ~IRQ_TYPE_EDGE_BOTH)) {
+		ret = -EINVAL;
+		goto Done;
+	}
+
+	spin_lock_irqsave(&stm32_chip->irq_lock, flags);
+
+	/*
+	 * The EXTI line must not be in use by another GPIO, or
+	 * through the generic IRQ layer
+	 */
+	if (stm32_chip->exti_2_gpio[line] != -1) {
+		spin_unlock_irqrestore(&stm32_chip->irq_lock, flags);
+		ret = -EBUSY;
+		goto Done;
+	}
+
+	stm32_chip->fast[line].handler = handler;
+	stm32_chip->fast[line].data = data;
+	stm32_chip->fast[line].gpio = gpio;
+	stm32_chip->exti_2_gpio[line] = gpio;
+
+	stm32_exti_enable_int(line, 0);
+	stm32_exti_connect(line, pin);
+	if (trigger & IRQ_TYPE_EDGE_RISING) {
+		stm32_exti_set_rising(line);
+	}
+	if (trigger & IRQ_TYPE_EDGE_FALLING) {
+		stm32_exti_set_falling(line);
+	}
+	stm32_exti_enable_int(line, 1);
+
+	spin_unlock_irqrestore(&stm32_chip->irq_lock, flags);
+
+Done:
+#if defined(DEBUG)
+	printk("%s:%d[%d,%d]=%d\n", __func__, gpio, line, pin, ret);
+#endif
+	return ret;
+}
+EXPORT_SYMBOL(stm32_gpio_request_fast_irq);
+
+/*
+ * Unregister the fast handler of a GPIO
+ * @gpio	GPIO
+ */
+void stm32_gpio_free_fast_irq(unsigned int gpio)
+{
+	struct stm32_gpio_chip *stm32_chip = &stm32_gpio_chip;
+	int line = STM32_GPIO_GETPIN(gpio);
+	unsigned long flags;
+
+	if (gpio >= STM32_GPIO_LEN) {
+		return;
+	}
+
+	spin_lock_irqsave(&stm32_chip->irq_lock, flags);
+
+	if (stm32_chip->fast[line].handler &&
+	    stm32_chip->fast[line].gpio == gpio) {
+		stm32_exti_enable_int(line, 0);
+		stm32_chip->fast[line].handler = NULL;
+		stm32_chip->exti_2_gpio[line] = -1;
+	}
+
+	spin_unlock_irqrestore(&stm32_chip->irq_lock, flags);
+}
+EXPORT_SYMBOL(stm32_gpio_free_fast_irq);
+
 /*
  * Convert GPIO number to logical GPIO IRQ number
  * @chip	GPIO chip
@@ -274,6 +385,16 @@ static void stm32_gpio_irq_enable(unsigned irq)
 
 	spin_lock_irqsave(&stm32_chip->irq_lock, flags);
 
+	/*
+	 * A line with a fast handler is not taken over
+	 */
+	if (stm32_chip->fast[line].handler) {
+		spin_unlock_irqrestore(&stm32_chip->irq_lock, flags);
+		pr_err("STM32 GPIO: EXTI line %d has a fast handler, "
+			"irq for GPIO %d not enabled\n", line, gpio);
+		return;
+	}
+
 	/*
 	 * On the STM32, multiple GPIO signals share a single EXTI line
 	 */
@@ -324,7 +445,11 @@ static void stm32_gpio_irq_disable(unsigned irq)
 
 	spin_lock_irqsave(&stm32_chip->irq_lock, flags);
 
-	stm32_exti_enable_int(line, 0);
+	if (stm32_chip->exti_2_gpio[line] == gpio &&
+	    !stm32_chip->fast[line].handler) {
+		stm32_exti_enable_int(line, 0);
+		stm32_chip->exti_2_gpio[line] = -1;
+	}
 	desc->status |= IRQ_MASKED;
 
 	spin_unlock_irqrestore(&stm32_chip->irq_lock, flags);
@@ -395,7 +520,7 @@ static struct stm32_gpio_chip stm32_gpio_chip = {
 		.set			= stm32_gpio_set_value,
 		.base			= STM32_GPIO_OFF,
 		.ngpio			= STM32_GPIO_LEN,
-		.can_sleep		= 1,
+		.can_sleep		= 0,
 #if defined (CONFIG_STM32_GPIO_INT)
 		.to_irq			= stm32_gpio_to_irq,
 #endif
@@ -419,6 +544,15 @@ static struct stm32_gpio_chip stm32_gpio_chip = {
 		23,			/* EXTI[9:5] */
 		40,			/* EXTI[15:10] */
 	},
+	.exti_lines		=  {
+		0x0001,			/* EXTI0 */
+		0x0002,			/* EXTI1 */
+		0x0004,			/* EXTI2 */
+		0x0008,			/* EXTI3 */
+		0x0010,			/* EXTI4 */
+		0x03E0,			/* EXTI[9:5] */
+		0xFC00,			/* EXTI[15:10] */
+	},
 #endif
 };
 
@@ -448,11 +582,18 @@ void __init stm32_gpio_init(void)
 	 * Register an IRQ handler for each EXTI IRQ line
 	 */
 	for (i = 0; i < STM32_EXTI_IRQS_LEN; i++) {
+		set_irq_data(stm32_chip->exti_irqs[i],
+			     (void *) stm32_chip->exti_lines[i]);
 		set_irq_chained_handler(stm32_chip->exti_irqs[i],
 					stm32_exti_irq_handler);
 		set_irq_chip_data(stm32_chip->exti_irqs[i], stm32_chip);
 	}
 
+	/*
+	 * Start the cycle counter used to timestamp edges
+	 */
+	stm32_dwt_cyccnt_enable();
+
 	/*
 	 * Register a generic handler for each logical GPIO IRQ line
 	 */
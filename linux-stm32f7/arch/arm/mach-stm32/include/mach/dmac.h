@@ -33,6 +33,7 @@
  */
 #define STM32_DMA_INTCOMPLETE		(1 << 0)
 #define STM32_DMA_INTHALF		(1 << 1)
+#define STM32_DMA_INTERROR		(1 << 2)
 
 /*
  * API functions of the STM32 DMA controller driver
@@ -43,6 +44,7 @@ int stm32_dma_ch_get(int ch);
 int stm32_dma_ch_put(int ch);
 int stm32_dma_ch_enable(int ch);
 int stm32_dma_ch_disable(int ch);
+int stm32_dma_ch_busy(int ch);
 int stm32_dma_ch_request_irq(
 	int ch, void (*handler)(int ch, unsigned long flags, void *data),
 	unsigned long flags, void *data);
@@ -52,5 +54,28 @@ int stm32_dma_ch_init_fifo(int ch, u8 burst, u8 threshold);
 int stm32_dma_ch_set_periph(int ch, u32 addr, u8 inc, u8 bitwidth, u8 burst);
 int stm32_dma_ch_set_memory(int ch, u32 addr, u8 inc, u8 bitwidth, u8 burst);
 int stm32_dma_ch_set_nitems(int ch, u16 nitems);
+int stm32_dma_ch_get_nitems(int ch);
+int stm32_dma_ch_set_request(int ch, u8 req);
+int stm32_dma_ch_set_dbm_memory(int ch, int target, u32 addr);
+
+#if defined(CONFIG_STM32_DMAENGINE)
+
+struct dma_chan;
+
+/*
+ * Slave channel of the dmaengine driver (drivers/dma/stm32-dma.c):
+ * the DMA channel (stream) to use, 0..15, and the request it serves
+ * (DMA_SxCR[CHSEL]), as per the DMA request mapping tables of the
+ * Reference Manual. To be passed to dma_request_channel() along with
+ * stm32_dma_filter().
+ */
+struct stm32_dma_slave {
+	int ch;
+	u8 request;
+};
+
+bool stm32_dma_filter(struct dma_chan *chan, void *param);
+
+#endif /* CONFIG_STM32_DMAENGINE */
 
 #endif /* _MACH_STM32_DMAC_H_ */
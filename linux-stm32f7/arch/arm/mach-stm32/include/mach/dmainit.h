@@ -60,6 +60,29 @@
 #define STM32F7_DMACH_I2C4_TX	5
 #endif
 #endif
+#if defined(CONFIG_SPI_STM32)
+/*
+ * SPI controllers
+ */
+/* SPI1: Rx - DMA2, stream0; Tx - DMA2, stream3 */
+#define STM32_DMACH_SPI1_RX	8
+#define STM32_DMACH_SPI1_TX	11
+/* SPI2: Rx - DMA1, stream3; Tx - DMA1, stream4 */
+#define STM32_DMACH_SPI2_RX	3
+#define STM32_DMACH_SPI2_TX	4
+/* SPI3: Rx - DMA1, stream0; Tx - DMA1, stream5 */
+#define STM32_DMACH_SPI3_RX	0
+#define STM32_DMACH_SPI3_TX	5
+/* SPI4: Rx - DMA2, stream0; Tx - DMA2, stream1 */
+#define STM32_DMACH_SPI4_RX	8
+#define STM32_DMACH_SPI4_TX	9
+/* SPI5: Rx - DMA2, stream3; Tx - DMA2, stream4 */
+#define STM32_DMACH_SPI5_RX	11
+#define STM32_DMACH_SPI5_TX	12
+/* SPI6: Rx - DMA2, stream6; Tx - DMA2, stream5 */
+#define STM32_DMACH_SPI6_RX	14
+#define STM32_DMACH_SPI6_TX	13
+#endif
 /*
  * STM32F2
  */
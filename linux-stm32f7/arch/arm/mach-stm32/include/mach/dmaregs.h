@@ -101,6 +101,7 @@
 /* Data transfer direction */
 #define STM32_DMA_CR_DIR_BITS		6
 #define STM32_DMA_CR_DIR_MSK		(3 << STM32_DMA_CR_DIR_BITS)
+#define STM32_DMA_CR_DIR_M2P		(1 << STM32_DMA_CR_DIR_BITS)
 /* Peripheral flow controller */
 #define STM32_DMA_CR_PFCTRL_BIT		5
 #define STM32_DMA_CR_PFCTRL_MSK		(1 << STM32_DMA_CR_PFCTRL_BIT)
@@ -108,6 +109,8 @@
 #define STM32_DMA_CR_TCIE		(1 << 4)
 /* Half transfer irq ena */
 #define STM32_DMA_CR_HTIE		(1 << 3)
+/* Transfer error irq ena */
+#define STM32_DMA_CR_TEIE		(1 << 2)
 #endif
 
 /* Stream enable */
@@ -0,0 +1,39 @@
+/*
+ * arch/arm/mach-stm32/include/mach/dwt.h
+ *
+ * Cortex-M Data Watchpoint and Trace unit cycle counter, used to
+ * timestamp events and to time short code paths in CPU cycles.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#ifndef _MACH_STM32_DWT_H_
+#define _MACH_STM32_DWT_H_
+
+#include <linux/types.h>
+
+/* Debug Exception and Monitor Control Register */
+#define DEMCR		(*(volatile u32 *)0xE000EDFC)
+#define DEMCR_TRCENA	(1 << 24)
+
+/* Data Watchpoint and Trace unit */
+#define DWT_CTRL	(*(volatile u32 *)0xE0001000)
+#define DWT_CYCCNT	(*(volatile u32 *)0xE0001004)
+#define DWT_LAR		(*(volatile u32 *)0xE0001FB0)
+#define DWT_CTRL_CYCCNTENA	(1 << 0)
+#define DWT_LAR_KEY	0xC5ACCE55
+
+/*
+ * Start the cycle counter, if not running yet. DWT_CYCCNT then counts
+ * CPU clock cycles, wrapping around every 2^32 of them.
+ */
+static inline void stm32_dwt_cyccnt_enable(void)
+{
+	DWT_LAR = DWT_LAR_KEY;
+	DEMCR |= DEMCR_TRCENA;
+	DWT_CTRL |= DWT_CTRL_CYCCNTENA;
+}
+
+#endif /* _MACH_STM32_DWT_H_ */
@@ -46,5 +46,6 @@ void stm32_exti_set_rising(unsigned int line);
 void stm32_exti_set_falling(unsigned int line);
 unsigned long stm32_exti_get_pending(void);
 void stm32_exti_clear_pending(unsigned int line);
+void stm32_exti_clear_pending_mask(unsigned long mask);
 
 #endif /* _MACH_STM32_EXTI_H_ */
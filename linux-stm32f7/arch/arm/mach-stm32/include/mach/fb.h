@@ -32,6 +32,15 @@
  */
 #define STM32F4_LTDC_BASE	0x40016800
 #define STM32F4_LTDC_LENGTH	0x400
+#define STM32F4_LTDC_IRQ	88
+#define STM32F4_LTDC_ERR_IRQ	89
+
+/*
+ * DMA2D (Chrom-ART) regs
+ */
+#define STM32F7_DMA2D_BASE	0x4002B000
+#define STM32F7_DMA2D_LENGTH	0xC00
+#define STM32F7_DMA2D_IRQ	90
 
 void __init stm32f4x9_fb_init(void);
 void __init stm32f7_fb_init(void);
@@ -44,6 +53,24 @@ struct stm32f4_fb_platform_data {
 	unsigned int modes_size;
 };
 
+/*
+ * stm32f7-ltdc platform data. The screen resolution selects one of
+ * `modes`; `mode_str` is the default, and can be overridden with
+ * video=stm32f7-ltdc:<mode> on the kernel command line.
+ */
+struct stm32f7_fb_platform_data {
+	struct fb_videomode *modes;
+	unsigned int modes_size;
+	const char *mode_str;
+	unsigned int flags;
+	int (*init)(int);
+};
+
+/* Data enable active high */
+#define STM32F7_FB_DE_HIGH	(1 << 0)
+/* Pixels driven on the falling edge of the pixel clock */
+#define STM32F7_FB_PCLK_INVERT	(1 << 1)
+
 static inline int stm32f4_fb_is_running(void)
 {
 	/* Check LTDC_GCR[LTDCEN] */
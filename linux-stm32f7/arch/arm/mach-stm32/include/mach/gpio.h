@@ -69,4 +69,65 @@
 
 void __init stm32_gpio_init(void);
 
+#if defined(CONFIG_STM32_GPIO)
+
+#include <mach/iomux.h>
+
+/*
+ * Port-wide GPIO access, for bit-banged buses. There is no locking:
+ * each call is a single register access. @port is 0 for GPIOA,
+ * 1 for GPIOB, and so on.
+ */
+#define STM32_GPIO_PORT_REGS(port)					\
+	((volatile struct stm32f2_gpio_regs *)				\
+	 (STM32F2_GPIOA_BASE + (port) * 0x400))
+
+/*
+ * Levels of all input pins of a port
+ */
+static inline u16 stm32_gpio_port_get(unsigned int port)
+{
+	return STM32_GPIO_PORT_REGS(port)->idr;
+}
+
+/*
+ * Drive the @set pins of a port high and the @clear pins low, with one
+ * store to BSRR; a pin in both is driven high
+ */
+static inline void stm32_gpio_port_set(unsigned int port, u16 set, u16 clear)
+{
+	*(volatile u32 *)&STM32_GPIO_PORT_REGS(port)->bsrrl =
+		((u32)clear << 16) | set;
+}
+
+/*
+ * Drive the @mask pins of a port to the levels in @value
+ */
+static inline void stm32_gpio_port_write(unsigned int port, u16 mask,
+					 u16 value)
+{
+	stm32_gpio_port_set(port, value & mask, ~value & mask);
+}
+
+#endif /* CONFIG_STM32_GPIO */
+
+#if defined(CONFIG_STM32_GPIO_INT)
+
+#include <linux/types.h>
+
+/*
+ * Fast GPIO edge interrupts. The handler is called straight from the
+ * EXTI vector, with interrupts disabled, bypassing the generic IRQ layer.
+ * @cycles is the DWT cycle counter (CPU clock) on entry to the vector.
+ * A GPIO with a fast handler has no logical IRQ, and vice versa.
+ */
+typedef void (*stm32_gpio_fast_handler_t)(unsigned int gpio, u32 cycles,
+					  void *data);
+
+int stm32_gpio_request_fast_irq(unsigned int gpio, unsigned int trigger,
+				stm32_gpio_fast_handler_t handler, void *data);
+void stm32_gpio_free_fast_irq(unsigned int gpio);
+
+#endif /* CONFIG_STM32_GPIO_INT */
+
 #endif /* _MACH_STM32_GPIO_H_ */
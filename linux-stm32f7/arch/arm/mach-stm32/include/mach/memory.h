@@ -32,4 +32,23 @@
 #define SRAM_PHYS_OFFSET	UL(0x20000000)
 #define SRAM_PHYS_SIZE		UL(0x00020000)
 
+#if defined(CONFIG_STM32_TCM)
+/*
+ * Cortex-M7 tightly coupled memories, as used by arch/arm/kernel/tcm.c.
+ * ITCM is at 0x00000000; its first KB is left unused, so that writes
+ * through NULL pointers do not corrupt code. DTCM is at the start of
+ * SRAM; the kernel vector table is copied to its first 2 KB, and the
+ * Ethernet buffers begin at STM32_ETHER_BUF_IN_SRAM_BASE.
+ */
+#define ITCM_OFFSET		UL(0x00000400)
+#define ITCM_END		UL(0x00003FFF)
+#define DTCM_OFFSET		UL(0x20000800)
+#define DTCM_END		UL(0x20000FFF)
+
+#if defined(CONFIG_STM32_ETHER_BUF_IN_SRAM) && \
+    CONFIG_STM32_ETHER_BUF_IN_SRAM_BASE < 0x1000
+#error "STM32_ETHER_BUF_IN_SRAM_BASE overlaps the kernel DTCM data"
+#endif
+#endif
+
 #endif
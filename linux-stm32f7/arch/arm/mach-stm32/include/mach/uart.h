@@ -122,6 +122,14 @@
 
 #define STM32_USART_DRV_NAME	"stm32serial"
 
+/*
+ * USART platform data
+ */
+struct stm32_usart_data {
+	int	tx_dma;		/* Transmit with DMA instead of PIO	      */
+	int	rx_buf_len;	/* Size of each RX DMA buffer, 0 - default    */
+};
+
 void __init stm32_uart_init(void);
 
 #endif /* __ASSEMBLY__ */
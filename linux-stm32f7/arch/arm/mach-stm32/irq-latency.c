@@ -0,0 +1,150 @@
+/*
+ * arch/arm/mach-stm32/irq-latency.c
+ *
+ * STM32 interrupt latency measurement.
+ *
+ * Triggers an otherwise unused NVIC interrupt from software, and counts,
+ * with the DWT cycle counter, the CPU cycles from the moment interrupts
+ * are enabled with the interrupt pending to the first instruction of its
+ * handler. This covers the exception entry, entry-v7m.S, asm_do_IRQ()
+ * and the generic IRQ layer. Each run is repeated with the caches
+ * flushed before the interrupt, to show the cost of fetching the
+ * interrupt path from SDRAM.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/interrupt.h>
+#include <linux/irqflags.h>
+#include <asm/div64.h>
+#include <asm/cacheflush.h>
+#include <mach/clock.h>
+#include <mach/dwt.h>
+
+/*
+ * The FPU global interrupt: the FPU exception flags do not raise
+ * it unless a handler is installed
+ */
+static int irq = 81;
+module_param(irq, int, S_IRUGO);
+MODULE_PARM_DESC(irq, "Unused NVIC interrupt to trigger (default: 81)");
+
+static unsigned int samples = 1000;
+module_param(samples, uint, S_IRUGO);
+MODULE_PARM_DESC(samples, "Interrupts per run (default: 1000)");
+
+/* Software Trigger Interrupt Register */
+#define NVIC_STIR	(*(volatile u32 *)0xE000EF00)
+
+static volatile u32 irq_lat_t0, irq_lat_t1;
+
+static irqreturn_t irq_lat_handler(int irq, void *dev_id)
+{
+	irq_lat_t1 = DWT_CYCCNT;
+
+	return IRQ_HANDLED;
+}
+
+/*
+ * Cycles from enabling interrupts, with ours pending, to its handler
+ */
+static u32 irq_lat_sample(int cold)
+{
+	unsigned long flags;
+
+	local_irq_save(flags);
+
+	if (cold)
+		flush_cache_all();
+
+	irq_lat_t1 = 0;
+	NVIC_STIR = irq;
+	asm("dsb");
+
+	irq_lat_t0 = DWT_CYCCNT;
+	local_irq_restore(flags);
+	asm("isb");
+
+	return irq_lat_t1 ? irq_lat_t1 - irq_lat_t0 : 0;
+}
+
+/*
+ * Run @samples interrupts, and print the min, average and max latency
+ */
+static int irq_lat_run(const char *name, int cold, u32 mhz)
+{
+	u32 min = ~0, max = 0, t;
+	u64 sum = 0;
+	int i;
+
+	for (i = 0; i < samples; i++) {
+		t = irq_lat_sample(cold);
+		if (!t) {
+			pr_err("stm32 irq latency: irq %d not taken\n", irq);
+			return -EIO;
+		}
+
+		min = min(min, t);
+		max = max(max, t);
+		sum += t;
+	}
+
+	do_div(sum, samples);
+
+	pr_info("stm32 irq latency: %s: min %u avg %u max %u cycles, "
+		"min %u avg %u ns\n", name, min, (u32)sum, max,
+		min * 1000 / mhz, (u32)sum * 1000 / mhz);
+
+	return 0;
+}
+
+static int __init irq_lat_init(void)
+{
+	u32 mhz = stm32_clock_get(CLOCK_HCLK) / 1000000;
+	int rv;
+
+	if (!samples)
+		samples = 1;
+
+	rv = request_irq(irq, irq_lat_handler, 0, "irq-latency", NULL);
+	if (rv) {
+		pr_err("stm32 irq latency: cannot get irq %d: %d\n", irq, rv);
+		return rv;
+	}
+
+	stm32_dwt_cyccnt_enable();
+
+	pr_info("stm32 irq latency: irq %d, %u MHz, interrupt path in %s\n",
+		irq, mhz,
+#ifdef CONFIG_STM32_TCM
+		"ITCM"
+#else
+		"SDRAM"
+#endif
+		);
+
+	rv = irq_lat_run("warm", 0, mhz);
+#ifdef CONFIG_CPU_CACHE_V7M
+	if (!rv)
+		rv = irq_lat_run("cold", 1, mhz);
+#endif
+
+	free_irq(irq, NULL);
+
+	return rv;
+}
+
+static void __exit irq_lat_exit(void)
+{
+}
+
+module_init(irq_lat_init);
+module_exit(irq_lat_exit);
+
+MODULE_DESCRIPTION("STM32 interrupt latency measurement");
+MODULE_LICENSE("GPL");
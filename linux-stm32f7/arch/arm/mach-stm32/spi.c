@@ -33,6 +33,7 @@
 #include <mach/platform.h>
 #include <mach/clock.h>
 #include <mach/spi.h>
+#include <mach/dmainit.h>
 
 /* 
  * Size of the SPI controller register area
@@ -58,6 +59,18 @@ static struct resource spi_stm32_dev1_resources[] = {
 		.end	= SPI_STM32_DEV1_REGS + SPI_STM32_REGS_SIZE,
 		.flags	= IORESOURCE_MEM,
 	},
+#if defined(CONFIG_STM32_SPI1_DMA)
+	{
+		.start	= STM32_DMACH_SPI1_RX,
+		.end	= STM32_DMACH_SPI1_RX,
+		.flags	= IORESOURCE_DMA,
+	},
+	{
+		.start	= STM32_DMACH_SPI1_TX,
+		.end	= STM32_DMACH_SPI1_TX,
+		.flags	= IORESOURCE_DMA,
+	},
+#endif
 };
 
 static struct platform_device spi_stm32_dev1 = {
@@ -88,6 +101,18 @@ static struct resource spi_stm32_dev2_resources[] = {
 		.end	= SPI_STM32_DEV2_REGS + SPI_STM32_REGS_SIZE,
 		.flags	= IORESOURCE_MEM,
 	},
+#if defined(CONFIG_STM32_SPI2_DMA)
+	{
+		.start	= STM32_DMACH_SPI2_RX,
+		.end	= STM32_DMACH_SPI2_RX,
+		.flags	= IORESOURCE_DMA,
+	},
+	{
+		.start	= STM32_DMACH_SPI2_TX,
+		.end	= STM32_DMACH_SPI2_TX,
+		.flags	= IORESOURCE_DMA,
+	},
+#endif
 };
 
 static struct platform_device spi_stm32_dev2 = {
@@ -118,6 +143,18 @@ static struct resource spi_stm32_dev3_resources[] = {
 		.end	= SPI_STM32_DEV3_REGS + SPI_STM32_REGS_SIZE,
 		.flags	= IORESOURCE_MEM,
 	},
+#if defined(CONFIG_STM32_SPI3_DMA)
+	{
+		.start	= STM32_DMACH_SPI3_RX,
+		.end	= STM32_DMACH_SPI3_RX,
+		.flags	= IORESOURCE_DMA,
+	},
+	{
+		.start	= STM32_DMACH_SPI3_TX,
+		.end	= STM32_DMACH_SPI3_TX,
+		.flags	= IORESOURCE_DMA,
+	},
+#endif
 };
 
 static struct platform_device spi_stm32_dev3 = {
@@ -148,6 +185,18 @@ static struct resource spi_stm32_dev4_resources[] = {
 		.end	= SPI_STM32_DEV4_REGS + SPI_STM32_REGS_SIZE,
 		.flags	= IORESOURCE_MEM,
 	},
+#if defined(CONFIG_STM32_SPI4_DMA)
+	{
+		.start	= STM32_DMACH_SPI4_RX,
+		.end	= STM32_DMACH_SPI4_RX,
+		.flags	= IORESOURCE_DMA,
+	},
+	{
+		.start	= STM32_DMACH_SPI4_TX,
+		.end	= STM32_DMACH_SPI4_TX,
+		.flags	= IORESOURCE_DMA,
+	},
+#endif
 };
 
 static struct platform_device spi_stm32_dev4 = {
@@ -178,6 +227,18 @@ static struct resource spi_stm32_dev5_resources[] = {
 		.end	= SPI_STM32_DEV5_REGS + SPI_STM32_REGS_SIZE,
 		.flags	= IORESOURCE_MEM,
 	},
+#if defined(CONFIG_STM32_SPI5_DMA)
+	{
+		.start	= STM32_DMACH_SPI5_RX,
+		.end	= STM32_DMACH_SPI5_RX,
+		.flags	= IORESOURCE_DMA,
+	},
+	{
+		.start	= STM32_DMACH_SPI5_TX,
+		.end	= STM32_DMACH_SPI5_TX,
+		.flags	= IORESOURCE_DMA,
+	},
+#endif
 };
 
 static struct platform_device spi_stm32_dev5 = {
@@ -208,6 +269,18 @@ static struct resource spi_stm32_dev6_resources[] = {
 		.end	= SPI_STM32_DEV6_REGS + SPI_STM32_REGS_SIZE,
 		.flags	= IORESOURCE_MEM,
 	},
+#if defined(CONFIG_STM32_SPI6_DMA)
+	{
+		.start	= STM32_DMACH_SPI6_RX,
+		.end	= STM32_DMACH_SPI6_RX,
+		.flags	= IORESOURCE_DMA,
+	},
+	{
+		.start	= STM32_DMACH_SPI6_TX,
+		.end	= STM32_DMACH_SPI6_TX,
+		.flags	= IORESOURCE_DMA,
+	},
+#endif
 };
 
 static struct platform_device spi_stm32_dev6 = {
@@ -27,7 +27,10 @@
 #include <linux/init.h>
 #include <linux/interrupt.h>
 #include <linux/irq.h>
+#include <linux/cnt32_to_63.h>
 
+#include <asm/div64.h>
+#include <asm/tcm.h>
 #include <asm/hardware/cortexm3.h>
 #include <mach/clock.h>
 #include <mach/stm32.h>
@@ -36,11 +39,16 @@
 /*
  * In STM32 we use two 32-bit TIMs to implement Clock Event and Clock
  * Source devices:
- * - TIM2 is a base for Clock Event device (system ticks per HZ);
- * - TIM5 is a base for Clock Source device (system time, etc.).
+ * - TIM2 is a base for Clock Event device (system ticks per HZ, or
+ *   one-shot events on the CC1 compare for NO_HZ and hrtimers);
+ * - TIM5 is a base for Clock Source device (system time, etc.) and
+ *   for sched_clock().
  *
  * Note: the other STM32 TIMs are 16-bit counters, so be carefull if
  * decide to replace TIM2/5 with some other TIMs here.
+ *
+ * On STM32F1, TIM2 and TIM5 are 16-bit, so TIM2 is periodic only, and
+ * the Cortex-M3 SysTick timer is the Clock Source device.
  */
 
 /*
@@ -79,11 +87,13 @@
  * STM32 TIM DIER
  */
 #define STM32_TIM_DIER_UIE	(1 << 0)	/* Update interrupt enable    */
+#define STM32_TIM_DIER_CC1IE	(1 << 1)	/* CC1 interrupt enable	      */
 
 /*
  * STM32 TIM SR fields
  */
 #define STM32_TIM_SR_UIF	(1 << 0)	/* Update interrupt flag      */
+#define STM32_TIM_SR_CC1IF	(1 << 1)	/* CC1 interrupt flag	      */
 
 /*
  * STM32 TIM EGR fields
@@ -142,11 +152,38 @@ struct stm32_tim_regs {
 #define TICK_TIM_RCC_MSK	STM32_RCC_MSK_TIM2
 #define TICK_TIM_CLOCK		CLOCK_PTMR1
 
+/*
+ * Clock Source timer settings
+ */
+#define SRC_TIM_BASE		STM32_TIM5_BASE
+#define SRC_TIM_RCC_RST		STM32_RCC_RST_TIM5
+#define SRC_TIM_RCC_ENR		STM32_RCC_ENR_TIM5
+#define SRC_TIM_RCC_MSK		STM32_RCC_MSK_TIM5
+#define SRC_TIM_CLOCK		CLOCK_PTMR1
+
+#ifdef CONFIG_ARCH_STM32F1
+#define TICK_TIM_COUNTER_BITWIDTH	16	/* STM32F1: 16-bit timer */
+#else
+#define TICK_TIM_COUNTER_BITWIDTH	32	/* STM32F2: 32-bit timer */
+#define TICK_TIM_ONESHOT
+#endif
+
+/*
+ * Shortest one-shot event, in timer ticks. Events closer than that
+ * may be missed before the compare register is written.
+ */
+#define TICK_TIM_MIN_DELTA	0x40
+
 /*
  * Reference clocks for the Timers
  */
 static unsigned int	tick_tmr_clk, src_tmr_clk;
 
+/*
+ * Timer ticks per jiffy in the periodic mode
+ */
+static u32		tick_tmr_period;
+
 /*
  * Clock event device set mode function
  */
@@ -159,16 +196,73 @@ static void tick_tmr_set_mode(enum clock_event_mode mode,
 
 	switch (mode) {
 	case CLOCK_EVT_MODE_PERIODIC:
+		/*
+		 * Update event every jiffy
+		 */
+		tim->cr1 &= ~STM32_TIM_CR1_CEN;
+		tim->dier &= ~(STM32_TIM_DIER_UIE | STM32_TIM_DIER_CC1IE);
+		tim->arr = tick_tmr_period;
+		tim->egr = STM32_TIM_EGR_UG;
+		tim->sr = ~(STM32_TIM_SR_UIF | STM32_TIM_SR_CC1IF);
+		tim->dier |= STM32_TIM_DIER_UIE;
 		tim->cr1 |= STM32_TIM_CR1_CEN;
 		break;
+#ifdef TICK_TIM_ONESHOT
+	case CLOCK_EVT_MODE_ONESHOT:
+		/*
+		 * Free-running counter over the full 32-bit range. Events
+		 * are programmed on the CC1 compare by tick_tmr_set_next_event()
+		 */
+		tim->cr1 &= ~STM32_TIM_CR1_CEN;
+		tim->dier &= ~(STM32_TIM_DIER_UIE | STM32_TIM_DIER_CC1IE);
+		tim->arr = 0xFFFFFFFF;
+		tim->egr = STM32_TIM_EGR_UG;
+		tim->sr = ~(STM32_TIM_SR_UIF | STM32_TIM_SR_CC1IF);
+		tim->cr1 |= STM32_TIM_CR1_CEN;
+		break;
+#endif
+	case CLOCK_EVT_MODE_RESUME:
+		break;
 	case CLOCK_EVT_MODE_UNUSED:
 	case CLOCK_EVT_MODE_SHUTDOWN:
 	default:
 		tim->cr1 &= ~STM32_TIM_CR1_CEN;
+		tim->dier &= ~(STM32_TIM_DIER_UIE | STM32_TIM_DIER_CC1IE);
 		break;
 	}
 }
 
+#ifdef TICK_TIM_ONESHOT
+/*
+ * Clock event device set next event function: interrupt on the CC1
+ * compare @delta timer ticks from now. Runs from ITCM, if there is one.
+ */
+static int __tcmfunc tick_tmr_set_next_event(unsigned long delta,
+					     struct clock_event_device *clk)
+{
+	volatile struct stm32_tim_regs	*tim;
+	u32				next;
+
+	tim = (struct stm32_tim_regs *)TICK_TIM_BASE;
+
+	next = tim->cnt + delta;
+	tim->ccr1 = next;
+	tim->sr = ~STM32_TIM_SR_CC1IF;
+	tim->dier |= STM32_TIM_DIER_CC1IE;
+
+	/*
+	 * If the counter went past the compare value while it was being
+	 * written, the event would only come after the counter wraps
+	 */
+	if ((s32)(next - tim->cnt) <= 0) {
+		tim->dier &= ~STM32_TIM_DIER_CC1IE;
+		return -ETIME;
+	}
+
+	return 0;
+}
+#endif
+
 /*
  * STM32 System Timer device
  */
@@ -176,25 +270,37 @@ static struct clock_event_device	tick_tmr_clockevent = {
 	.name		= "STM32 System Timer",
 	.rating		= 200,
 	.irq		= TICK_TIM_IRQ,
+#ifdef TICK_TIM_ONESHOT
+	.features	= CLOCK_EVT_FEAT_PERIODIC | CLOCK_EVT_FEAT_ONESHOT,
+	.set_next_event	= tick_tmr_set_next_event,
+#else
 	.features	= CLOCK_EVT_FEAT_PERIODIC,
+#endif
 	.set_mode	= tick_tmr_set_mode,
 	.cpumask	= cpu_all_mask,
 };
 
 /*
- * Timer IRQ handler
+ * Timer IRQ handler. Runs from ITCM, if there is one.
  */
-static irqreturn_t tick_tmr_irq_handler(int irq, void *dev_id)
+static irqreturn_t __tcmfunc tick_tmr_irq_handler(int irq, void *dev_id)
 {
 	volatile struct stm32_tim_regs	*tim;
 	struct clock_event_device	*evt = &tick_tmr_clockevent;
+	u16				sr;
 
 	tim = (struct stm32_tim_regs *)TICK_TIM_BASE;
 
 	/*
-	 * Clear the interrupt
+	 * Clear the interrupt. A one-shot event is disabled
+	 * until the next one is programmed.
 	 */
-	tim->sr &= ~STM32_TIM_SR_UIF;
+	sr = tim->sr & tim->dier & (STM32_TIM_SR_UIF | STM32_TIM_SR_CC1IF);
+	if (!sr)
+		return IRQ_NONE;
+	tim->sr = ~sr;
+	if (sr & STM32_TIM_SR_CC1IF)
+		tim->dier &= ~STM32_TIM_DIER_CC1IE;
 
 	/*
 	 * Handle Event
@@ -213,12 +319,6 @@ static struct irqaction	tick_tmr_irqaction = {
 	.handler	= tick_tmr_irq_handler,
 };
 
-#ifdef CONFIG_ARCH_STM32F1
-#define TICK_TIM_COUNTER_BITWIDTH	16	/* STM32F1: 16-bit timer */
-#else
-#define TICK_TIM_COUNTER_BITWIDTH	32	/* STM32F2: 32-bit timer */
-#endif
-
 /*
  * Clockevents init (sys timer)
  */
@@ -261,8 +361,10 @@ static void tick_tmr_init(void)
 	 * - upcounter;
 	 * - auto-reload
 	 */
+	tick_tmr_period = div >> psc_pwr;
+
 	tim->cr1 = STM32_TIM_CR1_ARPE;
-	tim->arr = (div >> psc_pwr);
+	tim->arr = tick_tmr_period;
 	tim->psc = (1 << psc_pwr) - 1;
 
 	/*
@@ -271,25 +373,27 @@ static void tick_tmr_init(void)
 	tim->egr = STM32_TIM_EGR_UG;
 
 	/*
-	 * Setup, and enable IRQ
+	 * Setup IRQ. The interrupt sources are enabled by
+	 * tick_tmr_set_mode().
 	 */
+	tim->sr = ~STM32_TIM_SR_UIF;
 	setup_irq(TICK_TIM_IRQ, &tick_tmr_irqaction);
-	tim->dier |= STM32_TIM_DIER_UIE;
 
 	/*
-	 * For system timer we don't provide set_next_event method,
-	 * so, I guess, setting mult, shift, max_delta_ns, min_delta_ns
-	 * makes no sense (I verified that kernel works well without these).
-	 * Nevertheless, some clocksource drivers with periodic-mode only do
-	 * this. So, let's set them to some values too.
+	 * One-shot events count timer ticks. The longest event is half
+	 * the counter range, to keep tick_tmr_set_next_event() check valid.
+	 * As TIM5 runs on the same clock, this also makes sure sched_clock()
+	 * is called at least once per half of the TIM5 period when idle.
 	 */
-	clockevents_calc_mult_shift(evt, tick_tmr_clk / HZ, 5);
-	evt->max_delta_ns = clockevent_delta2ns(0xFFFFFFF0, evt);
-	evt->min_delta_ns = clockevent_delta2ns(0xF, evt);
+	clockevents_calc_mult_shift(evt, tick_tmr_clk >> psc_pwr, 5);
+	evt->max_delta_ns = clockevent_delta2ns(
+		(1UL << (TICK_TIM_COUNTER_BITWIDTH - 1)) - 1, evt);
+	evt->min_delta_ns = clockevent_delta2ns(TICK_TIM_MIN_DELTA, evt);
 
 	clockevents_register_device(evt);
 }
 
+#ifdef CONFIG_ARCH_STM32F1
 /*
  * Source clock init
  */
@@ -300,6 +404,83 @@ static void src_tmr_init(void)
 	 */
 	cortex_m3_register_systick_clocksource(src_tmr_clk);
 }
+#else
+#define SRC_TIM		((volatile struct stm32_tim_regs *)SRC_TIM_BASE)
+
+/*
+ * sched_clock() ns = (cycles * src_tmr_ns_scale) >> SRC_TIM_NS_SHIFT
+ */
+#define SRC_TIM_NS_SHIFT	10
+static unsigned long		src_tmr_ns_scale;
+
+/*
+ * Get current clock source timer value
+ */
+static cycle_t src_tmr_read(struct clocksource *c)
+{
+	return (cycle_t)SRC_TIM->cnt;
+}
+
+/*
+ * STM32 Clock Source device
+ */
+static struct clocksource	src_tmr_clocksource = {
+	.name		= "STM32 TIM5",
+	.rating		= 300,
+	.read		= src_tmr_read,
+	.mask		= CLOCKSOURCE_MASK(32),
+	.flags		= CLOCK_SOURCE_IS_CONTINUOUS,
+};
+
+/*
+ * Scheduler clock, in ns. Overrides the jiffies based default, so that
+ * the scheduler accounts time with the resolution of TIM5. The 32-bit
+ * counter is extended with cnt32_to_63(), which has to be called at
+ * least once per half of the counter period (see tick_tmr_init()).
+ */
+unsigned long long sched_clock(void)
+{
+	u64 cyc = cnt32_to_63(SRC_TIM->cnt) & ~(1ULL << 63);
+
+	return (((cyc >> 32) * src_tmr_ns_scale) << (32 - SRC_TIM_NS_SHIFT)) +
+		(((cyc & 0xFFFFFFFF) * src_tmr_ns_scale) >> SRC_TIM_NS_SHIFT);
+}
+
+/*
+ * Source clock init
+ */
+static void src_tmr_init(void)
+{
+	volatile u32	*rcc_enr, *rcc_rst;
+	u64		scale;
+
+	rcc_enr = (u32 *)SRC_TIM_RCC_ENR;
+	rcc_rst = (u32 *)SRC_TIM_RCC_RST;
+
+	/*
+	 * Enable timer clock, and deinit registers
+	 */
+	*rcc_enr |= SRC_TIM_RCC_MSK;
+	*rcc_rst |= SRC_TIM_RCC_MSK;
+	*rcc_rst &= ~SRC_TIM_RCC_MSK;
+
+	/*
+	 * Free-running upcounter over the full 32-bit range, no prescaler
+	 */
+	SRC_TIM->cr1 = 0;
+	SRC_TIM->arr = 0xFFFFFFFF;
+	SRC_TIM->psc = 0;
+	SRC_TIM->egr = STM32_TIM_EGR_UG;
+	SRC_TIM->cr1 = STM32_TIM_CR1_CEN;
+
+	scale = (u64)NSEC_PER_SEC << SRC_TIM_NS_SHIFT;
+	do_div(scale, src_tmr_clk);
+	src_tmr_ns_scale = scale;
+
+	clocksource_calc_mult_shift(&src_tmr_clocksource, src_tmr_clk, 4);
+	clocksource_register(&src_tmr_clocksource);
+}
+#endif
 
 /*
  * Initialize the timer systems of the STM32
@@ -311,7 +492,11 @@ void __init stm32_timer_init(void)
 	 */
 	stm32_clock_init();
 	tick_tmr_clk = stm32_clock_get(TICK_TIM_CLOCK);
+#ifdef CONFIG_ARCH_STM32F1
 	src_tmr_clk  = stm32_clock_get(CLOCK_HCLK) / 8;
+#else
+	src_tmr_clk  = stm32_clock_get(SRC_TIM_CLOCK);
+#endif
 
 	/*
 	 * Init clockevents (sys timer)
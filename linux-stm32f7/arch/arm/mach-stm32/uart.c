@@ -90,6 +90,71 @@
 #define STM32_USART8_DMA_IRQ	17
 #endif
 
+/*
+ * USART TX DMA interrupts
+ */
+#ifdef CONFIG_ARCH_STM32F1
+/* STM32F1 */
+#define STM32_USART1_TX_DMA_IRQ	14	/* DMA1 Channel4 */
+#define STM32_USART2_TX_DMA_IRQ	17	/* DMA1 Channel7 */
+#define STM32_USART3_TX_DMA_IRQ	12	/* DMA1 Channel2 */
+#define STM32_USART4_TX_DMA_IRQ	59	/* DMA2 Channel4_5 */
+#else
+/* STM32F2 */
+#define STM32_USART1_TX_DMA_IRQ	70	/* DMA2 Stream7 */
+#define STM32_USART2_TX_DMA_IRQ	17	/* DMA1 Stream6 */
+#define STM32_USART3_TX_DMA_IRQ	14	/* DMA1 Stream3 */
+#define STM32_USART4_TX_DMA_IRQ	15	/* DMA1 Stream4 */
+#define STM32_USART5_TX_DMA_IRQ	47	/* DMA1 Stream7 */
+#define STM32_USART6_TX_DMA_IRQ	69	/* DMA2 Stream6 */
+#define STM32_USART7_TX_DMA_IRQ	12	/* DMA1 Stream1 */
+#define STM32_USART8_TX_DMA_IRQ	11	/* DMA1 Stream0 */
+#endif
+
+/*
+ * Ports which transmit with DMA
+ */
+#if defined(CONFIG_STM32_USART1_TX_DMA)
+#define STM32_USART1_TX_DMA	1
+#else
+#define STM32_USART1_TX_DMA	0
+#endif
+#if defined(CONFIG_STM32_USART2_TX_DMA)
+#define STM32_USART2_TX_DMA	1
+#else
+#define STM32_USART2_TX_DMA	0
+#endif
+#if defined(CONFIG_STM32_USART3_TX_DMA)
+#define STM32_USART3_TX_DMA	1
+#else
+#define STM32_USART3_TX_DMA	0
+#endif
+#if defined(CONFIG_STM32_USART4_TX_DMA)
+#define STM32_USART4_TX_DMA	1
+#else
+#define STM32_USART4_TX_DMA	0
+#endif
+#if defined(CONFIG_STM32_USART5_TX_DMA)
+#define STM32_USART5_TX_DMA	1
+#else
+#define STM32_USART5_TX_DMA	0
+#endif
+#if defined(CONFIG_STM32_USART6_TX_DMA)
+#define STM32_USART6_TX_DMA	1
+#else
+#define STM32_USART6_TX_DMA	0
+#endif
+#if defined(CONFIG_STM32_USART7_TX_DMA)
+#define STM32_USART7_TX_DMA	1
+#else
+#define STM32_USART7_TX_DMA	0
+#endif
+#if defined(CONFIG_STM32_USART8_TX_DMA)
+#define STM32_USART8_TX_DMA	1
+#else
+#define STM32_USART8_TX_DMA	0
+#endif
+
 /*
  * STM32F2 RCC USART specific definitions
  */
@@ -146,7 +211,15 @@ static struct resource			stm_usart_## uid ##_resources[] = {    \
 	{								       \
 		.start	= STM32_USART## uid ##_DMA_IRQ,			       \
 		.flags	= IORESOURCE_IRQ,				       \
+	},								       \
+	{								       \
+		.start	= STM32_USART## uid ##_TX_DMA_IRQ,		       \
+		.flags	= IORESOURCE_IRQ,				       \
 	}								       \
+};									       \
+static struct stm32_usart_data		stm_usart_## uid ##_data = {	       \
+	.tx_dma			= STM32_USART## uid ##_TX_DMA,		       \
+	.rx_buf_len		= CONFIG_STM32_USART_RX_BUF_LEN,	       \
 }
 
 /*
@@ -157,7 +230,8 @@ static struct platform_device		stm_usart_## uid ##_device = {	       \
 	.name			= STM32_USART_DRV_NAME,			       \
 	.id			= uid - 1,				       \
 	.resource		= stm_usart_## uid ##_resources,	       \
-	.num_resources		= 4,					       \
+	.num_resources		= ARRAY_SIZE(stm_usart_## uid ##_resources),   \
+	.dev.platform_data	= &stm_usart_## uid ##_data,		       \
 }
 
 /*
@@ -43,6 +43,12 @@
 
 #define STM32_RCC_ENR_OTGFSEN		(1 << 7)
 
+/*
+ * Size of the register space of an OTG controller, including the
+ * FIFO access windows and the direct FIFO RAM access window
+ */
+#define STM32_USB_OTG_SIZE		0x40000
+
 #ifdef CONFIG_STM32_USB_OTG_FS
 /*
  * USB platform device resources
@@ -50,7 +56,7 @@
 static struct resource		usb_otg_fs_resources[] = {
 	{
 		.start	= STM32_USB_OTG_FS_BASE,
-		.end	= STM32_USB_OTG_FS_BASE + 1,
+		.end	= STM32_USB_OTG_FS_BASE + STM32_USB_OTG_SIZE - 1,
 		.flags	= IORESOURCE_MEM,
 	},
 	{
@@ -88,7 +94,7 @@ void __init stm32_usb_otg_fs_init(void)
 static struct resource		usb_otg_hs_resources[] = {
 	{
 		.start	= STM32_USB_OTG_HS_BASE,
-		.end	= STM32_USB_OTG_HS_BASE + 1,
+		.end	= STM32_USB_OTG_HS_BASE + STM32_USB_OTG_SIZE - 1,
 		.flags	= IORESOURCE_MEM,
 	},
 	{
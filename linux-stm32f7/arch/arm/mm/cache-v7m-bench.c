@@ -0,0 +1,179 @@
+/*
+ * arch/arm/mm/cache-v7m-bench.c
+ *
+ * ARM-V7M DMA cache maintenance benchmark.
+ *
+ * Times the clean, invalidate and flush DMA range operations of
+ * cache-v7m.c, line by line and by set/way, for region sizes from 1 KB
+ * up to max_size, and reports the cost in CPU cycles per MB. The region
+ * is dirtied before each run, as it is before a DMA_TO_DEVICE mapping.
+ *
+ * The smallest size from which set/way is faster for every operation
+ * is reported, and with apply=1 set as v7m_dma_setway_threshold.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/gfp.h>
+#include <linux/string.h>
+#include <linux/irqflags.h>
+#include <asm/div64.h>
+#include <asm/cacheflush.h>
+#include <mach/dwt.h>
+
+static unsigned int max_size = 256 * 1024;
+module_param(max_size, uint, S_IRUGO);
+MODULE_PARM_DESC(max_size, "Largest region to time, in bytes (default: 256 KB)");
+
+static unsigned int iterations = 8;
+module_param(iterations, uint, S_IRUGO);
+MODULE_PARM_DESC(iterations, "Runs per operation, mode and size (default: 8)");
+
+static int apply;
+module_param(apply, bool, S_IRUGO);
+MODULE_PARM_DESC(apply, "Set the measured crossover as the set/way threshold");
+
+enum { OP_CLEAN, OP_INV, OP_FLUSH, OP_NUM };
+
+static const char *op_name[OP_NUM] = { "clean", "inv", "flush" };
+
+static void (*op_fn[OP_NUM])(const void *, const void *) = {
+	v7m_dma_clean_range,
+	v7m_dma_inv_range,
+	v7m_dma_flush_range,
+};
+
+/*
+ * Average cycles of @op over @size bytes at @buf, with @threshold as
+ * the set/way threshold
+ */
+static u32 bench_op(int op, void *buf, size_t size, unsigned long threshold)
+{
+	unsigned long saved, flags;
+	u64 total = 0;
+	u32 t;
+	int i;
+
+	for (i = 0; i < iterations; i++) {
+		memset(buf, i, size);
+
+		local_irq_save(flags);
+		saved = v7m_dma_setway_threshold;
+		v7m_dma_setway_threshold = threshold;
+
+		t = DWT_CYCCNT;
+		op_fn[op](buf, buf + size);
+		t = DWT_CYCCNT - t;
+
+		v7m_dma_setway_threshold = saved;
+		local_irq_restore(flags);
+
+		total += t;
+	}
+
+	do_div(total, iterations);
+	return total;
+}
+
+/*
+ * Cycles for @size bytes, scaled to cycles per MB
+ */
+static u32 per_mb(u32 cycles, size_t size)
+{
+	u64 v = (u64)cycles << 20;
+
+	do_div(v, size);
+	return v;
+}
+
+static int __init v7m_cache_bench_init(void)
+{
+	unsigned long crossover[OP_NUM];
+	unsigned long threshold = 0;
+	size_t size;
+	void *buf;
+	int op;
+
+	if (!iterations)
+		iterations = 1;
+
+	buf = alloc_pages_exact(max_size, GFP_KERNEL);
+	if (!buf) {
+		pr_err("%s: cannot allocate %u bytes\n", __func__, max_size);
+		return -ENOMEM;
+	}
+
+	stm32_dwt_cyccnt_enable();
+
+	pr_info("v7m cache bench: set/way threshold %lu, "
+		"cycles/MB line / set-way\n", v7m_dma_setway_threshold);
+
+	for (op = 0; op < OP_NUM; op++)
+		crossover[op] = 0;
+
+	for (size = 1024; size <= max_size; size <<= 1) {
+		u32 line[OP_NUM], sw[OP_NUM];
+
+		for (op = 0; op < OP_NUM; op++) {
+			line[op] = bench_op(op, buf, size, ULONG_MAX);
+			sw[op] = bench_op(op, buf, size, 0);
+
+			/* Set/way must stay faster from here on */
+			if (sw[op] < line[op]) {
+				if (!crossover[op])
+					crossover[op] = size;
+			} else {
+				crossover[op] = 0;
+			}
+		}
+
+		pr_info("%7zu: clean %8u / %8u  inv %8u / %8u  "
+			"flush %8u / %8u\n", size,
+			per_mb(line[OP_CLEAN], size), per_mb(sw[OP_CLEAN], size),
+			per_mb(line[OP_INV], size), per_mb(sw[OP_INV], size),
+			per_mb(line[OP_FLUSH], size), per_mb(sw[OP_FLUSH], size));
+	}
+
+	free_pages_exact(buf, max_size);
+
+	for (op = 0; op < OP_NUM; op++) {
+		if (!crossover[op]) {
+			pr_info("%s: set/way is not faster up to %u bytes\n",
+				op_name[op], max_size);
+			threshold = ULONG_MAX;
+		} else {
+			pr_info("%s: set/way is faster from %lu bytes\n",
+				op_name[op], crossover[op]);
+			threshold = max(threshold, crossover[op]);
+		}
+	}
+
+	if (threshold == ULONG_MAX) {
+		pr_info("v7m cache bench: no crossover, threshold left "
+			"at %lu\n", v7m_dma_setway_threshold);
+	} else if (apply) {
+		v7m_dma_setway_threshold = threshold;
+		pr_info("v7m cache bench: set/way threshold set to %lu\n",
+			threshold);
+	} else {
+		pr_info("v7m cache bench: suggested set/way threshold %lu\n",
+			threshold);
+	}
+
+	return 0;
+}
+
+static void __exit v7m_cache_bench_exit(void)
+{
+}
+
+module_init(v7m_cache_bench_init);
+module_exit(v7m_cache_bench_exit);
+
+MODULE_DESCRIPTION("ARMv7-M DMA cache maintenance benchmark");
+MODULE_LICENSE("GPL");
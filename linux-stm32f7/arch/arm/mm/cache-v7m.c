@@ -11,9 +11,13 @@
  */
 
 #include <linux/init.h>
+#include <linux/module.h>
 #include <linux/dma-mapping.h>
+#include <linux/dmamem.h>
+#include <linux/bitops.h>
 #include <asm/cache.h>
 #include <asm/cacheflush.h>
+#include <asm/mpu.h>
 
 /* Instruction cache invalidate all to Point of Unification (PoU) */
 #define ICIALLU(v)	*(volatile u32 *)0xE000EF50 = v
@@ -23,6 +27,8 @@
 #define DCIMVAC(v)	*(volatile u32 *)0xE000EF5C = v
 /* Data cache clean by address to PoC */
 #define DCCMVAC(v)	*(volatile u32 *)0xE000EF68 = v
+/* Data cache clean by set/way */
+#define DCCSW(v)	*(volatile u32 *)0xE000EF6C = v
 /* Data cache clean and invalidate by address to PoC */
 #define DCCIMVAC(v)	*(volatile u32 *)0xE000EF70 = v
 /* Data cache clean and invalidate by set/way */
@@ -36,13 +42,24 @@
 #define CSSELR(v)	*(volatile u32 *)0xE000ED84 = v
 
 #define MPU_TYPE()	(*(volatile u32 *)0xE000ED90)
+#define MPU_CTRL()	(*(volatile u32 *)0xE000ED94)
 #define MPU_RNR(v)	*(volatile u32 *)0xE000ED98 = v
+#define MPU_RBAR()	(*(volatile u32 *)0xE000ED9C)
 #define MPU_RASR()	(*(volatile u32 *)0xE000EDA0)
 
 #define CCSIDR_NSETS(x)	(((x) >> 13) & 0x7fff)	/* Number of sets (0-based) */
 #define CCSIDR_ASC(x)	(((x) >> 3) & 0x3ff)	/* Associativity */
 #define CCSIDR_LSZ(x)	(((x) >> 0) & 0x7)	/* Line Size */
 
+/*
+ * DMA range maintenance at or above this size, in bytes, is done on
+ * the whole data cache by set/way instead of line by line. Set to twice
+ * the data cache size by v7m_cache_init(); the cache-v7m-bench module
+ * measures the actual crossover.
+ */
+unsigned long v7m_dma_setway_threshold = ULONG_MAX;
+EXPORT_SYMBOL(v7m_dma_setway_threshold);
+
 /*
  * The caching policy is set per MPU region. This func walks through all Valid
  * MPU regions, and detect the best caching policy we have
@@ -115,9 +132,9 @@ char *v7m_icache_mode(void)
 }
 
 /*
- * Flush the entire cache
+ * Clean, or clean & invalidate (@inv), all Data Cache set/ways
  */
-void v7m_flush_kern_cache_all(void)
+static void v7m_dcache_all(int inv)
 {
 	u32	ccsidr;
 	u32	nsets, asc, linesz;
@@ -136,14 +153,27 @@ void v7m_flush_kern_cache_all(void)
 	sshift = linesz + 4;
 	asm("clz %0, %1" : "=r" (wshift) : "r" (asc));
 
-	/* Flush (clean & invalidate) all Data Cache set/ways */
 	for (set = 0; set <= nsets; set++) {
 		for (way = 0; way <= asc; way++) {
 			u32 sw = (way << wshift) | (set << sshift) | (0 << 1);
-			DCCISW(sw);
+			if (inv)
+				DCCISW(sw);
+			else
+				DCCSW(sw);
 		}
 	}
 
+	asm("dsb");
+}
+
+/*
+ * Flush the entire cache
+ */
+void v7m_flush_kern_cache_all(void)
+{
+	/* Flush (clean & invalidate) all Data Cache set/ways */
+	v7m_dcache_all(1);
+
 	/* Invalidate all Instruction Cache */
 	ICIALLU(0);
 
@@ -223,11 +253,19 @@ void v7m_flush_kern_dcache_area(void *addr, size_t size)
  * Invalidate the data cache within the specified region.
  * - start   - virtual start address of region
  * - end     - virtual end address of region
+ *
+ * Large regions are cleaned & invalidated with the whole cache: lines
+ * outside of the region are written back, not discarded.
  */
 void v7m_dma_inv_range(const void *start, const void *end)
 {
 	u32	s = (u32)start, e = (u32)end;
 
+	if (e - s >= v7m_dma_setway_threshold) {
+		v7m_dcache_all(1);
+		return;
+	}
+
 	/* Flush cache-unaligned head & tail */
 	if (s & (L1_CACHE_BYTES - 1)) {
 		DCCIMVAC(s);
@@ -235,7 +273,7 @@ void v7m_dma_inv_range(const void *start, const void *end)
 	}
 	if (e & (L1_CACHE_BYTES - 1)) {
 		DCCIMVAC(e);
-		e = (e - L1_CACHE_BYTES) & ~(L1_CACHE_BYTES - 1);
+		e &= ~(L1_CACHE_BYTES - 1);
 	}
 
 	/* Invalidate aligned part */
@@ -244,6 +282,7 @@ void v7m_dma_inv_range(const void *start, const void *end)
 
 	asm("dsb");
 }
+EXPORT_SYMBOL(v7m_dma_inv_range);
 
 /*
  * Clean the data cache within the specified region.
@@ -254,12 +293,19 @@ void v7m_dma_clean_range(const void *start, const void *end)
 {
 	u32	s, e;
 
+	if ((u32)end - (u32)start >= v7m_dma_setway_threshold) {
+		v7m_dcache_all(0);
+		return;
+	}
+
 	/* Clean */
-	for (s = (u32)start, e = (u32)end; s < e; s += L1_CACHE_BYTES)
+	for (s = (u32)start & ~(L1_CACHE_BYTES - 1), e = (u32)end; s < e;
+	     s += L1_CACHE_BYTES)
 		DCCMVAC(s);
 
 	asm("dsb");
 }
+EXPORT_SYMBOL(v7m_dma_clean_range);
 
 
 /*
@@ -271,18 +317,28 @@ void v7m_dma_flush_range(const void *start, const void *end)
 {
 	u32	s, e;
 
+	if ((u32)end - (u32)start >= v7m_dma_setway_threshold) {
+		v7m_dcache_all(1);
+		return;
+	}
+
 	/* Clean & invalidate */
-	for (s = (u32)start, e = (u32)end; s < e; s += L1_CACHE_BYTES)
+	for (s = (u32)start & ~(L1_CACHE_BYTES - 1), e = (u32)end; s < e;
+	     s += L1_CACHE_BYTES)
 		DCCIMVAC(s);
 
 	asm("dsb");
 }
+EXPORT_SYMBOL(v7m_dma_flush_range);
 
 /*
  * Prepare region for DMAing
  * - start - kernel virtual start address
  * - size  - size of region
  * - dir   - DMA direction
+ *
+ * The device is going to write the region: drop it from the cache.
+ * Otherwise the device reads it: write it back.
  */
 void v7m_dma_map_area(const void *start, size_t size, int dir)
 {
@@ -290,7 +346,8 @@ void v7m_dma_map_area(const void *start, size_t size, int dir)
 
 	if (dir == DMA_FROM_DEVICE)
 		v7m_dma_inv_range(start, end);
-	v7m_dma_clean_range(start, end);
+	else
+		v7m_dma_clean_range(start, end);
 }
 
 /*
@@ -298,11 +355,179 @@ void v7m_dma_map_area(const void *start, size_t size, int dir)
  * - start - kernel virtual start address
  * - size  - size of region
  * - dir   - DMA direction
+ *
+ * If the device wrote the region, drop lines the CPU may have
+ * speculatively fetched while the DMA was running.
  */
 void v7m_dma_unmap_area(const void *start, size_t size, int dir)
 {
 	void	*end = (void *)((u32)start + size);
 
-	if (dir == DMA_TO_DEVICE)
+	if (dir != DMA_TO_DEVICE)
 		v7m_dma_inv_range(start, end);
 }
+
+/*
+ * Default set/way threshold: twice the data cache size. A set/way
+ * operation walks every line of the cache, and writes back all dirty
+ * data, not just that of the region.
+ */
+static int __init v7m_cache_init(void)
+{
+	u32	ccsidr;
+
+	CSSELR(0);
+	asm("dsb");
+	ccsidr = CCSIDR();
+
+	v7m_dma_setway_threshold = 2 * (CCSIDR_NSETS(ccsidr) + 1) *
+		(CCSIDR_ASC(ccsidr) + 1) * (16 << CCSIDR_LSZ(ccsidr));
+
+	return 0;
+}
+arch_initcall(v7m_cache_init);
+
+#ifdef CONFIG_V7M_DMA_NOCACHE
+/*
+ * MPU region attributes of the non-cacheable DMA window: execute never,
+ * privileged access only (full access for the 'fb' part, which user
+ * space may mmap), Normal memory (TEX=1, C=0, B=0), shareable
+ */
+#define MPU_RASR_XN		(1 << 28)
+#define MPU_RASR_AP_PRIV_RW	(1 << 24)
+#define MPU_RASR_AP_RW		(3 << 24)
+#define MPU_RASR_NORMAL_NC	(1 << 19)
+#define MPU_RASR_S		(1 << 18)
+#define MPU_RASR_SIZE(o)	(((o) - 1) << 1)	/* 2^o bytes */
+#define MPU_RASR_EN		(1 << 0)
+
+#define MPU_CTRL_ENABLE		(1 << 0)
+
+/* Most MPU regions the window may take, 'fb' part included */
+#define V7M_DMA_NOCACHE_RGN	6
+
+/*
+ * Split b..e into naturally aligned power-of-two blocks, appending them
+ * to the bas[]/ord[]/ap[] tables from entry n on. Returns the new number
+ * of entries, or -1 if the range does not fit in the tables.
+ */
+static int __init v7m_dma_nocache_split(unsigned long b, unsigned long e,
+					 u32 attr, unsigned long *bas,
+					 int *ord, u32 *ap, int n)
+{
+	unsigned long	blk;
+
+	for (; b < e; b += blk, n++) {
+		blk = b ? b & -b : 1UL << 31;
+		while (blk > e - b)
+			blk >>= 1;
+
+		if (blk < 32 || n == V7M_DMA_NOCACHE_RGN)
+			return -1;
+
+		bas[n] = b;
+		ord[n] = __ffs(blk);
+		ap[n] = attr;
+	}
+
+	return n;
+}
+
+/*
+ * Make the dmamem area, or the window set in the config, non-cacheable.
+ * Called from paging_init() once dmamem is reserved, and before
+ * mpu_init() so that process mappings keep off the regions used here.
+ *
+ * Higher numbered MPU regions take priority, so the window is mapped
+ * from the top region down, above all regions enabled by the bootloader.
+ * The window is for the kernel only; the 'fb' part of dmamem gets its
+ * own, higher, regions with user access so that the framebuffer can
+ * still be mmap()ed.
+ */
+void __init v7m_dma_nocache_init(void)
+{
+	unsigned long	bas[V7M_DMA_NOCACHE_RGN];
+	int		ord[V7M_DMA_NOCACHE_RGN];
+	u32		ap[V7M_DMA_NOCACHE_RGN];
+	dma_addr_t	base = CONFIG_V7M_DMA_NOCACHE_BASE;
+	unsigned long	size = CONFIG_V7M_DMA_NOCACHE_SIZE;
+	dma_addr_t	fb_base;
+	unsigned long	fb_size, fb_b, fb_e;
+	int		regions, top, i, n;
+
+	if (!size && dmamem_area_get(&base, &size))
+		return;
+
+	/*
+	 * With the MPU off, the default memory map applies, in which
+	 * external RAM is not cacheable anyway
+	 */
+	if (!(MPU_CTRL() & MPU_CTRL_ENABLE)) {
+		printk(KERN_INFO "v7m: MPU off, DMA window left in default "
+			"memory map\n");
+		return;
+	}
+
+	/* Find the highest region set up by the bootloader */
+	regions = (MPU_TYPE() >> 8) & 0xFF;
+	for (top = regions - 1; top >= 0; top--) {
+		MPU_RNR(top);
+		if (MPU_RASR() & MPU_RASR_EN)
+			break;
+	}
+
+	/*
+	 * The part of the 'fb' area that falls in the window comes first,
+	 * so that it takes the higher regions and overrides the window
+	 */
+	n = 0;
+	if (!dmamem_fb_get(&fb_base, &fb_size) && fb_size) {
+		fb_b = max((unsigned long)fb_base, (unsigned long)base);
+		fb_e = min((unsigned long)fb_base + fb_size,
+			   (unsigned long)base + size);
+		if (fb_b < fb_e)
+			n = v7m_dma_nocache_split(fb_b, fb_e, MPU_RASR_AP_RW,
+						  bas, ord, ap, n);
+	}
+	if (n >= 0)
+		n = v7m_dma_nocache_split(base, base + size,
+					  MPU_RASR_AP_PRIV_RW,
+					  bas, ord, ap, n);
+
+	if (n < 0 || regions - n <= top) {
+		printk(KERN_WARNING "v7m: cannot map DMA window "
+			"%08x..%08lx with %d free MPU regions\n",
+			base, (unsigned long)base + size,
+			min(regions - 1 - top, V7M_DMA_NOCACHE_RGN));
+		return;
+	}
+
+#ifdef CONFIG_MPU
+	if (mpu_reserve_top(regions - n)) {
+		printk(KERN_WARNING "v7m: MPU regions %d..%d are needed "
+			"for processes, DMA window left cacheable\n",
+			regions - n, regions - 1);
+		return;
+	}
+#endif
+
+	for (i = 0; i < n; i++) {
+		MPU_RNR(regions - 1 - i);
+		MPU_RBAR() = bas[i];
+		MPU_RASR() = MPU_RASR_XN | ap[i] | MPU_RASR_NORMAL_NC |
+			     MPU_RASR_S | MPU_RASR_SIZE(ord[i]) | MPU_RASR_EN;
+	}
+	asm("dsb");
+	asm("isb");
+
+	/*
+	 * Write back and drop the lines the window had in the cache,
+	 * including any fetched while the regions were being set up
+	 */
+	v7m_flush_kern_cache_all();
+
+	printk(KERN_INFO "v7m: DMA window %08x..%08lx non-cacheable, "
+		"MPU regions %d..%d\n", base, (unsigned long)base + size,
+		regions - n, regions - 1);
+}
+#endif /* CONFIG_V7M_DMA_NOCACHE */
@@ -100,6 +100,18 @@ struct nvic_regs {
  */
 static int mpu_hw_reg_indx = 0;
 
+/*
+ * Index past the last MPU protection region available for use in
+ * this module. Regions at and above it are set up at boot time
+ * by other code (see mpu_reserve_top()) and are never touched here.
+ */
+static int mpu_hw_reg_top = 8;
+
+/*
+ * Barrier for the number of 16K pages allocated to the stack
+ */
+#define MPU_STACK_BAR	4
+
 /*
  * Set up an MPU protection region 
  */
@@ -565,7 +577,7 @@ static inline void mpu_page_map(
 	/*
  	 * Set the context for a next region allocation.
  	 */
-	p->indx = i == 7 ? p->barrier : i + 1;
+	p->indx = i == mpu_hw_reg_top - 1 ? p->barrier : i + 1;
 }
 
 /*
@@ -588,7 +600,7 @@ static inline void mpu_page_copyall(struct mm_struct *mm)
 	int i;
 	mpu_context_t *p = mpu_context_p(mm);
 
-	for (i = mpu_hw_reg_indx; i < 8; i ++) {
+	for (i = mpu_hw_reg_indx; i < mpu_hw_reg_top; i ++) {
 		mpu_region_write(i, p->mpu_regs[i].base, p->mpu_regs[i].attr);
 	}	
 }
@@ -694,6 +706,21 @@ void mpu_region_define(unsigned long b, unsigned long t)
 	mpu_addr_region_define(b, t);
 }
 
+/*
+ * Keep the MPU protection regions from @n up out of process mappings.
+ * At least one region must be left above the stack ones.
+ */
+int mpu_reserve_top(int n)
+{
+	if (n <= MPU_STACK_BAR)
+		return -EBUSY;
+
+	if (n < mpu_hw_reg_top)
+		mpu_hw_reg_top = n;
+
+	return 0;
+}
+
 /* 
  * Enable the MPU hardware as well as initalize related data structures
  * This is called from the architecture-specific initilization code.
@@ -782,11 +809,6 @@ void mpu_switch_mm(struct mm_struct *prev, struct mm_struct *next)
 	mpu_page_copyall(next);
 }
 
-/*
- * Barrier for the number of 16K pages allocated to the stack
- */
-#define MPU_STACK_BAR	4
-
 /*
  * MPU-specific part of start_thread.
  * This process is about to go to the user mode.
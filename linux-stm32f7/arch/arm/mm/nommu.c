@@ -58,6 +58,9 @@ void __init reserve_node_zero(pg_data_t *pgdat)
 void __init paging_init(struct machine_desc *mdesc)
 {
 	bootmem_init();
+#ifdef CONFIG_V7M_DMA_NOCACHE
+	v7m_dma_nocache_init();
+#endif
 #ifdef CONFIG_MPU
 	mpu_init();
 #endif
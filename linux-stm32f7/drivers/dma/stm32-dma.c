@@ -0,0 +1,821 @@
+/*
+ * dmaengine driver for the DMA controllers of the STM32F2/F4/F7
+ *
+ * This driver is built on top of the channel API of the STM32 DMA
+ * controller driver (arch/arm/mach-stm32/dmac.c), so that dmaengine
+ * clients and the drivers which use the channel API directly can share
+ * the DMA controllers. A DMA stream is acquired with stm32_dma_ch_get()
+ * when a dmaengine channel is allocated and released when it is freed,
+ * so a stream already used by some driver is never given to a dmaengine
+ * client, and vice versa.
+ *
+ * Slave channels are requested with dma_request_channel(), passing
+ * stm32_dma_filter() and a struct stm32_dma_slave, which tells the stream
+ * and the request to use. Memory-to-memory channels are requested with
+ * the DMA_MEMCPY capability only, and get a free stream of DMA2 (DMA1 can't
+ * do memory-to-memory transfers).
+ *
+ * Submitted descriptors are queued on the channel; when a descriptor
+ * is over, the next one is started right from the DMA interrupt, and
+ * client callbacks are run from a tasklet.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <linux/module.h>
+#include <linux/init.h>
+#include <linux/slab.h>
+#include <linux/interrupt.h>
+#include <linux/platform_device.h>
+#include <linux/dmaengine.h>
+#include <linux/scatterlist.h>
+
+#include <mach/dmac.h>
+#include <mach/dmaregs.h>
+
+#include "dmaengine.h"
+
+#define DRIVER_NAME			"stm32-dma"
+
+/*
+ * Number of dmaengine channels. Each of them gets a hardware stream
+ * when it is allocated, so there is no point in having more channels
+ * than streams.
+ */
+#define STM32_DMAE_CHANS		STM32F2_DMA_CH_NUM
+
+/*
+ * Max number of items in a single hardware transfer (DMA_SxNDTR)
+ */
+#define STM32_DMAE_MAX_ITEMS		0xFFFF
+
+/*
+ * A piece of a descriptor that fits into a single hardware transfer.
+ * For cyclic transfers, this is a period.
+ */
+struct stm32_dmae_sg {
+	dma_addr_t			addr;	/* Memory (destination) */
+	dma_addr_t			src;	/* Source of memcpy */
+	u32				len;	/* Length, in bytes */
+};
+
+/*
+ * Transfer descriptor
+ */
+struct stm32_dmae_desc {
+	struct dma_async_tx_descriptor	tx;
+	struct list_head		node;
+	enum dma_transfer_direction	dir;
+	int				cyclic;
+	u8				width;	/* log2 of item size */
+	unsigned int			sg_len;
+	struct stm32_dmae_sg		sg[0];
+};
+
+/*
+ * dmaengine channel
+ */
+struct stm32_dmae_chan {
+	struct dma_chan			chan;
+	spinlock_t			lock;
+	int				ch;	/* Stream; -1 if none */
+	struct stm32_dma_slave		*slave;	/* Set by the filter */
+	struct dma_slave_config		cfg;	/* Slave configuration */
+	struct list_head		queued;	/* Submitted descriptors */
+	struct list_head		active;	/* Issued descriptors */
+	struct list_head		done;	/* Descriptors to clean up */
+	struct stm32_dmae_desc		*cur;	/* Running descriptor */
+	unsigned int			sg_i;	/* Running piece of it */
+	int				target;	/* Cyclic: buffer in use */
+	unsigned int			periods; /* Cyclic: periods done */
+	struct tasklet_struct		tasklet;
+};
+
+/*
+ * Driver instance
+ */
+struct stm32_dmae {
+	struct dma_device		dma;
+	struct stm32_dmae_chan		chans[STM32_DMAE_CHANS];
+};
+
+static struct platform_driver stm32_dmae_driver;
+
+static inline struct stm32_dmae_chan *to_stm32_dmae_chan(struct dma_chan *c)
+{
+	return container_of(c, struct stm32_dmae_chan, chan);
+}
+
+static inline struct stm32_dmae_desc *to_stm32_dmae_desc(
+	struct dma_async_tx_descriptor *tx)
+{
+	return container_of(tx, struct stm32_dmae_desc, tx);
+}
+
+static inline struct device *chan2dev(struct dma_chan *chan)
+{
+	return &chan->dev->device;
+}
+
+/*
+ * Filter for dma_request_channel(); @param is a struct stm32_dma_slave
+ */
+bool stm32_dma_filter(struct dma_chan *chan, void *param)
+{
+	if (chan->device->dev->driver != &stm32_dmae_driver.driver)
+		return false;
+
+	to_stm32_dmae_chan(chan)->slave = param;
+	return true;
+}
+EXPORT_SYMBOL(stm32_dma_filter);
+
+/*
+ * Encode a slave bus width as a DMA_SxCR[PSIZE/MSIZE] value
+ */
+static int stm32_dmae_width(enum dma_slave_buswidth w)
+{
+	switch (w) {
+	case DMA_SLAVE_BUSWIDTH_1_BYTE:
+		return 0;
+	case DMA_SLAVE_BUSWIDTH_2_BYTES:
+		return 1;
+	case DMA_SLAVE_BUSWIDTH_4_BYTES:
+		return 2;
+	default:
+		return -EINVAL;
+	}
+}
+
+/*
+ * Encode a slave max burst as a DMA_SxCR[PBURST] value. Bursts need
+ * the FIFO, and must fit in the (full) FIFO threshold of 16 bytes;
+ * 0 (single transfers in the Direct Mode) is used otherwise.
+ */
+static int stm32_dmae_burst(u32 maxburst, int width)
+{
+	int burst;
+
+	switch (maxburst) {
+	case 4:
+		burst = 1;
+		break;
+	case 8:
+		burst = 2;
+		break;
+	case 16:
+		burst = 3;
+		break;
+	default:
+		return 0;
+	}
+
+	return (maxburst << width) <= 16 ? burst : 0;
+}
+
+/*
+ * Program the addresses and the length of a piece of a descriptor.
+ * Called with the channel lock held.
+ */
+static int stm32_dmae_load(struct stm32_dmae_chan *c,
+			   struct stm32_dmae_desc *d, unsigned int i)
+{
+	struct stm32_dmae_sg *sg = &d->sg[i];
+	int burst = 0;
+	int rv;
+
+	if (d->dir == DMA_MEM_TO_MEM) {
+		rv = stm32_dma_ch_set_periph(c->ch, sg->src, 1, d->width, 0);
+	} else if (d->dir == DMA_DEV_TO_MEM) {
+		burst = stm32_dmae_burst(c->cfg.src_maxburst, d->width);
+		rv = stm32_dma_ch_set_periph(c->ch, c->cfg.src_addr,
+			0, d->width, burst);
+	} else {
+		burst = stm32_dmae_burst(c->cfg.dst_maxburst, d->width);
+		rv = stm32_dma_ch_set_periph(c->ch, c->cfg.dst_addr,
+			0, d->width, burst);
+	}
+	if (rv < 0)
+		goto out;
+
+	rv = stm32_dma_ch_set_memory(c->ch, sg->addr, 1, d->width, 0);
+	if (rv < 0)
+		goto out;
+
+	rv = stm32_dma_ch_set_nitems(c->ch, sg->len >> d->width);
+out:
+	return rv;
+}
+
+/*
+ * Start the first issued descriptor, if there is one.
+ * Called with the channel lock held.
+ */
+static void stm32_dmae_start(struct stm32_dmae_chan *c)
+{
+	struct stm32_dmae_desc *d;
+	int fifo;
+	int rv;
+
+	if (list_empty(&c->active)) {
+		c->cur = NULL;
+		goto out;
+	}
+
+	d = list_first_entry(&c->active, struct stm32_dmae_desc, node);
+	c->cur = d;
+	c->sg_i = 0;
+	c->target = 0;
+	c->periods = 0;
+
+	/*
+	 * Memory-to-memory transfers go at the lowest priority and can't
+	 * use the Direct Mode. Slave transfers go at the high priority,
+	 * through the FIFO if bursts are used.
+	 */
+	if (d->dir == DMA_MEM_TO_MEM) {
+		rv = stm32_dma_ch_init(c->ch, 2, 0, 0, 0, 0);
+		fifo = 1;
+	} else {
+		rv = stm32_dma_ch_init(c->ch,
+			d->dir == DMA_MEM_TO_DEV ? 1 : 0,
+			c->cfg.device_fc ? 1 : 0, 2,
+			d->cyclic, d->cyclic);
+		fifo = stm32_dmae_burst(d->dir == DMA_MEM_TO_DEV ?
+			c->cfg.dst_maxburst : c->cfg.src_maxburst,
+			d->width) != 0;
+	}
+	if (rv < 0)
+		goto err;
+
+	rv = stm32_dma_ch_init_fifo(c->ch, fifo, fifo ? 3 : 0);
+	if (rv < 0)
+		goto err;
+
+	rv = stm32_dmae_load(c, d, 0);
+	if (rv < 0)
+		goto err;
+
+	/*
+	 * Cyclic transfers run in the Double Buffer Mode, one period
+	 * per buffer; the buffer just completed is set to the period
+	 * after the next one from the interrupt.
+	 */
+	if (d->cyclic) {
+		rv = stm32_dma_ch_set_dbm_memory(c->ch, 1,
+			d->sg[1 % d->sg_len].addr);
+		if (rv < 0)
+			goto err;
+	}
+
+	rv = stm32_dma_ch_enable(c->ch);
+	if (rv < 0)
+		goto err;
+
+	goto out;
+
+err:
+	dev_err(chan2dev(&c->chan), "failed to start transfer (%d)\n", rv);
+out:
+	;
+}
+
+/*
+ * DMA interrupt handler of a stream
+ */
+static void stm32_dmae_irq(int ch, unsigned long flags, void *data)
+{
+	struct stm32_dmae_chan *c = data;
+	struct stm32_dmae_desc *d;
+	unsigned int next;
+
+	spin_lock(&c->lock);
+
+	d = c->cur;
+	if (!d)
+		goto unlock;
+
+	if (flags & STM32_DMA_INTERROR) {
+		dev_err(chan2dev(&c->chan), "transfer error, cookie %d\n",
+			d->tx.cookie);
+		stm32_dma_ch_disable(c->ch);
+		goto complete;
+	}
+
+	if (!(flags & STM32_DMA_INTCOMPLETE))
+		goto unlock;
+
+	if (d->cyclic) {
+		next = (c->sg_i + 2) % d->sg_len;
+		stm32_dma_ch_set_dbm_memory(c->ch, c->target,
+			d->sg[next].addr);
+		c->target ^= 1;
+		c->sg_i = (c->sg_i + 1) % d->sg_len;
+		c->periods++;
+		tasklet_schedule(&c->tasklet);
+		goto unlock;
+	}
+
+	/*
+	 * Go on with the next piece of the descriptor, if any
+	 */
+	if (++c->sg_i < d->sg_len) {
+		if (stm32_dmae_load(c, d, c->sg_i) < 0 ||
+		    stm32_dma_ch_enable(c->ch) < 0) {
+			dev_err(chan2dev(&c->chan), "failed to load "
+				"piece %d of cookie %d\n", c->sg_i,
+				d->tx.cookie);
+			goto complete;
+		}
+		goto unlock;
+	}
+
+complete:
+	/*
+	 * The descriptor is over; start the next one right away
+	 */
+	dma_cookie_complete(&d->tx);
+	list_move_tail(&d->node, &c->done);
+	stm32_dmae_start(c);
+	tasklet_schedule(&c->tasklet);
+
+unlock:
+	spin_unlock(&c->lock);
+}
+
+/*
+ * Run client callbacks and free completed descriptors
+ */
+static void stm32_dmae_tasklet(unsigned long data)
+{
+	struct stm32_dmae_chan *c = (struct stm32_dmae_chan *)data;
+	struct stm32_dmae_desc *d, *_d;
+	dma_async_tx_callback callback = NULL;
+	void *param = NULL;
+	unsigned long fl;
+	LIST_HEAD(list);
+
+	spin_lock_irqsave(&c->lock, fl);
+	list_splice_init(&c->done, &list);
+	if (c->cur && c->cur->cyclic && c->periods) {
+		c->periods = 0;
+		callback = c->cur->tx.callback;
+		param = c->cur->tx.callback_param;
+	}
+	spin_unlock_irqrestore(&c->lock, fl);
+
+	if (callback)
+		callback(param);
+
+	list_for_each_entry_safe(d, _d, &list, node) {
+		if (d->tx.callback)
+			d->tx.callback(d->tx.callback_param);
+		kfree(d);
+	}
+}
+
+/*
+ * Stop the channel and drop all its descriptors.
+ * Called with the channel lock held.
+ */
+static void stm32_dmae_flush(struct stm32_dmae_chan *c)
+{
+	struct stm32_dmae_desc *d, *_d;
+
+	if (c->ch >= 0)
+		stm32_dma_ch_disable(c->ch);
+	c->cur = NULL;
+
+	list_splice_init(&c->queued, &c->done);
+	list_splice_init(&c->active, &c->done);
+	list_for_each_entry_safe(d, _d, &c->done, node)
+		kfree(d);
+	INIT_LIST_HEAD(&c->done);
+}
+
+static dma_cookie_t stm32_dmae_tx_submit(struct dma_async_tx_descriptor *tx)
+{
+	struct stm32_dmae_chan *c = to_stm32_dmae_chan(tx->chan);
+	struct stm32_dmae_desc *d = to_stm32_dmae_desc(tx);
+	dma_cookie_t cookie;
+	unsigned long fl;
+
+	spin_lock_irqsave(&c->lock, fl);
+	cookie = dma_cookie_assign(tx);
+	list_add_tail(&d->node, &c->queued);
+	spin_unlock_irqrestore(&c->lock, fl);
+
+	return cookie;
+}
+
+/*
+ * Allocate a descriptor of @sg_len pieces
+ */
+static struct stm32_dmae_desc *stm32_dmae_desc_alloc(
+	struct stm32_dmae_chan *c, unsigned int sg_len, unsigned long flags)
+{
+	struct stm32_dmae_desc *d;
+
+	d = kzalloc(sizeof(*d) + sg_len * sizeof(d->sg[0]), GFP_NOWAIT);
+	if (!d)
+		goto out;
+
+	dma_async_tx_descriptor_init(&d->tx, &c->chan);
+	d->tx.tx_submit = stm32_dmae_tx_submit;
+	d->tx.flags = flags;
+	INIT_LIST_HEAD(&d->node);
+	d->sg_len = sg_len;
+out:
+	return d;
+}
+
+static struct dma_async_tx_descriptor *stm32_dmae_prep_memcpy(
+	struct dma_chan *chan, dma_addr_t dest, dma_addr_t src,
+	size_t len, unsigned long flags)
+{
+	struct stm32_dmae_chan *c = to_stm32_dmae_chan(chan);
+	struct stm32_dmae_desc *d = NULL;
+	unsigned int i, n;
+	size_t max;
+	u8 width;
+
+	/* Only DMA2 can do memory-to-memory transfers */
+	if (!len || c->ch < STM32F2_DMA_CH_NUM_DMA1)
+		goto out;
+
+	/* Use the widest items the alignment allows */
+	if (!((dest | src | len) & 3))
+		width = 2;
+	else if (!((dest | src | len) & 1))
+		width = 1;
+	else
+		width = 0;
+
+	max = STM32_DMAE_MAX_ITEMS << width;
+	n = DIV_ROUND_UP(len, max);
+	d = stm32_dmae_desc_alloc(c, n, flags);
+	if (!d)
+		goto out;
+
+	d->dir = DMA_MEM_TO_MEM;
+	d->width = width;
+	for (i = 0; i < n; i++) {
+		d->sg[i].addr = dest + i * max;
+		d->sg[i].src = src + i * max;
+		d->sg[i].len = min_t(size_t, len - i * max, max);
+	}
+out:
+	return d ? &d->tx : NULL;
+}
+
+/*
+ * Get the item width of a slave transfer in the @dir direction
+ */
+static int stm32_dmae_slave_width(struct stm32_dmae_chan *c,
+				  enum dma_transfer_direction dir)
+{
+	if (dir == DMA_DEV_TO_MEM)
+		return stm32_dmae_width(c->cfg.src_addr_width);
+	else if (dir == DMA_MEM_TO_DEV)
+		return stm32_dmae_width(c->cfg.dst_addr_width);
+	else
+		return -EINVAL;
+}
+
+static struct dma_async_tx_descriptor *stm32_dmae_prep_slave_sg(
+	struct dma_chan *chan, struct scatterlist *sgl,
+	unsigned int sg_len, enum dma_transfer_direction direction,
+	unsigned long flags, void *context)
+{
+	struct stm32_dmae_chan *c = to_stm32_dmae_chan(chan);
+	struct stm32_dmae_desc *d = NULL;
+	struct scatterlist *sg;
+	unsigned int i, j, n = 0;
+	size_t max, l;
+	int width;
+
+	width = stm32_dmae_slave_width(c, direction);
+	if (!c->slave || width < 0)
+		goto out;
+	max = STM32_DMAE_MAX_ITEMS << width;
+
+	/*
+	 * Long entries are split to fit into the hardware
+	 */
+	for_each_sg(sgl, sg, sg_len, i) {
+		if ((sg_dma_address(sg) | sg_dma_len(sg)) &
+		    ((1 << width) - 1)) {
+			dev_err(chan2dev(chan), "unaligned sg entry %d\n", i);
+			goto out;
+		}
+		n += DIV_ROUND_UP(sg_dma_len(sg), max);
+	}
+
+	d = stm32_dmae_desc_alloc(c, n, flags);
+	if (!d)
+		goto out;
+
+	d->dir = direction;
+	d->width = width;
+	j = 0;
+	for_each_sg(sgl, sg, sg_len, i) {
+		for (l = 0; l < sg_dma_len(sg); l += max, j++) {
+			d->sg[j].addr = sg_dma_address(sg) + l;
+			d->sg[j].len = min_t(size_t, sg_dma_len(sg) - l, max);
+		}
+	}
+	d->sg_len = j;
+out:
+	return d ? &d->tx : NULL;
+}
+
+static struct dma_async_tx_descriptor *stm32_dmae_prep_cyclic(
+	struct dma_chan *chan, dma_addr_t buf_addr, size_t buf_len,
+	size_t period_len, enum dma_transfer_direction direction,
+	void *context)
+{
+	struct stm32_dmae_chan *c = to_stm32_dmae_chan(chan);
+	struct stm32_dmae_desc *d = NULL;
+	unsigned int i, n;
+	int width;
+
+	/*
+	 * All periods go through the same DMA_SxNDTR
+	 */
+	width = stm32_dmae_slave_width(c, direction);
+	if (!c->slave || width < 0 || !period_len ||
+	    buf_len % period_len ||
+	    (period_len | buf_addr) & ((1 << width) - 1) ||
+	    (period_len >> width) > STM32_DMAE_MAX_ITEMS) {
+		dev_err(chan2dev(chan), "unsupported cyclic transfer "
+			"%zu/%zu\n", buf_len, period_len);
+		goto out;
+	}
+
+	n = buf_len / period_len;
+	d = stm32_dmae_desc_alloc(c, n, DMA_CTRL_ACK);
+	if (!d)
+		goto out;
+
+	d->dir = direction;
+	d->width = width;
+	d->cyclic = 1;
+	for (i = 0; i < n; i++) {
+		d->sg[i].addr = buf_addr + i * period_len;
+		d->sg[i].len = period_len;
+	}
+out:
+	return d ? &d->tx : NULL;
+}
+
+static int stm32_dmae_control(struct dma_chan *chan, enum dma_ctrl_cmd cmd,
+			      unsigned long arg)
+{
+	struct stm32_dmae_chan *c = to_stm32_dmae_chan(chan);
+	struct dma_slave_config *cfg = (struct dma_slave_config *)arg;
+	unsigned long fl;
+	int rv = 0;
+
+	spin_lock_irqsave(&c->lock, fl);
+
+	switch (cmd) {
+	case DMA_TERMINATE_ALL:
+		stm32_dmae_flush(c);
+		break;
+	case DMA_SLAVE_CONFIG:
+		if (!c->slave) {
+			rv = -EINVAL;
+			break;
+		}
+		c->cfg = *cfg;
+		break;
+	default:
+		rv = -ENXIO;
+		break;
+	}
+
+	spin_unlock_irqrestore(&c->lock, fl);
+	return rv;
+}
+
+static enum dma_status stm32_dmae_tx_status(struct dma_chan *chan,
+	dma_cookie_t cookie, struct dma_tx_state *txstate)
+{
+	struct stm32_dmae_chan *c = to_stm32_dmae_chan(chan);
+	struct stm32_dmae_desc *d;
+	enum dma_status ret;
+	unsigned long fl;
+	unsigned int i;
+	u32 residue;
+	int n;
+
+	ret = dma_cookie_status(chan, cookie, txstate);
+	if (ret == DMA_SUCCESS || !txstate)
+		goto out;
+
+	/*
+	 * The residue is only known for the running descriptor
+	 */
+	spin_lock_irqsave(&c->lock, fl);
+	d = c->cur;
+	if (d && d->tx.cookie == cookie) {
+		n = stm32_dma_ch_get_nitems(c->ch);
+		residue = n > 0 ? n << d->width : 0;
+		for (i = c->sg_i + 1; i < d->sg_len; i++)
+			residue += d->sg[i].len;
+		dma_set_residue(txstate, residue);
+	}
+	spin_unlock_irqrestore(&c->lock, fl);
+out:
+	return ret;
+}
+
+static void stm32_dmae_issue_pending(struct dma_chan *chan)
+{
+	struct stm32_dmae_chan *c = to_stm32_dmae_chan(chan);
+	unsigned long fl;
+
+	spin_lock_irqsave(&c->lock, fl);
+	list_splice_tail_init(&c->queued, &c->active);
+	if (!c->cur)
+		stm32_dmae_start(c);
+	spin_unlock_irqrestore(&c->lock, fl);
+}
+
+/*
+ * Acquire a stream for a channel: the one asked for by a slave,
+ * or a free DMA2 stream for memory-to-memory transfers
+ */
+static int stm32_dmae_alloc_chan_resources(struct dma_chan *chan)
+{
+	struct stm32_dmae_chan *c = to_stm32_dmae_chan(chan);
+	int ch;
+	int rv;
+
+	if (c->slave) {
+		ch = c->slave->ch;
+		rv = stm32_dma_ch_get(ch);
+		if (rv < 0)
+			goto err;
+		rv = stm32_dma_ch_set_request(ch, c->slave->request);
+		if (rv < 0)
+			goto err_put;
+	} else {
+		rv = -EBUSY;
+		for (ch = STM32F2_DMA_CH_NUM_DMA1;
+		     ch < STM32F2_DMA_CH_NUM; ch++) {
+			rv = stm32_dma_ch_get(ch);
+			if (!rv)
+				break;
+		}
+		if (rv < 0)
+			goto err;
+	}
+
+	rv = stm32_dma_ch_request_irq(ch, stm32_dmae_irq,
+		STM32_DMA_INTCOMPLETE | STM32_DMA_INTERROR, c);
+	if (rv < 0)
+		goto err_put;
+
+	c->ch = ch;
+	dma_cookie_init(chan);
+	memset(&c->cfg, 0, sizeof(c->cfg));
+
+	dev_dbg(chan2dev(chan), "using stream %d\n", ch);
+	rv = 1;
+	goto out;
+
+err_put:
+	stm32_dma_ch_put(ch);
+err:
+	dev_dbg(chan2dev(chan), "no stream available (%d)\n", rv);
+	c->slave = NULL;
+out:
+	return rv;
+}
+
+static void stm32_dmae_free_chan_resources(struct dma_chan *chan)
+{
+	struct stm32_dmae_chan *c = to_stm32_dmae_chan(chan);
+	unsigned long fl;
+	int ch = c->ch;
+
+	spin_lock_irqsave(&c->lock, fl);
+	stm32_dmae_flush(c);
+	c->ch = -1;
+	spin_unlock_irqrestore(&c->lock, fl);
+
+	tasklet_kill(&c->tasklet);
+	stm32_dma_ch_free_irq(ch, c);
+	stm32_dma_ch_put(ch);
+	c->slave = NULL;
+}
+
+static int __devinit stm32_dmae_probe(struct platform_device *pdev)
+{
+	struct stm32_dmae *e;
+	struct dma_device *dd;
+	struct stm32_dmae_chan *c;
+	int i;
+	int rv;
+
+	e = kzalloc(sizeof(*e), GFP_KERNEL);
+	if (!e) {
+		rv = -ENOMEM;
+		goto out;
+	}
+
+	dd = &e->dma;
+	dd->dev = &pdev->dev;
+	INIT_LIST_HEAD(&dd->channels);
+
+	/*
+	 * Channels are private: each of them takes a hardware stream,
+	 * so they can't be put in the general-purpose allocator.
+	 */
+	dma_cap_set(DMA_SLAVE, dd->cap_mask);
+	dma_cap_set(DMA_CYCLIC, dd->cap_mask);
+	dma_cap_set(DMA_MEMCPY, dd->cap_mask);
+	dma_cap_set(DMA_PRIVATE, dd->cap_mask);
+
+	dd->device_alloc_chan_resources = stm32_dmae_alloc_chan_resources;
+	dd->device_free_chan_resources = stm32_dmae_free_chan_resources;
+	dd->device_prep_dma_memcpy = stm32_dmae_prep_memcpy;
+	dd->device_prep_slave_sg = stm32_dmae_prep_slave_sg;
+	dd->device_prep_dma_cyclic = stm32_dmae_prep_cyclic;
+	dd->device_control = stm32_dmae_control;
+	dd->device_tx_status = stm32_dmae_tx_status;
+	dd->device_issue_pending = stm32_dmae_issue_pending;
+
+	for (i = 0; i < STM32_DMAE_CHANS; i++) {
+		c = &e->chans[i];
+		c->chan.device = dd;
+		c->ch = -1;
+		spin_lock_init(&c->lock);
+		INIT_LIST_HEAD(&c->queued);
+		INIT_LIST_HEAD(&c->active);
+		INIT_LIST_HEAD(&c->done);
+		tasklet_init(&c->tasklet, stm32_dmae_tasklet,
+			(unsigned long)c);
+		list_add_tail(&c->chan.device_node, &dd->channels);
+	}
+
+	rv = dma_async_device_register(dd);
+	if (rv < 0) {
+		dev_err(&pdev->dev, "unable to register (%d)\n", rv);
+		goto err_free;
+	}
+
+	platform_set_drvdata(pdev, e);
+	dev_info(&pdev->dev, "%d channels\n", STM32_DMAE_CHANS);
+	goto out;
+
+err_free:
+	kfree(e);
+out:
+	return rv;
+}
+
+static int __devexit stm32_dmae_remove(struct platform_device *pdev)
+{
+	struct stm32_dmae *e = platform_get_drvdata(pdev);
+
+	dma_async_device_unregister(&e->dma);
+	platform_set_drvdata(pdev, NULL);
+	kfree(e);
+
+	return 0;
+}
+
+static struct platform_driver stm32_dmae_driver = {
+	.probe = stm32_dmae_probe,
+	.remove = __devexit_p(stm32_dmae_remove),
+	.driver = {
+		.name = DRIVER_NAME,
+		.owner = THIS_MODULE,
+	},
+};
+
+static int __init stm32_dmae_init(void)
+{
+	return platform_driver_register(&stm32_dmae_driver);
+}
+subsys_initcall(stm32_dmae_init);
+
+static void __exit stm32_dmae_exit(void)
+{
+	platform_driver_unregister(&stm32_dmae_driver);
+}
+module_exit(stm32_dmae_exit);
+
+MODULE_DESCRIPTION("STM32 dmaengine driver");
+MODULE_LICENSE("GPL");
+MODULE_ALIAS("platform:" DRIVER_NAME);
@@ -23,6 +23,9 @@
 #include <linux/io.h>
 #include <linux/delay.h>
 #include <linux/i2c.h>
+#include <linux/cache.h>
+#include <linux/spinlock.h>
+#include <linux/dma-mapping.h>
 #include <mach/i2c.h>
 #include <mach/stm32.h>
 
@@ -98,7 +101,14 @@ struct i2c_stm32f7 {
 	volatile int			msg_status;	/* Message status */
 	struct i2c_adapter		adap;		/* I2C adapter data */
 	wait_queue_head_t		wait;		/* Wait queue */
-	int				nbytes;		/* Count of the remained bytes after reload */
+	spinlock_t			lock;		/* Transfer state lock */
+	struct i2c_msg *		msg;		/* Message in progress */
+	int				msg_left;	/* Messages after it */
+	int				nbytes;		/* Bytes not yet put in NBYTES */
+	int				pos;		/* Bytes moved by PIO */
+	int				dma_ch;		/* DMA channel in use, or -1 */
+	dma_addr_t			dma_addr;	/* Mapped message buffer */
+	int				bounce;		/* DMA goes through dmabuf */
 	caddr_t				dmabuf;		/* Buffer in non-cached region to perform DMA */
 	int				dma_ch_tx;	/* DMA channel configured for I2C TX */
 	int				dma_ch_rx;	/* DMA channel configured for I2C RX */
@@ -131,13 +141,27 @@ struct i2c_stm32f7_regs {
  */
 #define MHZ(v)				((v) * 1000000)
 
-#define I2C_TIMEOUT_BUSY	25	/* 25 ms */
+#define I2C_TIMEOUT_XFER	(5 * HZ)	/* 5 s */
 
-/* DMA buffer is allocated from non-cached region in order
-   to guarantee validity of the DMA transactions when cache
-   is enabled. */
+/*
+ * Messages of up to this many bytes are moved by the CPU from the
+ * interrupt handler: setting up DMA costs more than a few interrupts.
+ */
+#define I2C_PIO_MAX		8
+
+/*
+ * Longer messages are DMAed to/from the caller's buffer directly.
+ * A receive buffer that shares cache lines with other data cannot be
+ * invalidated safely, so it is DMAed through this bounce buffer,
+ * allocated from the non-cached region, or moved by PIO if larger.
+ */
 #define DMABUF_SIZE		1024
 
+/*
+ * Most polls of a DMA channel waiting for it to flush its FIFO
+ */
+#define I2C_DMA_FLUSH_LOOPS	1000
+
 /*
  * Some bits in various CSRs
  */
@@ -206,9 +230,16 @@ struct i2c_stm32f7_regs {
 #define	_ISR_TXE		(1<<0)
 
 /* ICR register bits */
+#define	_ICR_OVRCF		(1<<10)
+#define	_ICR_ARLOCF		(1<<9)
+#define	_ICR_BERRCF		(1<<8)
 #define	_ICR_STOPCF		(1<<5)
 #define	_ICR_NACKCF		(1<<4)
 
+/* Interrupts used during a transfer */
+#define _CR1_XFER_IE		(_CR1_ERRIE | _CR1_TCIE | _CR1_STOPIE | \
+				 _CR1_NACKIE | _CR1_RXIE | _CR1_TXIE)
+
 static inline void _cr1_set_val(struct i2c_stm32f7 *c, uint32_t val)
 {
 	uint32_t cr1 = readl(&I2C_STM32F7(c)->cr1);
@@ -357,12 +388,13 @@ static int i2c_stm32_hw_init(struct i2c_stm32f7 *c)
 
 	/*
 	 * Direction: peripheral-to-memory
-	 * Flow controller: peripheral
+	 * Flow controller: DMA, so that the channel stops by itself,
+	 * with its FIFO flushed, once the message is in memory
 	 * Priority: very high (3)
 	 * Double buffer mode: disabled
 	 * Circular mode: disabled
 	 */
-	if (stm32_dma_ch_init(c->dma_ch_rx, 0, 1, 3, 0, 0) < 0) {
+	if (stm32_dma_ch_init(c->dma_ch_rx, 0, 0, 3, 0, 0) < 0) {
 		goto err_dma;
 	}
 
@@ -386,12 +418,12 @@ static int i2c_stm32_hw_init(struct i2c_stm32f7 *c)
 
 	/*
 	 * Direction: memory-to-peripheral
-	 * Flow controller: peripheral
+	 * Flow controller: DMA
 	 * Priority: very high (3)
 	 * Double buffer mode: disabled
 	 * Circular mode: disabled
 	 */
-	if (stm32_dma_ch_init(c->dma_ch_tx, 1, 1, 3, 0, 0) < 0) {
+	if (stm32_dma_ch_init(c->dma_ch_tx, 1, 0, 3, 0, 0) < 0) {
 		goto err_dma;
 	}
 
@@ -466,243 +498,331 @@ static void i2c_stm32_hw_release(struct i2c_stm32f7 *c)
 }
 
 /*
- * Interrupt handler routine
- * @param irq		IRQ number
- * @param d		controller data structure
- * @returns		IRQ handler exit code
+ * Reset the controller state machine, releasing the bus lines
+ * @param c		controller data structure
  */
-static irqreturn_t i2c_stm32_irq(int irq, void *d)
+static void i2c_stm32_reset(struct i2c_stm32f7 *c)
 {
-	struct i2c_stm32f7 *c = (struct i2c_stm32f7 *) d;
-	uint32_t isr = readl(&I2C_STM32F7(c)->isr);
+	_cr2_set_val(c, 0);
+	_cr1_clear_bits(c, _CR1_PE);
+	while (readl(&I2C_STM32F7(c)->cr1) & _CR1_PE);
+	_cr1_set_bits(c, _CR1_PE);
+}
 
-	if (isr & _ISR_STOPF) {
-		uint32_t icr = _ICR_STOPCF;
+/*
+ * CR2 value for the next chunk (at most 255 bytes) of the current message.
+ * Longer messages are continued with RELOAD; the last message of
+ * a transfer ends with an automatic STOP, the others with TC, so that
+ * the next message starts with a repeated START.
+ * @param c		controller data structure
+ * @returns		CR2 value, without START
+ */
+static uint32_t i2c_stm32_cr2_chunk(struct i2c_stm32f7 *c)
+{
+	struct i2c_msg *m = c->msg;
+	int len = min(c->nbytes, 255);
+	uint32_t cr2;
 
-		/* disable interrupts */
-		_cr1_clear_bits(c, _CR1_ERRIE | _CR1_STOPIE);
+	c->nbytes -= len;
 
-		if (isr & _ISR_NACKF) {
-			/* handle NACK event */
-			icr |= _ICR_NACKCF;
-			c->msg_status = -ENODEV;
-		}
+	cr2 = _CR2_NBYTES(len);
+	if (m->flags & I2C_M_TEN) {
+		cr2 |= _CR2_SADDR10(m->addr);
+	} else {
+		cr2 |= _CR2_SADDR7(m->addr);
+	}
+	if (m->flags & I2C_M_RD) {
+		cr2 |= _CR2_RD_WRN;
+	}
 
-		if (c->msg_status == -EBUSY) {
-			c->msg_status = 0;
+	if (c->nbytes) {
+		cr2 |= _CR2_RELOAD;
+	} else if (!c->msg_left) {
+		cr2 |= _CR2_AUTOEND;
+	}
+
+	return cr2;
+}
+
+/*
+ * Set up DMA of the current message, to/from the message buffer itself
+ * if possible, or through the bounce buffer
+ * @param c		controller data structure
+ * @returns		0->success, <0->error code (the message goes by PIO)
+ */
+static int i2c_stm32_dma_start(struct i2c_stm32f7 *c)
+{
+	struct i2c_msg *m = c->msg;
+	int rd = m->flags & I2C_M_RD;
+	int ch = rd ? c->dma_ch_rx : c->dma_ch_tx;
+	u32 addr;
+
+	if (!rd || !(((u32)m->buf | m->len) & (L1_CACHE_BYTES - 1))) {
+		c->dma_addr = dma_map_single(&c->dev->dev, m->buf, m->len,
+			rd ? DMA_FROM_DEVICE : DMA_TO_DEVICE);
+		addr = c->dma_addr;
+	} else if (m->len <= DMABUF_SIZE) {
+		c->bounce = 1;
+		addr = (u32)c->dmabuf;
+	} else {
+		return -EINVAL;
+	}
+
+	/*
+	 * Memory address: message or bounce buffer address
+	 * Memory incremental: enabled
+	 * Memory data size: 8-bit
+	 * Burst transfer configuration: no burst
+	 */
+	if (stm32_dma_ch_set_memory(ch, addr, 1, 0, 1) < 0 ||
+	    stm32_dma_ch_set_nitems(ch, m->len) < 0 ||
+	    stm32_dma_ch_enable(ch) < 0) {
+		if (!c->bounce) {
+			dma_unmap_single(&c->dev->dev, c->dma_addr, m->len,
+				rd ? DMA_FROM_DEVICE : DMA_TO_DEVICE);
 		}
+		c->bounce = 0;
+		return -EIO;
+	}
 
-		/* clear the event */
-		writel(icr, &I2C_STM32F7(c)->icr);
+	c->dma_ch = ch;
+	return 0;
+}
+
+/*
+ * Stop DMA of the current message, and hand its buffer back to the CPU.
+ * Once the last byte is in, the channel flushes its FIFO to memory and
+ * turns itself off, normally within a few bus cycles.
+ * @param c		controller data structure
+ * @param ok		the message went through, received data is valid
+ */
+static void i2c_stm32_dma_stop(struct i2c_stm32f7 *c, int ok)
+{
+	struct i2c_msg *m = c->msg;
+	int rd = m->flags & I2C_M_RD;
+	int i;
 
-		/* cleanup the finished transfer */
-		_cr2_set_val(c, 0);
+	_cr1_clear_bits(c, _CR1_TXDMAEN | _CR1_RXDMAEN);
 
-		wake_up(&c->wait);
-	} else if (isr & _ISR_TCR) {
-		uint32_t cr2 = readl(&I2C_STM32F7(c)->cr2);
+	if (rd && ok) {
+		for (i = 0; i < I2C_DMA_FLUSH_LOOPS &&
+			    stm32_dma_ch_busy(c->dma_ch) > 0; i++);
+	}
+	stm32_dma_ch_disable(c->dma_ch);
+	for (i = 0; i < I2C_DMA_FLUSH_LOOPS &&
+		    stm32_dma_ch_busy(c->dma_ch) > 0; i++);
 
-		if (c->nbytes > 255) {
-			c->nbytes -= 255;
-			cr2 |= _CR2_NBYTES(255);
-		} else {
-			c->nbytes = 0;
-			cr2 |= _CR2_NBYTES(c->nbytes);
-			cr2 &= ~_CR2_RELOAD;
-			_cr1_clear_bits(c, _CR1_TCIE);
+	if (c->bounce) {
+		if (rd && ok) {
+			memcpy(m->buf, c->dmabuf, m->len);
 		}
-
-		_cr2_set_val(c, cr2);
 	} else {
-		/*
-		 * Some error condition -> let's stop and report a failure
-		 */
-		_cr2_set_val(c, _CR2_STOP);
+		dma_unmap_single(&c->dev->dev, c->dma_addr, m->len,
+			rd ? DMA_FROM_DEVICE : DMA_TO_DEVICE);
+	}
 
-		c->msg_status = -EIO;
+	c->dma_ch = -1;
+	c->bounce = 0;
+}
 
-		dev_dbg(&c->dev->dev,
-			"error condition in irq handler: isr=%x\n", isr);
+/*
+ * Start the current message: with START, or a repeated START if
+ * the previous message ended with TC
+ * @param c		controller data structure
+ */
+static void i2c_stm32_msg_start(struct i2c_stm32f7 *c)
+{
+	struct i2c_msg *m = c->msg;
+	uint32_t ie = _CR1_ERRIE | _CR1_TCIE | _CR1_STOPIE | _CR1_NACKIE;
+
+	c->nbytes = m->len;
+	c->pos = 0;
+	c->dma_ch = -1;
+	c->bounce = 0;
+
+	if (m->len > I2C_PIO_MAX) {
+		i2c_stm32_dma_start(c);
 	}
 
-	return 0;
+	if (c->dma_ch < 0 && m->len) {
+		ie |= m->flags & I2C_M_RD ? _CR1_RXIE : _CR1_TXIE;
+	}
+	_cr1_clear_bits(c, _CR1_RXIE | _CR1_TXIE);
+	_cr1_set_bits(c, ie);
+
+	/* Put config and generate START */
+	_cr2_set_val(c, i2c_stm32_cr2_chunk(c) | _CR2_START);
+
+	if (c->dma_ch >= 0) {
+		_cr1_set_bits(c, m->flags & I2C_M_RD ?
+			      _CR1_RXDMAEN : _CR1_TXDMAEN);
+	}
+
+	d_printk(3, "addr=%x,len=%d,flags=%x,dma=%d,bounce=%d\n",
+		 m->addr, m->len, m->flags, c->dma_ch, c->bounce);
 }
 
 /*
- * Adapter transfer callback
- * @param a		I2C adapter
- * @param m		array of messages
- * @param n		number of messages
- * @returns		message segments transferred or error code (<1)
+ * Finish the current message, if any
+ * @param c		controller data structure
+ * @param ok		the message went through
  */
-static int i2c_stm32_transfer(struct i2c_adapter *a, struct i2c_msg *m, int n)
+static void i2c_stm32_msg_done(struct i2c_stm32f7 *c, int ok)
 {
-#if defined(I2C_STM32_DEBUG)
-	int j;
-#endif
-	struct i2c_stm32f7 *c = a->algo_data;
-	int ret = 0;
-	int i;
+	if (!c->msg) {
+		return;
+	}
 
-	for (i = 0; i < n; i++) {
-		uint32_t cr2 = 0;
-		int dma_ch;
+	if (c->dma_ch >= 0) {
+		i2c_stm32_dma_stop(c, ok);
+	}
+	_cr1_clear_bits(c, _CR1_RXIE | _CR1_TXIE);
 
-		/* Setup transfer */
+	c->msg = NULL;
+}
 
-		/* Transfer length */
+/*
+ * End the transfer, and wake up the waiting process
+ * @param c		controller data structure
+ * @param status	transfer status, unless already failed
+ */
+static void i2c_stm32_xfer_done(struct i2c_stm32f7 *c, int status)
+{
+	/* Finish the message before its status is overwritten */
+	i2c_stm32_msg_done(c, c->msg_status == -EBUSY && !status);
 
-		/* Maximum size of a single transfer
-		   is limited by the DMA buffer size. */
-		if (m[i].len > DMABUF_SIZE) {
-			if (ret == 0) {
-				ret = -EINVAL;
-			}
-			break;
-		}
-		if (m[i].len > 255) {
-			cr2 |= _CR2_NBYTES(255);
-			c->nbytes = m[i].len - 255;
-			cr2 |= _CR2_RELOAD;
-			_cr1_set_bits(c, _CR1_TCIE);
-		} else {
-			c->nbytes = 0;
-			cr2 |= _CR2_NBYTES(m[i].len);
-		}
+	if (c->msg_status == -EBUSY) {
+		c->msg_status = status;
+	}
 
-		/* Addressing mode */
-		if (m[i].flags & I2C_M_TEN) {
-			cr2 |= _CR2_SADDR10(m[i].addr);
-		} else {
-			cr2 |= _CR2_SADDR7(m[i].addr);
-		}
+	_cr1_clear_bits(c, _CR1_XFER_IE);
+	_cr2_set_val(c, 0);
 
-		/* Direction */
-		if (m[i].flags & I2C_M_RD) {
-			cr2 |= _CR2_RD_WRN;
-			dma_ch = c->dma_ch_rx;
-		} else {
-			memcpy(c->dmabuf, m[i].buf, m[i].len);
-			dma_ch = c->dma_ch_tx;
-		}
+	wake_up(&c->wait);
+}
 
-		/* Autogenerate STOP when finished */
-		cr2 |= _CR2_AUTOEND;
+/*
+ * Interrupt handler routine, for both the event and error interrupts.
+ * Moves the bytes of PIO messages, reloads NBYTES for messages longer
+ * than 255 bytes, and chains the messages of a transfer.
+ * @param irq		IRQ number
+ * @param d		controller data structure
+ * @returns		IRQ handler exit code
+ */
+static irqreturn_t i2c_stm32_irq(int irq, void *d)
+{
+	struct i2c_stm32f7 *c = (struct i2c_stm32f7 *) d;
+	struct i2c_msg *m;
+	uint32_t isr;
+	unsigned long flags;
 
-		c->msg_status = -EBUSY;
+	spin_lock_irqsave(&c->lock, flags);
 
-		/*
-		 * Setup and enable the DMA channel. After this point, the DMA transfer will
-		 * be able to start.
-		 */
+	isr = readl(&I2C_STM32F7(c)->isr);
+	m = c->msg;
 
+	if (isr & (_ISR_BERR | _ISR_ARLO | _ISR_OVR)) {
 		/*
-		 * Memory address: DMA buffer address
-		 * Memory incremental: enabled
-		 * Memory data size: 8-bit
-		 * Burst transfer configuration: no burst
+		 * Bus error, arbitration lost or overrun: give up, the
+		 * controller is reset by i2c_stm32_transfer()
 		 */
-		if (stm32_dma_ch_set_memory(dma_ch, (u32)c->dmabuf, 1, 0, 1) < 0) {
-			goto err_dma;
-		}
+		writel(_ICR_BERRCF | _ICR_ARLOCF | _ICR_OVRCF,
+		       &I2C_STM32F7(c)->icr);
+		dev_dbg(&c->dev->dev,
+			"error condition in irq handler: isr=%x\n", isr);
+		i2c_stm32_xfer_done(c, isr & _ISR_ARLO ? -EAGAIN : -EIO);
+		goto out;
+	}
 
-		if (stm32_dma_ch_set_nitems(dma_ch, m[i].len) < 0) {
-			goto err_dma;
+	if (isr & _ISR_NACKF) {
+		/* The controller sends STOP by itself */
+		writel(_ICR_NACKCF, &I2C_STM32F7(c)->icr);
+		if (c->msg_status == -EBUSY) {
+			c->msg_status = -ENODEV;
 		}
+	}
 
-		if (stm32_dma_ch_enable(dma_ch) < 0) {
-			goto err_dma;
+	if (m && c->dma_ch < 0 && c->pos < m->len) {
+		if (isr & _ISR_RXNE) {
+			m->buf[c->pos++] = readl(&I2C_STM32F7(c)->rxdr);
+		} else if (isr & _ISR_TXIS) {
+			writel(m->buf[c->pos++], &I2C_STM32F7(c)->txdr);
 		}
+	}
 
-		/* Enable interrupts */
-		_cr1_set_bits(c, _CR1_ERRIE | _CR1_STOPIE);
-
-		/* Put config and generate START */
-		_cr2_set_val(c, cr2 | _CR2_START);
-
-		if (m[i].len > 0) {
-			/* Busy loop to wait the I2C controller is ready for DMA */
-			unsigned long start = jiffies;
-			unsigned long tmout_jiffies = (I2C_TIMEOUT_BUSY * HZ) / 1000;
-			unsigned long tmout = 0;
-
-			while (1) {
-				uint32_t isr = readl(&I2C_STM32F7(c)->isr);
-				if (m[i].flags & I2C_M_RD) {
-					if (isr & _ISR_RXNE) {
-						/* Start DMA */
-						_cr1_set_bits(c, _CR1_RXDMAEN);
-						break;
-					}
-				} else {
-					if (isr & _ISR_TXIS) {
-						/* Start DMA */
-						_cr1_set_bits(c, _CR1_TXDMAEN);
-						break;
-					}
-				}
-
-				tmout = jiffies - start;
-
-				if (tmout > tmout_jiffies) {
-					break;
-				}
-			}
-
-			if (tmout > tmout_jiffies) {
-				/* Disable interrupts */
-				_cr1_clear_bits(c, _CR1_ERRIE | _CR1_STOPIE | _CR1_TCIE);
-
-				/* Clean up the transfer */
-				_cr2_set_val(c, 0);
-				if (ret == 0) {
-					ret = -ETIMEDOUT;
-				}
-				stm32_dma_ch_disable(dma_ch);
-				break;
-			}
-		}
+	if (m && (isr & _ISR_TCR)) {
+		/* Next chunk of a message longer than 255 bytes */
+		_cr2_set_val(c, i2c_stm32_cr2_chunk(c));
+	}
 
-		/*
-		 * Wait for the transfer to complete, one way or another
-		 */
-		if (wait_event_timeout(c->wait, c->msg_status != -EBUSY, 5*HZ) == 0) {
-			/* Disable interrupts */
-			_cr1_clear_bits(c, _CR1_ERRIE | _CR1_STOPIE | _CR1_TCIE);
-
-			/* Clean up the transfer */
-			_cr2_set_val(c, 0);
-			if (ret == 0) {
-				ret = -ETIMEDOUT;
-			}
+	if (m && (isr & _ISR_TC)) {
+		/* Message done without STOP: go on to the next one */
+		i2c_stm32_msg_done(c, c->msg_status == -EBUSY);
+		if (c->msg_status == -EBUSY && c->msg_left) {
+			c->msg = m + 1;
+			c->msg_left--;
+			i2c_stm32_msg_start(c);
 		} else {
-			if (c->msg_status != 0) {
-				if (ret == 0) {
-					ret = c->msg_status;
-				}
-			} else {
-				ret ++;
-			}
+			_cr2_set_val(c, _CR2_STOP);
 		}
+	}
 
-		/* Cleanup DMA */
-		_cr1_clear_bits(c, _CR1_TXDMAEN | _CR1_RXDMAEN);
-		stm32_dma_ch_disable(dma_ch);
+	if (isr & _ISR_STOPF) {
+		writel(_ICR_STOPCF, &I2C_STM32F7(c)->icr);
+		i2c_stm32_xfer_done(c, c->msg_left ? -EIO : 0);
+	}
 
-		if (ret != (i + 1)) {
-			/* Error */
-			break;
-		}
+out:
+	spin_unlock_irqrestore(&c->lock, flags);
+	return IRQ_HANDLED;
+}
 
-		if (m[i].flags & I2C_M_RD) {
-			memcpy(m[i].buf, c->dmabuf, m[i].len);
-		}
+/*
+ * Adapter transfer callback
+ * @param a		I2C adapter
+ * @param m		array of messages
+ * @param n		number of messages
+ * @returns		message segments transferred or error code (<1)
+ */
+static int i2c_stm32_transfer(struct i2c_adapter *a, struct i2c_msg *m, int n)
+{
+	struct i2c_stm32f7 *c = a->algo_data;
+	unsigned long flags;
+	int ret;
+
+	if (n <= 0) {
+		return 0;
 	}
 
-	return ret;
+	/*
+	 * Start the first message; the interrupt handler runs the rest
+	 * back-to-back, with repeated STARTs in between
+	 */
+	spin_lock_irqsave(&c->lock, flags);
+	c->msg_status = -EBUSY;
+	c->msg = m;
+	c->msg_left = n - 1;
+	i2c_stm32_msg_start(c);
+	spin_unlock_irqrestore(&c->lock, flags);
 
- err_dma:
-	return -1;
+	/*
+	 * Wait for the transfer to complete, one way or another
+	 */
+	if (wait_event_timeout(c->wait, c->msg_status != -EBUSY,
+			       I2C_TIMEOUT_XFER) == 0) {
+		spin_lock_irqsave(&c->lock, flags);
+		i2c_stm32_xfer_done(c, -ETIMEDOUT);
+		spin_unlock_irqrestore(&c->lock, flags);
+	}
+
+	ret = c->msg_status;
+	if (ret && ret != -ENODEV) {
+		/* Release the bus after errors other than NACK */
+		i2c_stm32_reset(c);
+	}
+
+	d_printk(2, "n=%d,ret=%d\n", n, ret);
+	return ret ? ret : n;
 }
 
 /*
@@ -895,6 +1015,7 @@ static int __devinit i2c_stm32_probe(struct platform_device *dev)
 	 * Set up the wait queue
 	 */
 	init_waitqueue_head(&c->wait);
+	spin_lock_init(&c->lock);
 
 	/*
 	 * Register the I2C adapter
@@ -78,6 +78,10 @@ struct sddrv_dmac_data {
 	void *dma_v_base;
 	int mapped;
 	int preallocated_tx_buf;
+#elif defined(CONFIG_STM32_SD_DMA)
+	struct scatterlist *sg;		/* Next segment to chain */
+	int sg_left;			/* Segments yet to be chained */
+	int sg_chained;			/* DMA is the flow controller */
 #endif /* CONFIG_LPC178X_SD_DMA */
 };
 static struct sddrv_dmac_data dmac_drvdat;
@@ -229,7 +233,7 @@ static void mmc_dma_dealloc(void)
 }
 
 /* Supports scatter/gather */
-static void mmc_dma_rx_start(struct mmci_host *host)
+static int mmc_dma_rx_start(struct mmci_host *host)
 {
 	unsigned int len;
 	int i, dma_len;
@@ -246,7 +250,7 @@ static void mmc_dma_rx_start(struct mmci_host *host)
 		mmc_dev(host->mmc), reqdata->sg, reqdata->sg_len,
 		DMA_FROM_DEVICE);
 	if (dma_len == 0)
-		return;
+		return -ENOMEM;
 
 	/* Setup transfer */
 	for (i = 0; i < len; i++) {
@@ -267,10 +271,12 @@ static void mmc_dma_rx_start(struct mmci_host *host)
 				dmalen -= dmaxferlen;
 		}
 	}
+
+	return 0;
 }
 
 /* May need to reorganize buffer for scatter/gather */
-static void mmc_dma_tx_start(struct mmci_host *host)
+static int mmc_dma_tx_start(struct mmci_host *host)
 {
 	unsigned int len;
 	int dma_len;
@@ -291,8 +297,10 @@ static void mmc_dma_tx_start(struct mmci_host *host)
 	if (len == 1 && !dmac_drvdat.preallocated_tx_buf) {
 		dma_len = dma_map_sg(mmc_dev(host->mmc), reqdata->sg,
 			reqdata->sg_len, DMA_TO_DEVICE);
-		if (dma_len == 0)
-			return;
+		if (dma_len == 0) {
+			local_irq_restore(flags);
+			return -ENOMEM;
+		}
 
 		dmaaddr = (void *) sg_dma_address(&sg[0]);
 		dmac_drvdat.mapped = 1;
@@ -322,53 +330,137 @@ static void mmc_dma_tx_start(struct mmci_host *host)
 		(void *) SD_FIFO((u32)host->base), 1);
 
 	local_irq_restore(flags);
+
+	return 0;
 }
 
 #elif defined(CONFIG_STM32_SD_DMA)
 
+/*
+ * Max length of a segment of a scatter/gather request. In a multi-segment
+ * transfer, the DMA controller is the flow controller, so the length of
+ * each segment must fit into the 16-bit Number Of Data register, which
+ * counts 32-bit words.
+ */
+#define MMC_DMA_SEG_MAX		((((1 << 16) - 1) * 4) & ~(SZ_512 - 1))
+
+/*
+ * DMA transfer complete interrupt (on STM32). In a multi-segment transfer,
+ * chain the DMA transfer of the next segment of the scatter/gather list.
+ * The SDIO controller is stalled by the hardware flow control meanwhile.
+ */
+static void mmc_dma_irq(int ch, unsigned long flags, void *data)
+{
+	struct scatterlist *sg = dmac_drvdat.sg;
+	int rv;
+
+	if (!dmac_drvdat.sg_left)
+		goto out;
+
+	rv = stm32_dma_ch_set_memory(ch, sg_dma_address(sg), 1, 2, 1);
+	if (rv < 0)
+		goto err;
+	rv = stm32_dma_ch_set_nitems(ch, sg_dma_len(sg) / 4);
+	if (rv < 0)
+		goto err;
+	rv = stm32_dma_ch_enable(ch);
+	if (rv < 0)
+		goto err;
+
+	dmac_drvdat.sg = sg_next(sg);
+	dmac_drvdat.sg_left--;
+	goto out;
+
+err:
+	dev_err(dmac_drvdat.dev, "DMA chaining failed (%d)\n", rv);
+	dmac_drvdat.sg_left = 0;
+out:
+	;
+}
+
 static int mmc_dma_setup(struct mmci_platform_data *plat)
 {
-	return stm32_dma_ch_get(STM32F2_DMACH_SDIO);
+	int rv;
+
+	rv = stm32_dma_ch_get(STM32F2_DMACH_SDIO);
+	if (rv < 0)
+		goto out;
+
+	rv = stm32_dma_ch_request_irq(STM32F2_DMACH_SDIO, mmc_dma_irq,
+		STM32_DMA_INTCOMPLETE, NULL);
+	if (rv < 0)
+		stm32_dma_ch_put(STM32F2_DMACH_SDIO);
+out:
+	return rv;
 }
 
 static void mmc_dma_dealloc(void)
 {
 	int rv;
 
+	stm32_dma_ch_free_irq(STM32F2_DMACH_SDIO, NULL);
 	rv = stm32_dma_ch_put(STM32F2_DMACH_SDIO);
 	if (rv < 0)
 		pr_err("%s: stm32_dma_ch_put() failed (%d)\n", __func__, rv);
 }
 
 /*
- * Prepare and enable DMA Rx channel (on STM32)
+ * Prepare and enable DMA channel (on STM32)
+ * @dir: 0 -> Rx (peripheral-to-memory), 1 -> Tx (memory-to-peripheral)
+ * @ret: 0 -> success; error code otherwise, with the sg list unmapped
  */
-static void mmc_dma_rx_start(struct mmci_host *host)
+static int mmc_dma_start(struct mmci_host *host, int dir)
 {
 	struct mmc_request *mrq = host->mrq;
 	struct mmc_data *reqdata = mrq->data;
+	struct scatterlist *sg;
 	int dma_len;
-	int rv;
-
-	/* Scatter/gather DMA is not supported */
-	BUG_ON(reqdata->sg_len > 1);
+	int rv, i;
 
 	dma_len = dma_map_sg(
 		mmc_dev(host->mmc), reqdata->sg, reqdata->sg_len,
-		DMA_FROM_DEVICE);
+		dir ? DMA_TO_DEVICE : DMA_FROM_DEVICE);
 	if (dma_len == 0) {
-		dev_err(mmc_dev(host->mmc), "could not map DMA Rx buffer\n");
+		dev_err(mmc_dev(host->mmc), "could not map DMA %s buffer\n",
+			dir ? "Tx" : "Rx");
+		rv = -ENOMEM;
 		goto out;
 	}
 
 	/*
-	 * Direction: peripheral-to-memory
-	 * Flow controller: peripheral
+	 * A single segment is transferred with the SDIO controller being
+	 * the flow controller, so there are no restrictions on its length.
+	 * Multiple segments are transferred one by one, with the DMA
+	 * controller being the flow controller, so that it stops at the end
+	 * of each segment. The length of each segment must then be a multiple
+	 * of the 4-beat word burst.
+	 */
+	dmac_drvdat.sg_chained = dma_len > 1;
+	if (dmac_drvdat.sg_chained) {
+		for_each_sg(reqdata->sg, sg, dma_len, i) {
+			if ((sg_dma_address(sg) & 3) ||
+			    (sg_dma_len(sg) & 15) ||
+			    sg_dma_len(sg) > MMC_DMA_SEG_MAX) {
+				dev_err(mmc_dev(host->mmc),
+					"unaligned DMA segment %d (%d)\n",
+					i, sg_dma_len(sg));
+				rv = -EINVAL;
+				goto unmap;
+			}
+		}
+	}
+	dmac_drvdat.sg = sg_next(reqdata->sg);
+	dmac_drvdat.sg_left = dma_len - 1;
+
+	/*
+	 * Direction: as requested
+	 * Flow controller: peripheral (single segment), DMA (multi-segment)
 	 * Priority: very high (3)
 	 * Double buffer mode: disabled
 	 * Circular mode: disabled
 	 */
-	rv = stm32_dma_ch_init(STM32F2_DMACH_SDIO, 0, 1, 3, 0, 0);
+	rv = stm32_dma_ch_init(STM32F2_DMACH_SDIO, dir,
+		!dmac_drvdat.sg_chained, 3, 0, 0);
 	if (rv < 0)
 		goto err;
 
@@ -391,7 +483,7 @@ static void mmc_dma_rx_start(struct mmci_host *host)
 		goto err;
 
 	/*
-	 * Memory address: DMA buffer address
+	 * Memory address: DMA address of the first segment
 	 * Memory incremental: enabled
 	 * Memory data size: 32-bit
 	 * Burst transfer configuration: incremental burst of 4 beats
@@ -402,11 +494,14 @@ static void mmc_dma_rx_start(struct mmci_host *host)
 		goto err;
 
 	/*
-	 * Set number of items to transfer to zero, because we use peripheral
-	 * flow controller, and therefore the SDIO controller will stop
-	 * the transfer when the whole block data has been transferred.
+	 * With the peripheral flow controller, set number of items to zero,
+	 * because the SDIO controller will stop the transfer when the whole
+	 * block data has been transferred. Otherwise, set it to the number
+	 * of words in the first segment; the rest are chained from the DMA
+	 * interrupt.
 	 */
-	rv = stm32_dma_ch_set_nitems(STM32F2_DMACH_SDIO, 0);
+	rv = stm32_dma_ch_set_nitems(STM32F2_DMACH_SDIO,
+		dmac_drvdat.sg_chained ? sg_dma_len(&reqdata->sg[0]) / 4 : 0);
 	if (rv < 0)
 		goto err;
 
@@ -421,95 +516,52 @@ static void mmc_dma_rx_start(struct mmci_host *host)
 	goto out;
 
 err:
-	dev_err(mmc_dev(host->mmc), "Rx DMA channel initialization failed\n");
+	dev_err(mmc_dev(host->mmc), "%s DMA channel initialization failed\n",
+		dir ? "Tx" : "Rx");
+unmap:
+	dma_unmap_sg(mmc_dev(host->mmc), reqdata->sg, reqdata->sg_len,
+		dir ? DMA_TO_DEVICE : DMA_FROM_DEVICE);
 out:
-	;
+	return rv < 0 ? rv : 0;
 }
 
 /*
- * Prepare and enable DMA Tx channel (on STM32)
+ * Prepare and enable DMA Rx channel (on STM32)
  */
-static void mmc_dma_tx_start(struct mmci_host *host)
+static int mmc_dma_rx_start(struct mmci_host *host)
 {
-	struct mmc_request *mrq = host->mrq;
-	struct mmc_data *reqdata = mrq->data;
-	int dma_len;
-	int rv;
-
-	/* Scatter/gather DMA is not supported */
-	BUG_ON(reqdata->sg_len > 1);
-
-	dma_len = dma_map_sg(
-		mmc_dev(host->mmc), reqdata->sg, reqdata->sg_len,
-		DMA_TO_DEVICE);
-	if (dma_len == 0) {
-		dev_err(mmc_dev(host->mmc), "could not map DMA Tx buffer\n");
-		goto out;
-	}
-
-	/*
-	 * Direction: memory-to-peripheral
-	 * Flow controller: peripheral
-	 * Priority: very high (3)
-	 * Double buffer mode: disabled
-	 * Circular mode: disabled
-	 */
-	rv = stm32_dma_ch_init(STM32F2_DMACH_SDIO, 1, 1, 3, 0, 0);
-	if (rv < 0)
-		goto err;
-
-	/*
-	 * Enable burst mode; set FIFO threshold to "full FIFO"
-	 */
-	rv = stm32_dma_ch_init_fifo(STM32F2_DMACH_SDIO, 1, 3);
-	if (rv < 0)
-		goto err;
-
-	/*
-	 * Peripheral address: SDIO controller FIFO data register
-	 * Peripheral increment: disabled
-	 * Peripheral data size: 32-bit
-	 * Burst transfer configuration: incremental burst of 4 beats
-	 */
-	rv = stm32_dma_ch_set_periph(STM32F2_DMACH_SDIO,
-		SD_FIFO((u32)host->base), 0, 2, 1);
-	if (rv < 0)
-		goto err;
+	return mmc_dma_start(host, 0);
+}
 
-	/*
-	 * Memory address: DMA buffer address
-	 * Memory incremental: enabled
-	 * Memory data size: 32-bit
-	 * Burst transfer configuration: incremental burst of 4 beats
-	 */
-	rv = stm32_dma_ch_set_memory(STM32F2_DMACH_SDIO,
-		sg_dma_address(&reqdata->sg[0]), 1, 2, 1);
-	if (rv < 0)
-		goto err;
+/*
+ * Prepare and enable DMA Tx channel (on STM32)
+ */
+static int mmc_dma_tx_start(struct mmci_host *host)
+{
+	return mmc_dma_start(host, 1);
+}
 
-	/*
-	 * Set number of items to transfer to zero, because we use peripheral
-	 * flow controller, and therefore the SDIO controller will stop
-	 * the transfer when the whole block data has been transferred.
-	 */
-	rv = stm32_dma_ch_set_nitems(STM32F2_DMACH_SDIO, 0);
-	if (rv < 0)
-		goto err;
+/*
+ * Stop the DMA channel at the end of a data transfer (on STM32)
+ */
+static void mmc_dma_stop(struct mmci_host *host, struct mmc_data *data)
+{
+	int i;
 
 	/*
-	 * Enable the DMA channel. After this point, the DMA transfer will
-	 * be able to start.
+	 * When the DMA controller is the flow controller, the SDIO controller
+	 * may signal the end of a read while the DMA FIFO is still being
+	 * flushed to memory. Let the flush complete.
 	 */
-	rv = stm32_dma_ch_enable(STM32F2_DMACH_SDIO);
-	if (rv < 0)
-		goto err;
-
-	goto out;
+	if (dmac_drvdat.sg_chained && !data->error &&
+	    (data->flags & MMC_DATA_READ)) {
+		for (i = 0; i < 100 &&
+		     stm32_dma_ch_busy(STM32F2_DMACH_SDIO) > 0; i++)
+			udelay(1);
+	}
 
-err:
-	dev_err(mmc_dev(host->mmc), "Tx DMA channel initialization failed\n");
-out:
-	;
+	dmac_drvdat.sg_left = 0;
+	stm32_dma_ch_disable(STM32F2_DMACH_SDIO);
 }
 
 #endif /* CONFIG_LPC178X_SD_DMA; CONFIG_STM32_SD_DMA */
@@ -696,13 +748,21 @@ static void mmci_init_sg(struct mmci_host *host, struct mmc_data *data)
 	sg_miter_start(&host->sg_miter, data->sg, data->sg_len, flags);
 }
 
-static void mmci_start_data(struct mmci_host *host, struct mmc_data *data)
+/*
+ * Set up the data path of a request
+ * @ret: 0 -> success; error code if DMA could not be set up. The data
+ * transfer is then failed with data->error, and not started
+ */
+static int mmci_start_data(struct mmci_host *host, struct mmc_data *data)
 {
 	struct variant_data *variant = host->variant;
 	unsigned int datactrl, timeout, irqmask = 0;
 	unsigned long long clks;
 	void __iomem *base;
 	int blksz_bits;
+#if defined(CONFIG_LPC178X_SD_DMA) || defined(CONFIG_STM32_SD_DMA)
+	int rv;
+#endif
 
 	dev_dbg(mmc_dev(host->mmc), "blksz %04x blks %04x flags %08x\n",
 		data->blksz, data->blocks, data->flags);
@@ -734,10 +794,15 @@ static void mmci_start_data(struct mmci_host *host, struct mmc_data *data)
 	if (data->flags & MMC_DATA_READ) {
 		datactrl |= MCI_DPSM_DIRECTION;
 		dmac_drvdat.lastch = DMA_CH_SDCARD_RX;
-		mmc_dma_rx_start(host);
+		rv = mmc_dma_rx_start(host);
 	} else {
 		dmac_drvdat.lastch = DMA_CH_SDCARD_TX;
-		mmc_dma_tx_start(host);
+		rv = mmc_dma_tx_start(host);
+	}
+	if (rv) {
+		data->error = rv;
+		mmci_stop_data(host);
+		return rv;
 	}
 #else
 	datactrl = MCI_DPSM_ENABLE | blksz_bits << 4;
@@ -774,6 +839,8 @@ static void mmci_start_data(struct mmci_host *host, struct mmc_data *data)
 #endif /* CONFIG_LPC178X_SD_DMA || CONFIG_STM32_SD_DMA */
 
 	mmci_set_mask1(host, irqmask);
+
+	return 0;
 }
 
 static void
@@ -855,7 +922,7 @@ mmci_data_irq(struct mmci_host *host, struct mmc_data *data,
 				DMA_PERID_SDCARD);
 			lpc178x_dma_flush_llist(dmac_drvdat.lastch);
 #else /* CONFIG_STM32_SD_DMA */
-			stm32_dma_ch_disable(STM32F2_DMACH_SDIO);
+			mmc_dma_stop(host, data);
 #endif
 			dma_unmap_sg(mmc_dev(host->mmc),
 				data->sg, data->sg_len, DMA_FROM_DEVICE);
@@ -866,7 +933,7 @@ mmci_data_irq(struct mmci_host *host, struct mmc_data *data,
 				dma_unmap_sg(mmc_dev(host->mmc), data->sg,
 					data->sg_len, DMA_TO_DEVICE);
 #else /* CONFIG_STM32_SD_DMA */
-			stm32_dma_ch_disable(STM32F2_DMACH_SDIO);
+			mmc_dma_stop(host, data);
 			dma_unmap_sg(mmc_dev(host->mmc), data->sg,
 				data->sg_len, DMA_TO_DEVICE);
 #endif
@@ -907,7 +974,12 @@ mmci_cmd_irq(struct mmci_host *host, struct mmc_command *cmd,
 			mmci_stop_data(host);
 		mmci_request_end(host, cmd->mrq);
 	} else if (!(cmd->data->flags & MMC_DATA_READ)) {
-		mmci_start_data(host, cmd->data);
+		if (mmci_start_data(host, cmd->data)) {
+			if (!cmd->data->stop)
+				mmci_request_end(host, cmd->mrq);
+			else
+				mmci_start_command(host, cmd->data->stop, 0);
+		}
 	}
 }
 
@@ -1147,11 +1219,15 @@ static void mmci_request(struct mmc_host *mmc, struct mmc_request *mrq)
 
 	host->mrq = mrq;
 
-	if (mrq->data && mrq->data->flags & MMC_DATA_READ)
-		mmci_start_data(host, mrq->data);
+	if (mrq->data && mrq->data->flags & MMC_DATA_READ &&
+	    mmci_start_data(host, mrq->data)) {
+		mmci_request_end(host, mrq);
+		goto out;
+	}
 
 	mmci_start_command(host, mrq->cmd, 0);
 
+out:
 	spin_unlock_irqrestore(&host->lock, flags);
 }
 
@@ -1385,11 +1461,19 @@ static int __devinit mmci_probe(struct amba_device *dev, struct amba_id *id)
 		mmc->ocr_avail = plat->ocr_mask;
 	mmc->caps = plat->capabilities;
 
-#ifdef CONFIG_STM32_SD_DMA
+#if defined(CONFIG_STM32_SD_DMA) && defined(CONFIG_ARCH_STM32F7)
+	/*
+	 * Scatter/gather is done by chaining DMA transfers of the segments
+	 * from the DMA interrupt. The SDIO controller waits for the next
+	 * segment to be set up thanks to the hardware flow control.
+	 */
+	mmc->max_hw_segs = NR_SG;
+#elif defined(CONFIG_STM32_SD_DMA)
 	/*
-	 * Always use a single bounce buffer on STM32. On STM32F2 this
-	 * could be set to 2, because this MCU supports Double Buffer Mode,
-	 * but it would be harder to implement than single buffer DMA.
+	 * Use a single bounce buffer on STM32F2/F4. Chaining of segments
+	 * relies on the hardware flow control, which is disabled on these
+	 * MCUs (see variant_ux500), so the SDIO FIFO would overrun while
+	 * the next segment is being set up.
 	 */
 	mmc->max_hw_segs = 1;
 #else
@@ -1407,7 +1491,16 @@ static int __devinit mmci_probe(struct amba_device *dev, struct amba_id *id)
 	 * denotes the number of 32-bit words in a data transfer. This is why
 	 * we multiply the maximum value of this register by 4.
 	 */
+#if defined(CONFIG_ARCH_STM32F7)
+	/*
+	 * For scatter/gather requests, that limit applies to each segment,
+	 * and the request is limited by the data length register only.
+	 */
+	mmc->max_req_size = min_t(unsigned int, NR_SG * MMC_DMA_SEG_MAX,
+		(1 << variant->datalength_bits) - 1);
+#else
 	mmc->max_req_size = ((1 << 16) - 1) * 4;
+#endif
 #else
 	/*
 	 * Since only a certain number of bits are valid in the data length
@@ -1432,6 +1525,12 @@ static int __devinit mmci_probe(struct amba_device *dev, struct amba_id *id)
 		mmc->max_seg_size = plat->dma_tx_size;
 	else
 		mmc->max_seg_size = DMA_BUFF_SIZE;
+#elif defined(CONFIG_STM32_SD_DMA)
+	/*
+	 * Each segment must fit into a single DMA transfer
+	 */
+	mmc->max_seg_size = min_t(unsigned int, mmc->max_req_size,
+		MMC_DMA_SEG_MAX);
 #else
 	/*
 	 * Set the maximum segment size.  Since we aren't doing DMA
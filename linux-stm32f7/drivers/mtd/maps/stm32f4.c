@@ -41,6 +41,16 @@
 #include <linux/mtd/stm32f4.h>
 #include <linux/mtd/concat.h>
 #include <linux/io.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/spinlock.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+
+#ifdef CONFIG_MTD_STM32F4_DMA
+#include <mach/dmac.h>
+#include <mach/dmaregs.h>
+#endif
 
 #define CYCLES_PER_US	168
 
@@ -110,6 +120,47 @@ static volatile map_word SRAM_DATA sr_val;
 
 static volatile unsigned long SRAM_DATA sram_buffer_start, sram_buffer_size;
 
+#ifdef CONFIG_MTD_STM32F4_DMA
+/*
+ * DMA stream registers used by the SRAM code, and the offset of the stream
+ * flags in the DMA_xISR/DMA_xIFCR registers
+ */
+static volatile u32 SRAM_DATA *sr_dma_cr, *sr_dma_isr, *sr_dma_ifcr;
+static volatile unsigned long SRAM_DATA sr_dma_shift, sr_dma_status;
+
+/* Stream flags in DMA_xISR/DMA_xIFCR, before shifting by sr_dma_shift */
+#define DMA_IRQF_TE		(1 << 3)
+#define DMA_IRQF_ALL		0x3D
+
+static int use_dma = 1;
+module_param(use_dma, bool, 0644);
+MODULE_PARM_DESC(use_dma, "Read the Flash with memory-to-memory DMA");
+#endif
+
+/*
+ * Number of bytes copied from the Flash per window with interrupts
+ * disabled and SDRAM in self-refresh. Bounded by the SRAM buffer size.
+ */
+static unsigned int chunk_size = CONFIG_MTD_STM32F4_SRAM_BUFFER_SIZE;
+module_param(chunk_size, uint, 0644);
+MODULE_PARM_DESC(chunk_size, "Bytes read from the Flash per interrupts-off window");
+
+/*
+ * Read path statistics, reported in debugfs
+ */
+struct stm32f4_flash_stats {
+	u64	bytes;		/* Bytes read by copy_from */
+	u64	read_ns;	/* Time spent in copy_from */
+	u64	irqoff_ns;	/* Time spent with interrupts disabled */
+	u32	irqoff_max_ns;	/* Longest window with interrupts disabled */
+	u32	chunks;		/* Windows with interrupts disabled */
+	u32	dma_chunks;	/* ... of which were read with DMA */
+	u32	dma_errors;	/* DMA transfer errors */
+};
+
+static struct stm32f4_flash_stats stats;
+static DEFINE_SPINLOCK(stats_lock);
+
 extern char _sram_start, _sram_end;
 extern char __sram_loc, _esram_loc;
 
@@ -168,22 +219,40 @@ SRAM_TEXT void sram_stm32f4_flash_write(void)
 	start_ram();
 }
 
+/*
+ * Copy sr_len bytes (a multiple of 4) from sr_flash (4-byte aligned) to
+ * the SRAM buffer. The FMC splits each word into two halfword accesses,
+ * and the CPU waits for the data, so no delay is needed between reads.
+ */
 SRAM_TEXT void sram_stm32f4_flash_copy_from(void)
 {
-	int i;
-	stop_ram();
-	for(i = sram_buffer_start;sr_len;)
-	{
-		*(volatile uint16_t __force*)i = *(volatile uint16_t*)sr_flash;
+	unsigned long src = sr_flash;
+	unsigned long end = sr_flash + sr_len;
+	unsigned long dst = sram_buffer_start;
 
-		sr_len -= 2;
-		sr_flash += 2;
-		i += 2;
+	stop_ram();
+	for (; src < end; src += 4, dst += 4)
+		*(volatile u32 *)dst = *(volatile u32 __force *)src;
+	start_ram();
+}
 
-		loop_delay(10);
-	}
+#ifdef CONFIG_MTD_STM32F4_DMA
+/*
+ * Run the memory-to-memory transfer set up by stm32f4_flash_dma_setup()
+ * and wait for the stream to finish. The CPU only polls the DMA registers
+ * meanwhile, so SDRAM stays idle. The transfer error flag is left
+ * in sr_dma_status.
+ */
+SRAM_TEXT void sram_stm32f4_flash_dma_from(void)
+{
+	stop_ram();
+	*sr_dma_ifcr = DMA_IRQF_ALL << sr_dma_shift;
+	*sr_dma_cr |= STM32_DMA_CR_EN;
+	while (*sr_dma_cr & STM32_DMA_CR_EN);
+	sr_dma_status = (*sr_dma_isr >> sr_dma_shift) & DMA_IRQF_ALL;
 	start_ram();
 }
+#endif
 
 SRAM_TEXT void sram_stm32f4_flash_copy_to(void)
 {
@@ -226,28 +295,181 @@ void stm32f4_flash_write(struct map_info *map, const map_word datum, unsigned lo
 	leave_critical_code(flags);
 }
 
+/*
+ * Current chunk size: a multiple of 4 that fits the SRAM buffer
+ */
+static unsigned long stm32f4_flash_chunk(void)
+{
+	unsigned long chunk = min((unsigned long)chunk_size, sram_buffer_size);
+
+	chunk &= ~3UL;
+	return max(chunk, 4UL);
+}
+
+static void stm32f4_flash_account_chunk(s64 irqoff_ns, int dma)
+{
+	unsigned long fl;
+
+	spin_lock_irqsave(&stats_lock, fl);
+	stats.chunks++;
+	if (dma)
+		stats.dma_chunks++;
+	stats.irqoff_ns += irqoff_ns;
+	if (irqoff_ns > stats.irqoff_max_ns)
+		stats.irqoff_max_ns = irqoff_ns;
+	spin_unlock_irqrestore(&stats_lock, fl);
+}
+
+#ifdef CONFIG_MTD_STM32F4_DMA
+/*
+ * Acquire a DMA2 stream for memory-to-memory transfers from the Flash to
+ * the SRAM buffer. Streams are searched from the top, which peripherals
+ * use least. Returns the stream, or a negative error code.
+ */
+static int stm32f4_flash_dma_get(void)
+{
+	volatile struct stm32_dma_regs *dma_regs = STM32_DMA2;
+	int ch;
+
+	for (ch = STM32F2_DMA_CH_NUM - 1; ch >= STM32F2_DMA_CH_NUM_DMA1; ch--) {
+		if (stm32_dma_ch_get(ch))
+			continue;
+
+		/* Memory-to-memory, high priority, FIFO full threshold */
+		if (stm32_dma_ch_init(ch, 2, 0, STM32_DMA_CR_PL_HIGH, 0, 0) ||
+		    stm32_dma_ch_init_fifo(ch, 1, 3) ||
+		    stm32_dma_ch_set_memory(ch, sram_buffer_start, 1, 2, 0)) {
+			stm32_dma_ch_put(ch);
+			return -EIO;
+		}
+
+		sr_dma_cr = &dma_regs->s[ch % STM32F2_DMA_CH_NUM_DMA1].cr;
+		sr_dma_isr = (ch & 4) ? &dma_regs->hisr : &dma_regs->lisr;
+		sr_dma_ifcr = (ch & 4) ? &dma_regs->hifcr : &dma_regs->lifcr;
+		sr_dma_shift = ((ch & 2) << 3) | ((ch & 1) * 6);
+
+		/* Completion is polled with interrupts disabled */
+		*sr_dma_cr &= ~(STM32_DMA_CR_TCIE | STM32_DMA_CR_HTIE |
+				STM32_DMA_CR_TEIE);
+		return ch;
+	}
+
+	return -EBUSY;
+}
+
+/*
+ * Point the stream at the next chunk of the Flash
+ */
+static int stm32f4_flash_dma_setup(int ch)
+{
+	if (stm32_dma_ch_set_periph(ch, sr_flash, 1, 2, 0) ||
+	    stm32_dma_ch_set_nitems(ch, sr_len / 4))
+		return -EIO;
+	return 0;
+}
+#endif
+
+/*
+ * Read the Flash in chunks of stm32f4_flash_chunk() bytes through
+ * the SRAM buffer. Each chunk is read with SDRAM in self-refresh and
+ * interrupts disabled, by DMA if a DMA2 stream is free, else by the CPU.
+ * The copy out of the SRAM buffer is done with interrupts enabled.
+ */
 void stm32f4_flash_copy_from(struct map_info *map, void *to, unsigned long from, ssize_t len)
 {
-	int read_len;
+	unsigned long read_len, skew, chunk, tail, ofs, i;
 	unsigned long lto = (unsigned long)to;
+	map_word w;
+	ktime_t start, t;
+	int dma_ch = -1;
+	unsigned long fl;
 	int flags;
 
+	chunk = stm32f4_flash_chunk();
+#ifdef CONFIG_MTD_STM32F4_DMA
+	if (use_dma)
+		dma_ch = stm32f4_flash_dma_get();
+#endif
+	start = ktime_get();
+
 	for(; len; ) {
-		read_len = min((unsigned long)len, sram_buffer_size);
+		/* Read whole words starting at a word boundary */
+		skew = (map->phys + from) & 3;
+		read_len = min((unsigned long)len, chunk - skew);
 
-		sr_flash = map->phys + from;
-		sr_len = ALIGN(read_len, 2);
+		sr_flash = map->phys + from - skew;
+		sr_len = ALIGN(read_len + skew, 4);
 
+		/*
+		 * Don't read past the end of the Flash. If its size is not
+		 * a multiple of 4, the last bytes are read by halfwords below
+		 */
+		tail = 0;
+		if (sr_flash + sr_len > map->phys + map->size) {
+			sr_len = (map->phys + map->size - sr_flash) & ~3;
+			tail = read_len - (sr_len > skew ? sr_len - skew : 0);
+			if (!sr_len)
+				goto copy_tail;
+		}
+
+#ifdef CONFIG_MTD_STM32F4_DMA
+		if (dma_ch >= 0 && stm32f4_flash_dma_setup(dma_ch)) {
+			stm32_dma_ch_put(dma_ch);
+			dma_ch = -1;
+		}
+#endif
+
+		t = ktime_get();
 		flags = enter_critical_code();
-		sram_stm32f4_flash_copy_from();
+#ifdef CONFIG_MTD_STM32F4_DMA
+		if (dma_ch >= 0)
+			sram_stm32f4_flash_dma_from();
+		else
+#endif
+			sram_stm32f4_flash_copy_from();
 		leave_critical_code(flags);
+		stm32f4_flash_account_chunk(
+			ktime_to_ns(ktime_sub(ktime_get(), t)), dma_ch >= 0);
+
+#ifdef CONFIG_MTD_STM32F4_DMA
+		if (dma_ch >= 0 && (sr_dma_status & DMA_IRQF_TE)) {
+			/* Read this chunk again, and the rest, with the CPU */
+			printk(KERN_WARNING "stm32f4-flash: DMA error at %lx, "
+			       "falling back to CPU reads\n", sr_flash);
+			spin_lock_irqsave(&stats_lock, fl);
+			stats.dma_errors++;
+			spin_unlock_irqrestore(&stats_lock, fl);
+			stm32_dma_ch_put(dma_ch);
+			dma_ch = -1;
+			continue;
+		}
+#endif
+
+		memcpy((void*)lto, (void*)(sram_buffer_start + skew),
+		       read_len - tail);
 
-		memcpy((void*)lto, (void*)sram_buffer_start, read_len);
+copy_tail:
+		for (i = read_len - tail; i < read_len; i++) {
+			ofs = from + i;
+			w = stm32f4_flash_read(map, ofs & ~1);
+			((u8 *)lto)[i] = w.x[0] >> ((ofs & 1) * 8);
+		}
 
 		from += read_len;
 		lto += read_len;
 		len -= read_len;
 	}
+
+#ifdef CONFIG_MTD_STM32F4_DMA
+	if (dma_ch >= 0)
+		stm32_dma_ch_put(dma_ch);
+#endif
+
+	t = ktime_sub(ktime_get(), start);
+	spin_lock_irqsave(&stats_lock, fl);
+	stats.bytes += lto - (unsigned long)to;
+	stats.read_ns += ktime_to_ns(t);
+	spin_unlock_irqrestore(&stats_lock, fl);
 }
 
 void stm32f4_flash_copy_to(struct map_info *map, unsigned long to, const void *from, ssize_t len)
@@ -455,6 +677,88 @@ static struct platform_driver stm32f4_flash_driver = {
 	},
 };
 
+#ifdef CONFIG_DEBUG_FS
+static struct dentry *stm32f4_flash_debugfs;
+
+static int stm32f4_flash_stats_show(struct seq_file *s, void *unused)
+{
+	struct stm32f4_flash_stats st;
+	unsigned long fl;
+	u64 kbps = 0;
+	u32 avg_ns = 0;
+
+	spin_lock_irqsave(&stats_lock, fl);
+	st = stats;
+	spin_unlock_irqrestore(&stats_lock, fl);
+
+	if (st.read_ns)
+		kbps = div64_u64(st.bytes * NSEC_PER_SEC, st.read_ns) >> 10;
+	if (st.chunks)
+		avg_ns = div_u64(st.irqoff_ns, st.chunks);
+
+	seq_printf(s, "chunk size:\t%lu\n", stm32f4_flash_chunk());
+	seq_printf(s, "bytes read:\t%llu\n", st.bytes);
+	seq_printf(s, "read time:\t%llu us\n", div_u64(st.read_ns, 1000));
+	seq_printf(s, "throughput:\t%llu KB/s\n", kbps);
+	seq_printf(s, "chunks:\t\t%u\n", st.chunks);
+	seq_printf(s, "dma chunks:\t%u\n", st.dma_chunks);
+	seq_printf(s, "dma errors:\t%u\n", st.dma_errors);
+	seq_printf(s, "irq-off total:\t%llu us\n", div_u64(st.irqoff_ns, 1000));
+	seq_printf(s, "irq-off max:\t%u us\n", st.irqoff_max_ns / 1000);
+	seq_printf(s, "irq-off avg:\t%u us\n", avg_ns / 1000);
+
+	return 0;
+}
+
+static int stm32f4_flash_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, stm32f4_flash_stats_show, NULL);
+}
+
+/*
+ * Any write resets the statistics
+ */
+static ssize_t stm32f4_flash_stats_write(struct file *file,
+	const char __user *buf, size_t count, loff_t *ppos)
+{
+	unsigned long fl;
+
+	spin_lock_irqsave(&stats_lock, fl);
+	memset(&stats, 0, sizeof(stats));
+	spin_unlock_irqrestore(&stats_lock, fl);
+
+	return count;
+}
+
+static const struct file_operations stm32f4_flash_stats_fops = {
+	.owner		= THIS_MODULE,
+	.open		= stm32f4_flash_stats_open,
+	.read		= seq_read,
+	.write		= stm32f4_flash_stats_write,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static void stm32f4_flash_debugfs_init(void)
+{
+	stm32f4_flash_debugfs = debugfs_create_dir("stm32f4-flash", NULL);
+	if (IS_ERR_OR_NULL(stm32f4_flash_debugfs)) {
+		stm32f4_flash_debugfs = NULL;
+		return;
+	}
+
+	debugfs_create_file("stats", S_IRUGO | S_IWUSR, stm32f4_flash_debugfs,
+			    NULL, &stm32f4_flash_stats_fops);
+}
+
+static void stm32f4_flash_debugfs_exit(void)
+{
+	debugfs_remove_recursive(stm32f4_flash_debugfs);
+}
+#else
+static inline void stm32f4_flash_debugfs_init(void) {}
+static inline void stm32f4_flash_debugfs_exit(void) {}
+#endif
 
 static int __init stm32f4_init(void)
 {
@@ -477,12 +781,15 @@ static int __init stm32f4_init(void)
 		sram_buffer_start, sram_buffer_size);
 
 	err = platform_driver_register(&stm32f4_flash_driver);
+	if (!err)
+		stm32f4_flash_debugfs_init();
 
 	return err;
 }
 
 static void __exit stm32f4_exit(void)
 {
+	stm32f4_flash_debugfs_exit();
 	platform_driver_unregister(&stm32f4_flash_driver);
 }
 
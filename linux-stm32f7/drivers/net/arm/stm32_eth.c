@@ -22,8 +22,11 @@
 
 #include <linux/dma-mapping.h>
 #include <linux/etherdevice.h>
+#include <linux/ethtool.h>
+#include <linux/hrtimer.h>
 #include <linux/init.h>
 #include <linux/kernel.h>
+#include <linux/log2.h>
 #include <linux/mii.h>
 #include <linux/phy.h>
 #include <linux/netdevice.h>
@@ -33,8 +36,12 @@
 #if defined(CONFIG_ARCH_LPC18XX)
 #include <linux/clk.h>
 #endif /* CONFIG_ARCH_LPC18XX */
+#if defined(CONFIG_ARCH_STM32)
+#include <mach/clock.h>
+#endif /* CONFIG_ARCH_STM32 */
 
 #include <asm/setup.h>
+#include <asm/tcm.h>
 
 #include <mach/eth.h>
 
@@ -60,11 +67,47 @@
  */
 #define STM32_INFO			KERN_INFO STM32_ETH_DRV_NAME
 
+/*
+ * RX frames shorter than this are copied into a freshly allocated skb, and
+ * the DMAed buffer is returned to the MAC. Longer frames are passed up to
+ * the stack in the DMAed skb itself, and the bd is refilled with a new one.
+ * With buffers in SRAM all frames are copied, whatever the value is.
+ */
+static int rx_copybreak = 256;
+module_param(rx_copybreak, int, 0644);
+MODULE_PARM_DESC(rx_copybreak, "copy RX frames shorter than this (bytes)");
+
+/*
+ * Default interrupt coalescing settings, may be changed with 'ethtool -C'
+ */
+#define STM32_ETH_COAL_TX_FRAMES	4	/* TX-complete irq per frames */
+#define STM32_ETH_COAL_TX_USECS		1000	/* TX cleanup timer delay     */
+#define STM32_ETH_COAL_RX_USECS		20	/* RX watchdog delay	      */
+
+/*
+ * In adaptive mode RX interrupts are coalesced only when a NAPI poll
+ * fetches this many frames, otherwise each frame is signalled at once
+ */
+#define STM32_ETH_COAL_RX_BURST		2
+
+/*
+ * Ring sizes are powers of two, so ring indexes wrap with a mask
+ */
+#define STM32_ETH_RX_IDX(stm, i)	((i) & ((stm)->rx_buf_num - 1))
+#define STM32_ETH_TX_IDX(stm, i)	((i) & ((stm)->tx_buf_num - 1))
+
+/*
+ * Ring size limits for 'ethtool -G'
+ */
+#define STM32_ETH_RING_MIN		4
+#define STM32_ETH_RING_MAX		256
+
 /*
  * MACCR reg fields
  */
 #define STM32_MAC_CR_RE			(1 << 2)	/* Receiver enable    */
 #define STM32_MAC_CR_TE			(1 << 3)	/* Transmitter enable */
+#define STM32_MAC_CR_IPCO		(1 << 10)	/* IPv4 csum offload  */
 #define STM32_MAC_CR_DM			(1 << 11)	/* Duplex mode	      */
 #define STM32_MAC_CR_FES		(1 << 14)	/* Fast Eth speed     */
 
@@ -131,6 +174,7 @@
 #define STM32_MAC_DMAOMR_SR		(1 << 1)	/* Start/stop rx      */
 #define STM32_MAC_DMAOMR_ST		(1 << 13)	/* Start/stop tx      */
 #define STM32_MAC_DMAOMR_FTF		(1 << 20)	/* Flush tx FIFO      */
+#define STM32_MAC_DMAOMR_TSF		(1 << 21)	/* Tx store & forward */
 
 /*
  * DMAIER reg fields
@@ -138,12 +182,19 @@
 #define STM32_MAC_DMAIER_TIE		(1 << 0)	/* Tx done interrupt  */
 #define STM32_MAC_DMAIER_RIE		(1 << 6)	/* Rx done interrupt  */
 
+/*
+ * DMARSWTR reg fields
+ */
+#define STM32_MAC_DMARSWTR_RSWTC_MSK	0xFF		/* x256 HCLK cycles   */
+
 /*
  * DMA transmit buffer descriptor bits
  */
 #define STM32_DMA_TBD_DMA_OWN		(1 << 31)	/* DMA/CPU owns bd    */
+#define STM32_DMA_TBD_IC		(1 << 30)	/* Irq on completion  */
 #define STM32_DMA_TBD_LS		(1 << 29)	/* Last segment	      */
 #define STM32_DMA_TBD_FS		(1 << 28)	/* First segment      */
+#define STM32_DMA_TBD_CIC_FULL		(3 << 22)	/* IP hdr & payload cs*/
 #define STM32_DMA_TBD_TCH		(1 << 20)	/* 2nd address chained*/
 #define STM32_DMA_TBD_ES		(1 << 15)	/* Error summary      */
 #define STM32_DMA_TBD_NC		(1 << 10)	/* No carrier	      */
@@ -152,6 +203,8 @@
 #define STM32_DMA_TBD_CC_MSK		0xF
 #define STM32_DMA_TBD_UF		(1 << 1)	/* Underflow	      */
 
+#define STM32_DMA_TBD_TBS1_MSK		0x1FFF		/* Buffer 1 size      */
+
 /*
  * DMA receive buffer descriptor bits
  */
@@ -163,8 +216,12 @@
 #define STM32_DMA_RBD_OE		(1 << 11)	/* Overrun error      */
 #define STM32_DMA_RBD_FS		(1 << 9)	/* First descriptor   */
 #define STM32_DMA_RBD_LS		(1 << 8)	/* Last descriptor    */
+#define STM32_DMA_RBD_IPHCE		(1 << 7)	/* IP hdr csum error  */
+#define STM32_DMA_RBD_FT		(1 << 5)	/* Ethernet-type frame*/
+#define STM32_DMA_RBD_PCE		(1 << 0)	/* Payload csum error */
 #define STM32_DMA_RBD_CE		(1 << 1)	/* CRC error	      */
 
+#define STM32_DMA_RBD_DIC		(1 << 31)	/* Disable irq on cmpl*/
 #define STM32_DMA_RBD_RCH		(1 << 14)	/* 2nd address chained*/
 
 /*
@@ -251,6 +308,47 @@ struct stm32_eth_dma_bd {
 	dma_addr_t		next;	/* Pointer to next BD in chain	      */
 };
 
+/*
+ * Driver specific statistics, reported with 'ethtool -S'
+ */
+struct stm32_eth_xstats {
+	u32	rx_copy;		/* Frames copied into a new skb	      */
+	u32	rx_swap;		/* Frames passed up in DMAed skb      */
+	u32	rx_refill_err;		/* No memory for a replacement skb    */
+	u32	tx_csum_hw;		/* Frames with csum inserted by MAC   */
+	u32	rx_csum_hw;		/* Frames with csum checked by MAC    */
+	u32	rx_csum_err;		/* Frames with csum errors found      */
+	u32	tx_irq_req;		/* Frames sent with irq on completion */
+	u32	tx_irq_skip;		/* Frames sent without irq	      */
+	u32	tx_timer_clean;		/* TX cleanups by coalescing timer    */
+	u32	rx_coal_on;		/* Adaptive RX coalescing enabled     */
+	u32	rx_coal_off;		/* Adaptive RX coalescing disabled    */
+	u32	rx_poll_full;		/* NAPI polls which used whole budget */
+};
+
+#define STM32_ETH_XSTAT(m)		\
+	{ #m, offsetof(struct stm32_eth_xstats, m) }
+
+static const struct {
+	char	name[ETH_GSTRING_LEN];
+	int	offset;
+} stm32_eth_xstats_str[] = {
+	STM32_ETH_XSTAT(rx_copy),
+	STM32_ETH_XSTAT(rx_swap),
+	STM32_ETH_XSTAT(rx_refill_err),
+	STM32_ETH_XSTAT(tx_csum_hw),
+	STM32_ETH_XSTAT(rx_csum_hw),
+	STM32_ETH_XSTAT(rx_csum_err),
+	STM32_ETH_XSTAT(tx_irq_req),
+	STM32_ETH_XSTAT(tx_irq_skip),
+	STM32_ETH_XSTAT(tx_timer_clean),
+	STM32_ETH_XSTAT(rx_coal_on),
+	STM32_ETH_XSTAT(rx_coal_off),
+	STM32_ETH_XSTAT(rx_poll_full),
+};
+
+#define STM32_ETH_XSTATS_LEN		ARRAY_SIZE(stm32_eth_xstats_str)
+
 #ifdef STM32_SRAM
 /*
  * Fake sk_buff, has only data and len
@@ -275,6 +373,7 @@ struct stm32_eth_priv {
 	struct net_device		*dev;
 	struct napi_struct		napi;
 	struct net_device_stats		stat;
+	struct stm32_eth_xstats		xstats;
 #if defined(CONFIG_ARCH_LPC18XX)
 	struct clk			*clk;
 #endif /* CONFIG_ARCH_LPC18XX */
@@ -325,17 +424,31 @@ struct stm32_eth_priv {
 	u32				tx_pending;
 	u32				tx_blocked;
 
+	/*
+	 * Interrupt coalescing
+	 */
+	u32				hclk;
+	u32				rx_coal_usecs;
+	u32				rx_coal_adaptive;
+	u32				rx_coal_active;
+	u32				tx_coal_frames;
+	u32				tx_coal_usecs;
+	u32				tx_coal_count;
+	struct hrtimer			tx_coal_timer;
+
 	/*
 	 * Driver settings
 	 */
 	u32				frame_max_size;
 	u32				rx_buf_num;
 	u32				tx_buf_num;
+	u32				rx_csum;
 
 #ifdef STM32_SRAM
 	/*
 	 * DMA in SRAM additional info
 	 */
+	u32				sram_base;
 	u32				sram_pointer;
 #endif
 };
@@ -345,12 +458,21 @@ struct stm32_eth_priv {
  */
 static void stm32_eth_hw_stop(struct net_device *dev);
 static void stm32_eth_buffers_free(struct net_device *dev);
+static void __tcmfunc stm32_eth_tx_complete(struct net_device *dev);
 static int  stm32_plat_remove(struct platform_device *pdev);
 #ifdef STM32_SRAM
 static void* stm32_sram_alloc(struct stm32_eth_priv *priv, size_t size);
 #endif
 
 
+/*
+ * Convert RX coalescing delay to the RX watchdog timer value
+ */
+static u32 stm32_eth_rx_usecs_to_riwt(struct stm32_eth_priv *stm, u32 usecs)
+{
+	return DIV_ROUND_UP(usecs * (stm->hclk / 1000000), 256);
+}
+
 /*
  * Hw initialization
  */
@@ -394,6 +516,13 @@ static int stm32_eth_hw_start(struct net_device *dev)
 	stm->regs->dmardlar = stm->rx_bd_dma_addr;
 	stm->regs->dmatdlar = stm->tx_bd_dma_addr;
 
+	/*
+	 * RX watchdog signals frames received into bds with DIC set
+	 */
+	stm->regs->dmarswtr = stm32_eth_rx_usecs_to_riwt(stm,
+						stm->rx_coal_usecs);
+	stm->rx_coal_active = stm->rx_coal_usecs && !stm->rx_coal_adaptive;
+
 	/*
 	 * Flush FIFOs, and enable transmitter and receiver
 	 */
@@ -409,12 +538,19 @@ static int stm32_eth_hw_start(struct net_device *dev)
 		goto out;
 	}
 
+	if (stm->rx_csum)
+		stm->regs->maccr |= STM32_MAC_CR_IPCO;
+	else
+		stm->regs->maccr &= ~STM32_MAC_CR_IPCO;
+
 	stm->regs->maccr |= STM32_MAC_CR_TE | STM32_MAC_CR_RE;
 
 	/*
-	 * Start DMA TX and RX
+	 * Start DMA TX and RX. TX checksums may be inserted only if the
+	 * whole frame is in FIFO, so TX works in store-and-forward mode
 	 */
-	stm->regs->dmaomr |= STM32_MAC_DMAOMR_ST | STM32_MAC_DMAOMR_SR;
+	stm->regs->dmaomr |= STM32_MAC_DMAOMR_TSF |
+			     STM32_MAC_DMAOMR_ST | STM32_MAC_DMAOMR_SR;
 
 	rv = 0;
 out:
@@ -464,6 +600,7 @@ static int stm32_eth_get_mdio_clock(struct net_device *dev)
 	}
 	clk_enable(stm->clk);
 	rate = clk_get_rate(stm->clk);
+	stm->hclk = rate;
 
 	/*
 	 * Select MDIO clock divider
@@ -519,8 +656,10 @@ static void* stm32_sram_alloc(struct stm32_eth_priv *priv, size_t size)
 {
 	u32 base = priv->sram_pointer;
 
+	if (base + ALIGN(size, 4) + 4 > SRAM_PHYS_OFFSET + SRAM_PHYS_SIZE)
+		return NULL;
+
 	priv->sram_pointer += ALIGN(size, 4) + 4;
-	BUG_ON(priv->sram_pointer >= SRAM_PHYS_OFFSET + SRAM_PHYS_SIZE);
 
 	return (void*)base;
 }
@@ -533,6 +672,18 @@ static int stm32_eth_buffers_alloc(struct net_device *dev)
 	struct stm32_eth_priv	*stm = netdev_priv(dev);
 	int			rv, i, skb_size;
 
+	/*
+	 * Allocate bufs for pointers; these are not accessed by DMA
+	 */
+	stm->rx_skb = kzalloc(stm->rx_buf_num * sizeof(void *), GFP_KERNEL);
+	stm->tx_skb = kzalloc(stm->tx_buf_num * sizeof(void *), GFP_KERNEL);
+	if (!stm->rx_skb || !stm->tx_skb) {
+		printk(STM32_INFO ": no memory for %d/%d rx/tx skb pointers\n",
+			stm->rx_buf_num, stm->tx_buf_num);
+		rv = -ENOMEM;
+		goto out;
+	}
+
 	/*
 	 * Allocate RX and TX buffer descriptors
 	 */
@@ -544,6 +695,13 @@ static int stm32_eth_buffers_alloc(struct net_device *dev)
 			sizeof(struct stm32_eth_dma_bd) * stm->tx_buf_num);
 	stm->tx_bd_dma_addr = (dma_addr_t)stm->tx_bd;
 
+	if (!stm->rx_bd || !stm->tx_bd) {
+		printk(STM32_INFO ": no SRAM for %d/%d rx/tx descriptors\n",
+			stm->rx_buf_num, stm->tx_buf_num);
+		rv = -ENOMEM;
+		goto out;
+	}
+
 	/*
 	 * We allocate 4 bytes more to have a place for CRC
 	 */
@@ -554,6 +712,12 @@ static int stm32_eth_buffers_alloc(struct net_device *dev)
 	 */
 	for (i = 0; i < stm->rx_buf_num; i++) {
 		stm->rx_skb[i] = stm32_sram_alloc(stm, skb_size);
+		if (!stm->rx_skb[i]) {
+			printk(STM32_INFO ": no SRAM for rx buffer %d of %d\n",
+				i + 1, stm->rx_buf_num);
+			rv = -ENOMEM;
+			goto out;
+		}
 
 		stm->rx_bd[i].stat = STM32_DMA_RBD_DMA_OWN;
 		stm->rx_bd[i].ctrl = STM32_DMA_RBD_RCH | stm->frame_max_size;
@@ -561,7 +725,7 @@ static int stm32_eth_buffers_alloc(struct net_device *dev)
 
 		stm->rx_bd[i].next = stm->rx_bd_dma_addr +
 				      (sizeof(struct stm32_eth_dma_bd) *
-				       ((i + 1) % stm->rx_buf_num));
+				       STM32_ETH_RX_IDX(stm, i + 1));
 	}
 
 	/*
@@ -570,32 +734,47 @@ static int stm32_eth_buffers_alloc(struct net_device *dev)
 	 */
 	for (i = 0; i < stm->tx_buf_num; i++) {
 		stm->tx_skb[i] = stm32_sram_alloc(stm, skb_size);
+		if (!stm->tx_skb[i]) {
+			printk(STM32_INFO ": no SRAM for tx buffer %d of %d\n",
+				i + 1, stm->tx_buf_num);
+			rv = -ENOMEM;
+			goto out;
+		}
 
 		stm->tx_bd[i].stat = STM32_DMA_TBD_TCH;
 		stm->tx_bd[i].ctrl = 0;
 		stm->tx_bd[i].buf  = (u32)stm->tx_skb[i]->data;
 		stm->tx_bd[i].next = stm->tx_bd_dma_addr +
 				     (sizeof(struct stm32_eth_dma_bd) *
-				      ((i + 1) % stm->tx_buf_num));
+				      STM32_ETH_TX_IDX(stm, i + 1));
 	}
 
 	rv = 0;
+out:
+	if (rv != 0)
+		stm32_eth_buffers_free(dev);
 
 	return rv;
 }
 
+/*
+ * Free STM32 net device buffers and descriptors. Nothing else is allocated
+ * from our SRAM area, so just rewind to its base
+ */
 static void stm32_eth_buffers_free(struct net_device *dev)
 {
 	struct stm32_eth_priv	*stm = netdev_priv(dev);
 
-	u32 total_alloc_size;
-	total_alloc_size =
-		sizeof(struct stm32_eth_dma_bd) +
-		sizeof(struct stm32_sk_buff_fake) +
-		stm->frame_max_size + 4;
-	total_alloc_size *= (stm->rx_buf_num + stm->tx_buf_num);
+	stm->sram_pointer = stm->sram_base;
+	stm->rx_bd = NULL;
+	stm->tx_bd = NULL;
+	stm->tx_pending = 0;
 
-	stm->sram_pointer -= total_alloc_size;
+	kfree(stm->tx_skb);
+	stm->tx_skb = NULL;
+
+	kfree(stm->rx_skb);
+	stm->rx_skb = NULL;
 }
 #else /* !STM32_SRAM */
 
@@ -607,6 +786,16 @@ static int stm32_eth_buffers_alloc(struct net_device *dev)
 	struct stm32_eth_priv	*stm = netdev_priv(dev);
 	int			rv, i;
 
+	/*
+	 * Allocate bufs for pointers
+	 */
+	stm->rx_skb = kzalloc(stm->rx_buf_num * sizeof(void *), GFP_KERNEL);
+	stm->tx_skb = kzalloc(stm->tx_buf_num * sizeof(void *), GFP_KERNEL);
+	if (!stm->rx_skb || !stm->tx_skb) {
+		rv = -ENOMEM;
+		goto out;
+	}
+
 	/*
 	 * Allocate RX and TX buffer descriptors
 	 */
@@ -626,7 +815,8 @@ static int stm32_eth_buffers_alloc(struct net_device *dev)
 	 * We allocate 4 bytes more to have a place for CRC
 	 */
 	for (i = 0; i < stm->rx_buf_num; i++) {
-		stm->rx_skb[i] = dev_alloc_skb(stm->frame_max_size + 4);
+		stm->rx_skb[i] = netdev_alloc_skb_ip_align(dev,
+						stm->frame_max_size + 4);
 		if (!stm->rx_skb[i]) {
 			rv = -ENOMEM;
 			goto out;
@@ -641,7 +831,7 @@ static int stm32_eth_buffers_alloc(struct net_device *dev)
 
 		stm->rx_bd[i].next  = stm->rx_bd_dma_addr +
 				      (sizeof(struct stm32_eth_dma_bd) *
-				       ((i + 1) % stm->rx_buf_num));
+				       STM32_ETH_RX_IDX(stm, i + 1));
 	}
 
 	/*
@@ -656,7 +846,7 @@ static int stm32_eth_buffers_alloc(struct net_device *dev)
 		stm->tx_bd[i].buf  = 0;
 		stm->tx_bd[i].next = stm->tx_bd_dma_addr +
 				     (sizeof(struct stm32_eth_dma_bd) *
-				      ((i + 1) % stm->tx_buf_num));
+				      STM32_ETH_TX_IDX(stm, i + 1));
 	}
 
 	rv = 0;
@@ -667,6 +857,30 @@ out:
 	return rv;
 }
 
+/*
+ * Unmap the segment of the 'idx' TX bd, and free the skb if this is
+ * the last segment of the frame
+ */
+static void stm32_eth_tx_unmap(struct net_device *dev, u32 idx)
+{
+	struct stm32_eth_priv	*stm = netdev_priv(dev);
+	struct stm32_eth_dma_bd	*bd = &stm->tx_bd[idx];
+	u32			len = bd->ctrl & STM32_DMA_TBD_TBS1_MSK;
+
+	/*
+	 * The first segment is the linear part of skb, the others are frags
+	 */
+	if (bd->stat & STM32_DMA_TBD_FS)
+		dma_unmap_single(&dev->dev, bd->buf, len, DMA_TO_DEVICE);
+	else
+		dma_unmap_page(&dev->dev, bd->buf, len, DMA_TO_DEVICE);
+
+	if (stm->tx_skb[idx]) {
+		dev_kfree_skb_any(stm->tx_skb[idx]);
+		stm->tx_skb[idx] = NULL;
+	}
+}
+
 /*
  * Free STM32 net device buffers and descriptors
  */
@@ -678,14 +892,14 @@ static void stm32_eth_buffers_free(struct net_device *dev)
 	if (!stm->tx_bd)
 		goto rx_free;
 
-	for (i = 0; i < stm->tx_buf_num; i++) {
-		if (!stm->tx_skb[i])
-			continue;
-		dma_unmap_single(&dev->dev, stm->tx_bd[i].buf,
-				 stm->tx_skb[i]->len, DMA_TO_DEVICE);
-		dev_kfree_skb(stm->tx_skb[i]);
-		stm->tx_skb[i] = NULL;
+	/*
+	 * Drop the segments which were not sent
+	 */
+	for (i = 0; i < stm->tx_pending; i++) {
+		stm32_eth_tx_unmap(dev, stm->tx_done_idx);
+		stm->tx_done_idx = STM32_ETH_TX_IDX(stm, stm->tx_done_idx + 1);
 	}
+	stm->tx_pending = 0;
 
 	dma_free_coherent(NULL,
 			  sizeof(struct stm32_eth_dma_bd) * stm->tx_buf_num,
@@ -700,7 +914,7 @@ rx_free:
 		if (!stm->rx_skb[i])
 			continue;
 		dma_unmap_single(&dev->dev, stm->rx_bd[i].buf,
-				 stm->rx_skb[i]->len, DMA_FROM_DEVICE);
+				 stm->frame_max_size, DMA_FROM_DEVICE);
 		dev_kfree_skb(stm->rx_skb[i]);
 		stm->rx_skb[i] = NULL;
 	}
@@ -711,14 +925,112 @@ rx_free:
 	stm->rx_bd = NULL;
 
 out:
-	return;
+	kfree(stm->tx_skb);
+	stm->tx_skb = NULL;
+
+	kfree(stm->rx_skb);
+	stm->rx_skb = NULL;
+}
+
+/*
+ * Pass the DMAed skb of the 'idx' RX bd up to the stack, and refill the bd
+ * with a new skb. Returns NULL if there is no memory for the replacement;
+ * the frame is then left in the bd for the caller to copy
+ */
+static struct sk_buff *stm32_eth_rx_swap(struct net_device *dev, u32 idx,
+					 u32 len)
+{
+	struct stm32_eth_priv	*stm = netdev_priv(dev);
+	struct sk_buff		*skb, *new;
+
+	new = netdev_alloc_skb_ip_align(dev, stm->frame_max_size + 4);
+	if (unlikely(!new)) {
+		stm->xstats.rx_refill_err++;
+		skb = NULL;
+		goto out;
+	}
+
+	skb = stm->rx_skb[idx];
+	dma_unmap_single(&dev->dev, stm->rx_bd[idx].buf,
+			 stm->frame_max_size, DMA_FROM_DEVICE);
+	skb_put(skb, len);
+
+	stm->rx_skb[idx] = new;
+	stm->rx_bd[idx].buf = dma_map_single(&dev->dev, new->data,
+					     stm->frame_max_size,
+					     DMA_FROM_DEVICE);
+	stm->xstats.rx_swap++;
+out:
+	return skb;
 }
 
 #endif /* STM32_SRAM */
 
 /*
- * Walk through the list of ready descriptors, fetch rxed frames,
- * and copy data to skbufs
+ * Copy the frame received into the 'idx' RX bd to a new skb; the DMAed
+ * buffer stays in place
+ */
+static struct sk_buff *stm32_eth_rx_copy(struct net_device *dev, u32 idx,
+					 u32 len)
+{
+	struct stm32_eth_priv	*stm = netdev_priv(dev);
+	struct sk_buff		*skb;
+
+	skb = netdev_alloc_skb_ip_align(dev, len);
+	if (unlikely(!skb))
+		goto out;
+
+#ifndef STM32_SRAM
+	dma_sync_single_for_cpu(&dev->dev, stm->rx_bd[idx].buf,
+				len, DMA_FROM_DEVICE);
+#endif
+
+	skb_copy_to_linear_data(skb, stm->rx_skb[idx]->data, len);
+	skb_put(skb, len);
+
+#ifndef STM32_SRAM
+	dma_sync_single_for_device(&dev->dev, stm->rx_bd[idx].buf,
+				   len, DMA_FROM_DEVICE);
+#endif
+	stm->xstats.rx_copy++;
+out:
+	return skb;
+}
+
+/*
+ * Check the result of RX checksum offload
+ */
+static void stm32_eth_rx_csum(struct stm32_eth_priv *stm, struct sk_buff *skb,
+			      u32 stat)
+{
+	switch (stat & (STM32_DMA_RBD_FT | STM32_DMA_RBD_IPHCE |
+			STM32_DMA_RBD_PCE)) {
+	case STM32_DMA_RBD_FT:
+		/*
+		 * IPv4/IPv6 frame, both header and payload checksums are ok
+		 */
+		skb->ip_summed = CHECKSUM_UNNECESSARY;
+		stm->xstats.rx_csum_hw++;
+		break;
+	case STM32_DMA_RBD_FT | STM32_DMA_RBD_PCE:
+	case STM32_DMA_RBD_FT | STM32_DMA_RBD_IPHCE:
+	case STM32_DMA_RBD_FT | STM32_DMA_RBD_IPHCE | STM32_DMA_RBD_PCE:
+		/*
+		 * Let the stack verify checksums, and drop the frame
+		 */
+		stm->xstats.rx_csum_err++;
+		break;
+	default:
+		/*
+		 * Not an IP frame, or payload is not TCP/UDP/ICMP
+		 */
+		break;
+	}
+}
+
+/*
+ * Walk through the list of ready descriptors, and pass rxed frames
+ * to the stack
  */
 static int stm32_eth_rx_get(struct net_device *dev, int processed, int budget)
 {
@@ -764,21 +1076,24 @@ static int stm32_eth_rx_get(struct net_device *dev, int processed, int budget)
 		len -= 4;
 
 		/*
-		 * Allocate skbuff, and put received data there
+		 * Hand the DMAed skb up if the frame is long enough, or
+		 * copy it out and reuse the buffer
 		 */
-		skb = netdev_alloc_skb_ip_align(dev, len);
+		skb = NULL;
+#ifndef STM32_SRAM
+		if (len >= rx_copybreak)
+			skb = stm32_eth_rx_swap(dev, idx, len);
+#endif
+		if (!skb)
+			skb = stm32_eth_rx_copy(dev, idx, len);
 		if (unlikely(!skb)) {
 			stm->stat.rx_dropped++;
 			goto next;
 		}
 
-#ifndef STM32_SRAM
-		dma_sync_single_for_cpu(NULL, stm->rx_bd[idx].buf,
-					len, DMA_FROM_DEVICE);
-#endif
+		if (stm->rx_csum)
+			stm32_eth_rx_csum(stm, skb, stat);
 
-		skb_copy_to_linear_data(skb, stm->rx_skb[idx]->data, len);
-		skb_put(skb, len);
 		skb->protocol = eth_type_trans(skb, dev);
 
 		netif_receive_skb(skb);
@@ -788,10 +1103,14 @@ static int stm32_eth_rx_get(struct net_device *dev, int processed, int budget)
 
 next:
 		/*
-		 * Allow DMA to use current BD again, and switch to the next BD
+		 * Allow DMA to use current BD again, and switch to the next BD.
+		 * With RX coalescing, the frame will be signalled by watchdog
 		 */
+		bd->ctrl = STM32_DMA_RBD_RCH | stm->frame_max_size;
+		if (stm->rx_coal_active)
+			bd->ctrl |= STM32_DMA_RBD_DIC;
 		bd->stat = STM32_DMA_RBD_DMA_OWN;
-		stm->rx_done_idx = (stm->rx_done_idx + 1) % stm->rx_buf_num;
+		stm->rx_done_idx = STM32_ETH_RX_IDX(stm, stm->rx_done_idx + 1);
 		processed++;
 	}
 
@@ -809,12 +1128,21 @@ static int stm32_eth_rx_poll(struct napi_struct *napi, int budget)
 	unsigned long		flags;
 	int			rx = 0, more;
 
+	/*
+	 * Reclaim TX bds which completed without interrupt
+	 */
+	if (stm->tx_pending)
+		stm32_eth_tx_complete(dev);
+
 	do {
 		more = 0;
 
 		rx = stm32_eth_rx_get(dev, rx, budget);
 		if (!(rx < budget)) {
-			stm->regs->dmaier |= STM32_MAC_DMAIER_RIE;
+			/*
+			 * Stay in polling mode, Rx interrupts remain disabled
+			 */
+			stm->xstats.rx_poll_full++;
 			break;
 		}
 
@@ -836,20 +1164,36 @@ static int stm32_eth_rx_poll(struct napi_struct *napi, int budget)
 		spin_unlock_irqrestore(&stm->rx_lock, flags);
 	} while (more && napi_reschedule(napi));
 
+	/*
+	 * Coalesce RX interrupts only while frames come in bursts
+	 */
+	if (stm->rx_coal_adaptive && stm->rx_coal_usecs) {
+		if (rx >= STM32_ETH_COAL_RX_BURST && !stm->rx_coal_active) {
+			stm->rx_coal_active = 1;
+			stm->xstats.rx_coal_on++;
+		} else if (rx < STM32_ETH_COAL_RX_BURST &&
+			   stm->rx_coal_active) {
+			stm->rx_coal_active = 0;
+			stm->xstats.rx_coal_off++;
+		}
+	}
+
 	return rx;
 }
 
 /*
- * Process TX-complete interrupt
+ * Process TX-complete interrupt. Runs from ITCM, if there is one.
  */
-static void stm32_eth_tx_complete(struct net_device *dev)
+static void __tcmfunc stm32_eth_tx_complete(struct net_device *dev)
 {
 	struct stm32_eth_priv	*stm = netdev_priv(dev);
+	unsigned long		flags;
 
 	/*
-	 * Process all sent frames, and exit on the first not-sent yet
+	 * Process all sent frames, and exit on the first not-sent yet.
+	 * Besides the TX irq, we are called from NAPI and timer contexts
 	 */
-	spin_lock(&stm->tx_lock);
+	spin_lock_irqsave(&stm->tx_lock, flags);
 	while (stm->tx_pending) {
 		volatile struct stm32_eth_dma_bd	*bd;
 		u32					stat, idx;
@@ -864,6 +1208,12 @@ static void stm32_eth_tx_complete(struct net_device *dev)
 		if (stat & STM32_DMA_TBD_DMA_OWN)
 			break;
 
+		/*
+		 * Frame status is valid in the last segment only
+		 */
+		if (!(stat & STM32_DMA_TBD_LS))
+			goto next;
+
 		if (stat & STM32_DMA_TBD_ES) {
 			stm->stat.tx_errors++;
 			if (stat & STM32_DMA_TBD_NC)
@@ -882,18 +1232,16 @@ static void stm32_eth_tx_complete(struct net_device *dev)
 						STM32_DMA_TBD_CC_MSK;
 		}
 
+next:
 #ifndef STM32_SRAM
 		/*
 		 * tx_skb are in SRAM, dont unmap them
 		 */
-		dma_unmap_single(&dev->dev, stm->tx_bd[idx].buf,
-				 stm->tx_skb[idx]->len, DMA_TO_DEVICE);
-		dev_kfree_skb_irq(stm->tx_skb[idx]);
-		stm->tx_skb[idx] = NULL;
+		stm32_eth_tx_unmap(dev, idx);
 #endif
 
 		stm->tx_pending--;
-		stm->tx_done_idx = (stm->tx_done_idx + 1) % stm->tx_buf_num;
+		stm->tx_done_idx = STM32_ETH_TX_IDX(stm, stm->tx_done_idx + 1);
 	}
 
 	if (unlikely(stm->tx_blocked)) {
@@ -901,13 +1249,33 @@ static void stm32_eth_tx_complete(struct net_device *dev)
 		netif_wake_queue(dev);
 	}
 
-	spin_unlock(&stm->tx_lock);
+	spin_unlock_irqrestore(&stm->tx_lock, flags);
 }
 
 /*
- * Common MAC interrupt handler
+ * TX coalescing timer: reclaim the frames sent without interrupt. This is
+ * an hrtimer, so that the delay is tx_coal_usecs and not a jiffy or more
  */
-static irqreturn_t stm32_eth_irq(int irq, void *dev_id)
+static enum hrtimer_restart stm32_eth_tx_coal_timer(struct hrtimer *t)
+{
+	struct stm32_eth_priv	*stm = container_of(t, struct stm32_eth_priv,
+						    tx_coal_timer);
+
+	stm32_eth_tx_complete(stm->dev);
+	stm->xstats.tx_timer_clean++;
+
+	if (!stm->tx_pending)
+		return HRTIMER_NORESTART;
+
+	hrtimer_forward_now(t, ns_to_ktime((u64)stm->tx_coal_usecs *
+					   NSEC_PER_USEC));
+	return HRTIMER_RESTART;
+}
+
+/*
+ * Common MAC interrupt handler. Runs from ITCM, if there is one.
+ */
+static irqreturn_t __tcmfunc stm32_eth_irq(int irq, void *dev_id)
 {
 	struct net_device	*dev;
 	struct stm32_eth_priv	*stm;
@@ -1016,6 +1384,7 @@ static int stm32_netdev_open(struct net_device *dev)
 
 	stm->tx_pending = 0;
 	stm->tx_blocked = 0;
+	stm->tx_coal_count = 0;
 
 	rv = request_irq(stm->irq, stm32_eth_irq, IRQF_SHARED, dev->name, dev);
 	if (rv) {
@@ -1059,6 +1428,7 @@ static int stm32_netdev_close(struct net_device *dev)
 	stm->regs->dmaier &= ~(STM32_MAC_DMAIER_TIE | STM32_MAC_DMAIER_RIE |
 			       STM32_MAC_DMASR_NIS | STM32_MAC_DMASR_AIS);
 	free_irq(stm->irq, dev);
+	hrtimer_cancel(&stm->tx_coal_timer);
 
 	stm32_eth_hw_stop(dev);
 	stm32_eth_buffers_free(dev);
@@ -1077,7 +1447,14 @@ static int stm32_netdev_xmit(struct sk_buff *skb, struct net_device *dev)
 {
 	struct stm32_eth_priv	*stm = netdev_priv(dev);
 	unsigned long		flags;
-	int			rv, idx;
+	int			rv, idx, first, nr_bds;
+	u32			ic;
+#ifndef STM32_SRAM
+	int			i;
+	skb_frag_t		*frag;
+	dma_addr_t		buf;
+	u32			len, stat;
+#endif
 
 	/*
 	 * Check params
@@ -1089,59 +1466,139 @@ static int stm32_netdev_xmit(struct sk_buff *skb, struct net_device *dev)
 		goto out;
 	}
 
+#ifndef STM32_SRAM
+	/*
+	 * Each fragment is sent from its own bd. Frames with more fragments
+	 * than we have bds at all are linearized
+	 */
+	nr_bds = 1 + skb_shinfo(skb)->nr_frags;
+	if (unlikely(nr_bds > stm->tx_buf_num)) {
+		if (skb_linearize(skb)) {
+			stm->stat.tx_dropped++;
+			dev_kfree_skb(skb);
+			rv = NETDEV_TX_OK;
+			goto out;
+		}
+		nr_bds = 1;
+	}
+#else
+	/*
+	 * Fragments are gathered while copying into SRAM
+	 */
+	nr_bds = 1;
+#endif
+
 	/*
-	 * We need atomical access only while 'capturing' next tx bd;
-	 * then we may unlock the spin: if we'll be preempted, and some
-	 * other call to xmit() happens, then the next 'skb', even being
-	 * programmed to bds, won't be sent until we complete our captured
-	 * bd (since our one is the first in the bd list)
+	 * The bds are claimed, filled and given to DMA under the lock:
+	 * tx_complete() runs from the TX irq, NAPI and the coalescing timer,
+	 * and would otherwise reclaim claimed bds not handed to DMA yet
 	 */
 	spin_lock_irqsave(&stm->tx_lock, flags);
-	idx = stm->tx_todo_idx;
+	first = stm->tx_todo_idx;
 
 	/*
-	 * Actually, enough to check tx_blocked; checking tx_pending is
-	 * a paranoidal one. Moreover, all this check is paranoidal -
-	 * we shouldn't be called in 'blocked' case, because we stopped
-	 * netif queue previously (see at the end of this function).
+	 * The queue is stopped when there is no bd left at all (see at the
+	 * end of this function), but a fragmented frame may need more bds
+	 * than there are free. Stop the queue until some frames are sent.
 	 */
-	if (stm->tx_blocked || stm->tx_pending >= stm->tx_buf_num) {
+	if (stm->tx_blocked || stm->tx_pending + nr_bds > stm->tx_buf_num) {
+		stm->tx_blocked = 1;
+		netif_stop_queue(dev);
 		spin_unlock_irqrestore(&stm->tx_lock, flags);
 
 		rv = NETDEV_TX_BUSY;
-		printk(STM32_INFO ": TX queue overflow\n");
+		debug(STM32_INFO ": TX queue overflow\n");
 		goto out;
 	}
-	stm->tx_pending++;
-	stm->tx_todo_idx = (stm->tx_todo_idx + 1) % stm->tx_buf_num;
-	spin_unlock_irqrestore(&stm->tx_lock, flags);
+	stm->tx_pending += nr_bds;
+	stm->tx_todo_idx = STM32_ETH_TX_IDX(stm, stm->tx_todo_idx + nr_bds);
+
+	/*
+	 * Request TX-complete interrupt once per tx_coal_frames frames, or
+	 * if the ring is full now. Frames sent without interrupt are
+	 * reclaimed from NAPI poll, or by the coalescing timer
+	 */
+	if (++stm->tx_coal_count >= stm->tx_coal_frames ||
+	    stm->tx_pending == stm->tx_buf_num) {
+		stm->tx_coal_count = 0;
+		ic = STM32_DMA_TBD_IC;
+		stm->xstats.tx_irq_req++;
+	} else {
+		ic = 0;
+		stm->xstats.tx_irq_skip++;
+		if (!hrtimer_is_queued(&stm->tx_coal_timer)) {
+			hrtimer_start(&stm->tx_coal_timer,
+				ns_to_ktime((u64)stm->tx_coal_usecs *
+					    NSEC_PER_USEC),
+				HRTIMER_MODE_REL);
+		}
+	}
 
 	dev->trans_start = jiffies;
 
 #ifndef STM32_SRAM
 	/*
-	 * We have no limitations on the buffer address alignment
+	 * We have no limitations on the buffer address alignment, so map
+	 * the linear part and the fragments in place. The fragment bds get
+	 * OWN as they are filled; the first bd is given to DMA only after
+	 * all the others are ready, still under tx_lock, so tx_complete()
+	 * never sees a partly filled frame
 	 */
-	stm->tx_skb[idx] = skb;
+	idx = first;
+	for (i = 0; i < nr_bds; i++) {
+		if (i == 0) {
+			len = skb_headlen(skb);
+			buf = dma_map_single(&dev->dev, skb->data, len,
+					     DMA_TO_DEVICE);
+			stat = STM32_DMA_TBD_FS;
+			if (skb->ip_summed == CHECKSUM_PARTIAL) {
+				stat |= STM32_DMA_TBD_CIC_FULL;
+				stm->xstats.tx_csum_hw++;
+			}
+		} else {
+			frag = &skb_shinfo(skb)->frags[i - 1];
+			len = frag->size;
+			buf = dma_map_page(&dev->dev, frag->page,
+					   frag->page_offset, len,
+					   DMA_TO_DEVICE);
+			stat = STM32_DMA_TBD_DMA_OWN;
+		}
+
+		/*
+		 * skb is freed on completion of its last segment
+		 */
+		if (i == nr_bds - 1) {
+			stat |= STM32_DMA_TBD_LS | ic;
+			stm->tx_skb[idx] = skb;
+		} else {
+			stm->tx_skb[idx] = NULL;
+		}
+
+		stm->tx_bd[idx].ctrl = len;
+		stm->tx_bd[idx].buf  = buf;
+		stm->tx_bd[idx].stat = stat | STM32_DMA_TBD_TCH;
+
+		idx = STM32_ETH_TX_IDX(stm, idx + 1);
+	}
+	wmb();
 #else
 	/*
-	 * Copy into SRAM and free
+	 * Copy into SRAM and free. Buffer pointer is set once and for all
+	 * in buffers_alloc
 	 */
-	skb_copy_from_linear_data(skb, stm->tx_skb[idx]->data, skb->len);
+	idx = first;
+	skb_copy_bits(skb, 0, stm->tx_skb[idx]->data, skb->len);
 	stm->tx_skb[idx]->len = skb->len;
-	dev_kfree_skb(skb);
-#endif
 
 	stm->tx_bd[idx].ctrl  = skb->len;
-#ifndef STM32_SRAM
-	/*
-	 * Buffer pointer is set once and for all in buffers_alloc
-	 */
-	stm->tx_bd[idx].buf   = dma_map_single(&dev->dev, skb->data,
-					       skb->len, DMA_TO_DEVICE);
+	stm->tx_bd[idx].stat  = STM32_DMA_TBD_TCH | STM32_DMA_TBD_FS |
+				STM32_DMA_TBD_LS | ic;
+	if (skb->ip_summed == CHECKSUM_PARTIAL) {
+		stm->tx_bd[idx].stat |= STM32_DMA_TBD_CIC_FULL;
+		stm->xstats.tx_csum_hw++;
+	}
 #endif
-	stm->tx_bd[idx].stat |= STM32_DMA_TBD_FS | STM32_DMA_TBD_LS |
-				STM32_DMA_TBD_DMA_OWN;
+	stm->tx_bd[first].stat |= STM32_DMA_TBD_DMA_OWN;
 
 	/*
 	 * Command DMA to refetch BD (legaly even if DMA already running)
@@ -1151,7 +1608,6 @@ static int stm32_netdev_xmit(struct sk_buff *skb, struct net_device *dev)
 	/*
 	 * If there's no place for the next xmit, stop queue
 	 */
-	spin_lock_irqsave(&stm->tx_lock, flags);
 	if (stm->tx_pending == stm->tx_buf_num) {
 		stm->tx_blocked = 1;
 		netif_stop_queue(dev);
@@ -1162,6 +1618,13 @@ static int stm32_netdev_xmit(struct sk_buff *skb, struct net_device *dev)
 		spin_unlock_irqrestore(&stm->tx_lock, flags);
 	}
 
+#ifdef STM32_SRAM
+	/*
+	 * The frame is in SRAM now
+	 */
+	dev_kfree_skb(skb);
+#endif
+
 	rv = NETDEV_TX_OK;
 out:
 	return rv;
@@ -1214,6 +1677,256 @@ static const struct net_device_ops	stm32_netdev_ops = {
 	.ndo_set_mac_address	= eth_mac_addr,
 };
 
+/******************************************************************************
+ * Ethtool interface
+ ******************************************************************************/
+
+static void stm32_ethtool_get_drvinfo(struct net_device *dev,
+				      struct ethtool_drvinfo *info)
+{
+	strcpy(info->driver, STM32_ETH_DRV_NAME);
+	strcpy(info->bus_info, dev_name(dev->dev.parent));
+	info->n_stats = STM32_ETH_XSTATS_LEN;
+}
+
+static int stm32_ethtool_get_settings(struct net_device *dev,
+				      struct ethtool_cmd *cmd)
+{
+	struct stm32_eth_priv	*stm = netdev_priv(dev);
+
+	if (!stm->phy_dev)
+		return -ENODEV;
+
+	return phy_ethtool_gset(stm->phy_dev, cmd);
+}
+
+static int stm32_ethtool_set_settings(struct net_device *dev,
+				      struct ethtool_cmd *cmd)
+{
+	struct stm32_eth_priv	*stm = netdev_priv(dev);
+
+	if (!stm->phy_dev)
+		return -ENODEV;
+
+	return phy_ethtool_sset(stm->phy_dev, cmd);
+}
+
+static u32 stm32_ethtool_get_rx_csum(struct net_device *dev)
+{
+	struct stm32_eth_priv	*stm = netdev_priv(dev);
+
+	return stm->rx_csum;
+}
+
+static int stm32_ethtool_set_rx_csum(struct net_device *dev, u32 data)
+{
+	struct stm32_eth_priv	*stm = netdev_priv(dev);
+
+	stm->rx_csum = data ? 1 : 0;
+	if (stm->rx_csum)
+		stm->regs->maccr |= STM32_MAC_CR_IPCO;
+	else
+		stm->regs->maccr &= ~STM32_MAC_CR_IPCO;
+
+	return 0;
+}
+
+static int stm32_ethtool_get_coalesce(struct net_device *dev,
+				      struct ethtool_coalesce *ec)
+{
+	struct stm32_eth_priv	*stm = netdev_priv(dev);
+
+	memset(ec, 0, sizeof(*ec));
+	ec->rx_coalesce_usecs = stm->rx_coal_usecs;
+	ec->use_adaptive_rx_coalesce = stm->rx_coal_adaptive;
+	ec->tx_coalesce_usecs = stm->tx_coal_usecs;
+	ec->tx_max_coalesced_frames = stm->tx_coal_frames;
+
+	return 0;
+}
+
+static int stm32_ethtool_set_coalesce(struct net_device *dev,
+				      struct ethtool_coalesce *ec)
+{
+	struct stm32_eth_priv	*stm = netdev_priv(dev);
+	u32			riwt;
+
+	riwt = stm32_eth_rx_usecs_to_riwt(stm, ec->rx_coalesce_usecs);
+	if (riwt > STM32_MAC_DMARSWTR_RSWTC_MSK)
+		return -EINVAL;
+
+	if (!ec->tx_max_coalesced_frames ||
+	    ec->tx_max_coalesced_frames > stm->tx_buf_num ||
+	    !ec->tx_coalesce_usecs)
+		return -EINVAL;
+
+	stm->tx_coal_frames = ec->tx_max_coalesced_frames;
+	stm->tx_coal_usecs = ec->tx_coalesce_usecs;
+
+	stm->rx_coal_usecs = ec->rx_coalesce_usecs;
+	stm->rx_coal_adaptive = ec->use_adaptive_rx_coalesce ? 1 : 0;
+	stm->rx_coal_active = stm->rx_coal_usecs && !stm->rx_coal_adaptive;
+	stm->regs->dmarswtr = riwt;
+
+	return 0;
+}
+
+static void stm32_ethtool_get_ringparam(struct net_device *dev,
+				       struct ethtool_ringparam *ring)
+{
+	struct stm32_eth_priv	*stm = netdev_priv(dev);
+
+	memset(ring, 0, sizeof(*ring));
+	ring->rx_max_pending = STM32_ETH_RING_MAX;
+	ring->tx_max_pending = STM32_ETH_RING_MAX;
+	ring->rx_pending = stm->rx_buf_num;
+	ring->tx_pending = stm->tx_buf_num;
+}
+
+/*
+ * Resize rings. If the device is up, the MAC is stopped, and the rings
+ * are reallocated with the new sizes
+ */
+static int stm32_ethtool_set_ringparam(struct net_device *dev,
+				       struct ethtool_ringparam *ring)
+{
+	struct stm32_eth_priv	*stm = netdev_priv(dev);
+	u32			rx_old, tx_old;
+	int			rv;
+
+	if (ring->rx_mini_pending || ring->rx_jumbo_pending)
+		return -EINVAL;
+
+	if (ring->rx_pending < STM32_ETH_RING_MIN ||
+	    ring->rx_pending > STM32_ETH_RING_MAX ||
+	    !is_power_of_2(ring->rx_pending) ||
+	    ring->tx_pending < STM32_ETH_RING_MIN ||
+	    ring->tx_pending > STM32_ETH_RING_MAX ||
+	    !is_power_of_2(ring->tx_pending))
+		return -EINVAL;
+
+	rx_old = stm->rx_buf_num;
+	tx_old = stm->tx_buf_num;
+	if (ring->rx_pending == rx_old && ring->tx_pending == tx_old)
+		return 0;
+
+	if (netif_running(dev)) {
+		napi_disable(&stm->napi);
+		netif_stop_queue(dev);
+
+		stm->regs->dmaier &= ~(STM32_MAC_DMAIER_TIE |
+				       STM32_MAC_DMAIER_RIE);
+		synchronize_irq(stm->irq);
+		hrtimer_cancel(&stm->tx_coal_timer);
+
+		stm32_eth_hw_stop(dev);
+		stm32_eth_buffers_free(dev);
+	}
+
+	stm->rx_buf_num = ring->rx_pending;
+	stm->tx_buf_num = ring->tx_pending;
+	if (stm->tx_coal_frames > stm->tx_buf_num)
+		stm->tx_coal_frames = stm->tx_buf_num;
+
+	if (!netif_running(dev))
+		return 0;
+
+	rv = stm32_eth_buffers_alloc(dev);
+	if (rv) {
+		/*
+		 * Fall back to the rings which worked
+		 */
+		printk(STM32_INFO ": can't resize rings to %d/%d\n",
+			stm->rx_buf_num, stm->tx_buf_num);
+		stm->rx_buf_num = rx_old;
+		stm->tx_buf_num = tx_old;
+		if (stm32_eth_buffers_alloc(dev))
+			goto out;
+	}
+
+	stm->rx_done_idx = 0;
+	stm->tx_todo_idx = 0;
+	stm->tx_done_idx = 0;
+	stm->tx_pending = 0;
+	stm->tx_blocked = 0;
+	stm->tx_coal_count = 0;
+
+	if (stm32_eth_hw_start(dev)) {
+		rv = -EBUSY;
+		goto out;
+	}
+
+	stm->regs->dmaier |= STM32_MAC_DMAIER_TIE | STM32_MAC_DMAIER_RIE;
+	netif_wake_queue(dev);
+out:
+	/*
+	 * Leave NAPI enabled even if we failed, so that ndo_stop can
+	 * disable it
+	 */
+	napi_enable(&stm->napi);
+
+	return rv;
+}
+
+static int stm32_ethtool_get_sset_count(struct net_device *dev, int sset)
+{
+	switch (sset) {
+	case ETH_SS_STATS:
+		return STM32_ETH_XSTATS_LEN;
+	default:
+		return -EOPNOTSUPP;
+	}
+}
+
+static void stm32_ethtool_get_strings(struct net_device *dev, u32 sset,
+				      u8 *data)
+{
+	int	i;
+
+	if (sset != ETH_SS_STATS)
+		return;
+
+	for (i = 0; i < STM32_ETH_XSTATS_LEN; i++) {
+		memcpy(data, stm32_eth_xstats_str[i].name, ETH_GSTRING_LEN);
+		data += ETH_GSTRING_LEN;
+	}
+}
+
+static void stm32_ethtool_get_stats(struct net_device *dev,
+				    struct ethtool_stats *stats, u64 *data)
+{
+	struct stm32_eth_priv	*stm = netdev_priv(dev);
+	int			i;
+
+	for (i = 0; i < STM32_ETH_XSTATS_LEN; i++) {
+		data[i] = *(u32 *)((char *)&stm->xstats +
+				   stm32_eth_xstats_str[i].offset);
+	}
+}
+
+/*
+ * STM32 ethtool methods
+ */
+static const struct ethtool_ops		stm32_ethtool_ops = {
+	.get_drvinfo		= stm32_ethtool_get_drvinfo,
+	.get_settings		= stm32_ethtool_get_settings,
+	.set_settings		= stm32_ethtool_set_settings,
+	.get_link		= ethtool_op_get_link,
+	.get_rx_csum		= stm32_ethtool_get_rx_csum,
+	.set_rx_csum		= stm32_ethtool_set_rx_csum,
+	.get_tx_csum		= ethtool_op_get_tx_csum,
+	.set_tx_csum		= ethtool_op_set_tx_csum,
+	.get_sg			= ethtool_op_get_sg,
+	.set_sg			= ethtool_op_set_sg,
+	.get_coalesce		= stm32_ethtool_get_coalesce,
+	.get_ringparam		= stm32_ethtool_get_ringparam,
+	.set_ringparam		= stm32_ethtool_set_ringparam,
+	.set_coalesce		= stm32_ethtool_set_coalesce,
+	.get_sset_count		= stm32_ethtool_get_sset_count,
+	.get_strings		= stm32_ethtool_get_strings,
+	.get_ethtool_stats	= stm32_ethtool_get_stats,
+};
+
 /******************************************************************************
  * MDIO interface
  ******************************************************************************/
@@ -1518,6 +2231,8 @@ static int __init stm32_plat_probe(struct platform_device *pdev)
         }
 
 	dev->netdev_ops = &stm32_netdev_ops;
+	dev->ethtool_ops = &stm32_ethtool_ops;
+	dev->features |= NETIF_F_SG | NETIF_F_IP_CSUM;
 
 	stm = netdev_priv(dev);
 
@@ -1525,7 +2240,8 @@ static int __init stm32_plat_probe(struct platform_device *pdev)
 	stm->pdev = pdev;
 
 #ifdef STM32_SRAM
-	stm->sram_pointer = ALIGN(STM32_SRAM, 4);
+	stm->sram_base = ALIGN(STM32_SRAM, 4);
+	stm->sram_pointer = stm->sram_base;
 	printk(STM32_INFO ": Using SRAM for DMA buffers from %x\n", stm->sram_pointer);
 #endif
 
@@ -1563,32 +2279,46 @@ static int __init stm32_plat_probe(struct platform_device *pdev)
 		goto out;
 	}
 
+	stm->rx_csum = 1;
+
+#if defined(CONFIG_ARCH_STM32)
+	stm->hclk = stm32_clock_get(CLOCK_HCLK);
+#endif /* CONFIG_ARCH_STM32 */
+	stm->rx_coal_usecs = STM32_ETH_COAL_RX_USECS;
+	stm->rx_coal_adaptive = 1;
+	stm->tx_coal_frames = STM32_ETH_COAL_TX_FRAMES;
+	stm->tx_coal_usecs = STM32_ETH_COAL_TX_USECS;
+	hrtimer_init(&stm->tx_coal_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	stm->tx_coal_timer.function = stm32_eth_tx_coal_timer;
+
 	stm->rx_buf_num = data->rx_buf_num;
 	stm->tx_buf_num = data->tx_buf_num;
-	if (!stm->tx_buf_num || !stm->rx_buf_num) {
+	if (stm->tx_buf_num < STM32_ETH_RING_MIN ||
+	    stm->rx_buf_num < STM32_ETH_RING_MIN) {
 		printk(STM32_INFO ": incorrect xx_buf_num param value\n");
 		rv = -EINVAL;
 		goto out;
 	}
+	if (stm->tx_buf_num > STM32_ETH_RING_MAX ||
+	    stm->rx_buf_num > STM32_ETH_RING_MAX) {
+		stm->rx_buf_num = min_t(u32, stm->rx_buf_num,
+					STM32_ETH_RING_MAX);
+		stm->tx_buf_num = min_t(u32, stm->tx_buf_num,
+					STM32_ETH_RING_MAX);
+		printk(STM32_INFO ": xx_buf_num clamped to %d/%d\n",
+			stm->rx_buf_num, stm->tx_buf_num);
+	}
 
 	/*
-	 * Allocate bufs for pointers
+	 * Rings are indexed with masks
 	 */
-#ifndef STM32_SRAM
-	stm->rx_skb = kmalloc(stm->rx_buf_num * sizeof(void *), GFP_KERNEL);
-	stm->tx_skb = kmalloc(stm->tx_buf_num * sizeof(void *), GFP_KERNEL);
-	if (!stm->rx_skb || !stm->tx_skb) {
-		printk(STM32_INFO ": rx/tx (%d/%d) bufs allocation failed\n",
+	if (!is_power_of_2(stm->rx_buf_num) ||
+	    !is_power_of_2(stm->tx_buf_num)) {
+		stm->rx_buf_num = rounddown_pow_of_two(stm->rx_buf_num);
+		stm->tx_buf_num = rounddown_pow_of_two(stm->tx_buf_num);
+		printk(STM32_INFO ": xx_buf_num rounded down to %d/%d\n",
 			stm->rx_buf_num, stm->tx_buf_num);
-		rv = -ENOMEM;
-		goto out;
 	}
-#else
-	stm->rx_skb = stm32_sram_alloc(stm,
-		stm->rx_buf_num * sizeof(void *));
-	stm->tx_skb = stm32_sram_alloc(stm,
-		stm->tx_buf_num * sizeof(void *));
-#endif
 
 	rv = register_netdev(dev);
 	if (rv) {
@@ -1620,7 +2350,6 @@ out:
 static int stm32_plat_remove(struct platform_device *pdev)
 {
 	struct net_device	*dev;
-	struct stm32_eth_priv	*stm;
 
 	if (!pdev)
 		goto out;
@@ -1630,23 +2359,9 @@ static int stm32_plat_remove(struct platform_device *pdev)
 		goto out;
 	platform_set_drvdata(pdev, NULL);
 
-	stm = netdev_priv(dev);
-
 	unregister_netdev(dev);
 	stm32_eth_buffers_free(dev);
 
-#ifndef STM32_SRAM
-	if (stm->tx_skb) {
-		kfree(stm->tx_skb);
-		stm->tx_skb = NULL;
-	}
-
-	if (stm->rx_skb) {
-		kfree(stm->rx_skb);
-		stm->rx_skb = NULL;
-	}
-#endif
-
 	free_netdev(dev);
 out:
 	return 0;
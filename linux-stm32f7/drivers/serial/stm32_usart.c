@@ -59,13 +59,17 @@
 /*
  * Size, and number of DMAed RX buffers.
  * Notes:
+ * - the size is set per port with platform data, the default is used if
+ * the platform doesn't specify it;
  * - the number of buffers may be either 2, or 1;
+ * - the buffers are treated as one ring of (size * number) chars;
  * - in case of strong flow on serial line, i.e. without IDLEs, rx
  * interrupts (from DMA) will be generated at half, and full levels of these
  * buffers.
  */
 /* 512 chars */
 #define STM32_DMA_RX_BUF_LEN	512
+#define STM32_DMA_RX_BUF_MIN	16
 
 #ifdef CONFIG_ARCH_STM32F1
 /* STM32F1: Double buffer mode is not supported */
@@ -111,11 +115,23 @@
 
 #define STM32_USART_CR3_CTSE	(1 << 9)
 #define STM32_USART_CR3_RTSE	(1 << 8)
+#define STM32_USART_CR3_DMAT	(1 << 7)	/* DMA enable transmitter     */
 #define STM32_USART_CR3_DMAR	(1 << 6)	/* DMA enable receiver	      */
+#define STM32_USART_CR3_EIE	(1 << 0)	/* Error interrupt enable     */
 
 #define STM32_USART_ISR_IDLE	(1 << 4)
+#define STM32_USART_ISR_ORE	(1 << 3)	/* Overrun error	      */
+#define STM32_USART_ISR_NF	(1 << 2)	/* Noise detected	      */
+#define STM32_USART_ISR_FE	(1 << 1)	/* Framing error	      */
+#define STM32_USART_ISR_ERRORS	(STM32_USART_ISR_ORE | STM32_USART_ISR_NF |    \
+				 STM32_USART_ISR_FE)
 
 #define STM32_USART_ICR_IDLECF	(1 << 4)
+#define STM32_USART_ICR_ORECF	(1 << 3)
+#define STM32_USART_ICR_NCF	(1 << 2)
+#define STM32_USART_ICR_FECF	(1 << 1)
+#define STM32_USART_ICR_ERRORS	(STM32_USART_ICR_ORECF | STM32_USART_ICR_NCF | \
+				 STM32_USART_ICR_FECF)
 
 #else
 #define STM32_USART_CR1_UE	(1 << 13)	/* USART enable		      */
@@ -135,13 +151,16 @@
 
 #define STM32_USART_CR3_CTSE	(1 << 9)
 #define STM32_USART_CR3_RTSE	(1 << 8)
+#define STM32_USART_CR3_DMAT	(1 << 7)	/* DMA enable transmitter     */
 #define STM32_USART_CR3_DMAR	(1 << 6)	/* DMA enable receiver	      */
+#define STM32_USART_CR3_EIE	(1 << 0)	/* Error interrupt enable     */
 
 /*
  * USART SR bits (this is not the full list, see the others in uart.h header)
  */
 #define STM32_USART_SR_IDLE	(1 << 4)
 #define STM32_USART_SR_ORE	(1 << 3)	/* Overrun error	      */
+#define STM32_USART_SR_NF	(1 << 2)	/* Noise detected	      */
 #define STM32_USART_SR_FE	(1 << 1)	/* Framing error	      */
 #define STM32_USART_SR_PE	(1 << 0)	/* Parity error		      */
 #define STM32_USART_SR_ERRORS	(STM32_USART_SR_ORE | STM32_USART_SR_FE |      \
@@ -211,6 +230,18 @@ enum stm32_dma_stream {
 
 	STM32_DMA_STREAM_LAST
 };
+
+/*
+ * Stream interrupt flags, relative to the stream position in ISR/IFCR
+ */
+#define STM32_DMA_FLAG_FE		(1 << 0)	/* FIFO error	      */
+#define STM32_DMA_FLAG_DME		(1 << 2)	/* Direct mode error  */
+#define STM32_DMA_FLAG_TE		(1 << 3)	/* Transfer error     */
+#define STM32_DMA_FLAG_HT		(1 << 4)	/* Half transfer      */
+#define STM32_DMA_FLAG_TC		(1 << 5)	/* Transfer complete  */
+#define STM32_DMA_FLAG_ALL		(STM32_DMA_FLAG_FE | STM32_DMA_FLAG_DME |\
+					 STM32_DMA_FLAG_TE | STM32_DMA_FLAG_HT |\
+					 STM32_DMA_FLAG_TC)
 #endif /* !CONFIG_ARCH_STM32F1 */
 
 enum stm32_dma_chan {
@@ -262,10 +293,22 @@ struct stm32_usart_priv {
 
 	u8					*rxb[STM32_DMA_RX_BUF_NUM];
 	dma_addr_t				rxb_dma[STM32_DMA_RX_BUF_NUM];
-	u32					wbuf;
-	u32					wpos;
-	u32					rbuf;
-	u32					rpos;
+	u32					rx_buf_len;
+	u32					rx_tail;
+
+	/*
+	 * TX DMA. The stream is on the same controller as the RX one.
+	 * tx_dma_len is the number of chars in flight, 0 if TX DMA is idle.
+	 */
+	int					tx_dma;
+	int					tx_dma_irq;
+#ifndef CONFIG_ARCH_STM32F1
+	struct stm32_dma_ini			tx_ini;
+	volatile u32				*tx_dma_isr;
+	volatile u32				*tx_dma_ifcr;
+	dma_addr_t				tx_dma_addr;
+	u32					tx_dma_len;
+#endif
 };
 #define stm32_drv_priv(port)	    (struct stm32_usart_priv *)		       \
 				    ((port)->private_data)
@@ -284,6 +327,10 @@ static void stm32_transmit(struct uart_port *port);
 
 static irqreturn_t stm32_usart_isr(int irq, void *dev_id);
 static irqreturn_t stm32_dma_isr(int irq, void *dev_id);
+#ifndef CONFIG_ARCH_STM32F1
+static void stm32_tx_dma_start(struct uart_port *port);
+static irqreturn_t stm32_tx_dma_isr(int irq, void *dev_id);
+#endif
 
 /*
  * UART ports and privates
@@ -327,6 +374,28 @@ static struct stm32_dma_ini	stm32_usart_rx_dma[STM32_NR_UARTS] = {
 	/* USART8 */
 	{STM32_DMA_STREAM_6, STM32_DMA_CHAN_5}
 };
+
+/*
+ * STM32F2: TX DMA peripheral streams & channels
+ */
+static struct stm32_dma_ini	stm32_usart_tx_dma[STM32_NR_UARTS] = {
+	/* USART1 */
+	{STM32_DMA_STREAM_7, STM32_DMA_CHAN_4},
+	/* USART2 */
+	{STM32_DMA_STREAM_6, STM32_DMA_CHAN_4},
+	/* USART3 */
+	{STM32_DMA_STREAM_3, STM32_DMA_CHAN_4},
+	/* USART4 */
+	{STM32_DMA_STREAM_4, STM32_DMA_CHAN_4},
+	/* USART5 */
+	{STM32_DMA_STREAM_7, STM32_DMA_CHAN_4},
+	/* USART6 */
+	{STM32_DMA_STREAM_6, STM32_DMA_CHAN_5},
+	/* USART7 */
+	{STM32_DMA_STREAM_1, STM32_DMA_CHAN_5},
+	/* USART8 */
+	{STM32_DMA_STREAM_0, STM32_DMA_CHAN_5}
+};
 #endif
 
 #ifdef CONFIG_ARCH_STM32F1
@@ -342,6 +411,14 @@ static u32 stm32_dma_isr_bit[STM32_DMA_CHAN_LAST] = {
 	(1 << 21) | (1 << 22),
 	(1 << 25) | (1 << 26), /* Channel 7 */
 };
+
+/*
+ * STM32F1: Channel ISR bits for complete transfers
+ */
+static u32 stm32_dma_isr_tc_bit[STM32_DMA_CHAN_LAST] = {
+	(1 <<  1), (1 <<  5), (1 <<  9), (1 << 13),
+	(1 << 17), (1 << 21), (1 << 25)
+};
 #else
 /*
  * STM32F2: Stream ISR bits for half[0]/complete[1] transfers
@@ -356,6 +433,22 @@ static u32 stm32_dma_isr_bit[STM32_DMA_STREAM_LAST] = {
 	(1 << 20) | (1 << 21),
 	(1 << 26) | (1 << 27)
 };
+
+/*
+ * STM32F2: Stream ISR bits for complete transfers
+ */
+static u32 stm32_dma_isr_tc_bit[STM32_DMA_STREAM_LAST] = {
+	(1 <<  5), (1 << 11), (1 << 21), (1 << 27),
+	(1 <<  5), (1 << 11), (1 << 21), (1 << 27)
+};
+
+/*
+ * STM32F2: Position of the stream flags in ISR/IFCR
+ */
+static u32 stm32_dma_flag_shift[STM32_DMA_STREAM_LAST] = {
+	0, 6, 16, 22,
+	0, 6, 16, 22
+};
 #endif
 
 /*
@@ -364,6 +457,7 @@ static u32 stm32_dma_isr_bit[STM32_DMA_STREAM_LAST] = {
 static u32 stm_port_tx_empty(struct uart_port *port)
 {
 	volatile struct stm32_usart_regs	*uart = stm32_usart(port);
+	struct stm32_usart_priv			*priv = stm32_drv_priv(port);
 	unsigned long				flags;
 	u32					rv;
 
@@ -372,6 +466,10 @@ static u32 stm_port_tx_empty(struct uart_port *port)
 	rv = (uart->isr & STM32_USART_ISR_TXE) ? TIOCSER_TEMT : 0;
 #else
 	rv = (uart->sr & STM32_USART_SR_TXE) ? TIOCSER_TEMT : 0;
+#endif
+#ifndef CONFIG_ARCH_STM32F1
+	if (priv->tx_dma_len)
+		rv = 0;
 #endif
 	spin_unlock_irqrestore(&port->lock, flags);
 
@@ -397,15 +495,59 @@ static void stm_port_stop_tx(struct uart_port *port)
 static void stm_port_start_tx(struct uart_port *port)
 {
 	volatile struct stm32_usart_regs	*uart = stm32_usart(port);
+	struct stm32_usart_priv			*priv = stm32_drv_priv(port);
 	unsigned long				flags;
 
-	spin_lock_irqsave(&port->lock, flags);
-	uart->cr1 |= STM32_USART_CR1_TXEIE;
-	spin_unlock_irqrestore(&port->lock, flags);
+	/*
+	 * With TX DMA the end of transfer is signalled by the DMA stream,
+	 * so don't bother the USART with TX-empty interrupts
+	 */
+	if (!priv->tx_dma) {
+		spin_lock_irqsave(&port->lock, flags);
+		uart->cr1 |= STM32_USART_CR1_TXEIE;
+		spin_unlock_irqrestore(&port->lock, flags);
+	}
 
 	stm32_transmit(port);
 }
 
+#ifndef CONFIG_ARCH_STM32F1
+/*
+ * Abort TX DMA in progress. Called with the port lock held
+ */
+static void stm32_tx_dma_stop(struct uart_port *port)
+{
+	volatile struct stm32_dma_regs		*dma = stm32_dma(port);
+	struct stm32_usart_priv			*priv = stm32_drv_priv(port);
+	int					s = priv->tx_ini.stream;
+
+	dma->s[s].cr &= ~STM32_DMA_CR_EN;
+	while (dma->s[s].cr & STM32_DMA_CR_EN);
+	*priv->tx_dma_ifcr = STM32_DMA_FLAG_ALL << stm32_dma_flag_shift[s];
+
+	if (priv->tx_dma_len) {
+		dma_unmap_single(port->dev, priv->tx_dma_addr,
+				 priv->tx_dma_len, DMA_TO_DEVICE);
+		priv->tx_dma_len = 0;
+	}
+}
+
+/*
+ * Discard the chars queued for transmission
+ */
+static void stm_port_flush_buffer(struct uart_port *port)
+{
+	struct stm32_usart_priv			*priv = stm32_drv_priv(port);
+
+	/*
+	 * The core has already emptied the circ buffer; the chars being
+	 * DMAed from it are stale now
+	 */
+	if (priv->tx_dma)
+		stm32_tx_dma_stop(port);
+}
+#endif
+
 /*
  * Stop receiver
  */
@@ -430,6 +572,23 @@ static void stm_port_stop_rx(struct uart_port *port)
 	spin_unlock_irqrestore(&port->lock, flags);
 }
 
+/*
+ * Free the DMAed RX buffers
+ */
+static void stm32_rx_bufs_free(struct uart_port *port)
+{
+	struct stm32_usart_priv	*priv = stm32_drv_priv(port);
+	int			i;
+
+	for (i = 0; i < STM32_DMA_RX_BUF_NUM; i++) {
+		if (!priv->rxb[i])
+			continue;
+		dma_free_coherent(NULL, priv->rx_buf_len,
+			priv->rxb[i], priv->rxb_dma[i]);
+		priv->rxb[i] = NULL;
+	}
+}
+
 static void stm_set_baud_rate(struct uart_port *port, int baudrate)
 {
 	u32 apb_clock, int_div, frac_div;
@@ -467,23 +626,18 @@ static int stm_port_startup(struct uart_port *port)
 	 * Reinitialize offsets in DMA buffers, otherwise wrong data will be
 	 * received after second `open()` system call operation.
 	 */
-	priv->wbuf = 0;
-	priv->wpos = 0;
-	priv->rbuf = 0;
-	priv->rpos = 0;
+	priv->rx_tail = 0;
 
 	for (i = 0; i < STM32_DMA_RX_BUF_NUM; i++) {
-		priv->rxb[i] = dma_alloc_coherent(NULL, STM32_DMA_RX_BUF_LEN,
+		if (priv->rxb[i])
+			continue;
+		priv->rxb[i] = dma_alloc_coherent(NULL, priv->rx_buf_len,
 				&priv->rxb_dma[i], GFP_KERNEL | GFP_DMA);
 		if (priv->rxb[i])
 			continue;
 		printk(KERN_ERR "%s: alloc_coherent[%d](%d) failed\n",
-			__func__, i, STM32_DMA_RX_BUF_LEN);
-		while (--i >= 0) {
-			dma_free_coherent(NULL, STM32_DMA_RX_BUF_LEN,
-				priv->rxb[i], priv->rxb_dma[i]);
-			priv->rxb[i] = NULL;
-		}
+			__func__, i, priv->rx_buf_len);
+		stm32_rx_bufs_free(port);
 		rv = -ENOMEM;
 		goto out;
 	}
@@ -505,6 +659,21 @@ static int stm_port_startup(struct uart_port *port)
 		free_irq(priv->usart_irq, port);
 		goto out;
 	}
+#ifndef CONFIG_ARCH_STM32F1
+	if (priv->tx_dma) {
+		priv->tx_dma_len = 0;
+		rv = request_irq(priv->tx_dma_irq, stm32_tx_dma_isr,
+				 IRQF_DISABLED, STM32_USART_PORT, port);
+		if (rv) {
+			printk(KERN_ERR "%s: request_irq(%d) failed (%d)\n",
+				__func__, priv->tx_dma_irq, rv);
+			free_irq(priv->dma_irq, port);
+			free_irq(priv->usart_irq, port);
+			goto out;
+		}
+		stm32_tx_dma_stop(port);
+	}
+#endif
 
 	/*
 	 * Configure DMA to receive from USART:
@@ -530,7 +699,7 @@ static int stm_port_startup(struct uart_port *port)
 	while (dma->s[priv->ini.stream].cr & STM32_DMA_CR_EN);
 
 	dma->s[priv->ini.stream].cr   = tmp;
-	dma->s[priv->ini.stream].ndtr = STM32_DMA_RX_BUF_LEN;
+	dma->s[priv->ini.stream].ndtr = priv->rx_buf_len;
 #if defined (CONFIG_ARCH_STM32F7)
 	dma->s[priv->ini.stream].par  = &uart->rdr;
 #else
@@ -569,14 +738,20 @@ static int stm_port_startup(struct uart_port *port)
 #endif
 
 	/*
-	 * Enable DMA access to USART
+	 * Enable DMA access to USART. Errors (overrun in particular) are
+	 * reported through the USART interrupt.
 	 */
-	uart->cr3 = STM32_USART_CR3_DMAR;
+	uart->cr3 = STM32_USART_CR3_DMAR | STM32_USART_CR3_EIE;
+	if (priv->tx_dma)
+		uart->cr3 |= STM32_USART_CR3_DMAT;
 
 	/*
-	 * Enable RX-idle & TX-empty interrupts
+	 * Enable RX-idle & TX-empty interrupts. TX-empty is not used if
+	 * transmitting with DMA.
 	 */
-	uart->cr1 |= STM32_USART_CR1_IDLIE | STM32_USART_CR1_TXEIE;
+	uart->cr1 |= STM32_USART_CR1_IDLIE;
+	if (!priv->tx_dma)
+		uart->cr1 |= STM32_USART_CR1_TXEIE;
 
 	/*
 	 * Set baudrate to the default value of 115200 if the baudrate
@@ -609,15 +784,32 @@ static void stm_port_shutdown(struct uart_port *port)
 	dma->s[priv->ini.stream].cr &= ~STM32_DMA_CR_EN;
 	while (dma->s[priv->ini.stream].cr & STM32_DMA_CR_EN);
 
+#ifndef CONFIG_ARCH_STM32F1
+	if (priv->tx_dma) {
+		unsigned long	flags;
+
+		spin_lock_irqsave(&port->lock, flags);
+		stm32_tx_dma_stop(port);
+		spin_unlock_irqrestore(&port->lock, flags);
+	}
+#endif
+
 	uart->cr1 &= ~(STM32_USART_CR1_TE | STM32_USART_CR1_RE |
 		       STM32_USART_CR1_UE);
 	uart->cr1 &= ~(STM32_USART_CR1_IDLIE | STM32_USART_CR1_TXEIE);
+	uart->cr3 &= ~STM32_USART_CR3_DMAT;
 #if !defined (CONFIG_ARCH_STM32F7)
 	uart->sr   = 0;
 #endif
 
+#ifndef CONFIG_ARCH_STM32F1
+	if (priv->tx_dma)
+		free_irq(priv->tx_dma_irq, port);
+#endif
 	free_irq(priv->dma_irq, port);
 	free_irq(priv->usart_irq, port);
+
+	stm32_rx_bufs_free(port);
 }
 
 /*
@@ -716,16 +908,7 @@ static int stm_port_verify_port(struct uart_port *port, struct serial_struct *se
  */
 static void stm_port_release_port(struct uart_port *port)
 {
-	struct stm32_usart_priv	*priv = stm32_drv_priv(port);
-	int			i;
-
-	for (i = 0; i < STM32_DMA_RX_BUF_NUM; i++) {
-		if (!priv->rxb[i])
-			continue;
-		dma_free_coherent(NULL, STM32_DMA_RX_BUF_LEN,
-			priv->rxb[i], priv->rxb_dma[0]);
-		priv->rxb[i] = NULL;
-	}
+	stm32_rx_bufs_free(port);
 }
 
 /*
@@ -794,6 +977,9 @@ static struct uart_ops stm32_uart_ops = {
 	.stop_tx	= stm_port_stop_tx,
 	.start_tx	= stm_port_start_tx,
 	.stop_rx	= stm_port_stop_rx,
+#ifndef CONFIG_ARCH_STM32F1
+	.flush_buffer	= stm_port_flush_buffer,
+#endif
 	.enable_ms	= stm_port_enable_ms,
 	.break_ctl	= stm_port_break_ctl,
 	.startup	= stm_port_startup,
@@ -851,6 +1037,16 @@ static void stm_console_write(struct console *co, const char *s,
 	if (idmae)
 		dma->s[priv->ini.stream].cr &= ~idmae;
 
+#ifndef CONFIG_ARCH_STM32F1
+	/*
+	 * Let TX DMA in progress complete, so that console messages do not
+	 * intermix with the chars being DMAed. The completion is processed
+	 * by the TX DMA ISR once we release the lock.
+	 */
+	if (priv->tx_dma)
+		while (dma->s[priv->tx_ini.stream].cr & STM32_DMA_CR_EN);
+#endif
+
 	uart_console_write(port, s, count, stm_console_putchar);
 
 	/*
@@ -959,8 +1155,16 @@ static void stm32_xmit_char(volatile struct stm32_usart_regs *uart,
 static void stm32_transmit(struct uart_port *port)
 {
 	volatile struct stm32_usart_regs	*uart = stm32_usart(port);
+	struct stm32_usart_priv			*priv = stm32_drv_priv(port);
 	struct circ_buf				*xmit;
 
+	if (priv->tx_dma) {
+#ifndef CONFIG_ARCH_STM32F1
+		stm32_tx_dma_start(port);
+#endif
+		goto out;
+	}
+
 	if (port->x_char) {
 		stm32_xmit_char(uart, port->x_char);
 		port->x_char = 0;
@@ -987,119 +1191,180 @@ out:
 	return;
 }
 
+#ifndef CONFIG_ARCH_STM32F1
 /*
- * Process receive interrupt event
+ * Start DMA of the contiguous span of chars at the tail of the circ buffer.
+ * Does nothing if the previous transfer is still in flight: the TX DMA ISR
+ * will restart us on completion.
  */
-static void stm32_receive(struct uart_port *port)
+static void stm32_tx_dma_start(struct uart_port *port)
 {
+	volatile struct stm32_usart_regs	*uart = stm32_usart(port);
 	volatile struct stm32_dma_regs		*dma = stm32_dma(port);
 	struct stm32_usart_priv			*priv = stm32_drv_priv(port);
-	struct tty_struct			*tty = port->state->port.tty;
-	u32					new_wbuf, new_wpos, tmp, wrap;
+	struct circ_buf				*xmit = &port->state->xmit;
+	int					s = priv->tx_ini.stream;
+	u32					len;
+
+	if (priv->tx_dma_len)
+		goto out;
+
+	if (port->x_char) {
+		stm32_xmit_char(uart, port->x_char);
+		port->x_char = 0;
+		port->icount.tx++;
+	}
+
+	if (uart_circ_empty(xmit) || uart_tx_stopped(port))
+		goto out;
+
+	len = CIRC_CNT_TO_END(xmit->head, xmit->tail, UART_XMIT_SIZE);
+	if (len > STM32_DMA_NDTR_NDT_MSK)
+		len = STM32_DMA_NDTR_NDT_MSK;
+
+	priv->tx_dma_addr = dma_map_single(port->dev, &xmit->buf[xmit->tail],
+					   len, DMA_TO_DEVICE);
+	priv->tx_dma_len = len;
 
 	/*
-	 * Read DMA current buf, counter, and make sure we done this atomic
+	 * Memory-to-peripheral, byte-wide, single transfer
 	 */
-#ifdef CONFIG_ARCH_STM32F1
-	/* Double Buffer Mode is not supported on STM32F1 */
-	new_wbuf = 0;
+	*priv->tx_dma_ifcr = STM32_DMA_FLAG_ALL << stm32_dma_flag_shift[s];
+	dma->s[s].cr   = (priv->tx_ini.chan << STM32_DMA_CR_CHSEL_BIT) |
+			 (STM32_DMA_CR_PL_HIGH << STM32_DMA_CR_PL_BIT) |
+			 STM32_DMA_CR_DIR_M2P | STM32_DMA_CR_MINC |
+			 STM32_DMA_CR_TCIE | STM32_DMA_CR_TEIE;
+	dma->s[s].ndtr = len;
+#if defined (CONFIG_ARCH_STM32F7)
+	dma->s[s].par  = &uart->tdr;
 #else
-	new_wbuf = !!(dma->s[priv->ini.stream].cr & STM32_DMA_CR_CT);
-#endif
-	new_wpos = dma->s[priv->ini.stream].ndtr;
-#if (STM32_DMA_RX_BUF_NUM == 2)
-	tmp = !!(dma->s[priv->ini.stream].cr & STM32_DMA_CR_CT);
-	if (new_wbuf != tmp) {
-		/*
-		 * DMA changed the buffer (maybe between our reads from CR
-		 * and NDTR)
-		 */
-		new_wpos = dma->s[priv->ini.stream].ndtr;
-		new_wbuf = tmp;
-	}
+	dma->s[s].par  = &uart->dr;
 #endif
+	dma->s[s].m0ar = (void *)priv->tx_dma_addr;
+	dma->s[s].cr  |= STM32_DMA_CR_EN;
+out:
+	return;
+}
+#endif /* !CONFIG_ARCH_STM32F1 */
 
-	/*
-	 * Convert 'remained space' to 'written bytes'
-	 */
-	new_wpos = STM32_DMA_RX_BUF_LEN - new_wpos;
+/*
+ * Process receive interrupt event
+ */
+static void stm32_receive(struct uart_port *port)
+{
+	volatile struct stm32_dma_regs		*dma = stm32_dma(port);
+	struct stm32_usart_priv			*priv = stm32_drv_priv(port);
+	struct tty_struct			*tty = port->state->port.tty;
+	u32					len = priv->rx_buf_len;
+	u32					ring = len * STM32_DMA_RX_BUF_NUM;
+	u32					buf, head, tail, cnt, n, sts;
+	int					copied;
 
-#if (STM32_DMA_RX_BUF_NUM == 2)
 	/*
-	 * Wrap criteria: DMA switched to another buffer, than we saw
-	 * last time. Otherwise, assume DMA is still ahead the reader.
-	 * Note, actually may use the same criteria as for 1-buf case.
+	 * ACK the DMA events first, and only then read the writer position,
+	 * so that every event ACKed here is accounted for by the position.
+	 * If a buffer completes in between, ACK and read again: an event
+	 * left pending always comes after the position read, and brings us
+	 * here again.
 	 */
-	wrap = likely(new_wbuf == priv->wbuf) ? 0 : 1;
+	sts = 0;
+	do {
+		n = *priv->dma_isr & stm32_dma_isr_bit[priv->ini.stream];
+		if (n)
+			*priv->dma_ifcr = n;
+		sts |= n;
+
+		/*
+		 * Read DMA current buf, counter, and make sure we done this
+		 * atomic
+		 */
+#ifdef CONFIG_ARCH_STM32F1
+		/* Double Buffer Mode is not supported on STM32F1 */
+		buf = 0;
 #else
-	/*
-	 * Wrap criteria: DMA pointer becomes less, that we saw last
-	 * time. Otherwise, assume DMA is still ahead the reader.
-	 */
-	wrap = likely(priv->wpos <= new_wpos) ? 0 : 1;
+		buf = !!(dma->s[priv->ini.stream].cr & STM32_DMA_CR_CT);
 #endif
-
-	if (unlikely(wrap)) {
-		if (priv->rpos == STM32_DMA_RX_BUF_LEN) {
-			/*
-			 * Reader completed this buf, switch to the next one
-			 * (or to the beginning of the same, if have 1 buf)
-			 */
-			priv->rpos = 0;
-			priv->wpos = new_wpos;
-			priv->wbuf = priv->rbuf = new_wbuf;
-
-			/*
-			 * We've just wrapped, clear the pending DMA interrupt
-			 * (full buffer complete)
-			 */
-			wrap = 0;
-		} else {
+		n = dma->s[priv->ini.stream].ndtr;
+#if (STM32_DMA_RX_BUF_NUM == 2)
+		if (buf != !!(dma->s[priv->ini.stream].cr & STM32_DMA_CR_CT)) {
 			/*
-			 * There are unread chars at the end of the buffer
-			 * completed by DMA, read these chars to the end
+			 * DMA changed the buffer (maybe between our reads
+			 * from CR and NDTR)
 			 */
-			priv->wpos = STM32_DMA_RX_BUF_LEN;
+			buf = !buf;
+			n = dma->s[priv->ini.stream].ndtr;
 		}
-	} else {
+#endif
+
 		/*
-		 * No wrap, just update the writer position
+		 * Convert 'remained space' to the writer position in the ring
 		 */
-		priv->wpos = new_wpos;
-	}
+		head = (buf * len + len - n) % ring;
+	} while (*priv->dma_isr & stm32_dma_isr_tc_bit[priv->ini.stream]);
 
-	debug("%s: w:[%d;%d]; r[%d;%d] -> ", __func__, priv->wbuf, priv->wpos,
-		priv->rbuf, priv->rpos);
+	tail = priv->rx_tail;
+	cnt = (head + ring - tail) % ring;
 
 	/*
-	 * Fetch rxed data from buffer. Note, we do not control overflows
-	 * here. That is, DMA may catch us, and overwrite data ahead of
-	 * our 'rpos'.
-	 * Do read until catch the writer
+	 * DMA completed a buffer, but (modulo ring) the writer is not past
+	 * the end of the buffer we stopped reading at last time: DMA has
+	 * gone full circle, and overwritten the chars we hadn't fetched.
+	 * Skip to the writer, and report the loss.
 	 */
-	while (priv->rpos < priv->wpos) {
-		tty_insert_flip_char(tty, priv->rxb[priv->rbuf][priv->rpos],
-				     TTY_NORMAL);
-		priv->rpos++;
+	if ((sts & stm32_dma_isr_tc_bit[priv->ini.stream]) &&
+	    cnt < len - (tail % len)) {
+		port->icount.overrun++;
+		tty_insert_flip_char(tty, 0, TTY_OVERRUN);
+		tail = head;
+		cnt = 0;
 	}
 
-	debug("w:[%d;%d]; r[%d;%d] [%s,%d,%d,%x/%x,%d/%d]\n", priv->wbuf, priv->wpos,
-		priv->rbuf, priv->rpos);
+	debug("%s: w:%d r:%d cnt:%d\n", __func__, head, tail, cnt);
 
 	/*
-	 * Let's DMA interrupt pending to come here again asap, and
-	 * to read data in new buffer (or behind us if have 1 buf) if wrap
-	 * has a place. Otherwise, just ACK DMA
+	 * Fetch rxed data from the ring, in at most two contiguous spans
 	 */
-	if (likely(!wrap)) {
-		tmp = *priv->dma_isr & stm32_dma_isr_bit[priv->ini.stream];
-		if (tmp)
-			*priv->dma_ifcr = tmp;
+	while (cnt) {
+		n = min(cnt, len - (tail % len));
+		copied = tty_insert_flip_string(tty,
+				&priv->rxb[tail / len][tail % len], n);
+		if (copied < n)
+			port->icount.buf_overrun += n - copied;
+		port->icount.rx += copied;
+
+		tail = (tail + n) % ring;
+		cnt -= n;
 	}
+	priv->rx_tail = tail;
 
 	tty_flip_buffer_push(tty);
 }
 
+/*
+ * Account USART receive errors. Chars DMAed before the error are pushed
+ * first, so that the error mark appears in the right place in the stream.
+ */
+static void stm32_receive_errors(struct uart_port *port, u32 sr)
+{
+	struct tty_struct			*tty = port->state->port.tty;
+
+	stm32_receive(port);
+
+#if defined (CONFIG_ARCH_STM32F7)
+	if (sr & STM32_USART_ISR_FE)
+		port->icount.frame++;
+	if (sr & STM32_USART_ISR_ORE) {
+#else
+	if (sr & STM32_USART_SR_FE)
+		port->icount.frame++;
+	if (sr & STM32_USART_SR_ORE) {
+#endif
+		port->icount.overrun++;
+		tty_insert_flip_char(tty, 0, TTY_OVERRUN);
+		tty_flip_buffer_push(tty);
+	}
+}
+
 /*
  * STM32 USART irq handler
  */
@@ -1107,32 +1372,48 @@ static irqreturn_t stm32_usart_isr(int irq, void *dev_id)
 {
 	struct uart_port			*port = dev_id;
 	volatile struct stm32_usart_regs	*uart = stm32_usart(port);
+	struct stm32_usart_priv			*priv = stm32_drv_priv(port);
 
 #if defined (CONFIG_ARCH_STM32F7)
-	if (uart->isr & STM32_USART_ISR_IDLE) {
-		u8	tmp;
+	u32					sr = uart->isr;
 
-		tmp = uart->rdr;
+	/*
+	 * Line went idle: flush the partially filled DMA buffer. Don't
+	 * touch RDR here, the char there (if any) belongs to DMA.
+	 */
+	if (sr & STM32_USART_ISR_IDLE) {
+		/* clear interrupt */
+		uart->icr = STM32_USART_ICR_IDLECF;
 		stm32_receive(dev_id);
+	}
 
-		/* clear interrupt */
-		uart->icr |= STM32_USART_ICR_IDLECF;
+	if (sr & STM32_USART_ISR_ERRORS) {
+		uart->icr = STM32_USART_ICR_ERRORS;
+		stm32_receive_errors(port, sr);
 	}
 #else
+	u32					sr = uart->sr;
+
 	/*
 	 * TBD: without reading DR IDLE interrupt continue pending; check
 	 * if this read don't lead to missing the read char, and it's DMAed
-	 * to buf
+	 * to buf. The same SR/DR read sequence clears the error flags.
 	 */
-	if (uart->sr & STM32_USART_SR_IDLE) {
+	if (sr & (STM32_USART_SR_IDLE | STM32_USART_SR_ORE |
+		  STM32_USART_SR_NF | STM32_USART_SR_FE)) {
 		u8	tmp;
 
 		tmp = uart->dr;
-		stm32_receive(dev_id);
+		if (sr & (STM32_USART_SR_ORE | STM32_USART_SR_NF |
+			  STM32_USART_SR_FE))
+			stm32_receive_errors(port, sr);
+		else
+			stm32_receive(dev_id);
 	}
 #endif
 
-	stm32_transmit(dev_id);
+	if (!priv->tx_dma)
+		stm32_transmit(dev_id);
 
 	return IRQ_HANDLED;
 }
@@ -1147,6 +1428,55 @@ static irqreturn_t stm32_dma_isr(int irq, void *dev_id)
 	return IRQ_HANDLED;
 }
 
+#ifndef CONFIG_ARCH_STM32F1
+/*
+ * STM32 TX DMA irq handler
+ */
+static irqreturn_t stm32_tx_dma_isr(int irq, void *dev_id)
+{
+	struct uart_port			*port = dev_id;
+	volatile struct stm32_dma_regs		*dma = stm32_dma(port);
+	struct stm32_usart_priv			*priv = stm32_drv_priv(port);
+	struct circ_buf				*xmit = &port->state->xmit;
+	int					s = priv->tx_ini.stream;
+	u32					sts, sent;
+
+	spin_lock(&port->lock);
+
+	sts = (*priv->tx_dma_isr >> stm32_dma_flag_shift[s]) &
+		STM32_DMA_FLAG_ALL;
+	*priv->tx_dma_ifcr = sts << stm32_dma_flag_shift[s];
+
+	/*
+	 * Nothing in flight (e.g. flushed), or not the end of transfer
+	 */
+	if (!priv->tx_dma_len ||
+	    !(sts & (STM32_DMA_FLAG_TC | STM32_DMA_FLAG_TE)))
+		goto out;
+
+	/*
+	 * On a transfer error the stream is disabled by h/w; account
+	 * only the chars which left the buffer
+	 */
+	sent = priv->tx_dma_len - dma->s[s].ndtr;
+	dma_unmap_single(port->dev, priv->tx_dma_addr, priv->tx_dma_len,
+			 DMA_TO_DEVICE);
+	priv->tx_dma_len = 0;
+
+	xmit->tail = (xmit->tail + sent) & (UART_XMIT_SIZE - 1);
+	port->icount.tx += sent;
+
+	if (uart_circ_chars_pending(xmit) < WAKEUP_CHARS)
+		uart_write_wakeup(port);
+
+	stm32_tx_dma_start(port);
+out:
+	spin_unlock(&port->lock);
+
+	return IRQ_HANDLED;
+}
+#endif /* !CONFIG_ARCH_STM32F1 */
+
 /*
  * Remove stm32 uart device
  */
@@ -1178,6 +1508,7 @@ static int __devinit stm32_probe(struct platform_device *pdev)
 	struct uart_port	*port;
 	struct resource		*usart_reg_res, *usart_irq_res;
 	struct resource		*dma_reg_res, *dma_irq_res;
+	struct stm32_usart_data	*pdata = pdev->dev.platform_data;
 	struct device		*dev = &pdev->dev;
 	int			id = pdev->id, rv;
 
@@ -1259,6 +1590,42 @@ static int __devinit stm32_probe(struct platform_device *pdev)
 	}
 #endif
 
+	/*
+	 * Size of the RX DMA buffers
+	 */
+	priv->rx_buf_len = STM32_DMA_RX_BUF_LEN;
+	if (pdata && pdata->rx_buf_len)
+		priv->rx_buf_len = clamp_t(u32, pdata->rx_buf_len,
+					   STM32_DMA_RX_BUF_MIN,
+					   STM32_DMA_NDTR_NDT_MSK);
+
+	/*
+	 * TX DMA, if requested by the platform
+	 */
+	priv->tx_dma = 0;
+#ifndef CONFIG_ARCH_STM32F1
+	if (pdata && pdata->tx_dma) {
+		struct resource	*tx_dma_irq_res;
+
+		tx_dma_irq_res = platform_get_resource(pdev, IORESOURCE_IRQ, 2);
+		if (!tx_dma_irq_res) {
+			dev_warn(dev, "%s: no TX DMA irq, using PIO\n",
+				 __func__);
+		} else {
+			priv->tx_dma = 1;
+			priv->tx_dma_irq = tx_dma_irq_res->start;
+			priv->tx_ini = stm32_usart_tx_dma[id];
+			if (priv->tx_ini.stream <= STM32_DMA_STREAM_3) {
+				priv->tx_dma_isr  = &priv->reg_dma_base->lisr;
+				priv->tx_dma_ifcr = &priv->reg_dma_base->lifcr;
+			} else {
+				priv->tx_dma_isr  = &priv->reg_dma_base->hisr;
+				priv->tx_dma_ifcr = &priv->reg_dma_base->hifcr;
+			}
+		}
+	}
+#endif
+
 	port->private_data = &stm32_usart_priv[id];
 	dev_set_drvdata(dev, port);
 
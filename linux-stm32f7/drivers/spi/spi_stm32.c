@@ -24,11 +24,17 @@
 #include <linux/gpio.h>
 #include <linux/wait.h>
 #include <linux/delay.h>
+#include <linux/kthread.h>
+#include <linux/completion.h>
+#include <linux/dma-mapping.h>
 #include <linux/spi/spi.h>
 #include <linux/spi/spi_stm32.h>
 #include <mach/platform.h>
 #include <mach/stm32.h>
 #include <mach/iomux.h>
+#if defined(CONFIG_STM32_DMA)
+#include <mach/dmac.h>
+#endif
 
 /*
  * Debug output control. While debugging, have SPI_STM32_DEBUG defined.
@@ -90,6 +96,61 @@ __setup("spi_stm32_debug=", spi_stm32_debug_setup);
 #define	CONFIG_SPI_STM32_POLLED
 #endif
 
+/*
+ * DMA is used for the transfers of the controllers which have been
+ * given DMA channels by the platform
+ */
+#if defined(CONFIG_STM32_DMA) && !defined(CONFIG_ARCH_STM32F1)
+#define SPI_STM32_DMA
+#endif
+
+#if defined(SPI_STM32_DMA)
+
+/*
+ * Transfers of at least this many bytes go over DMA; shorter ones
+ * (commands, addresses, register reads) are cheaper to do in PIO.
+ * The value can be changed for each controller through sysfs.
+ */
+static int spi_stm32_dma_threshold = 64;
+module_param(spi_stm32_dma_threshold, int, S_IRUGO);
+MODULE_PARM_DESC(spi_stm32_dma_threshold,
+	"Default minimal length of a transfer to be done with DMA");
+
+/*
+ * Max number of frames in a single DMA transfer (DMA_SxNDTR)
+ */
+#define SPI_STM32_DMA_MAX		0xFFFF
+
+#endif /* SPI_STM32_DMA */
+
+/*
+ * Messages no longer than this many bytes are transferred right in
+ * the context of the caller of spi_async()/spi_sync(), if the controller
+ * is idle at that time, rather than being passed to the message pump.
+ * This saves two context switches on short transfers, such as sensor
+ * reads. 0 disables this, which is the default: a client that submits
+ * messages from atomic context, or that expects its completion callback
+ * to run in another context, must not be used with this enabled.
+ * The value can be changed for each controller through sysfs.
+ */
+static int spi_stm32_sync_len = 0;
+module_param(spi_stm32_sync_len, int, S_IRUGO);
+MODULE_PARM_DESC(spi_stm32_sync_len,
+	"Default max length of a message to be transferred synchronously");
+
+/*
+ * Transfer statistics of a controller
+ */
+struct spi_stm32_stats {
+	unsigned long			sync_msgs;	/* Msgs done in caller */
+	unsigned long			setups;		/* Slave re-configs */
+	unsigned long			pio_msgs;	/* Msgs done in PIO */
+	unsigned long			pio_bytes;	/* Bytes done in PIO */
+	unsigned long			dma_xfers;	/* Xfers done in DMA */
+	unsigned long			dma_bytes;	/* Bytes done in DMA */
+	unsigned long			dma_errors;	/* Failed DMA xfers */
+};
+
 /*
  * Private data structure for an SPI controller instance
  */
@@ -100,13 +161,18 @@ struct spi_stm32 {
 	unsigned char			stopping;	/* Is being stopped? */
 	spinlock_t 			lock;		/* Exclusive access */
 	struct list_head 		queue;		/* Message Q */
-	struct work_struct		work;		/* Work Q */
-	struct workqueue_struct *	workqueue;	/* Work Q */
+	struct task_struct *		pump;		/* Message pump */
+	int				busy;		/* Msg in progress */
+	int				sync_len;	/* Max sync msg len */
 #if !defined(CONFIG_SPI_STM32_POLLED)
 	wait_queue_head_t		wait;		/* Wait queue */
 	int				irq;		/* IRQ # */
 #endif
 	struct spi_device *		slave;		/* Current SPI slave */
+	unsigned int			slave_mode;	/* ... its mode */
+	unsigned int			slave_hz;	/* ... its rate */
+	unsigned int			slave_bt;	/* ... its frame size */
+	struct spi_device *		cs_slave;	/* Slave with CS held */
 	struct spi_message *		msg;		/* SPI message */
 	volatile int			xfer_status;	/* Xfer status */
 	int				len;		/* Xfer len */
@@ -119,6 +185,15 @@ struct spi_stm32 {
 	int				rx_i;		/* Cur Rx index */
 	int				ti;		/* Tx count */
 	int				ri;		/* Rx count */
+#if defined(SPI_STM32_DMA)
+	int				dma_rx;		/* Rx DMA channel */
+	int				dma_tx;		/* Tx DMA channel */
+	int				dma_threshold;	/* Min len for DMA */
+	struct completion		dma_done;	/* Rx DMA is done */
+	int				dma_error;	/* DMA transfer error */
+	unsigned int			dma_dummy;	/* Rx/Tx w/o buffer */
+#endif
+	struct spi_stm32_stats		stats;		/* Statistics */
 };
 
 /* 
@@ -170,6 +245,8 @@ struct reg_spi {
 #define SPI_CR2_TXEIE			(1<<7)
 #define SPI_CR2_RXNEIE			(1<<6)
 #define SPI_CR2_ERRIE			(1<<5)
+#define SPI_CR2_TXDMAEN			(1<<1)
+#define SPI_CR2_RXDMAEN			(1<<0)
 #define SPI_SR_FRE			(1<<8)
 #define SPI_SR_BSY			(1<<7)
 #define SPI_SR_OVR			(1<<6)
@@ -695,19 +772,25 @@ Done:
  * Prepare for a transfer
  * @param c		controller data structure
  * @param s		slave data structure
+ * @param x		single xfer to run; NULL->entire message
  */
 static void inline spi_stm32_xfer_init(
-	struct spi_stm32 *c, struct spi_device *s)
+	struct spi_stm32 *c, struct spi_device *s, struct spi_transfer *x)
 {
 	struct spi_transfer *t;
 
 	/*
- 	 * Count the total length of the message.
+ 	 * Count the total length of the message (or of the xfer).
  	 */
 	c->len = 0;
 	c->wb = (s->bits_per_word + 7) / 8;
-	list_for_each_entry(t, &c->msg->transfers, transfer_list) {
-		c->len += t->len;
+	if (x) {
+		c->len = x->len;
+	}
+	else {
+		list_for_each_entry(t, &c->msg->transfers, transfer_list) {
+			c->len += t->len;
+		}
 	}
 	c->len /= c->wb;
 
@@ -721,12 +804,12 @@ static void inline spi_stm32_xfer_init(
  	 * We will need to advance separately over 
  	 * transmit and receive data
  	 */
-	c->tx_t = list_entry((&c->msg->transfers)->next,
+	c->tx_t = x ? x : list_entry((&c->msg->transfers)->next,
 		   struct spi_transfer, transfer_list);
 	c->tx_l = c->tx_t->len / c->wb;
 	c->tx_i = 0;
 	c->ti = 0;
-	c->rx_t = list_entry((&c->msg->transfers)->next,
+	c->rx_t = x ? x : list_entry((&c->msg->transfers)->next,
 		   struct spi_transfer, transfer_list);
 	c->rx_l = c->rx_t->len / c->wb;
 	c->rx_i = 0;
@@ -803,11 +886,13 @@ static void inline spi_stm32_xfer_rx_next(struct spi_stm32 *c)
  * Transfer a message in PIO, polled mode
  * @param c		controller data structure
  * @param s		slave data structure
+ * @param x		single xfer to run; NULL->entire message
  * @param		pointer to actual transfer length (set here)
  * @returns		0->success, <0->error code
  */
 static int spi_stm32_pio_polled(
-	struct spi_stm32 *c, struct spi_device *s, int *rlen)
+	struct spi_stm32 *c, struct spi_device *s, struct spi_transfer *x,
+	int *rlen)
 {
 	int i;
 	int ret = 0;
@@ -815,7 +900,7 @@ static int spi_stm32_pio_polled(
 	/*
  	 * Prepare to run a transfer
  	 */
-	spi_stm32_xfer_init(c, s);
+	spi_stm32_xfer_init(c, s, x);
 
 	/*
  	 * Perform the transfer. Transfer is done when all frames
@@ -857,7 +942,7 @@ static int spi_stm32_pio_polled(
 	/*
  	 * Return the number of bytes actully transferred
  	 */
-	*rlen = c->ri;
+	*rlen = c->ri * c->wb;
 Done:
 	spi_stm32_hw_rxfifo_purge(c);
 	d_printk(3, "msg=%p,len=%d,rlen=%d,ret=%d\n", 
@@ -914,11 +999,13 @@ static irqreturn_t spi_stm32_irq(int irq, void *dev_id)
  * Transfer a message in PIO, interrupted mode
  * @param c		controller data structure
  * @param s		slave data structure
+ * @param x		single xfer to run; NULL->entire message
  * @param		pointer to actual transfer length (set here)
  * @returns		0->success, <0->error code
  */
 static int spi_stm32_pio_interrupted(
-	struct spi_stm32 *c, struct spi_device *s, int *rlen)
+	struct spi_stm32 *c, struct spi_device *s, struct spi_transfer *x,
+	int *rlen)
 {
 	struct spi_stm32_slv *v = s->controller_data;
 	int ret = 0;
@@ -926,7 +1013,7 @@ static int spi_stm32_pio_interrupted(
 	/*
  	 * Prepare to run a transfer
  	 */
-	spi_stm32_xfer_init(c, s);
+	spi_stm32_xfer_init(c, s, x);
 
 	/*
  	 * Start the transfer
@@ -949,7 +1036,7 @@ static int spi_stm32_pio_interrupted(
 			 * Success ->
  	 		 * Return the number of bytes actully transferred
  	 		 */
-			*rlen = c->ri;
+			*rlen = c->ri * c->wb;
 		}
 	}
 	c->xfer_status = 0;
@@ -961,6 +1048,228 @@ static int spi_stm32_pio_interrupted(
 
 #endif
 
+/*
+ * Transfer a message, or a single xfer of it, in PIO
+ * @param c		controller data structure
+ * @param s		slave data structure
+ * @param x		single xfer to run; NULL->entire message
+ * @param		pointer to actual transfer length (set here)
+ * @returns		0->success, <0->error code
+ */
+static inline int spi_stm32_pio(
+	struct spi_stm32 *c, struct spi_device *s, struct spi_transfer *x,
+	int *rlen)
+{
+	int ret;
+
+#if defined(CONFIG_SPI_STM32_POLLED)
+	ret = spi_stm32_pio_polled(c, s, x, rlen);
+#else
+	ret = spi_stm32_pio_interrupted(c, s, x, rlen);
+#endif
+	if (!ret) {
+		c->stats.pio_bytes += *rlen;
+	}
+	return ret;
+}
+
+#if defined(SPI_STM32_DMA)
+
+/*
+ * DMA Rx completion and Rx/Tx error handler
+ * @param ch		DMA channel
+ * @param flags		events which caused the interrupt
+ * @param data		controller data structure
+ */
+static void spi_stm32_dma_irq(int ch, unsigned long flags, void *data)
+{
+	struct spi_stm32 *c = data;
+
+	if (flags & STM32_DMA_INTERROR) {
+		c->dma_error = 1;
+	}
+	complete(&c->dma_done);
+}
+
+/*
+ * Set up a DMA channel for a single DMA transfer
+ * @param c		controller data structure
+ * @param ch		DMA channel
+ * @param dir		0->peripheral-to-memory; 1->memory-to-peripheral
+ * @param addr		memory address
+ * @param inc		increment memory address?
+ * @param n		number of frames
+ * @returns		0->success, <0->error code
+ */
+static int spi_stm32_dma_ch_setup(
+	struct spi_stm32 *c, int ch, int dir, dma_addr_t addr, int inc, int n)
+{
+	int ret;
+
+	/*
+	 * Byte-wide direct mode transfers to/from the data register,
+	 * high priority
+	 */
+	if ((ret = stm32_dma_ch_init(ch, dir, 0, 2, 0, 0)) ||
+	    (ret = stm32_dma_ch_init_fifo(ch, 0, 0)) ||
+	    (ret = stm32_dma_ch_set_periph(ch, (u32)&SPI(c)->spi_dr,
+					   0, 0, 0)) ||
+	    (ret = stm32_dma_ch_set_memory(ch, (u32)addr, inc, 0, 0)) ||
+	    (ret = stm32_dma_ch_set_nitems(ch, n))) {
+		goto Done;
+	}
+
+Done:
+	d_printk(4, "ch=%d,dir=%d,addr=%x,n=%d,ret=%d\n",
+		 ch, dir, addr, n, ret);
+	return ret;
+}
+
+/*
+ * Transfer a single xfer in DMA
+ * @param c		controller data structure
+ * @param s		slave data structure
+ * @param x		xfer to run
+ * @param		pointer to actual transfer length (set here)
+ * @returns		0->success, <0->error code
+ */
+static int spi_stm32_dma(
+	struct spi_stm32 *c, struct spi_device *s, struct spi_transfer *x,
+	int *rlen)
+{
+	struct spi_stm32_slv *v = s->controller_data;
+	struct device *d = &c->slave->master->dev;
+	dma_addr_t tx_dma = 0, rx_dma = 0, dummy_dma = 0;
+	unsigned int cr2;
+	unsigned int i, n;
+	int ret = 0;
+
+	*rlen = 0;
+
+	/*
+	 * Map the buffers, unless the caller has done that already.
+	 * A missing buffer is replaced with the dummy word, fixed address.
+	 */
+	if (x->tx_buf) {
+		tx_dma = c->msg->is_dma_mapped ? x->tx_dma :
+			dma_map_single(d, (void *)x->tx_buf, x->len,
+				       DMA_TO_DEVICE);
+	}
+	if (x->rx_buf) {
+		rx_dma = c->msg->is_dma_mapped ? x->rx_dma :
+			dma_map_single(d, x->rx_buf, x->len,
+				       DMA_FROM_DEVICE);
+	}
+	if (!x->tx_buf || !x->rx_buf) {
+		c->dma_dummy = 0;
+		dummy_dma = dma_map_single(d, &c->dma_dummy,
+					   sizeof(c->dma_dummy),
+					   DMA_BIDIRECTIONAL);
+	}
+
+	/*
+	 * PIO is driven by the RXNE interrupt; keep it quiet while DMA
+	 * is reading the data register
+	 */
+	cr2 = readl(&SPI(c)->spi_cr2);
+	writel(cr2 & ~SPI_CR2_RXNEIE, &SPI(c)->spi_cr2);
+	spi_stm32_hw_rxfifo_purge(c);
+
+	for (i = 0; i < x->len; i += n) {
+		n = min_t(unsigned int, x->len - i, SPI_STM32_DMA_MAX);
+
+		/*
+		 * Set up Rx first, so that no incoming frame is missed
+		 */
+		if ((ret = spi_stm32_dma_ch_setup(c, c->dma_rx, 0,
+			x->rx_buf ? rx_dma + i : dummy_dma,
+			!!x->rx_buf, n)) ||
+		    (ret = spi_stm32_dma_ch_setup(c, c->dma_tx, 1,
+			x->tx_buf ? tx_dma + i : dummy_dma,
+			!!x->tx_buf, n))) {
+			goto Done;
+		}
+
+		INIT_COMPLETION(c->dma_done);
+		c->dma_error = 0;
+		stm32_dma_ch_enable(c->dma_rx);
+		stm32_dma_ch_enable(c->dma_tx);
+
+		/*
+		 * Let the controller kick DMA off
+		 */
+		writel(readl(&SPI(c)->spi_cr2) |
+		       SPI_CR2_RXDMAEN | SPI_CR2_TXDMAEN, &SPI(c)->spi_cr2);
+
+		/*
+		 * Once the last frame is received, the xfer is over
+		 */
+		if (!wait_for_completion_timeout(&c->dma_done,
+				(v->timeout ? v->timeout : 1) * HZ)) {
+			ret = -ETIMEDOUT;
+		}
+		else if (c->dma_error) {
+			ret = -EIO;
+		}
+
+		writel(readl(&SPI(c)->spi_cr2) &
+		       ~(SPI_CR2_RXDMAEN | SPI_CR2_TXDMAEN), &SPI(c)->spi_cr2);
+		stm32_dma_ch_disable(c->dma_tx);
+		stm32_dma_ch_disable(c->dma_rx);
+
+		if (ret) {
+			goto Done;
+		}
+		*rlen += n;
+	}
+
+Done:
+	writel(cr2, &SPI(c)->spi_cr2);
+
+	if (x->tx_buf && !c->msg->is_dma_mapped) {
+		dma_unmap_single(d, tx_dma, x->len, DMA_TO_DEVICE);
+	}
+	if (x->rx_buf && !c->msg->is_dma_mapped) {
+		dma_unmap_single(d, rx_dma, x->len, DMA_FROM_DEVICE);
+	}
+	if (!x->tx_buf || !x->rx_buf) {
+		dma_unmap_single(d, dummy_dma, sizeof(c->dma_dummy),
+				 DMA_BIDIRECTIONAL);
+	}
+
+	if (ret) {
+		c->stats.dma_errors++;
+	}
+	else {
+		c->stats.dma_xfers++;
+		c->stats.dma_bytes += *rlen;
+	}
+
+	d_printk(3, "msg=%p,len=%d,rlen=%d,ret=%d\n",
+		 c->msg, x->len, *rlen, ret);
+	return ret;
+}
+
+/*
+ * Check if an xfer is to be done in DMA
+ * @param c		controller data structure
+ * @param s		slave data structure
+ * @param x		xfer
+ * @returns		!0->DMA,0->PIO
+ */
+static inline int spi_stm32_xfer_dma(
+	struct spi_stm32 *c, struct spi_device *s, struct spi_transfer *x)
+{
+	/*
+	 * PIO sends wider frames MSB-first from the byte stream;
+	 * keep DMA to 8-bit frames so that the wire format is the same.
+	 */
+	return c->dma_rx >= 0 && s->bits_per_word == 8 &&
+		x->len >= c->dma_threshold;
+}
+
+#endif /* SPI_STM32_DMA */
+
 /*
  * Transfer a message 
  * @param c		controller data structure
@@ -970,7 +1279,7 @@ static int spi_stm32_pio_interrupted(
 static int spi_stm32_handle_message(
 	struct spi_stm32 *c, struct spi_message *msg)
 {
-#if defined(SPI_STM32_DEBUG)
+#if defined(SPI_STM32_DEBUG) || defined(SPI_STM32_DMA)
 	struct spi_transfer *t;
 #endif
 	struct spi_device *s = msg->spi;
@@ -979,33 +1288,82 @@ static int spi_stm32_handle_message(
 
 
 	/*
- 	 * Check if the current slave of this controller is
- 	 * the message's SPI device, and if not, set 
+	 * If the previous message has left chip select active
+	 * for another slave, release it now
+	 */
+	if (c->cs_slave && c->cs_slave != s) {
+		spi_stm32_release_slave(c, c->cs_slave);
+		c->cs_slave = NULL;
+	}
+
+	/*
+ 	 * Check if the controller is set up for the message's SPI device,
+ 	 * with the same mode, rate and frame size, and if not, set
  	 * the speed and mode select for the slave
  	 */
-	if (c->slave != s) {
+	if (c->slave != s || c->slave_mode != s->mode ||
+	    c->slave_hz != s->max_speed_hz ||
+	    c->slave_bt != s->bits_per_word) {
 		c->slave = s;
+		c->stats.setups++;
 		ret = spi_stm32_prepare_for_slave(c, s);
 		if (ret) {
 			c->slave = NULL;
 			goto Done;
 		}
+		c->slave_mode = s->mode;
+		c->slave_hz = s->max_speed_hz;
+		c->slave_bt = s->bits_per_word;
 	}
 
 	/*
-	 * Activate chip select for the slave
+	 * Activate chip select for the slave, unless it has been kept
+	 * active since the previous message
 	 */
-	spi_stm32_capture_slave(c, s);
+	if (c->cs_slave != s) {
+		spi_stm32_capture_slave(c, s);
+		c->cs_slave = s;
+	}
 
 	/*
  	 * Transfer the message over the wire
  	 */
 	c->msg = msg;
-#if defined(CONFIG_SPI_STM32_POLLED)
-	ret = spi_stm32_pio_polled(c, s, &rlen);
-#else
-	ret = spi_stm32_pio_interrupted(c, s, &rlen);
+#if defined(SPI_STM32_DMA)
+	/*
+	 * If any of the xfers is long enough to be worth DMA,
+	 * go xfer by xfer, each in its own mode
+	 */
+	list_for_each_entry(t, &msg->transfers, transfer_list) {
+		if (spi_stm32_xfer_dma(c, s, t)) {
+			break;
+		}
+	}
+	if (&t->transfer_list != &msg->transfers) {
+		list_for_each_entry(t, &msg->transfers, transfer_list) {
+			int l = 0;
+
+			if (!t->len) {
+				continue;
+			}
+			if (spi_stm32_xfer_dma(c, s, t)) {
+				ret = spi_stm32_dma(c, s, t, &l);
+			}
+			else {
+				c->stats.pio_msgs++;
+				ret = spi_stm32_pio(c, s, t, &l);
+			}
+			rlen += l;
+			if (ret) {
+				goto Done;
+			}
+		}
+		msg->actual_length = rlen;
+		goto Done;
+	}
 #endif
+	c->stats.pio_msgs++;
+	ret = spi_stm32_pio(c, s, NULL, &rlen);
 	if (ret) {
 		goto Done;
 	}
@@ -1014,9 +1372,16 @@ static int spi_stm32_handle_message(
 
 Done:
 	/*
-	 * Release chip select for the slave
+	 * Release chip select for the slave, unless the client has asked
+	 * to keep it active after the message (cs_change on the last xfer)
+	 * and the message went fine. In that case, chip select is released
+	 * once there is a message for another slave.
 	 */
-	spi_stm32_release_slave(c, s);
+	if (ret || !list_entry(msg->transfers.prev,
+			struct spi_transfer, transfer_list)->cs_change) {
+		spi_stm32_release_slave(c, s);
+		c->cs_slave = NULL;
+	}
 
 #if defined(SPI_STM32_DEBUG)
 	list_for_each_entry(t, &msg->transfers, transfer_list) {
@@ -1037,53 +1402,62 @@ Done:
 }
 
 /*
- * Handle a ping to the workqueue
- * @param w		work data structure
+ * Transfer a message and let the upper layers complete processing of it
+ * @param c		controller data structure
+ * @param msg		message
+ */
+static inline void spi_stm32_pump_message(
+	struct spi_stm32 *c, struct spi_message *msg)
+{
+	msg->status = spi_stm32_handle_message(c, msg);
+	msg->complete(msg->context);
+}
+
+/*
+ * Message pump thread: transfers messages queued to the controller
+ * @param data		controller data structure
+ * @returns		0
  */
-static void spi_stm32_handle(struct work_struct *w)
+static int spi_stm32_pump(void *data)
 {
+	struct spi_stm32 *c = data;
 	struct spi_message *msg;
-	struct spi_stm32 *c = container_of(w, struct spi_stm32, work);
 	unsigned long f = 0;
 
-	/*
-	 * In atomic manner 
-	 */
-	spin_lock_irqsave(&c->lock, f);
+	while (!kthread_should_stop()) {
 
-	/*
- 	 * Check if the message queue has messages
- 	 */
-	while (!c->xfer_status && !list_empty(&c->queue)) {
+		/*
+		 * Sleep until there is something to do. The state is set
+		 * before checking, so that a wake-up isn't missed.
+		 */
+		set_current_state(TASK_INTERRUPTIBLE);
+		spin_lock_irqsave(&c->lock, f);
+		if (c->busy || c->xfer_status || list_empty(&c->queue)) {
+			spin_unlock_irqrestore(&c->lock, f);
+			schedule();
+			continue;
+		}
+		__set_current_state(TASK_RUNNING);
 
 		/*
-		 * Extract the next message from the queue
+		 * Extract the next message from the queue and
+		 * transfer it over SPI wires
 		 */
 		msg = list_entry(c->queue.next, struct spi_message, queue);
 		list_del_init(&msg->queue);
-
+		c->busy = 1;
 		spin_unlock_irqrestore(&c->lock, f);
 
-		/*
-		 * Transfer the message over SPI wires
-		 */
-		msg->status = spi_stm32_handle_message(c, msg);
+		spi_stm32_pump_message(c, msg);
 
-		/*
- 		 * Let the upper layers complete processing of the message
- 		 */
-		msg->complete(msg->context);
-
-		/*
- 		 * Re-acquire the lock and go check the message list again
- 		 */
 		spin_lock_irqsave(&c->lock, f);
+		c->busy = 0;
+		spin_unlock_irqrestore(&c->lock, f);
 	}
+	__set_current_state(TASK_RUNNING);
 
-	/*
-	 * Release the lock and return
-	 */
-	spin_unlock_irqrestore(&c->lock, f);
+	d_printk(1, "bus=%d\n", c->bus);
+	return 0;
 }
 
 /*
@@ -1117,6 +1491,9 @@ static int spi_stm32_setup(struct spi_device *s)
 	/*
 	 * Make sure Chip Select is inactive for this slave
 	 */
+	if (c->cs_slave == s) {
+		c->cs_slave = NULL;
+	}
 	spi_stm32_release_slave(c, s);
 
 Done:
@@ -1144,7 +1521,9 @@ static void spi_stm32_cleanup(struct spi_device *s)
 static int spi_stm32_transfer(struct spi_device *s, struct spi_message *msg)
 {
 	struct spi_stm32 *c = spi_master_get_devdata(s->master);
+	struct spi_transfer *t;
 	unsigned long f;
+	int len = 0;
 	int ret = 0;
 
 	/*
@@ -1170,12 +1549,41 @@ static int spi_stm32_transfer(struct spi_device *s, struct spi_message *msg)
 	msg->actual_length = 0;
 
 	/*
-	 * In atomic manner: add the message to the message queue
-	 * and ping the workqueue thread letting it process the message
+	 * A short message is transferred right here, provided that
+	 * we are allowed to sleep and the controller is idle
 	 */
+	if (c->sync_len && !in_atomic() && !irqs_disabled()) {
+		list_for_each_entry(t, &msg->transfers, transfer_list) {
+			len += t->len;
+		}
+	}
 	spin_lock_irqsave(&c->lock, f);
+	if (len && len <= c->sync_len &&
+	    !c->busy && !c->xfer_status && list_empty(&c->queue)) {
+		c->busy = 1;
+		c->stats.sync_msgs++;
+		spin_unlock_irqrestore(&c->lock, f);
+
+		spi_stm32_pump_message(c, msg);
+
+		/*
+		 * Kick the pump, in case messages were queued meanwhile
+		 */
+		spin_lock_irqsave(&c->lock, f);
+		c->busy = 0;
+		if (!list_empty(&c->queue)) {
+			wake_up_process(c->pump);
+		}
+		spin_unlock_irqrestore(&c->lock, f);
+		goto Done;
+	}
+
+	/*
+	 * In atomic manner: add the message to the message queue
+	 * and ping the pump thread letting it process the message
+	 */
 	list_add_tail(&msg->queue, &c->queue);
-	queue_work(c->workqueue, &c->work);
+	wake_up_process(c->pump);
 	spin_unlock_irqrestore(&c->lock, f);
 
 Done:
@@ -1183,6 +1591,182 @@ Done:
 	return ret;
 }
 
+#if defined(SPI_STM32_DMA)
+
+/*
+ * Acquire the DMA channels passed by the platform. If there are none,
+ * or they can't be acquired, the controller works in PIO.
+ * @dev			SPI controller platform device
+ * @c			controller data structure
+ */
+static void spi_stm32_dma_init(struct platform_device *dev, struct spi_stm32 *c)
+{
+	struct resource *rx, *tx;
+	int ret = 0;
+
+	c->dma_rx = -1;
+	c->dma_tx = -1;
+	c->dma_threshold = spi_stm32_dma_threshold;
+	init_completion(&c->dma_done);
+
+	rx = platform_get_resource(dev, IORESOURCE_DMA, 0);
+	tx = platform_get_resource(dev, IORESOURCE_DMA, 1);
+	if (!rx || !tx) {
+		goto Done;
+	}
+
+	if ((ret = stm32_dma_ch_get(rx->start))) {
+		goto Done;
+	}
+	if ((ret = stm32_dma_ch_get(tx->start))) {
+		goto Error_put_rx;
+	}
+	ret = stm32_dma_ch_request_irq(rx->start, spi_stm32_dma_irq,
+				       STM32_DMA_INTCOMPLETE |
+				       STM32_DMA_INTERROR, c);
+	if (ret) {
+		goto Error_put_tx;
+	}
+	ret = stm32_dma_ch_request_irq(tx->start, spi_stm32_dma_irq,
+				       STM32_DMA_INTERROR, c);
+	if (ret) {
+		goto Error_free_rx;
+	}
+
+	c->dma_rx = rx->start;
+	c->dma_tx = tx->start;
+	goto Done;
+
+Error_free_rx:
+	stm32_dma_ch_free_irq(rx->start, c);
+Error_put_tx:
+	stm32_dma_ch_put(tx->start);
+Error_put_rx:
+	stm32_dma_ch_put(rx->start);
+	dev_warn(&dev->dev, "unable to get DMA channels %d/%d (%d), "
+		 "using PIO\n", rx->start, tx->start, ret);
+Done:
+	d_printk(1, "bus=%d,rx=%d,tx=%d,ret=%d\n",
+		 c->bus, c->dma_rx, c->dma_tx, ret);
+}
+
+/*
+ * Release the DMA channels
+ * @c			controller data structure
+ */
+static void spi_stm32_dma_release(struct spi_stm32 *c)
+{
+	if (c->dma_rx >= 0) {
+		stm32_dma_ch_free_irq(c->dma_tx, c);
+		stm32_dma_ch_free_irq(c->dma_rx, c);
+		stm32_dma_ch_put(c->dma_rx);
+		stm32_dma_ch_put(c->dma_tx);
+		c->dma_rx = -1;
+		c->dma_tx = -1;
+	}
+}
+
+/*
+ * Show the DMA threshold of a controller
+ */
+static ssize_t spi_stm32_dma_threshold_show(
+	struct device *d, struct device_attribute *attr, char *buf)
+{
+	struct spi_master *m = platform_get_drvdata(to_platform_device(d));
+	struct spi_stm32 *c = spi_master_get_devdata(m);
+
+	return sprintf(buf, "%d\n", c->dma_threshold);
+}
+
+/*
+ * Set the DMA threshold of a controller
+ */
+static ssize_t spi_stm32_dma_threshold_store(
+	struct device *d, struct device_attribute *attr,
+	const char *buf, size_t count)
+{
+	struct spi_master *m = platform_get_drvdata(to_platform_device(d));
+	struct spi_stm32 *c = spi_master_get_devdata(m);
+	unsigned long v;
+
+	if (strict_strtoul(buf, 0, &v) || v > INT_MAX) {
+		return -EINVAL;
+	}
+	c->dma_threshold = v;
+	return count;
+}
+
+static DEVICE_ATTR(dma_threshold, S_IRUGO | S_IWUSR,
+		   spi_stm32_dma_threshold_show, spi_stm32_dma_threshold_store);
+
+#endif /* SPI_STM32_DMA */
+
+/*
+ * Show the max length of a message transferred synchronously
+ */
+static ssize_t spi_stm32_sync_len_show(
+	struct device *d, struct device_attribute *attr, char *buf)
+{
+	struct spi_master *m = platform_get_drvdata(to_platform_device(d));
+	struct spi_stm32 *c = spi_master_get_devdata(m);
+
+	return sprintf(buf, "%d\n", c->sync_len);
+}
+
+/*
+ * Set the max length of a message transferred synchronously
+ */
+static ssize_t spi_stm32_sync_len_store(
+	struct device *d, struct device_attribute *attr,
+	const char *buf, size_t count)
+{
+	struct spi_master *m = platform_get_drvdata(to_platform_device(d));
+	struct spi_stm32 *c = spi_master_get_devdata(m);
+	unsigned long v;
+
+	if (strict_strtoul(buf, 0, &v) || v > INT_MAX) {
+		return -EINVAL;
+	}
+	c->sync_len = v;
+	return count;
+}
+
+static DEVICE_ATTR(sync_len, S_IRUGO | S_IWUSR,
+		   spi_stm32_sync_len_show, spi_stm32_sync_len_store);
+
+/*
+ * Show the transfer statistics of a controller
+ */
+static ssize_t spi_stm32_stats_show(
+	struct device *d, struct device_attribute *attr, char *buf)
+{
+	struct spi_master *m = platform_get_drvdata(to_platform_device(d));
+	struct spi_stm32 *c = spi_master_get_devdata(m);
+
+	return sprintf(buf,
+		"sync_msgs %lu\nsetups %lu\n"
+		"pio_msgs %lu\npio_bytes %lu\n"
+		"dma_xfers %lu\ndma_bytes %lu\ndma_errors %lu\n",
+		c->stats.sync_msgs, c->stats.setups,
+		c->stats.pio_msgs, c->stats.pio_bytes,
+		c->stats.dma_xfers, c->stats.dma_bytes, c->stats.dma_errors);
+}
+
+static DEVICE_ATTR(stats, S_IRUGO, spi_stm32_stats_show, NULL);
+
+static struct attribute *spi_stm32_attrs[] = {
+	&dev_attr_stats.attr,
+	&dev_attr_sync_len.attr,
+#if defined(SPI_STM32_DMA)
+	&dev_attr_dma_threshold.attr,
+#endif
+	NULL
+};
+
+static struct attribute_group spi_stm32_attr_group = {
+	.attrs = spi_stm32_attrs,
+};
+
 /*
  * Instantiate an SPI controller
  * @dev			SPI controller platform device
@@ -1284,18 +1868,6 @@ static int __devinit spi_stm32_probe(struct platform_device *dev)
 	init_waitqueue_head(&c->wait);
 #endif
 
-	/*
- 	 * Create a workqueue and register the handler
- 	 */
-	c->workqueue = create_singlethread_workqueue(dev_name(&dev->dev));
-	if (!c->workqueue) {
-		dev_err(&dev->dev, "unable to create workqueue for "
-			"SPI controller %d\n", bus);
-		ret = -ENXIO;
-		goto Error_release_irq;
-	}
-	INIT_WORK(&c->work, spi_stm32_handle);
-
 	/*
  	 * Set up queue of messages
  	 */
@@ -1306,6 +1878,20 @@ static int __devinit spi_stm32_probe(struct platform_device *dev)
  	 */
 	spin_lock_init(&c->lock);
 	c->xfer_status = 0;
+	c->busy = 0;
+	c->sync_len = spi_stm32_sync_len;
+	c->cs_slave = NULL;
+
+	/*
+ 	 * Start the message pump thread
+ 	 */
+	c->pump = kthread_run(spi_stm32_pump, c, "%s", dev_name(&dev->dev));
+	if (IS_ERR(c->pump)) {
+		dev_err(&dev->dev, "unable to create message pump for "
+			"SPI controller %d\n", bus);
+		ret = PTR_ERR(c->pump);
+		goto Error_release_irq;
+	}
 
 	/* 
  	 * Initialize the controller hardware
@@ -1314,9 +1900,16 @@ static int __devinit spi_stm32_probe(struct platform_device *dev)
 		dev_err(&dev->dev, "unable to initialize hardware for "
 			"SPI controller %d\n", bus);
 		ret = -ENXIO;
-		goto Error_release_workqueue;
+		goto Error_release_pump;
 	}
 
+#if defined(SPI_STM32_DMA)
+	/*
+	 * Set up DMA, if the platform wants it for this controller
+	 */
+	spi_stm32_dma_init(dev, c);
+#endif
+
 	/*
  	 * Figure the clock rate for this controller.
  	 * This is passed to us by the platform.
@@ -1363,12 +1956,25 @@ static int __devinit spi_stm32_probe(struct platform_device *dev)
  	 */
 	platform_set_drvdata(dev, m);
 
+	/*
+	 * Statistics and tunables in sysfs; not fatal if this fails
+	 */
+	if (sysfs_create_group(&dev->dev.kobj, &spi_stm32_attr_group)) {
+		dev_warn(&dev->dev, "unable to create sysfs attributes\n");
+	}
+
 	/*
 	 * If we are here, we are successful
 	 */
 #if !defined(CONFIG_SPI_STM32_POLLED)
+#if defined(SPI_STM32_DMA)
+	dev_info(&dev->dev, "SPI Controller %d at %p,irq=%d,hz=%d,dma=%d/%d\n",
+		 m->bus_num, c->regs, c->irq, c->speed_hz,
+		 c->dma_rx, c->dma_tx);
+#else
 	dev_info(&dev->dev, "SPI Controller %d at %p,irq=%d,hz=%d\n",
 		 m->bus_num, c->regs, c->irq, c->speed_hz);
+#endif
 #else
 	dev_info(&dev->dev, "SPI Controller %d at %p,hz=%d\n",
 		 m->bus_num, c->regs, c->speed_hz);
@@ -1379,9 +1985,12 @@ static int __devinit spi_stm32_probe(struct platform_device *dev)
 	 * Error processing
 	 */
 Error_release_hardware: 
+#if defined(SPI_STM32_DMA)
+	spi_stm32_dma_release(c);
+#endif
 	spi_stm32_hw_release(c);
-Error_release_workqueue: 
-	destroy_workqueue(c->workqueue);
+Error_release_pump: 
+	kthread_stop(c->pump);
 Error_release_irq: 
 #if !defined(CONFIG_SPI_STM32_POLLED)
 	free_irq(c->irq, c);
@@ -1434,14 +2043,27 @@ static int __devexit spi_stm32_remove(struct platform_device *dev)
 	}
 	spin_unlock_irqrestore(&c->lock, f);
 
+	/*
+	 * Stop the message pump and release chip select,
+	 * if it has been kept active after the last message
+	 */
+	kthread_stop(c->pump);
+	if (c->cs_slave) {
+		spi_stm32_release_slave(c, c->cs_slave);
+		c->cs_slave = NULL;
+	}
+
 	/*
 	 * Release kernel resources.
 	 */
+	sysfs_remove_group(&dev->dev.kobj, &spi_stm32_attr_group);
+#if defined(SPI_STM32_DMA)
+	spi_stm32_dma_release(c);
+#endif
 	spi_unregister_master(m);
 #if !defined(CONFIG_SPI_STM32_POLLED)
 	free_irq(c->irq, c);
 #endif
-	destroy_workqueue(c->workqueue);
 	iounmap(c->regs);
 	spi_master_put(m);
 	platform_set_drvdata(dev, NULL);
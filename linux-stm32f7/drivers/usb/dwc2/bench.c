@@ -0,0 +1,232 @@
+/*
+ * bench.c - DesignWare HS OTG Controller bulk throughput benchmark
+ *
+ * Binds to a Linux-USB "Gadget Zero" device, running g_zero with its
+ * f_sourcesink configuration, and times bulk OUT transfers to the sink
+ * endpoint and bulk IN transfers from the source endpoint. The results,
+ * in KB/s, show the effect of the DMA mode (buffer or descriptor) and of
+ * the FIFO sizes of the host controller.
+ *
+ * Up to depth URBs of size bytes each are kept in flight, so that the
+ * controller never waits for the CPU between URBs. The benchmark runs
+ * from probe, in khubd, so each direction is cut short after timeout
+ * seconds, for a device that stops answering.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/ktime.h>
+#include <linux/completion.h>
+#include <linux/usb.h>
+#include <asm/div64.h>
+
+static unsigned int size = 16384;
+module_param(size, uint, S_IRUGO);
+MODULE_PARM_DESC(size, "Bytes per URB (default: 16384)");
+
+static unsigned int depth = 4;
+module_param(depth, uint, S_IRUGO);
+MODULE_PARM_DESC(depth, "URBs in flight (default: 4)");
+
+static unsigned int total = 16;
+module_param(total, uint, S_IRUGO);
+MODULE_PARM_DESC(total, "MB to move in each direction (default: 16)");
+
+static unsigned int timeout = 30;
+module_param(timeout, uint, S_IRUGO);
+MODULE_PARM_DESC(timeout, "Seconds allowed for each direction (default: 30)");
+
+/* Gadget Zero, as set up by drivers/usb/gadget/zero.c */
+#define DWC2_BENCH_VENDOR	0x0525
+#define DWC2_BENCH_PRODUCT	0xa4a0
+
+struct dwc2_bench {
+	struct completion	done;
+	atomic_t		pending;	/* URBs in flight */
+	unsigned int		left;		/* URBs still to submit */
+	int			status;		/* First error */
+};
+
+static void dwc2_bench_complete(struct urb *urb)
+{
+	struct dwc2_bench *b = urb->context;
+
+	if (urb->status && !b->status)
+		b->status = urb->status;
+
+	if (!b->status && b->left) {
+		b->left--;
+		if (usb_submit_urb(urb, GFP_ATOMIC) == 0)
+			return;
+		b->status = -EIO;
+	}
+
+	if (atomic_dec_and_test(&b->pending))
+		complete(&b->done);
+}
+
+/*
+ * Move total MB through @pipe, and report the throughput
+ */
+static int dwc2_bench_run(struct usb_device *udev, unsigned int pipe,
+			  const char *name)
+{
+	struct dwc2_bench b;
+	struct urb **urbs;
+	unsigned int count = DIV_ROUND_UP(total << 20, size);
+	unsigned int i, n = min(depth, count);
+	ktime_t t0;
+	u64 kbps;
+	u32 us;
+	int ret = 0;
+
+	urbs = kcalloc(n, sizeof(*urbs), GFP_KERNEL);
+	if (!urbs)
+		return -ENOMEM;
+
+	for (i = 0; i < n; i++) {
+		urbs[i] = usb_alloc_urb(0, GFP_KERNEL);
+		if (!urbs[i]) {
+			ret = -ENOMEM;
+			goto out;
+		}
+		urbs[i]->transfer_buffer = usb_buffer_alloc(udev, size,
+			GFP_KERNEL, &urbs[i]->transfer_dma);
+		if (!urbs[i]->transfer_buffer) {
+			ret = -ENOMEM;
+			goto out;
+		}
+		usb_fill_bulk_urb(urbs[i], udev, pipe,
+			urbs[i]->transfer_buffer, size,
+			dwc2_bench_complete, &b);
+		urbs[i]->transfer_flags |= URB_NO_TRANSFER_DMA_MAP;
+		if (usb_pipeout(pipe))
+			memset(urbs[i]->transfer_buffer, 0, size);
+	}
+
+	init_completion(&b.done);
+	atomic_set(&b.pending, n);
+	b.left = count - n;
+	b.status = 0;
+
+	t0 = ktime_get();
+	for (i = 0; i < n; i++) {
+		ret = usb_submit_urb(urbs[i], GFP_KERNEL);
+		if (ret) {
+			b.status = ret;
+			b.left = 0;
+			/* The URBs not submitted will never complete */
+			if (atomic_sub_and_test(n - i, &b.pending))
+				complete(&b.done);
+			break;
+		}
+	}
+	if (!wait_for_completion_timeout(&b.done, timeout * HZ)) {
+		/* Stop resubmitting, and wait for the URBs to come back */
+		b.status = -ETIMEDOUT;
+		for (i = 0; i < n; i++)
+			usb_kill_urb(urbs[i]);
+		wait_for_completion(&b.done);
+	}
+	us = ktime_to_us(ktime_sub(ktime_get(), t0));
+
+	ret = b.status;
+	if (ret) {
+		dev_err(&udev->dev, "%s: failed: %d\n", name, ret);
+		goto out;
+	}
+
+	kbps = (u64)count * size * 1000000 / 1024;
+	do_div(kbps, max(us, 1U));
+	dev_info(&udev->dev, "%s: %u x %u bytes, %u in flight: %u us, "
+		 "%llu KB/s\n", name, count, size, n, us,
+		 (unsigned long long)kbps);
+
+out:
+	for (i = 0; i < n; i++) {
+		if (!urbs[i])
+			break;
+		if (urbs[i]->transfer_buffer)
+			usb_buffer_free(udev, size, urbs[i]->transfer_buffer,
+					urbs[i]->transfer_dma);
+		usb_free_urb(urbs[i]);
+	}
+	kfree(urbs);
+	return ret;
+}
+
+static int dwc2_bench_probe(struct usb_interface *intf,
+			    const struct usb_device_id *id)
+{
+	struct usb_device *udev = interface_to_usbdev(intf);
+	struct usb_host_interface *alt = intf->cur_altsetting;
+	struct usb_endpoint_descriptor *in = NULL, *out = NULL;
+	int i;
+
+	for (i = 0; i < alt->desc.bNumEndpoints; i++) {
+		struct usb_endpoint_descriptor *ep = &alt->endpoint[i].desc;
+
+		if (!usb_endpoint_xfer_bulk(ep))
+			continue;
+		if (usb_endpoint_dir_in(ep) && !in)
+			in = ep;
+		else if (usb_endpoint_dir_out(ep) && !out)
+			out = ep;
+	}
+
+	/* The loopback configuration has bulk endpoints too; skip it */
+	if (!in || !out || udev->actconfig->desc.bConfigurationValue != 3)
+		return -ENODEV;
+
+	if (!size || !depth || !total || !timeout)
+		return -EINVAL;
+
+	dev_info(&intf->dev, "bulk benchmark: %s speed, max packet %d\n",
+		 udev->speed == USB_SPEED_HIGH ? "high" : "full",
+		 le16_to_cpu(in->wMaxPacketSize));
+
+	dwc2_bench_run(udev, usb_sndbulkpipe(udev,
+		usb_endpoint_num(out)), "bulk out");
+	dwc2_bench_run(udev, usb_rcvbulkpipe(udev,
+		usb_endpoint_num(in)), "bulk in");
+
+	return 0;
+}
+
+static void dwc2_bench_disconnect(struct usb_interface *intf)
+{
+}
+
+static const struct usb_device_id dwc2_bench_ids[] = {
+	{ USB_DEVICE(DWC2_BENCH_VENDOR, DWC2_BENCH_PRODUCT) },
+	{ }
+};
+MODULE_DEVICE_TABLE(usb, dwc2_bench_ids);
+
+static struct usb_driver dwc2_bench_driver = {
+	.name		= "dwc2_bench",
+	.probe		= dwc2_bench_probe,
+	.disconnect	= dwc2_bench_disconnect,
+	.id_table	= dwc2_bench_ids,
+};
+
+static int __init dwc2_bench_init(void)
+{
+	return usb_register(&dwc2_bench_driver);
+}
+
+static void __exit dwc2_bench_exit(void)
+{
+	usb_deregister(&dwc2_bench_driver);
+}
+
+module_init(dwc2_bench_init);
+module_exit(dwc2_bench_exit);
+
+MODULE_DESCRIPTION("DESIGNWARE HS OTG bulk throughput benchmark");
+MODULE_LICENSE("GPL");
@@ -527,6 +527,7 @@ static void dwc2_calculate_dynamic_fifo(struct dwc2_hsotg *hsotg)
 	struct dwc2_core_params *params = hsotg->core_params;
 	struct dwc2_hw_params *hw = &hsotg->hw_params;
 	u32 rxfsiz, nptxfsiz, ptxfsiz, total_fifo_size;
+	u32 np_mps, p_mps, rx_min;
 
 	total_fifo_size = hw->total_fifo_size;
 	rxfsiz = params->host_rx_fifo_size;
@@ -537,42 +538,56 @@ static void dwc2_calculate_dynamic_fifo(struct dwc2_hsotg *hsotg)
 	 * Will use Method 2 defined in the DWC2 spec: minimum FIFO depth
 	 * allocation with support for high bandwidth endpoints. Synopsys
 	 * defines MPS(Max Packet size) for a periodic EP=1024, and for
-	 * non-periodic as 512.
+	 * non-periodic as 512; at full speed these are 1023 and 64.
 	 */
+	if (params->speed == DWC2_SPEED_PARAM_HIGH) {
+		np_mps = 512 / 4;
+		p_mps = 1024 / 4;
+	} else {
+		np_mps = 64 / 4;
+		p_mps = DIV_ROUND_UP(1023, 4);
+	}
+
 	/*
-	 * STM32 USB FS has 1.25 * 1024 bytes, that means a total
-	 * of 320 words
+	 * The Rx FIFO holds two packets and their status words, plus
+	 * the global OUT NAK status
 	 */
+	rx_min = 2 * (np_mps + 1) + 1;
+
 	if (total_fifo_size < (rxfsiz + nptxfsiz + ptxfsiz)) {
 		/*
-		 * Half of the available space
+		 * The periodic Tx FIFO gets one largest periodic packet,
+		 * unless that would leave less than the minimum to the
+		 * Rx FIFO. STM32 USB FS, with 1.25 * 1024 bytes (320 words)
+		 * of FIFO RAM, has no room for it: there, it gets one
+		 * non-periodic sized packet, enough for interrupt endpoints.
 		 */
-		rxfsiz = 160;
+		ptxfsiz = p_mps;
+		if ((total_fifo_size - ptxfsiz) / 2 < rx_min)
+			ptxfsiz = np_mps;
+		if ((total_fifo_size - ptxfsiz) / 2 < rx_min)
+			ptxfsiz = 0;
 
 		/*
-		 * Half of the available space
+		 * Bulk transfers in both directions get half of the rest
+		 * each; the Rx FIFO gets the odd word
 		 */
-		nptxfsiz = 160;
-
-		/* FIXME no periodic for now */
-		ptxfsiz = 0;
+		nptxfsiz = (total_fifo_size - ptxfsiz) / 2;
+		rxfsiz = total_fifo_size - ptxfsiz - nptxfsiz;
 
 		params->host_rx_fifo_size = rxfsiz;
 		params->host_nperio_tx_fifo_size = nptxfsiz;
 		params->host_perio_tx_fifo_size = ptxfsiz;
+
+		dev_dbg(hsotg->dev, "fifo sizes: rx %u, nptx %u, ptx %u of %u\n",
+			rxfsiz, nptxfsiz, ptxfsiz, total_fifo_size);
 	}
 
 	/*
-	 * If the summation of RX, NPTX and PTX fifo sizes is still
-	 * bigger than the total_fifo_size, then we have a problem.
-	 *
-	 * We won't be able to allocate as many endpoints. Right now,
-	 * we're just printing an error message, but ideally this FIFO
-	 * allocation algorithm would be improved in the future.
-	 *
-	 * FIXME improve this FIFO allocation algorithm.
+	 * If the Rx or non-periodic Tx FIFO still does not hold two
+	 * largest packets, bulk transfers will stall on every packet.
 	 */
-	if (unlikely(total_fifo_size < (rxfsiz + nptxfsiz + ptxfsiz)))
+	if (unlikely(rxfsiz < rx_min || nptxfsiz < 2 * np_mps))
 		dev_err(hsotg->dev, "invalid fifo sizes\n");
 }
 
@@ -131,11 +131,13 @@ static int dwc2_driver_probe(struct platform_device *dev)
 	dwc2_set_all_params(&defparams, -1);
 	params = &defparams;
 
+#ifndef CONFIG_USB_DWC2_DMA_DESC
 	/*
 	 * Disable descriptor dma mode by default as the HW can support
 	 * it, but does not support it for SPLIT transactions.
 	 */
 	defparams.dma_desc_enable = 0;
+#endif
 
 	hsotg = devm_kzalloc(&dev->dev, sizeof(*hsotg), GFP_KERNEL);
 	if (!hsotg)
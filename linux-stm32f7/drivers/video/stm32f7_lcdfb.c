@@ -14,6 +14,14 @@
 #include <asm/pgtable.h>
 #include <linux/clk.h>
 #include <linux/string.h>
+#include <linux/io.h>
+#include <linux/wait.h>
+#include <linux/console.h>
+#include <linux/ktime.h>
+#include <linux/dma-mapping.h>
+#include <linux/dmamem.h>
+#include <video/stm32f7_fb.h>
+#include <mach/fb.h>
 
 #define DRIVER_NAME "stm32f7-ltdc"
 
@@ -22,141 +30,1489 @@
 #define LTDC_AWCR	0x10
 #define LTDC_TWCR	0x14
 #define LTDC_GCR	0x18
-#define LTDC_SRCR	0x24 
-#define LTDC_BCCR	0x2c 
+#define LTDC_SRCR	0x24
+#define LTDC_BCCR	0x2c
 #define LTDC_IER	0x34
+#define LTDC_ISR	0x38
+#define LTDC_ICR	0x3c
+#define LTDC_LIPCR	0x40
 
-static struct fb_fix_screeninfo fb_fix __initdata = {
-	.id		= DRIVER_NAME,
-	.smem_len	= 480 * 272 * 4,
-	.type		= FB_TYPE_PACKED_PIXELS,
-	.visual		= FB_VISUAL_TRUECOLOR,
-	.line_length	= 480 * 4,
-	.accel		= FB_ACCEL_NONE,
+/* Layer registers; layer 0 is at the bottom */
+#define LTDC_LAYER_CR(i)	(0x84 + 0x80 * (i))
+#define LTDC_LAYER_WHPCR(i)	(0x88 + 0x80 * (i))
+#define LTDC_LAYER_WVPCR(i)	(0x8c + 0x80 * (i))
+#define LTDC_LAYER_PFCR(i)	(0x94 + 0x80 * (i))
+#define LTDC_LAYER_CACR(i)	(0x98 + 0x80 * (i))
+#define LTDC_LAYER_DCCR(i)	(0x9c + 0x80 * (i))
+#define LTDC_LAYER_BFCR(i)	(0xa0 + 0x80 * (i))
+#define LTDC_LAYER_CFBAR(i)	(0xac + 0x80 * (i))
+#define LTDC_LAYER_CFBLR(i)	(0xb0 + 0x80 * (i))
+#define LTDC_LAYER_CFBLNR(i)	(0xb4 + 0x80 * (i))
+#define LTDC_LAYER_CLUTWR(i)	(0xc4 + 0x80 * (i))
+
+#define LTDC_GCR_LTDCEN	(1 << 0)
+#define LTDC_GCR_PCPOL	(1 << 28)
+#define LTDC_GCR_DEPOL	(1 << 29)
+#define LTDC_GCR_VSPOL	(1 << 30)
+#define LTDC_GCR_HSPOL	(1 << 31)
+
+#define LTDC_SRCR_IMR	(1 << 0)
+#define LTDC_SRCR_VBR	(1 << 1)
+
+#define LTDC_IER_LIE	(1 << 0)
+#define LTDC_IER_FUIE	(1 << 1)
+#define LTDC_IER_TERRIE	(1 << 2)
+
+#define LTDC_ISR_LIF	(1 << 0)
+#define LTDC_ISR_FUIF	(1 << 1)
+#define LTDC_ISR_TERRIF	(1 << 2)
+
+#define LTDC_LCR_LEN	(1 << 0)
+#define LTDC_LCR_CLUTEN	(1 << 4)
+
+/* Blending: constant alpha, or pixel alpha times constant alpha */
+#define LTDC_BFCR_CA	0x405
+#define LTDC_BFCR_PAXCA	0x607
+
+#define LTDC_PF_ARGB8888	0
+#define LTDC_PF_RGB888		1
+#define LTDC_PF_RGB565		2
+#define LTDC_PF_L8		5
+
+/*
+ * Pixel formats of the layers. The screen ignores the alpha of its
+ * pixels, so it does not advertise them.
+ */
+struct ltdc_format {
+	u32 bpp;
+	u32 pf;
+	struct fb_bitfield red;
+	struct fb_bitfield green;
+	struct fb_bitfield blue;
+	struct fb_bitfield transp;
+	struct fb_bitfield transp_screen;
 };
 
-static struct fb_var_screeninfo fb_var __initdata = {
-	.xres		= 480,
-	.yres		= 272,
-	.xres_virtual	= 480,
-	.yres_virtual	= 272,
-	.bits_per_pixel	= 32,
-    	.red		= {16, 8, 0},
-	.green		= {8, 8, 0},
-	.blue		= {0, 8, 0},
-	.activate	= FB_ACTIVATE_NOW,
-	.height		= 272,
-	.width		= 480,
-	.vmode		= FB_VMODE_NONINTERLACED,
+static const struct ltdc_format ltdc_formats[] = {
+	{ 32, LTDC_PF_ARGB8888, {16, 8, 0}, {8, 8, 0}, {0, 8, 0},
+	  {24, 8, 0}, {0, 0, 0} },
+	{ 24, LTDC_PF_RGB888, {16, 8, 0}, {8, 8, 0}, {0, 8, 0},
+	  {0, 0, 0}, {0, 0, 0} },
+	{ 16, LTDC_PF_RGB565, {11, 5, 0}, {5, 6, 0}, {0, 5, 0},
+	  {0, 0, 0}, {0, 0, 0} },
+	{ 8, LTDC_PF_L8, {0, 8, 0}, {0, 8, 0}, {0, 8, 0},
+	  {0, 0, 0}, {0, 0, 0} },
 };
 
-static u32 *fb_base;
+/* DMA2D (Chrom-ART) registers */
+#define DMA2D_CR	0x00
+#define DMA2D_ISR	0x04
+#define DMA2D_IFCR	0x08
+#define DMA2D_FGMAR	0x0c
+#define DMA2D_FGOR	0x10
+#define DMA2D_BGMAR	0x14
+#define DMA2D_BGOR	0x18
+#define DMA2D_FGPFCCR	0x1c
+#define DMA2D_FGCOLR	0x20
+#define DMA2D_BGPFCCR	0x24
+#define DMA2D_FGCMAR	0x2c
+#define DMA2D_OPFCCR	0x34
+#define DMA2D_OCOLR	0x38
+#define DMA2D_OMAR	0x3c
+#define DMA2D_OOR	0x40
+#define DMA2D_NLR	0x44
+
+#define DMA2D_CR_START		(1 << 0)
+#define DMA2D_CR_ABORT		(1 << 2)
+#define DMA2D_CR_TEIE		(1 << 8)
+#define DMA2D_CR_TCIE		(1 << 9)
+#define DMA2D_CR_CAEIE		(1 << 11)
+#define DMA2D_CR_CEIE		(1 << 13)
+#define DMA2D_CR_IE		(DMA2D_CR_TEIE | DMA2D_CR_TCIE | \
+				 DMA2D_CR_CAEIE | DMA2D_CR_CEIE)
+#define DMA2D_CR_M2M		(0 << 16)
+#define DMA2D_CR_M2M_PFC	(1 << 16)
+#define DMA2D_CR_M2M_BLEND	(2 << 16)
+#define DMA2D_CR_R2M		(3 << 16)
+
+#define DMA2D_ISR_TEIF		(1 << 0)
+#define DMA2D_ISR_CAEIF		(1 << 3)
+#define DMA2D_ISR_CEIF		(1 << 5)
+#define DMA2D_ISR_ALL		0x3f
+#define DMA2D_ISR_ERR		(DMA2D_ISR_TEIF | DMA2D_ISR_CAEIF | \
+				 DMA2D_ISR_CEIF)
+
+#define DMA2D_PFCCR_START	(1 << 5)
+#define DMA2D_PFCCR_CS(n)	((n) << 8)
+#define DMA2D_PFCCR_AM_REPLACE	(1 << 16)
+#define DMA2D_PFCCR_AM_MUL	(2 << 16)
+#define DMA2D_PFCCR_ALPHA(a)	((a) << 24)
 
-static int fb_setcolreg(u32 regno, u32 red, u32 green,
-			u32 blue, u32 transp, struct fb_info *info)
+#define DMA2D_CM_ARGB8888	0
+#define DMA2D_CM_RGB888		1
+#define DMA2D_CM_RGB565		2
+#define DMA2D_CM_L8		5
+#define DMA2D_CM_A8		9
+
+#define DMA2D_NLR_VAL(w, h)	(((w) << 16) | (h))
+#define DMA2D_PL_MAX		0x3fff
+#define DMA2D_NL_MAX		0xffff
+#define DMA2D_OFFSET_MAX	0x3fff
+
+/* Requests smaller than this are cheaper to draw with the CPU */
+#define DMA2D_MIN_PIXELS	256
+
+/* Upper bound on a transfer: a full screen takes a few milliseconds */
+#define DMA2D_TIMEOUT_US	100000
+
+struct dma2d_map {
+	dma_addr_t addr;
+	size_t len;
+	enum dma_data_direction dir;
+};
+
+#define LTDC_LAYER_NUM	2
+
+/*
+ * State shared by the layers: the LTDC and the DMA2D engine
+ */
+struct stm32f7_ltdc {
+	struct device *dev;
+	struct stm32f7_fb_platform_data *pdata;
+	void __iomem *base;
+	int irq;
+	int err_irq;
+	struct clk *clk;
+	struct clk *pix_clk;
+	struct fb_info *layer[LTDC_LAYER_NUM];
+	/* Timings the LTDC is running with */
+	struct fb_videomode mode;
+	int enabled;
+
+	/* Vertical blankings seen so far */
+	unsigned long vsync_count;
+	wait_queue_head_t vsync_wq;
+
+	/* DMA2D engine, NULL if everything is drawn by the CPU */
+	void __iomem *dma2d;
+	int dma2d_irq;
+	int dma2d_busy;
+	int dma2d_err;
+	wait_queue_head_t dma2d_wq;
+	/* Buffers handed to the engine for the transfer in progress */
+	struct dma2d_map map[3];
+	int nmap;
+};
+
+/*
+ * Per layer state; layer 0 is the screen, layer 1 the overlay
+ */
+struct stm32f7_fb_par {
+	struct stm32f7_ltdc *lcd;
+	int index;
+	u32 pseudo_palette[16];
+
+	/* Screen buffers allocated from the heap, and their size */
+	void *mem;
+	unsigned long mem_len;
+	/* Size of the dmamem fb area, if the buffers live there */
+	unsigned long mem_cap;
+
+	/* Overlay window position, constant alpha and visibility */
+	u32 x;
+	u32 y;
+	u32 alpha;
+	int blank;
+
+	/* Results of the last benchmark, in operations per second */
+	unsigned long bench_fill[2];
+	unsigned long bench_copy[2];
+};
+
+static inline struct stm32f7_ltdc *fb_lcd(struct fb_info *info)
+{
+	return ((struct stm32f7_fb_par *)info->par)->lcd;
+}
+
+static inline u32 dma2d_read(struct stm32f7_ltdc *lcd, u32 reg)
+{
+	return readl(lcd->dma2d + reg);
+}
+
+static inline void dma2d_write(struct stm32f7_ltdc *lcd, u32 reg, u32 val)
+{
+	writel(val, lcd->dma2d + reg);
+}
+
+/*
+ * DMA2D colour mode of the framebuffer, or -1 if the engine can't
+ * write it
+ */
+static int dma2d_fb_cm(struct fb_info *info)
 {
-	((u32 *)info->pseudo_palette)[regno] = 0xff << 24 |
-					red << 16 | green << 8 | blue;
+	switch (info->var.bits_per_pixel) {
+	case 32:
+		return DMA2D_CM_ARGB8888;
+	case 24:
+		return DMA2D_CM_RGB888;
+	case 16:
+		return DMA2D_CM_RGB565;
+	}
+	return -1;
+}
+
+static int dma2d_usable(struct fb_info *info)
+{
+	struct stm32f7_ltdc *lcd = fb_lcd(info);
+
+	return lcd->dma2d && info->state == FBINFO_STATE_RUNNING &&
+		dma2d_fb_cm(info) >= 0;
+}
+
+static inline u32 fb_pitch(struct fb_info *info)
+{
+	return info->fix.line_length * 8 / info->var.bits_per_pixel;
+}
+
+static inline void *fb_addr(struct fb_info *info, u32 x, u32 y)
+{
+	return info->screen_base + y * info->fix.line_length +
+		x * info->var.bits_per_pixel / 8;
+}
+
+static inline size_t fb_span(struct fb_info *info, u32 w, u32 h)
+{
+	return (h - 1) * info->fix.line_length +
+		w * info->var.bits_per_pixel / 8;
+}
+
+static inline int fb_rect_ok(struct fb_info *info, u32 x, u32 y,
+			     u32 w, u32 h)
+{
+	return w && h && w <= DMA2D_PL_MAX && h <= DMA2D_NL_MAX &&
+		x < info->var.xres_virtual && y < info->var.yres_virtual &&
+		w <= info->var.xres_virtual - x &&
+		h <= info->var.yres_virtual - y;
+}
+
+/*
+ * Hand a buffer over to the engine; it is given back to the CPU when
+ * the transfer is waited for.
+ */
+static void dma2d_map(struct stm32f7_ltdc *lcd, void *addr, size_t len,
+		      enum dma_data_direction dir)
+{
+	struct dma2d_map *m = &lcd->map[lcd->nmap++];
+
+	m->addr = dma_map_single(lcd->dev, addr, len, dir);
+	m->len = len;
+	m->dir = dir;
+}
+
+static void dma2d_start(struct stm32f7_ltdc *lcd, u32 mode)
+{
+	dma2d_write(lcd, DMA2D_IFCR, DMA2D_ISR_ALL);
+	lcd->dma2d_err = 0;
+	lcd->dma2d_busy = 1;
+	dma2d_write(lcd, DMA2D_CR, mode | DMA2D_CR_START |
+		    (lcd->dma2d_irq >= 0 ? DMA2D_CR_IE : 0));
+}
+
+/*
+ * Wait for the transfer in progress, if any. Drawing ops run with the
+ * console lock held and possibly in atomic context, so they poll; the
+ * blit ioctl sleeps until the completion interrupt.
+ */
+static int dma2d_wait(struct stm32f7_ltdc *lcd, int can_sleep)
+{
+	int ret = 0;
+	int n;
+
+	if (!lcd->dma2d_busy)
+		return 0;
+
+	if (can_sleep && lcd->dma2d_irq >= 0) {
+		if (!wait_event_timeout(lcd->dma2d_wq,
+				!(dma2d_read(lcd, DMA2D_CR) & DMA2D_CR_START),
+				usecs_to_jiffies(DMA2D_TIMEOUT_US) + 1))
+			ret = -ETIMEDOUT;
+	} else {
+		for (n = DMA2D_TIMEOUT_US;
+		     dma2d_read(lcd, DMA2D_CR) & DMA2D_CR_START; n--) {
+			if (!n) {
+				ret = -ETIMEDOUT;
+				break;
+			}
+			udelay(1);
+		}
+	}
+
+	if (ret) {
+		dev_err(lcd->dev, "DMA2D transfer timed out\n");
+		dma2d_write(lcd, DMA2D_CR, DMA2D_CR_ABORT);
+		while (dma2d_read(lcd, DMA2D_CR) & DMA2D_CR_START)
+			cpu_relax();
+	} else if ((dma2d_read(lcd, DMA2D_ISR) & DMA2D_ISR_ERR) ||
+		   lcd->dma2d_err) {
+		dev_err(lcd->dev, "DMA2D transfer error\n");
+		ret = -EIO;
+	}
+	dma2d_write(lcd, DMA2D_IFCR, DMA2D_ISR_ALL);
+
+	while (lcd->nmap) {
+		struct dma2d_map *m = &lcd->map[--lcd->nmap];
+
+		dma_unmap_single(lcd->dev, m->addr, m->len, m->dir);
+	}
+	lcd->dma2d_busy = 0;
+
+	return ret;
+}
+
+static void dma2d_fill(struct fb_info *info, u32 x, u32 y, u32 w, u32 h,
+		       u32 color)
+{
+	struct stm32f7_ltdc *lcd = fb_lcd(info);
+	void *dst = fb_addr(info, x, y);
+
+	dma2d_wait(lcd, 0);
+	dma2d_map(lcd, dst, fb_span(info, w, h), DMA_BIDIRECTIONAL);
+	dma2d_write(lcd, DMA2D_OPFCCR, dma2d_fb_cm(info));
+	dma2d_write(lcd, DMA2D_OCOLR, color);
+	dma2d_write(lcd, DMA2D_OMAR, (u32)dst);
+	dma2d_write(lcd, DMA2D_OOR, fb_pitch(info) - w);
+	dma2d_write(lcd, DMA2D_NLR, DMA2D_NLR_VAL(w, h));
+	dma2d_start(lcd, DMA2D_CR_R2M);
+}
+
+static void dma2d_copy(struct fb_info *info, u32 sx, u32 sy, u32 dx, u32 dy,
+		       u32 w, u32 h)
+{
+	struct stm32f7_ltdc *lcd = fb_lcd(info);
+	void *src = fb_addr(info, sx, sy);
+	void *dst = fb_addr(info, dx, dy);
+	size_t len = fb_span(info, w, h);
+	int cm = dma2d_fb_cm(info);
+
+	dma2d_wait(lcd, 0);
+	dma2d_map(lcd, src, len, DMA_TO_DEVICE);
+	dma2d_map(lcd, dst, len, DMA_BIDIRECTIONAL);
+	dma2d_write(lcd, DMA2D_FGPFCCR, cm);
+	dma2d_write(lcd, DMA2D_FGMAR, (u32)src);
+	dma2d_write(lcd, DMA2D_FGOR, fb_pitch(info) - w);
+	dma2d_write(lcd, DMA2D_OPFCCR, cm);
+	dma2d_write(lcd, DMA2D_OMAR, (u32)dst);
+	dma2d_write(lcd, DMA2D_OOR, fb_pitch(info) - w);
+	dma2d_write(lcd, DMA2D_NLR, DMA2D_NLR_VAL(w, h));
+	dma2d_start(lcd, DMA2D_CR_M2M);
+}
+
+static void stm32f7_fb_fillrect(struct fb_info *info,
+				const struct fb_fillrect *rect)
+{
+	struct stm32f7_ltdc *lcd = fb_lcd(info);
+	u32 color = rect->color;
+
+	if (!dma2d_usable(info) || rect->rop != ROP_COPY ||
+	    rect->width * rect->height < DMA2D_MIN_PIXELS ||
+	    !fb_rect_ok(info, rect->dx, rect->dy,
+			rect->width, rect->height)) {
+		if (lcd->dma2d)
+			dma2d_wait(lcd, 0);
+		cfb_fillrect(info, rect);
+		return;
+	}
+
+	if (info->fix.visual == FB_VISUAL_TRUECOLOR ||
+	    info->fix.visual == FB_VISUAL_DIRECTCOLOR)
+		color = ((u32 *)info->pseudo_palette)[color];
+
+	dma2d_fill(info, rect->dx, rect->dy, rect->width, rect->height,
+		   color);
+}
+
+static void stm32f7_fb_copyarea(struct fb_info *info,
+				const struct fb_copyarea *area)
+{
+	struct stm32f7_ltdc *lcd = fb_lcd(info);
+	u32 sx = area->sx, sy = area->sy, dx = area->dx, dy = area->dy;
+	u32 w = area->width, h = area->height;
+	u32 band, n;
+
+	if (!dma2d_usable(info) || w * h < DMA2D_MIN_PIXELS ||
+	    !fb_rect_ok(info, sx, sy, w, h) ||
+	    !fb_rect_ok(info, dx, dy, w, h))
+		goto software;
+
+	if (sx == dx && sy == dy)
+		return;
+
+	/*
+	 * The engine walks the lines top to bottom, left to right. That
+	 * is safe for overlapping areas unless the copy goes down, or
+	 * right within the same lines.
+	 */
+	if (dx < sx + w && sx < dx + w && dy < sy + h && sy < dy + h) {
+		if (dy == sy && dx > sx)
+			goto software;
+
+		if (dy > sy) {
+			/*
+			 * Go bottom up in bands no taller than the
+			 * distance moved, so no band overlaps itself
+			 */
+			band = dy - sy;
+			if (h > band * 32)
+				goto software;
+			for (n = h; n > 0; n -= min(n, band))
+				dma2d_copy(info, sx, sy + n - min(n, band),
+					   dx, dy + n - min(n, band),
+					   w, min(n, band));
+			return;
+		}
+	}
+
+	dma2d_copy(info, sx, sy, dx, dy, w, h);
+	return;
+
+software:
+	if (lcd->dma2d)
+		dma2d_wait(lcd, 0);
+	cfb_copyarea(info, area);
+}
+
+static void stm32f7_fb_imageblit(struct fb_info *info,
+				 const struct fb_image *image)
+{
+	struct stm32f7_ltdc *lcd = fb_lcd(info);
+	u32 w = image->width, h = image->height;
+	u32 *clut = info->pseudo_palette;
+	void *dst;
+	int n;
+
+	/*
+	 * Monochrome glyphs are expanded by the CPU. Colour images are
+	 * palette indices, one byte per pixel; on an ARGB8888 screen the
+	 * pseudo palette doubles as the DMA2D CLUT.
+	 */
+	if (!dma2d_usable(info) || image->depth == 1 || image->depth > 8 ||
+	    info->var.bits_per_pixel != 32 ||
+	    info->fix.visual != FB_VISUAL_TRUECOLOR ||
+	    w * h < DMA2D_MIN_PIXELS ||
+	    !fb_rect_ok(info, image->dx, image->dy, w, h)) {
+		if (lcd->dma2d)
+			dma2d_wait(lcd, 0);
+		cfb_imageblit(info, image);
+		return;
+	}
+
+	dst = fb_addr(info, image->dx, image->dy);
+
+	dma2d_wait(lcd, 0);
+	dma2d_map(lcd, clut, sizeof(u32) << image->depth, DMA_TO_DEVICE);
+	dma2d_map(lcd, (void *)image->data, w * h, DMA_TO_DEVICE);
+	dma2d_map(lcd, dst, fb_span(info, w, h), DMA_BIDIRECTIONAL);
+
+	/* Load the CLUT */
+	dma2d_write(lcd, DMA2D_FGCMAR, (u32)clut);
+	dma2d_write(lcd, DMA2D_FGPFCCR, DMA2D_CM_L8 | DMA2D_PFCCR_START |
+		    DMA2D_PFCCR_CS((1 << image->depth) - 1));
+	for (n = DMA2D_TIMEOUT_US;
+	     n && (dma2d_read(lcd, DMA2D_FGPFCCR) & DMA2D_PFCCR_START); n--)
+		udelay(1);
+
+	dma2d_write(lcd, DMA2D_FGMAR, (u32)image->data);
+	dma2d_write(lcd, DMA2D_FGOR, 0);
+	dma2d_write(lcd, DMA2D_OPFCCR, DMA2D_CM_ARGB8888);
+	dma2d_write(lcd, DMA2D_OMAR, (u32)dst);
+	dma2d_write(lcd, DMA2D_OOR, fb_pitch(info) - w);
+	dma2d_write(lcd, DMA2D_NLR, DMA2D_NLR_VAL(w, h));
+	dma2d_start(lcd, DMA2D_CR_M2M_PFC);
+
+	/* The caller may free the image as soon as we return */
+	dma2d_wait(lcd, 0);
+}
+
+static int stm32f7_fb_sync(struct fb_info *info)
+{
+	struct stm32f7_ltdc *lcd = fb_lcd(info);
+
+	if (lcd->dma2d)
+		dma2d_wait(lcd, 0);
 	return 0;
 }
 
+/*
+ * Convert an ARGB8888 colour to the framebuffer format for R2M fills
+ */
+static u32 dma2d_color(int cm, u32 argb)
+{
+	switch (cm) {
+	case DMA2D_CM_RGB888:
+		return argb & 0xffffff;
+	case DMA2D_CM_RGB565:
+		return ((argb >> 8) & 0xf800) | ((argb >> 5) & 0x07e0) |
+			((argb >> 3) & 0x001f);
+	}
+	return argb;
+}
+
+/* Bits per pixel of the STM32F7_FB_FMT_* formats, 0 if not supported */
+static const u8 dma2d_fmt_bits[] = {
+	[STM32F7_FB_FMT_ARGB8888]	= 32,
+	[STM32F7_FB_FMT_RGB888]		= 24,
+	[STM32F7_FB_FMT_RGB565]		= 16,
+	[STM32F7_FB_FMT_ARGB1555]	= 16,
+	[STM32F7_FB_FMT_ARGB4444]	= 16,
+	[STM32F7_FB_FMT_A8]		= 8,
+	[STM32F7_FB_FMT_A4]		= 4,
+};
+
+static int dma2d_blit(struct fb_info *info, struct stm32f7_fb_blit *b)
+{
+	struct stm32f7_ltdc *lcd = fb_lcd(info);
+	int cm = dma2d_fb_cm(info);
+	u32 pfccr = 0, mode, bits, pitch, alpha;
+	void *dst;
+	size_t len;
+
+	if (!lcd->dma2d)
+		return -ENODEV;
+	if (cm < 0)
+		return -EINVAL;
+	if (!fb_rect_ok(info, b->dx, b->dy, b->width, b->height) ||
+	    b->alpha > 0xff)
+		return -EINVAL;
+
+	if (b->flags & STM32F7_FB_BLIT_ALPHA_REPLACE)
+		pfccr |= DMA2D_PFCCR_AM_REPLACE;
+	if (b->flags & STM32F7_FB_BLIT_ALPHA_MUL)
+		pfccr |= DMA2D_PFCCR_AM_MUL;
+	if (pfccr == (DMA2D_PFCCR_AM_REPLACE | DMA2D_PFCCR_AM_MUL))
+		return -EINVAL;
+	pfccr |= DMA2D_PFCCR_ALPHA(b->alpha);
+
+	dst = fb_addr(info, b->dx, b->dy);
+	len = fb_span(info, b->width, b->height);
+
+	dma2d_wait(lcd, 0);
+
+	if (b->src) {
+		if (b->src_format >= ARRAY_SIZE(dma2d_fmt_bits) ||
+		    !(bits = dma2d_fmt_bits[b->src_format]))
+			return -EINVAL;
+		if ((b->src_pitch * 8) % bits ||
+		    (bits >= 16 && bits != 24 && b->src % (bits / 8)))
+			return -EINVAL;
+		pitch = b->src_pitch * 8 / bits;
+		if (pitch < b->width || pitch - b->width > DMA2D_OFFSET_MAX)
+			return -EINVAL;
+		if (!access_ok(VERIFY_READ, (void __user *)b->src,
+			       (b->height - 1) * b->src_pitch +
+			       (b->width * bits + 7) / 8))
+			return -EFAULT;
+
+		dma2d_map(lcd, (void *)b->src, (b->height - 1) * b->src_pitch +
+			  (b->width * bits + 7) / 8, DMA_TO_DEVICE);
+		dma2d_write(lcd, DMA2D_FGMAR, b->src);
+		dma2d_write(lcd, DMA2D_FGOR, pitch - b->width);
+		dma2d_write(lcd, DMA2D_FGPFCCR, pfccr | b->src_format);
+		dma2d_write(lcd, DMA2D_FGCOLR, b->color & 0xffffff);
+
+		if (b->flags & STM32F7_FB_BLIT_BLEND)
+			mode = DMA2D_CR_M2M_BLEND;
+		else if (b->src_format == cm &&
+			 !(b->flags & (STM32F7_FB_BLIT_ALPHA_REPLACE |
+				       STM32F7_FB_BLIT_ALPHA_MUL)))
+			mode = DMA2D_CR_M2M;
+		else
+			mode = DMA2D_CR_M2M_PFC;
+	} else if (b->flags & STM32F7_FB_BLIT_BLEND) {
+		/*
+		 * Translucent fill: read the destination as an A8
+		 * foreground, and replace its alpha with a constant one
+		 */
+		alpha = b->color >> 24;
+		if (b->flags & STM32F7_FB_BLIT_ALPHA_REPLACE)
+			alpha = b->alpha;
+		else if (b->flags & STM32F7_FB_BLIT_ALPHA_MUL)
+			alpha = alpha * b->alpha / 255;
+		pfccr = DMA2D_PFCCR_AM_REPLACE | DMA2D_PFCCR_ALPHA(alpha);
+
+		dma2d_write(lcd, DMA2D_FGMAR, (u32)dst);
+		dma2d_write(lcd, DMA2D_FGOR,
+			    info->fix.line_length - b->width);
+		dma2d_write(lcd, DMA2D_FGPFCCR, pfccr | DMA2D_CM_A8);
+		dma2d_write(lcd, DMA2D_FGCOLR, b->color & 0xffffff);
+		mode = DMA2D_CR_M2M_BLEND;
+	} else {
+		dma2d_write(lcd, DMA2D_OCOLR, dma2d_color(cm, b->color));
+		mode = DMA2D_CR_R2M;
+	}
+
+	if (mode == DMA2D_CR_M2M_BLEND) {
+		dma2d_write(lcd, DMA2D_BGMAR, (u32)dst);
+		dma2d_write(lcd, DMA2D_BGOR, fb_pitch(info) - b->width);
+		dma2d_write(lcd, DMA2D_BGPFCCR, cm);
+	}
+
+	dma2d_map(lcd, dst, len, DMA_BIDIRECTIONAL);
+	dma2d_write(lcd, DMA2D_OPFCCR, cm);
+	dma2d_write(lcd, DMA2D_OMAR, (u32)dst);
+	dma2d_write(lcd, DMA2D_OOR, fb_pitch(info) - b->width);
+	dma2d_write(lcd, DMA2D_NLR, DMA2D_NLR_VAL(b->width, b->height));
+	dma2d_start(lcd, mode);
+
+	return dma2d_wait(lcd, 1);
+}
+
+static const struct ltdc_format *ltdc_format(u32 bpp)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(ltdc_formats); i++) {
+		if (ltdc_formats[i].bpp == bpp)
+			return &ltdc_formats[i];
+	}
+	return NULL;
+}
+
+static const struct fb_videomode *ltdc_find_mode(struct stm32f7_ltdc *lcd,
+						 u32 xres, u32 yres)
+{
+	struct stm32f7_fb_platform_data *pdata = lcd->pdata;
+	int i;
+
+	for (i = 0; i < pdata->modes_size; i++) {
+		if (pdata->modes[i].xres == xres &&
+		    pdata->modes[i].yres == yres)
+			return &pdata->modes[i];
+	}
+	return NULL;
+}
+
+/*
+ * Program the panel timings. The LTDC is stopped while they change, so
+ * this is skipped if they are the same as before.
+ */
+static void ltdc_set_timing(struct stm32f7_ltdc *lcd,
+			    struct fb_var_screeninfo *var)
+{
+	struct fb_videomode mode;
+	u32 h, v, gcr = 0;
+
+	fb_var_to_videomode(&mode, var);
+	if (lcd->enabled && fb_mode_is_equal(&mode, &lcd->mode))
+		return;
+	lcd->mode = mode;
+
+	writel(readl(lcd->base + LTDC_GCR) & ~LTDC_GCR_LTDCEN,
+	       lcd->base + LTDC_GCR);
+
+	clk_set_rate(lcd->pix_clk, PICOS2KHZ(var->pixclock) * 1000);
+	if (!lcd->enabled)
+		clk_enable(lcd->pix_clk);
+
+	/*
+	 * The registers hold accumulated counts, starting with the sync
+	 * pulse, minus one
+	 */
+	h = var->hsync_len - 1;
+	v = var->vsync_len - 1;
+	writel((h << 16) | v, lcd->base + LTDC_SSCR);
+	h += var->left_margin;
+	v += var->upper_margin;
+	writel((h << 16) | v, lcd->base + LTDC_BPCR);
+	h += var->xres;
+	v += var->yres;
+	writel((h << 16) | v, lcd->base + LTDC_AWCR);
+	/* The vertical blanking interrupt: the line after the active area */
+	writel(v + 1, lcd->base + LTDC_LIPCR);
+	h += var->right_margin;
+	v += var->lower_margin;
+	writel((h << 16) | v, lcd->base + LTDC_TWCR);
+
+	if (var->sync & FB_SYNC_HOR_HIGH_ACT)
+		gcr |= LTDC_GCR_HSPOL;
+	if (var->sync & FB_SYNC_VERT_HIGH_ACT)
+		gcr |= LTDC_GCR_VSPOL;
+	if (lcd->pdata->flags & STM32F7_FB_DE_HIGH)
+		gcr |= LTDC_GCR_DEPOL;
+	if (lcd->pdata->flags & STM32F7_FB_PCLK_INVERT)
+		gcr |= LTDC_GCR_PCPOL;
+
+	writel(0, lcd->base + LTDC_BCCR);
+	writel((lcd->err_irq >= 0 ? LTDC_IER_FUIE | LTDC_IER_TERRIE : 0) |
+	       (lcd->irq >= 0 ? LTDC_IER_LIE : 0), lcd->base + LTDC_IER);
+	writel(LTDC_SRCR_IMR, lcd->base + LTDC_SRCR);
+	writel(gcr | LTDC_GCR_LTDCEN, lcd->base + LTDC_GCR);
+	lcd->enabled = 1;
+}
+
+/*
+ * Program a layer from its var and window position. The window is
+ * clipped to the screen. `reload` is LTDC_SRCR_IMR to apply the
+ * change at once, or LTDC_SRCR_VBR to apply it at vertical blanking.
+ */
+static void ltdc_set_layer(struct fb_info *info, u32 reload)
+{
+	struct stm32f7_fb_par *par = info->par;
+	struct stm32f7_ltdc *lcd = par->lcd;
+	struct fb_var_screeninfo *var = &info->var;
+	struct fb_videomode *mode = &lcd->mode;
+	const struct ltdc_format *f = ltdc_format(var->bits_per_pixel);
+	int i = par->index;
+	u32 x, y, w, h;
+
+	x = min(par->x, mode->xres - 1);
+	y = min(par->y, mode->yres - 1);
+	w = min(var->xres, mode->xres - x);
+	h = min(var->yres, mode->yres - y);
+	x += mode->hsync_len + mode->left_margin;
+	y += mode->vsync_len + mode->upper_margin;
+
+	writel(x | ((x + w - 1) << 16), lcd->base + LTDC_LAYER_WHPCR(i));
+	writel(y | ((y + h - 1) << 16), lcd->base + LTDC_LAYER_WVPCR(i));
+	writel(f->pf, lcd->base + LTDC_LAYER_PFCR(i));
+	writel(par->alpha, lcd->base + LTDC_LAYER_CACR(i));
+	writel(0, lcd->base + LTDC_LAYER_DCCR(i));
+	/*
+	 * The screen is opaque whatever the pixels say; the overlay is
+	 * blended with its per pixel alpha
+	 */
+	writel(i ? LTDC_BFCR_PAXCA : LTDC_BFCR_CA,
+	       lcd->base + LTDC_LAYER_BFCR(i));
+	writel(info->fix.smem_start + var->yoffset * info->fix.line_length,
+	       lcd->base + LTDC_LAYER_CFBAR(i));
+	writel((info->fix.line_length << 16) |
+	       (w * var->bits_per_pixel / 8 + 3),
+	       lcd->base + LTDC_LAYER_CFBLR(i));
+	writel(h, lcd->base + LTDC_LAYER_CFBLNR(i));
+	writel((par->blank ? 0 : LTDC_LCR_LEN) |
+	       (f->pf == LTDC_PF_L8 ? LTDC_LCR_CLUTEN : 0),
+	       lcd->base + LTDC_LAYER_CR(i));
+	writel(reload, lcd->base + LTDC_SRCR);
+}
+
+static int stm32f7_fb_check_var(struct fb_var_screeninfo *var,
+				struct fb_info *info)
+{
+	struct stm32f7_fb_par *par = info->par;
+	struct stm32f7_ltdc *lcd = par->lcd;
+	const struct fb_videomode *mode;
+	const struct ltdc_format *f;
+	struct fb_var_screeninfo *screen;
+	u32 line;
+
+	/* Round the depth up to a supported format */
+	if (var->bits_per_pixel <= 8)
+		var->bits_per_pixel = 8;
+	else if (var->bits_per_pixel <= 16)
+		var->bits_per_pixel = 16;
+	else if (var->bits_per_pixel <= 24)
+		var->bits_per_pixel = 24;
+	else
+		var->bits_per_pixel = 32;
+	f = ltdc_format(var->bits_per_pixel);
+
+	if (par->index == 0) {
+		/* The screen resolution selects one of the panel modes */
+		mode = ltdc_find_mode(lcd, var->xres, var->yres);
+		if (!mode)
+			return -EINVAL;
+		var->pixclock = mode->pixclock;
+		var->left_margin = mode->left_margin;
+		var->right_margin = mode->right_margin;
+		var->upper_margin = mode->upper_margin;
+		var->lower_margin = mode->lower_margin;
+		var->hsync_len = mode->hsync_len;
+		var->vsync_len = mode->vsync_len;
+		var->sync = mode->sync;
+		var->vmode = mode->vmode;
+	} else {
+		/* The overlay is a window of any size within the screen */
+		screen = &lcd->layer[0]->var;
+		if (!var->xres || !var->yres)
+			return -EINVAL;
+		var->xres = min(var->xres, screen->xres);
+		var->yres = min(var->yres, screen->yres);
+		var->pixclock = screen->pixclock;
+		var->left_margin = screen->left_margin;
+		var->right_margin = screen->right_margin;
+		var->upper_margin = screen->upper_margin;
+		var->lower_margin = screen->lower_margin;
+		var->hsync_len = screen->hsync_len;
+		var->vsync_len = screen->vsync_len;
+		var->sync = screen->sync;
+		var->vmode = screen->vmode;
+	}
+
+	var->xres_virtual = var->xres;
+	var->xoffset = 0;
+	if (var->yres_virtual < var->yres)
+		var->yres_virtual = var->yres;
+
+	/* Buffers in the dmamem fb area can't grow beyond it */
+	line = var->xres_virtual * var->bits_per_pixel / 8;
+	if (par->mem_cap && line * var->yres_virtual > par->mem_cap) {
+		var->yres_virtual = par->mem_cap / line;
+		if (var->yres_virtual < var->yres)
+			return -ENOMEM;
+	}
+	if (var->yoffset > var->yres_virtual - var->yres)
+		var->yoffset = var->yres_virtual - var->yres;
+
+	var->red = f->red;
+	var->green = f->green;
+	var->blue = f->blue;
+	var->transp = par->index ? f->transp : f->transp_screen;
+	var->nonstd = 0;
+	var->grayscale = 0;
+	var->height = -1;
+	var->width = -1;
+
+	return 0;
+}
+
+/*
+ * Make sure the layer has `len` bytes of screen buffers
+ */
+static int fb_alloc_mem(struct fb_info *info, unsigned long len)
+{
+	struct stm32f7_fb_par *par = info->par;
+	void *mem;
+
+	if (!par->mem_cap && (!par->mem || len > par->mem_len)) {
+		mem = kzalloc(len + 256, GFP_KERNEL);
+		if (!mem)
+			return -ENOMEM;
+		kfree(par->mem);
+		par->mem = mem;
+		par->mem_len = len;
+		info->fix.smem_start = ALIGN((unsigned long)mem, 256);
+		info->screen_base = (char *)info->fix.smem_start;
+	}
+
+	mutex_lock(&info->mm_lock);
+	info->fix.smem_len = len;
+	mutex_unlock(&info->mm_lock);
+	info->screen_size = len;
+
+	return 0;
+}
+
+static int stm32f7_fb_set_par(struct fb_info *info)
+{
+	struct stm32f7_fb_par *par = info->par;
+	struct stm32f7_ltdc *lcd = par->lcd;
+	struct fb_var_screeninfo *var = &info->var;
+	struct fb_info *ovl = lcd->layer[1];
+	int ret;
+
+	info->fix.line_length = var->xres_virtual * var->bits_per_pixel / 8;
+	info->fix.visual = var->bits_per_pixel == 8 ?
+		FB_VISUAL_PSEUDOCOLOR : FB_VISUAL_TRUECOLOR;
+	if (var->yres_virtual > var->yres) {
+		info->fix.ypanstep = 1;
+		info->flags |= FBINFO_HWACCEL_YPAN;
+	} else {
+		info->fix.ypanstep = 0;
+		info->flags &= ~FBINFO_HWACCEL_YPAN;
+	}
+
+	/* The engine may still be drawing into the old buffers */
+	stm32f7_fb_sync(info);
+
+	ret = fb_alloc_mem(info, info->fix.line_length * var->yres_virtual);
+	if (ret)
+		return ret;
+
+	if (par->index == 0)
+		ltdc_set_timing(lcd, var);
+	ltdc_set_layer(info, LTDC_SRCR_IMR);
+
+	/* The overlay window must follow changes of the screen size */
+	if (par->index == 0 && ovl && ovl->fix.smem_start)
+		ltdc_set_layer(ovl, LTDC_SRCR_IMR);
+
+	return 0;
+}
+
+static inline u32 chan_to_field(u32 chan, struct fb_bitfield *bf)
+{
+	return (chan >> (16 - bf->length)) << bf->offset;
+}
+
+static int stm32f7_fb_setcolreg(u32 regno, u32 red, u32 green,
+				u32 blue, u32 transp, struct fb_info *info)
+{
+	struct stm32f7_fb_par *par = info->par;
+	struct fb_var_screeninfo *var = &info->var;
+
+	if (info->fix.visual == FB_VISUAL_PSEUDOCOLOR) {
+		if (regno > 255)
+			return -EINVAL;
+		writel((regno << 24) | ((red >> 8) << 16) |
+		       ((green >> 8) << 8) | (blue >> 8),
+		       par->lcd->base + LTDC_LAYER_CLUTWR(par->index));
+		return 0;
+	}
+
+	if (regno >= 16)
+		return -EINVAL;
+
+	/* Console colours are opaque, also on the overlay */
+	par->pseudo_palette[regno] = chan_to_field(red, &var->red) |
+		chan_to_field(green, &var->green) |
+		chan_to_field(blue, &var->blue) |
+		(var->bits_per_pixel == 32 ? 0xff << 24 : 0);
+
+	return 0;
+}
+
+static int stm32f7_fb_blank(int blank, struct fb_info *info)
+{
+	struct stm32f7_fb_par *par = info->par;
+
+	par->blank = blank != FB_BLANK_UNBLANK;
+	if (info->fix.smem_start)
+		ltdc_set_layer(info, LTDC_SRCR_VBR);
+
+	return 0;
+}
+
+/*
+ * Flip to another part of the virtual screen. The new address is
+ * latched by the LTDC at the next vertical blanking, so the flip never
+ * tears; FBIO_WAITFORVSYNC tells when it has happened.
+ */
+static int stm32f7_fb_pan_display(struct fb_var_screeninfo *var,
+				  struct fb_info *info)
+{
+	struct stm32f7_fb_par *par = info->par;
+	struct stm32f7_ltdc *lcd = par->lcd;
+
+	/* Let the engine finish with the buffer first */
+	stm32f7_fb_sync(info);
+
+	writel(info->fix.smem_start + var->yoffset * info->fix.line_length,
+	       lcd->base + LTDC_LAYER_CFBAR(par->index));
+	writel(LTDC_SRCR_VBR, lcd->base + LTDC_SRCR);
+
+	return 0;
+}
+
+/*
+ * The overlay is shown from the first time it is opened, and stays
+ * until it is blanked
+ */
+static int stm32f7_fb_open(struct fb_info *info, int user)
+{
+	struct stm32f7_fb_par *par = info->par;
+
+	if (par->index && !info->fix.smem_start)
+		return stm32f7_fb_set_par(info);
+
+	return 0;
+}
+
+static int ltdc_wait_vsync(struct fb_info *info)
+{
+	struct stm32f7_ltdc *lcd = fb_lcd(info);
+	unsigned long count = lcd->vsync_count;
+	int ret;
+
+	if (lcd->irq < 0)
+		return -ENODEV;
+
+	ret = wait_event_interruptible_timeout(lcd->vsync_wq,
+			count != lcd->vsync_count, HZ / 10);
+	if (ret < 0)
+		return ret;
+	if (!ret)
+		return -ETIMEDOUT;
+
+	return 0;
+}
+
+static irqreturn_t ltdc_irq(int irq, void *dev_id)
+{
+	struct stm32f7_ltdc *lcd = dev_id;
+	u32 isr;
+
+	isr = readl(lcd->base + LTDC_ISR);
+	writel(isr, lcd->base + LTDC_ICR);
+
+	/* The line interrupt is set to the first line after the screen */
+	if (isr & LTDC_ISR_LIF) {
+		lcd->vsync_count++;
+		wake_up_interruptible(&lcd->vsync_wq);
+	}
+
+	if ((isr & (LTDC_ISR_FUIF | LTDC_ISR_TERRIF)) && printk_ratelimit())
+		dev_warn(lcd->dev, "%s\n", isr & LTDC_ISR_FUIF ?
+			 "FIFO underrun" : "transfer error");
+
+	return IRQ_HANDLED;
+}
+
+static int stm32f7_fb_ioctl(struct fb_info *info, unsigned int cmd,
+			    unsigned long arg)
+{
+	struct stm32f7_fb_par *par = info->par;
+	struct stm32f7_fb_blit blit;
+	struct stm32f7_fb_overlay ovl;
+	u32 crtc;
+	int ret;
+
+	switch (cmd) {
+	case FBIO_WAITFORVSYNC:
+		if (get_user(crtc, (u32 __user *)arg))
+			return -EFAULT;
+		if (crtc)
+			return -ENODEV;
+		return ltdc_wait_vsync(info);
+	case STM32F7_FB_IOC_BLIT:
+		if (copy_from_user(&blit, (void __user *)arg, sizeof(blit)))
+			return -EFAULT;
+		/* Keep the console from drawing while we use the engine */
+		acquire_console_sem();
+		ret = dma2d_blit(info, &blit);
+		release_console_sem();
+		return ret;
+	case STM32F7_FB_IOC_SET_OVERLAY:
+		if (!par->index)
+			return -EINVAL;
+		if (copy_from_user(&ovl, (void __user *)arg, sizeof(ovl)))
+			return -EFAULT;
+		if (ovl.alpha > 0xff)
+			return -EINVAL;
+		par->x = ovl.x;
+		par->y = ovl.y;
+		par->alpha = ovl.alpha;
+		if (info->fix.smem_start)
+			ltdc_set_layer(info, LTDC_SRCR_VBR);
+		return 0;
+	case STM32F7_FB_IOC_GET_OVERLAY:
+		if (!par->index)
+			return -EINVAL;
+		ovl.x = par->x;
+		ovl.y = par->y;
+		ovl.alpha = par->alpha;
+		if (copy_to_user((void __user *)arg, &ovl, sizeof(ovl)))
+			return -EFAULT;
+		return 0;
+	}
+
+	return -ENOTTY;
+}
+
 static struct fb_ops fb_ops = {
 	.owner		= THIS_MODULE,
-	.fb_setcolreg	= fb_setcolreg,
-	.fb_fillrect	= cfb_fillrect,
-	.fb_copyarea	= cfb_copyarea,
-	.fb_imageblit	= cfb_imageblit,
+	.fb_open	= stm32f7_fb_open,
+	.fb_check_var	= stm32f7_fb_check_var,
+	.fb_set_par	= stm32f7_fb_set_par,
+	.fb_setcolreg	= stm32f7_fb_setcolreg,
+	.fb_blank	= stm32f7_fb_blank,
+	.fb_fillrect	= stm32f7_fb_fillrect,
+	.fb_copyarea	= stm32f7_fb_copyarea,
+	.fb_imageblit	= stm32f7_fb_imageblit,
+	.fb_sync	= stm32f7_fb_sync,
+	.fb_pan_display	= stm32f7_fb_pan_display,
+	.fb_ioctl	= stm32f7_fb_ioctl,
 };
 
-static void stm_clock_init(void)
+static unsigned long bench_rate(unsigned int n, ktime_t start)
 {
-	clk_enable(clk_get_sys(0, "sai_r_clk"));
-	clk_enable(clk_get_sys("stm32f4-ltdc.0", 0));
-	clk_enable(clk_get_sys(0, "gpioe"));
-	clk_enable(clk_get_sys(0, "gpiog"));
-	clk_enable(clk_get_sys(0, "gpioi"));
-	clk_enable(clk_get_sys(0, "gpioj"));
-	clk_enable(clk_get_sys(0, "gpiok"));
+	u64 us = ktime_to_us(ktime_sub(ktime_get(), start));
+	u64 rate = (u64)n * USEC_PER_SEC;
+
+	do_div(rate, us ? us : 1);
+	return rate;
 }
 
-static void ltdc_init(base)
+/*
+ * Benchmark: `echo N > bench` does N full screen fills and N scrolls by
+ * 16 lines, first with the CPU, then with the DMA2D. `cat bench`
+ * reports the rates. The screen contents are lost.
+ */
+static ssize_t stm32f7_fb_bench_show(struct device *dev,
+				     struct device_attribute *attr, char *buf)
 {
-	stm_clock_init();
+	struct fb_info *info = dev_get_drvdata(dev);
+	struct stm32f7_fb_par *par = info->par;
 
-	writel(BIT(12), 0x40022018); /* Assert display enable LCD_DISP pin */
-	writel(BIT(3), 0x40022818);
-	writel(0x280009, base + LTDC_SSCR);
-	writel(0x35000b, base + LTDC_BPCR);
-	writel(0x215011b, base + LTDC_AWCR);
-	writel(0x235011d, base + LTDC_TWCR);
-	writel(0, base + LTDC_BCCR);
-	writel(0x6, base + LTDC_IER);
-	writel(0x2221, base + LTDC_GCR);
+	return sprintf(buf, "fillrect: cpu %lu/s, dma2d %lu/s\n"
+			    "copyarea: cpu %lu/s, dma2d %lu/s\n",
+		       par->bench_fill[0], par->bench_fill[1],
+		       par->bench_copy[0], par->bench_copy[1]);
 }
 
-static void store_hex(u32 addr)
+static ssize_t stm32f7_fb_bench_store(struct device *dev,
+				      struct device_attribute *attr,
+				      const char *buf, size_t count)
 {
-	u32 layer0[] = { 1, 0x2150036, 0x11b000c, 0, 0 ,0xff, 0, 0x607 ,0, 0,
-		0, 0x7800783, 0x110, 0, 0, 0, 0 };
-	u32 layer1[] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
+	struct fb_info *info = dev_get_drvdata(dev);
+	struct stm32f7_fb_par *par = info->par;
+	struct stm32f7_ltdc *lcd = par->lcd;
+	struct fb_fillrect fill = {
+		.width	= info->var.xres,
+		.height	= info->var.yres,
+		.rop	= ROP_COPY,
+	};
+	struct fb_copyarea copy = {
+		.sy	= 16,
+		.width	= info->var.xres,
+		.height	= info->var.yres - 16,
+	};
+	unsigned int n = simple_strtoul(buf, NULL, 0);
+	unsigned int i;
+	ktime_t t;
+
+	if (!dma2d_usable(info))
+		return -ENODEV;
+	if (!n || n > 10000)
+		return -EINVAL;
+
+	acquire_console_sem();
+
+	t = ktime_get();
+	for (i = 0; i < n; i++) {
+		fill.color = i & 15;
+		cfb_fillrect(info, &fill);
+	}
+	par->bench_fill[0] = bench_rate(n, t);
+
+	t = ktime_get();
+	for (i = 0; i < n; i++) {
+		fill.color = i & 15;
+		stm32f7_fb_fillrect(info, &fill);
+	}
+	dma2d_wait(lcd, 0);
+	par->bench_fill[1] = bench_rate(n, t);
 
-	layer0[10] = addr; /* framebuffer base address register */
-	layer1[10] = addr; /* framebuffer base address register */
+	t = ktime_get();
+	for (i = 0; i < n; i++)
+		cfb_copyarea(info, &copy);
+	par->bench_copy[0] = bench_rate(n, t);
 
-	memcpy((void *)0x40016884, layer0, sizeof(layer0));
-	memcpy((void *)0x40016884 + 0x80, layer1, sizeof(layer1));
+	t = ktime_get();
+	for (i = 0; i < n; i++)
+		stm32f7_fb_copyarea(info, &copy);
+	dma2d_wait(lcd, 0);
+	par->bench_copy[1] = bench_rate(n, t);
+
+	release_console_sem();
+
+	return count;
 }
 
-static int __init fb_probe(struct platform_device *dev)
+static DEVICE_ATTR(bench, S_IWUSR | S_IRUGO,
+		   stm32f7_fb_bench_show, stm32f7_fb_bench_store);
+
+#if defined(CONFIG_FB_STM32F7_DMA2D)
+static irqreturn_t dma2d_irq(int irq, void *dev_id)
 {
-	struct fb_info *info;
-	int ret = -ENOMEM;
-	u32 base = 0x40016800; // get from plat data TODO
+	struct stm32f7_ltdc *lcd = dev_id;
+	u32 isr;
 
-	if (!(fb_base = kmalloc(480 * 272 * 4+ 256, GFP_KERNEL)))
-		goto err_exit;
-	fb_fix.smem_start = (u32) fb_base + 256 - ((u32)fb_base % 256);
-	
-	ltdc_init(base);
-	store_hex(fb_fix.smem_start); /* layer config dumped memory */
-	writel(1, (u32)(base + LTDC_SRCR)); /* force reload */
+	isr = dma2d_read(lcd, DMA2D_ISR);
+	dma2d_write(lcd, DMA2D_IFCR, isr);
+	if (isr & DMA2D_ISR_ERR)
+		lcd->dma2d_err = -EIO;
+	wake_up(&lcd->dma2d_wq);
+
+	return IRQ_HANDLED;
+}
+
+static void dma2d_init(struct platform_device *dev, struct stm32f7_ltdc *lcd)
+{
+	struct resource *res;
+	int irq;
+
+	res = platform_get_resource_byname(dev, IORESOURCE_MEM, "dma2d");
+	if (!res)
+		return;
+	lcd->dma2d = ioremap(res->start, resource_size(res));
+	if (!lcd->dma2d)
+		return;
+
+	clk_enable(clk_get_sys(0, "dma2d"));
+	init_waitqueue_head(&lcd->dma2d_wq);
+
+	irq = platform_get_irq_byname(dev, "dma2d");
+	if (irq >= 0 && !request_irq(irq, dma2d_irq, 0, DRIVER_NAME, lcd))
+		lcd->dma2d_irq = irq;
+}
+
+static void dma2d_release(struct stm32f7_ltdc *lcd)
+{
+	if (!lcd->dma2d)
+		return;
+
+	dma2d_wait(lcd, 0);
+	if (lcd->dma2d_irq >= 0)
+		free_irq(lcd->dma2d_irq, lcd);
+	clk_disable(clk_get_sys(0, "dma2d"));
+	iounmap(lcd->dma2d);
+	lcd->dma2d = NULL;
+}
+#else
+static inline void dma2d_init(struct platform_device *dev,
+			      struct stm32f7_ltdc *lcd)
+{
+}
+
+static inline void dma2d_release(struct stm32f7_ltdc *lcd)
+{
+}
+#endif
+
+static const char *layer_ids[LTDC_LAYER_NUM] = {
+	DRIVER_NAME, "stm32f7-overlay",
+};
+
+/*
+ * Set up the fb_info of a layer. The screen gets the mode asked for on
+ * the command line or in the platform data, and as many buffers as
+ * CONFIG_FB_STM32F7_BUFFERS asks for, preferably in the dmamem fb area:
+ * it is not cached, and may still hold the boot loader's picture, which
+ * is left alone. The overlay starts as a full screen window, and gets
+ * its memory when first opened.
+ */
+static int ltdc_layer_init(struct stm32f7_ltdc *lcd, int i)
+{
+	struct stm32f7_fb_platform_data *pdata = lcd->pdata;
+	struct fb_info *info = lcd->layer[i];
+	struct stm32f7_fb_par *par = info->par;
+	char *options = NULL;
+#if defined(CONFIG_DMAMEM)
+	dma_addr_t dmem;
+	unsigned long dmem_len;
+#endif
 
-	if (!(info = framebuffer_alloc(sizeof(u32) * 16, &dev->dev)))
-		goto err_free_mem;
+	par->lcd = lcd;
+	par->index = i;
+	par->alpha = 0xff;
 
-	info->var = fb_var;
-	info->fix = fb_fix;
+	strlcpy(info->fix.id, layer_ids[i], sizeof(info->fix.id));
+	info->fix.type = FB_TYPE_PACKED_PIXELS;
+	info->fix.accel = FB_ACCEL_NONE;
 	info->fbops = &fb_ops;
 	info->flags = FBINFO_DEFAULT;
-	info->pseudo_palette = info->par;
-	info->par = NULL;
-	info->screen_base = (char *) fb_fix.smem_start;
+	if (lcd->dma2d)
+		info->flags |= FBINFO_HWACCEL_COPYAREA |
+			FBINFO_HWACCEL_FILLRECT;
+	info->pseudo_palette = par->pseudo_palette;
 
 	if (fb_alloc_cmap(&info->cmap, 256, 0) < 0)
-		goto err_free_fb;
+		return -ENOMEM;
 
-	if (register_framebuffer(info) < 0) {
-		ret = -EINVAL;
-		goto err_free_cmap;
+	if (i == 0) {
+		fb_get_options(DRIVER_NAME, &options);
+		if (!fb_find_mode(&info->var, info, options ? options :
+				  pdata->mode_str, pdata->modes,
+				  pdata->modes_size, &pdata->modes[0], 32))
+			return -EINVAL;
+		info->var.yres_virtual = info->var.yres *
+			CONFIG_FB_STM32F7_BUFFERS;
+#if defined(CONFIG_DMAMEM)
+		if (!dmamem_fb_get(&dmem, &dmem_len)) {
+			par->mem_cap = dmem_len;
+			info->fix.smem_start = dmem;
+			info->screen_base = (char *)dmem;
+		}
+#endif
+	} else {
+		info->var = lcd->layer[0]->var;
+		info->var.yres_virtual = info->var.yres;
+		info->var.yoffset = 0;
+		info->var.bits_per_pixel = 32;
 	}
+	info->var.activate = FB_ACTIVATE_NOW;
 
-        pr_info("%s: fb%d registered @ 0x%p\n", DRIVER_NAME, info->node,
-			info->screen_base);
+	return stm32f7_fb_check_var(&info->var, info);
+}
 
-	return 0;
+static void ltdc_layer_release(struct fb_info *info)
+{
+	struct stm32f7_fb_par *par = info->par;
 
-err_free_cmap:
 	fb_dealloc_cmap(&info->cmap);
-err_free_fb:
+	kfree(par->mem);
 	framebuffer_release(info);
-err_free_mem:
-	kfree(fb_base);
+}
+
+static int __devinit fb_probe(struct platform_device *dev)
+{
+	struct stm32f7_fb_platform_data *pdata = dev->dev.platform_data;
+	struct stm32f7_ltdc *lcd;
+	struct fb_info *info;
+	struct resource *res;
+	int ret = -ENOMEM;
+	int i;
+
+	if (!pdata || !pdata->modes || !pdata->modes_size) {
+		dev_err(&dev->dev, "no platform data\n");
+		return -EINVAL;
+	}
+
+	lcd = kzalloc(sizeof(*lcd), GFP_KERNEL);
+	if (!lcd)
+		goto err_exit;
+	lcd->dev = &dev->dev;
+	lcd->pdata = pdata;
+	lcd->irq = -1;
+	lcd->err_irq = -1;
+	lcd->dma2d_irq = -1;
+	init_waitqueue_head(&lcd->vsync_wq);
+
+	res = platform_get_resource_byname(dev, IORESOURCE_MEM, "ltdc");
+	if (!res) {
+		ret = -ENODEV;
+		goto err_free_lcd;
+	}
+	lcd->base = ioremap(res->start, resource_size(res));
+	if (!lcd->base)
+		goto err_free_lcd;
+
+	lcd->clk = clk_get_sys("stm32f4-ltdc.0", NULL);
+	lcd->pix_clk = clk_get_sys(NULL, "sai_r_clk");
+	if (IS_ERR(lcd->clk) || IS_ERR(lcd->pix_clk)) {
+		dev_err(&dev->dev, "unable to get clocks\n");
+		ret = -ENODEV;
+		goto err_unmap;
+	}
+	clk_enable(lcd->clk);
+
+	if (pdata->init)
+		pdata->init(1);
+
+	/* Vertical blanking interrupt: the line after the active area */
+	i = platform_get_irq_byname(dev, "ltdc");
+	if (i >= 0 && !request_irq(i, ltdc_irq, 0, DRIVER_NAME, lcd))
+		lcd->irq = i;
+
+	/* FIFO underrun and transfer error come on their own interrupt */
+	i = platform_get_irq_byname(dev, "ltdc_er");
+	if (i >= 0 && !request_irq(i, ltdc_irq, 0, DRIVER_NAME, lcd))
+		lcd->err_irq = i;
+
+	dma2d_init(dev, lcd);
+
+	for (i = 0; i < LTDC_LAYER_NUM; i++) {
+		info = framebuffer_alloc(sizeof(struct stm32f7_fb_par),
+					 &dev->dev);
+		if (!info) {
+			ret = -ENOMEM;
+			goto err_layers;
+		}
+		lcd->layer[i] = info;
+
+		ret = ltdc_layer_init(lcd, i);
+		if (ret)
+			goto err_layers;
+	}
+
+	/* Light up the screen; the overlay waits for its first user */
+	info = lcd->layer[0];
+	ret = stm32f7_fb_set_par(info);
+	if (ret)
+		goto err_layers;
+	if (info->var.yres_virtual > info->var.yres)
+		memset(info->screen_base + info->fix.line_length *
+		       info->var.yres, 0, info->fix.line_length *
+		       (info->var.yres_virtual - info->var.yres));
+
+	for (i = 0; i < LTDC_LAYER_NUM; i++) {
+		ret = register_framebuffer(lcd->layer[i]);
+		if (ret < 0)
+			goto err_unregister;
+	}
+	platform_set_drvdata(dev, lcd);
+
+	for (i = 0; i < LTDC_LAYER_NUM; i++) {
+		if (lcd->dma2d &&
+		    device_create_file(lcd->layer[i]->dev, &dev_attr_bench))
+			pr_info("%s: failed to create the bench attribute\n",
+				DRIVER_NAME);
+	}
+
+	info = lcd->layer[0];
+	pr_info("%s: fb%d %dx%d-%d registered @ 0x%p, %d buffer(s)%s, "
+		"overlay fb%d\n", DRIVER_NAME, info->node, info->var.xres,
+		info->var.yres, info->var.bits_per_pixel, info->screen_base,
+		info->var.yres_virtual / info->var.yres,
+		lcd->dma2d ? ", DMA2D" : "", lcd->layer[1]->node);
+
+	return 0;
+
+err_unregister:
+	while (--i >= 0)
+		unregister_framebuffer(lcd->layer[i]);
+	i = LTDC_LAYER_NUM - 1;
+err_layers:
+	writel(0, lcd->base + LTDC_GCR);
+	for (; i >= 0; i--) {
+		if (lcd->layer[i])
+			ltdc_layer_release(lcd->layer[i]);
+	}
+	dma2d_release(lcd);
+	writel(0, lcd->base + LTDC_IER);
+	if (lcd->irq >= 0)
+		free_irq(lcd->irq, lcd);
+	if (lcd->err_irq >= 0)
+		free_irq(lcd->err_irq, lcd);
+	if (pdata->init)
+		pdata->init(0);
+	if (lcd->enabled)
+		clk_disable(lcd->pix_clk);
+	clk_disable(lcd->clk);
+err_unmap:
+	iounmap(lcd->base);
+err_free_lcd:
+	kfree(lcd);
 err_exit:
 	return ret;
 }
 
+static int __devexit fb_remove(struct platform_device *dev)
+{
+	struct stm32f7_ltdc *lcd = platform_get_drvdata(dev);
+	int i;
+
+	for (i = LTDC_LAYER_NUM - 1; i >= 0; i--) {
+		if (lcd->dma2d)
+			device_remove_file(lcd->layer[i]->dev,
+					   &dev_attr_bench);
+		unregister_framebuffer(lcd->layer[i]);
+	}
+	dma2d_release(lcd);
+
+	writel(0, lcd->base + LTDC_IER);
+	if (lcd->irq >= 0)
+		free_irq(lcd->irq, lcd);
+	if (lcd->err_irq >= 0)
+		free_irq(lcd->err_irq, lcd);
+	writel(0, lcd->base + LTDC_GCR);
+	if (lcd->enabled)
+		clk_disable(lcd->pix_clk);
+	clk_disable(lcd->clk);
+	if (lcd->pdata->init)
+		lcd->pdata->init(0);
+
+	for (i = 0; i < LTDC_LAYER_NUM; i++)
+		ltdc_layer_release(lcd->layer[i]);
+	iounmap(lcd->base);
+	kfree(lcd);
+	platform_set_drvdata(dev, NULL);
+
+	return 0;
+}
+
 static struct platform_driver fb_pdrv = {
 	.probe	= fb_probe,
+	.remove	= __devexit_p(fb_remove),
 	.driver	= {
 		.name	= DRIVER_NAME,
 	},
@@ -175,7 +1531,6 @@ int __init init_module0(void)
 void __exit cleanup_module0(void)
 {
 	platform_driver_unregister(&fb_pdrv);
-	kfree(fb_base);
 	pr_info("clean");
 }
 
@@ -8,7 +8,8 @@
 int dmamem_init(int memnode);
 
 /*
- * Allocate pages from dmamem region
+ * Allocate pages from dmamem region. Requests of up to half a page
+ * get a sub-page object aligned to its (power of two) size.
  */
 caddr_t dmamem_alloc(size_t size, size_t align, int gfp);
 
@@ -22,5 +23,10 @@ void dmamem_free(caddr_t adr);
  */
 int dmamem_fb_get(dma_addr_t *base, unsigned long *size);
 
+/*
+ * Get the whole dmamem area
+ */
+int dmamem_area_get(dma_addr_t *base, unsigned long *size);
+
 #endif /* _DMA_MEM_H_ */
 
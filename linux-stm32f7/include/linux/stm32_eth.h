@@ -36,8 +36,8 @@
  */
 struct stm32_eth_data {
 	unsigned int	frame_max_size;	/* Max eth frame size (up to 0x3FFC)  */
-	unsigned int	rx_buf_num;	/* Max frames num simulateously rxed  */
-	unsigned int	tx_buf_num;	/* Max frames num simulateously txed  */
+	unsigned int	rx_buf_num;	/* RX ring size, power of two	      */
+	unsigned int	tx_buf_num;	/* TX ring size, power of two	      */
 	unsigned char	mac_addr[6];	/* MAC address to use by default      */
 	unsigned char	phy_id;		/* PHY address (identifier)	      */
 };
@@ -0,0 +1,62 @@
+#ifndef _STM32_GPIO_BULK_H
+#define _STM32_GPIO_BULK_H
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+/*
+ * Batched port-wide access to STM32 GPIOs through /dev/gpio_bulk,
+ * which needs CAP_SYS_RAWIO. DELAY and WAIT are timed with the CPU
+ * cycle counter, to the cycle, plus a few cycles of loop overhead; a
+ * WAIT may also see the levels up to one port read (tens of ns) late.
+ */
+
+/* Commands */
+/* Drive the mask pins of port to the levels in value, with one store */
+#define STM32_GPIO_BULK_WRITE		0
+/* Read the levels of the mask pins of port into value */
+#define STM32_GPIO_BULK_READ		1
+/* Busy-wait for value nanoseconds, at most STM32_GPIO_BULK_DELAY_MAX_NS */
+#define STM32_GPIO_BULK_DELAY		2
+/*
+ * Busy-wait, for at most STM32_GPIO_BULK_WAIT_MAX_NS, until the mask
+ * pins of port read as value; value is then set to the levels read,
+ * and the batch stops with -ETIMEDOUT if they do not match
+ */
+#define STM32_GPIO_BULK_WAIT		3
+
+#define STM32_GPIO_BULK_DELAY_MAX_NS	1000000
+#define STM32_GPIO_BULK_WAIT_MAX_NS	100000
+
+struct stm32_gpio_bulk_cmd {
+	__u8	cmd;		/* STM32_GPIO_BULK_* */
+	__u8	port;		/* 0 for GPIOA, 1 for GPIOB, ... */
+	__u16	mask;		/* Pins of the port */
+	__u32	value;		/* Levels, or delay in ns */
+};
+
+/* Most commands per STM32_GPIO_BULK_IOC_RUN */
+#define STM32_GPIO_BULK_MAX_CMDS	1024
+
+/*
+ * Run the batch with interrupts disabled, for exact timing. The delays
+ * of the batch, counting STM32_GPIO_BULK_WAIT_MAX_NS per WAIT, must
+ * not add up to more than STM32_GPIO_BULK_ATOMIC_MAX_NS. Without this
+ * flag, other tasks may run between the commands of a batch.
+ */
+#define STM32_GPIO_BULK_ATOMIC		(1 << 0)
+#define STM32_GPIO_BULK_ATOMIC_MAX_NS	2000000
+
+struct stm32_gpio_bulk_run {
+	__u32	flags;		/* STM32_GPIO_BULK_ATOMIC */
+	__u32	ncmds;		/* Commands in cmds */
+	__u64	cmds;		/* User address of the commands */
+};
+
+/*
+ * Run a batch of commands. The values of READ and WAIT commands are
+ * written back to the user's array.
+ */
+#define STM32_GPIO_BULK_IOC_RUN		_IOW('G', 0x48, struct stm32_gpio_bulk_run)
+
+#endif /* _STM32_GPIO_BULK_H */
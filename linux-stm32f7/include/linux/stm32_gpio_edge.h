@@ -0,0 +1,42 @@
+#ifndef _STM32_GPIO_EDGE_H
+#define _STM32_GPIO_EDGE_H
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+/*
+ * Edge timestamps of STM32 GPIO inputs, read from /dev/gpio_edges
+ */
+
+/* Edges to capture */
+#define STM32_GPIO_EDGE_RISING		(1 << 0)
+#define STM32_GPIO_EDGE_FALLING		(1 << 1)
+
+/*
+ * One record read(2) from the device per edge, oldest first. cycles is
+ * the CPU cycle counter when the interrupt was taken: it runs at the
+ * rate given by STM32_GPIO_EDGE_IOC_HZ and wraps around at 2^32.
+ */
+struct stm32_gpio_edge {
+	__u32	cycles;
+	__u32	gpio;
+};
+
+/*
+ * Argument of STM32_GPIO_EDGE_IOC_ADD
+ */
+struct stm32_gpio_edge_req {
+	__u32	gpio;		/* GPIO number */
+	__u32	edges;		/* STM32_GPIO_EDGE_* */
+};
+
+/* Start capturing edges of a GPIO */
+#define STM32_GPIO_EDGE_IOC_ADD		_IOW('G', 0x40, struct stm32_gpio_edge_req)
+/* Stop capturing edges of a GPIO */
+#define STM32_GPIO_EDGE_IOC_DEL		_IOW('G', 0x41, __u32)
+/* Cycle counter rate, in Hz */
+#define STM32_GPIO_EDGE_IOC_HZ		_IOR('G', 0x42, __u32)
+/* Edges lost because the FIFO was full, since the last call */
+#define STM32_GPIO_EDGE_IOC_OVERRUNS	_IOR('G', 0x43, __u32)
+
+#endif /* _STM32_GPIO_EDGE_H */
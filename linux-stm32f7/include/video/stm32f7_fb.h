@@ -0,0 +1,73 @@
+#ifndef _STM32F7_FB_H
+#define _STM32F7_FB_H
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+/*
+ * Pixel formats of a STM32F7_FB_IOC_BLIT source. The values are the
+ * DMA2D colour mode encodings.
+ */
+#define STM32F7_FB_FMT_ARGB8888		0
+#define STM32F7_FB_FMT_RGB888		1
+#define STM32F7_FB_FMT_RGB565		2
+#define STM32F7_FB_FMT_ARGB1555		3
+#define STM32F7_FB_FMT_ARGB4444		4
+#define STM32F7_FB_FMT_A8		9
+#define STM32F7_FB_FMT_A4		10
+
+/*
+ * Blit flags
+ */
+/* Blend the source over the destination instead of replacing it */
+#define STM32F7_FB_BLIT_BLEND		(1 << 0)
+/* Use `alpha` as the source alpha */
+#define STM32F7_FB_BLIT_ALPHA_REPLACE	(1 << 1)
+/* Multiply the source alpha by `alpha` */
+#define STM32F7_FB_BLIT_ALPHA_MUL	(1 << 2)
+
+/*
+ * Draw a `width` x `height` rectangle at (dx, dy) of the virtual screen
+ * with the DMA2D engine. `src` is the address of the source pixels;
+ * if it is 0 the rectangle is filled with `color` (ARGB8888) instead.
+ * For A8 and A4 sources `color` gives the RGB of the pixels. The call
+ * returns once the engine has finished.
+ */
+struct stm32f7_fb_blit {
+	__u32	flags;
+	__u32	src;
+	__u32	src_pitch;
+	__u32	src_format;
+	__u32	color;
+	__u32	alpha;
+	__u32	dx;
+	__u32	dy;
+	__u32	width;
+	__u32	height;
+};
+
+#define STM32F7_FB_IOC_BLIT	_IOW('F', 0x90, struct stm32f7_fb_blit)
+
+/*
+ * Window of the overlay (the second framebuffer): position of its top
+ * left corner on the screen, and constant alpha (0..255) multiplied
+ * with the alpha of its pixels. The change shows at the next vertical
+ * blanking.
+ */
+struct stm32f7_fb_overlay {
+	__u32	x;
+	__u32	y;
+	__u32	alpha;
+};
+
+#define STM32F7_FB_IOC_SET_OVERLAY	_IOW('F', 0x91, struct stm32f7_fb_overlay)
+#define STM32F7_FB_IOC_GET_OVERLAY	_IOR('F', 0x92, struct stm32f7_fb_overlay)
+
+/*
+ * Wait for the next vertical blanking; the argument must point to 0
+ */
+#ifndef FBIO_WAITFORVSYNC
+#define FBIO_WAITFORVSYNC	_IOW('F', 0x20, __u32)
+#endif
+
+#endif /* _STM32F7_FB_H */
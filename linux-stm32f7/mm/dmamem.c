@@ -18,6 +18,11 @@
 #include <linux/bootmem.h>
 #include <linux/ioport.h>
 #include <linux/mm.h>
+#include <linux/slab.h>
+#include <linux/rbtree.h>
+#include <linux/list.h>
+#include <linux/bitmap.h>
+#include <linux/spinlock.h>
 #include <linux/dmamem.h>
 
 #include <asm/setup.h>
@@ -25,12 +30,46 @@
 #define DM_NAME		"dmamem"
 
 /*
- * dmamem block descriptor
+ * Requests up to half a page are carved from slab pages, in power of
+ * two sized objects from 32 bytes up. An object is aligned to its size.
  */
-struct dm_dsc {
-	struct dm_dsc	*next;
-	caddr_t		base;		/* base of allocated block */
-	size_t		size;		/* size in bytes */
+#define DM_SLAB_MIN_SHIFT	5
+#define DM_SLAB_MAX_SHIFT	(PAGE_SHIFT - 1)
+#define DM_SLAB_CLASSES		(DM_SLAB_MAX_SHIFT - DM_SLAB_MIN_SHIFT + 1)
+#define DM_SLAB_OBJS_MAX	(PAGE_SIZE >> DM_SLAB_MIN_SHIFT)
+
+/*
+ * Descriptors an allocation may need: one for the pages skipped to
+ * align the block, one for the rest of the free block
+ */
+#define DM_SPARE	2
+
+/*
+ * dmamem block descriptor. The blocks tile the general area, and are
+ * all in the address tree; the free ones are in the size tree too.
+ */
+struct dm_blk {
+	struct rb_node		addr_node;
+	struct rb_node		size_node;
+	unsigned long		base;		/* base of the block */
+	unsigned long		size;		/* size in bytes */
+	int			free;
+
+	/* Slab page: size class (-1 if none), objects in use and map */
+	int			cls;
+	unsigned int		inuse;
+	struct list_head	slab_list;	/* also the spare list */
+	unsigned long		map[BITS_TO_LONGS(DM_SLAB_OBJS_MAX)];
+};
+
+/*
+ * Slab size class
+ */
+struct dm_slab_class {
+	struct list_head	partial;	/* pages with free objects */
+	unsigned int		pages;
+	unsigned int		objs;
+	unsigned int		objs_peak;
 };
 
 static int dm_proc(char *page, char **start, off_t off,
@@ -40,8 +79,21 @@ static unsigned long	dm_base;
 static unsigned long	dm_sz_all;
 static unsigned long	dm_sz_fb;
 
-static struct dm_dsc	*dm_lst_free;
-static struct dm_dsc	*dm_lst_used;
+static DEFINE_SPINLOCK(dm_lock);
+static struct kmem_cache *dm_cache;
+
+static struct rb_root	dm_addr_root = RB_ROOT;
+static struct rb_root	dm_size_root = RB_ROOT;
+static struct dm_slab_class dm_slabs[DM_SLAB_CLASSES];
+
+static LIST_HEAD(dm_spare);
+static int		dm_nspare;
+
+/* Statistics */
+static unsigned long	dm_used;
+static unsigned long	dm_used_peak;
+static unsigned long	dm_largest_min;
+static unsigned long	dm_fail;
 
 static struct resource	dm_res = {
 	.name	= DM_NAME " area",
@@ -69,10 +121,307 @@ static int __init parse_tag_dmamem(const struct tag *tag)
 }
 __tagtable(ATAG_DMAMEM, parse_tag_dmamem);
 
+/*
+ * Take a descriptor from the spare list; the caller has made sure
+ * there are enough of them. Called with dm_lock held.
+ */
+static struct dm_blk *dm_blk_get(void)
+{
+	struct dm_blk *b;
+
+	b = list_first_entry(&dm_spare, struct dm_blk, slab_list);
+	list_del(&b->slab_list);
+	dm_nspare--;
+	b->free = 1;
+	b->cls = -1;
+
+	return b;
+}
+
+/*
+ * Release a descriptor. Called with dm_lock held.
+ */
+static void dm_blk_put(struct dm_blk *b)
+{
+	if (dm_nspare < DM_SPARE) {
+		list_add(&b->slab_list, &dm_spare);
+		dm_nspare++;
+	} else {
+		kmem_cache_free(dm_cache, b);
+	}
+}
+
+/*
+ * Top up the spare list. The descriptors are allocated outside of
+ * dm_lock, so the caller's gfp flags can be honoured.
+ */
+static int dm_spare_fill(gfp_t gfp)
+{
+	struct dm_blk *b;
+	unsigned long fl;
+
+	while (dm_nspare < DM_SPARE) {
+		b = kmem_cache_alloc(dm_cache, gfp);
+		if (!b)
+			return -ENOMEM;
+		spin_lock_irqsave(&dm_lock, fl);
+		list_add(&b->slab_list, &dm_spare);
+		dm_nspare++;
+		spin_unlock_irqrestore(&dm_lock, fl);
+	}
+
+	return 0;
+}
+
+static void dm_addr_insert(struct dm_blk *nb)
+{
+	struct rb_node **p = &dm_addr_root.rb_node, *parent = NULL;
+	struct dm_blk *b;
+
+	while (*p) {
+		parent = *p;
+		b = rb_entry(parent, struct dm_blk, addr_node);
+		if (nb->base < b->base)
+			p = &parent->rb_left;
+		else
+			p = &parent->rb_right;
+	}
+	rb_link_node(&nb->addr_node, parent, p);
+	rb_insert_color(&nb->addr_node, &dm_addr_root);
+}
+
+/*
+ * Find the block that holds `addr`
+ */
+static struct dm_blk *dm_addr_lookup(unsigned long addr)
+{
+	struct rb_node *n = dm_addr_root.rb_node;
+	struct dm_blk *b;
+
+	while (n) {
+		b = rb_entry(n, struct dm_blk, addr_node);
+		if (addr < b->base)
+			n = n->rb_left;
+		else if (addr >= b->base + b->size)
+			n = n->rb_right;
+		else
+			return b;
+	}
+
+	return NULL;
+}
+
+/*
+ * The size tree is ordered by size, then by address
+ */
+static void dm_size_insert(struct dm_blk *nb)
+{
+	struct rb_node **p = &dm_size_root.rb_node, *parent = NULL;
+	struct dm_blk *b;
+
+	while (*p) {
+		parent = *p;
+		b = rb_entry(parent, struct dm_blk, size_node);
+		if (nb->size < b->size ||
+		    (nb->size == b->size && nb->base < b->base))
+			p = &parent->rb_left;
+		else
+			p = &parent->rb_right;
+	}
+	rb_link_node(&nb->size_node, parent, p);
+	rb_insert_color(&nb->size_node, &dm_size_root);
+}
+
+/*
+ * Find the smallest free block of at least `size` bytes
+ */
+static struct dm_blk *dm_size_lookup(unsigned long size)
+{
+	struct rb_node *n = dm_size_root.rb_node;
+	struct dm_blk *b, *best = NULL;
+
+	while (n) {
+		b = rb_entry(n, struct dm_blk, size_node);
+		if (b->size >= size) {
+			best = b;
+			n = n->rb_left;
+		} else {
+			n = n->rb_right;
+		}
+	}
+
+	return best;
+}
+
+static unsigned long dm_largest_free(void)
+{
+	struct rb_node *n = rb_last(&dm_size_root);
+
+	return n ? rb_entry(n, struct dm_blk, size_node)->size : 0;
+}
+
+/*
+ * Allocate a block of `size` bytes aligned to `align`, both multiples
+ * of the page size. The best fitting free block is taken; if the
+ * alignment makes it too short, the smallest block that fits whatever
+ * its alignment is. Called with dm_lock held and DM_SPARE spare
+ * descriptors.
+ */
+static struct dm_blk *dm_page_alloc(unsigned long size, unsigned long align)
+{
+	struct dm_blk *b, *nb;
+	unsigned long abase;
+
+	b = dm_size_lookup(size);
+	if (b && ALIGN(b->base, align) + size > b->base + b->size)
+		b = dm_size_lookup(size + align - PAGE_SIZE);
+	if (!b) {
+		dm_fail++;
+		return NULL;
+	}
+	rb_erase(&b->size_node, &dm_size_root);
+
+	/* The pages skipped for alignment stay free */
+	abase = ALIGN(b->base, align);
+	if (abase != b->base) {
+		nb = dm_blk_get();
+		nb->base = b->base;
+		nb->size = abase - b->base;
+		b->base = abase;
+		b->size -= nb->size;
+		dm_addr_insert(nb);
+		dm_size_insert(nb);
+	}
+
+	/* So does the rest of the block */
+	if (b->size > size) {
+		nb = dm_blk_get();
+		nb->base = b->base + size;
+		nb->size = b->size - size;
+		b->size = size;
+		dm_addr_insert(nb);
+		dm_size_insert(nb);
+	}
+
+	b->free = 0;
+	b->cls = -1;
+
+	dm_used += size;
+	if (dm_used > dm_used_peak)
+		dm_used_peak = dm_used;
+	abase = dm_largest_free();
+	if (abase < dm_largest_min)
+		dm_largest_min = abase;
+
+	return b;
+}
+
+/*
+ * Free a block, merging it with its free neighbours.
+ * Called with dm_lock held.
+ */
+static void dm_page_free(struct dm_blk *b)
+{
+	struct rb_node *n;
+	struct dm_blk *nb;
+
+	dm_used -= b->size;
+	b->free = 1;
+	b->cls = -1;
+
+	n = rb_next(&b->addr_node);
+	if (n) {
+		nb = rb_entry(n, struct dm_blk, addr_node);
+		if (nb->free) {
+			b->size += nb->size;
+			rb_erase(&nb->size_node, &dm_size_root);
+			rb_erase(&nb->addr_node, &dm_addr_root);
+			dm_blk_put(nb);
+		}
+	}
+
+	n = rb_prev(&b->addr_node);
+	if (n) {
+		nb = rb_entry(n, struct dm_blk, addr_node);
+		if (nb->free) {
+			rb_erase(&nb->size_node, &dm_size_root);
+			nb->size += b->size;
+			rb_erase(&b->addr_node, &dm_addr_root);
+			dm_blk_put(b);
+			b = nb;
+		}
+	}
+
+	dm_size_insert(b);
+}
+
+/*
+ * Allocate an object of size class `cls`, starting a new slab page
+ * if none has a free object. Called with dm_lock held and DM_SPARE
+ * spare descriptors.
+ */
+static unsigned long dm_slab_alloc(int cls)
+{
+	struct dm_slab_class *c = &dm_slabs[cls];
+	unsigned int shift = cls + DM_SLAB_MIN_SHIFT;
+	struct dm_blk *b;
+	unsigned int i;
+
+	if (list_empty(&c->partial)) {
+		b = dm_page_alloc(PAGE_SIZE, PAGE_SIZE);
+		if (!b)
+			return 0;
+		b->cls = cls;
+		b->inuse = 0;
+		bitmap_zero(b->map, DM_SLAB_OBJS_MAX);
+		list_add(&b->slab_list, &c->partial);
+		c->pages++;
+	}
+
+	b = list_first_entry(&c->partial, struct dm_blk, slab_list);
+	i = find_first_zero_bit(b->map, PAGE_SIZE >> shift);
+	__set_bit(i, b->map);
+	if (++b->inuse == PAGE_SIZE >> shift)
+		list_del_init(&b->slab_list);
+
+	if (++c->objs > c->objs_peak)
+		c->objs_peak = c->objs;
+
+	return b->base + (i << shift);
+}
+
+/*
+ * Free a slab object; the page goes back to the area once it is
+ * empty. Called with dm_lock held.
+ */
+static int dm_slab_free(struct dm_blk *b, unsigned long addr)
+{
+	struct dm_slab_class *c = &dm_slabs[b->cls];
+	unsigned int shift = b->cls + DM_SLAB_MIN_SHIFT;
+	unsigned int i = (addr - b->base) >> shift;
+
+	if (addr & ((1 << shift) - 1) || !test_bit(i, b->map))
+		return -EINVAL;
+
+	__clear_bit(i, b->map);
+	if (b->inuse-- == PAGE_SIZE >> shift)
+		list_add(&b->slab_list, &c->partial);
+	c->objs--;
+
+	if (!b->inuse) {
+		list_del(&b->slab_list);
+		c->pages--;
+		dm_page_free(b);
+	}
+
+	return 0;
+}
+
 static int __init dm_init(void)
 {
 	struct proc_dir_entry	*res;
-	int			rv;
+	struct dm_blk		*b;
+	int			i, rv;
 
 	if (!dm_sz_all) {
 		printk(KERN_CRIT "%s: no correct ATAG found, "
@@ -86,15 +435,31 @@ static int __init dm_init(void)
 	dm_res.end = dm_base + dm_sz_all;
 	request_resource(&iomem_resource, &dm_res);
 
-	/* Create free list */
-	dm_lst_free = kmalloc(sizeof(struct dm_dsc), GFP_KERNEL);
-	if (!dm_lst_free) {
+	for (i = 0; i < DM_SLAB_CLASSES; i++)
+		INIT_LIST_HEAD(&dm_slabs[i].partial);
+
+	dm_cache = kmem_cache_create("dmamem_blk", sizeof(struct dm_blk),
+				     0, 0, NULL);
+	if (!dm_cache) {
 		rv = -ENOMEM;
 		goto out;
 	}
-	dm_lst_free->next = NULL;
-	dm_lst_free->base = (void *)(dm_base + dm_sz_fb);
-	dm_lst_free->size = dm_sz_all - dm_sz_fb;
+
+	/* The whole general area is one free block */
+	b = kmem_cache_alloc(dm_cache, GFP_KERNEL);
+	if (!b) {
+		kmem_cache_destroy(dm_cache);
+		dm_cache = NULL;
+		rv = -ENOMEM;
+		goto out;
+	}
+	b->base = dm_base + dm_sz_fb;
+	b->size = dm_sz_all - dm_sz_fb;
+	b->free = 1;
+	b->cls = -1;
+	dm_addr_insert(b);
+	dm_size_insert(b);
+	dm_largest_min = b->size;
 
 	/*
 	 * Create /proc entry for it
@@ -139,93 +504,50 @@ int dmamem_init(int memnode)
  */
 caddr_t dmamem_alloc(size_t size, size_t align, int gfp)
 {
-	struct dm_dsc	*dm, *ndm, *adm, **pdm;
-	caddr_t		abase = 0;
-	int		count, a;
-
-	count = (size + PAGE_SIZE - 1) / PAGE_SIZE;
-
-	ndm = NULL;
-	adm = NULL;
-
-	a = align;
-	if (!align)
-		align = PAGE_SIZE;
-	if (align % PAGE_SIZE)
-		align = (align + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+	unsigned long addr = 0;
+	unsigned long fl;
+	struct dm_blk *b;
+	int cls = -1;
 
-	/*
-	 * Search a free block which is large enough, even with alignment.
-	 */
-	pdm = &dm_lst_free;
-	while (*pdm != NULL) {
-		dm= *pdm;
-		abase = (caddr_t)((((unsigned long)dm->base +
-				    align - 1) / align) * align);
-
-		if (abase + count * PAGE_SIZE <= dm->base + dm->size)
-			break;
+	if (!dm_cache || !size)
+		return NULL;
 
-		pdm = &dm->next;
+	if (size <= PAGE_SIZE / 2 && align <= PAGE_SIZE / 2) {
+		cls = fls(max(size, align) - 1) - DM_SLAB_MIN_SHIFT;
+		if (cls < 0)
+			cls = 0;
+	} else {
+		size = PAGE_ALIGN(size);
+		align = align ? PAGE_ALIGN(align) : PAGE_SIZE;
 	}
 
-	dm = *pdm;
-	if (!dm)
-		return NULL;
-
 	/*
-	 * When we have to align, the pages needed for alignment can
-	 * be put back to the free pool.
-	 * We check here if we need a second dmamem data structure later
-	 * and allocate it now, so that we don't have to check for a
-	 * failed kmalloc later.
+	 * The descriptors come from a cache that is not in ZONE_DMA;
+	 * only the blocks they describe are used for DMA
 	 */
-	if (abase - dm->base + count * PAGE_SIZE < dm->size) {
-		ndm = kmalloc(sizeof(struct dm_dsc), gfp);
-		if (!ndm)
-			return NULL;
-	}
+	gfp &= ~__GFP_DMA;
 
-	if (abase != dm->base) {
-		adm = kmalloc(sizeof(struct dm_dsc), gfp);
-		if (!adm) {
-			if (ndm)
-				kfree(ndm);
+	for (;;) {
+		if (dm_spare_fill(gfp))
 			return NULL;
-		}
-		adm->base = dm->base;
-		adm->size = abase - dm->base;
-		dm->base = abase;
-		dm->size -= adm->size;
-		adm->next = dm;
-		*pdm = adm;
-		pdm = &adm->next;
-	}
 
-	if (ndm) {
-		/*
-		 * Range is larger than needed, create a new list element for
-		 * the used list and shrink the element in the free list.
-		 */
-		ndm->base = dm->base;
-		ndm->size = count * PAGE_SIZE;
-		dm->base = ndm->base + ndm->size;
-		dm->size = dm->size - ndm->size;
-	} else {
-		/*
-		 * Range fits perfectly, remove it from free list.
-		 */
-		*pdm = dm->next;
-		ndm = dm;
+		spin_lock_irqsave(&dm_lock, fl);
+		if (dm_nspare < DM_SPARE) {
+			/* Someone else used them up; try again */
+			spin_unlock_irqrestore(&dm_lock, fl);
+			continue;
+		}
+		if (cls >= 0) {
+			addr = dm_slab_alloc(cls);
+		} else {
+			b = dm_page_alloc(size, align);
+			addr = b ? b->base : 0;
+		}
+		spin_unlock_irqrestore(&dm_lock, fl);
+		break;
 	}
 
-	/*
-	 * Insert block into used list
-	 */
-	ndm->next = dm_lst_used;
-	dm_lst_used = ndm;
-
-	return ndm->base;
+	return (caddr_t)addr;
 }
 
 /*
@@ -233,59 +555,28 @@ caddr_t dmamem_alloc(size_t size, size_t align, int gfp)
  */
 void dmamem_free(caddr_t base)
 {
-	struct dm_dsc *prev, *next, *dm, **pdm;
-
-	/*
-	 * Search the block in the used list.
-	 */
-	for (pdm = &dm_lst_used; *pdm; pdm = &(*pdm)->next) {
-		if ((*pdm)->base == base)
-			break;
-	}
+	unsigned long addr = (unsigned long)base;
+	struct dm_blk *b;
+	unsigned long fl;
+	int rv = -EINVAL;
 
-	if (*pdm == NULL) {
-		printk("%s: 0x%08x not allocated!\n", DM_NAME, (unsigned)base);
+	if (!base)
 		return;
-	}
-
-	/*
-	 * Remove range from the used list:
-	 */
-	dm = *pdm;
-	*pdm = (*pdm)->next;
-
-	/*
-	 * The free-list is sorted by address, search insertion point
-	 * and insert block in free list.
-	 */
-	for (pdm = &dm_lst_free, prev = NULL; *pdm;
-	     prev = *pdm, pdm = &(*pdm)->next) {
-		if ((*pdm)->base >= base)
-			break;
-	}
 
-	/*
-	 * Concatenate free range with neighbors, if possible.
-	 * Try for upper neighbor (next in list) first, then
-	 * for lower neighbor (predecessor in list).
-	 */
-	dm->next = *pdm;
-	*pdm = dm;
-
-	if (dm->next &&
-	    dm->base + dm->size == dm->next->base) {
-		next = dm->next;
-		dm->size += dm->next->size;
-		dm->next = next->next;
-		kfree(next);
+	spin_lock_irqsave(&dm_lock, fl);
+	b = dm_addr_lookup(addr);
+	if (b && !b->free) {
+		if (b->cls >= 0) {
+			rv = dm_slab_free(b, addr);
+		} else if (b->base == addr) {
+			dm_page_free(b);
+			rv = 0;
+		}
 	}
+	spin_unlock_irqrestore(&dm_lock, fl);
 
-	if (prev &&
-	    prev->base + prev->size == dm->base) {
-		prev->size += prev->next->size;
-		prev->next = dm->next;
-		kfree(dm);
-	}
+	if (rv)
+		printk("%s: 0x%08x not allocated!\n", DM_NAME, (unsigned)base);
 }
 
 /*
@@ -305,52 +596,93 @@ int dmamem_fb_get(dma_addr_t *base, unsigned long *size)
 	return 0;
 }
 
+/*
+ * Get the whole dmamem area, 'fb' part included
+ */
+int dmamem_area_get(dma_addr_t *base, unsigned long *size)
+{
+	if (!dm_sz_all)
+		return -ENODEV;
+
+	if (base)
+		*base = dm_base;
+
+	if (size)
+		*size = dm_sz_all;
+
+	return 0;
+}
+
 /*
  * Called on /proc read
  */
 static int dm_proc(char *page, char **start, off_t off,
 		   int count, int *eof, void *data)
 {
-	struct dm_dsc	*dm;
-	int		len;
-	int		free_count, free_total, free_max;
-	int		used_count, used_total, used_max;
+	struct dm_blk	*dm;
+	struct rb_node	*n;
+	unsigned long	fl;
+	int		len, i;
+	unsigned long	free_count, free_total, free_max;
+	unsigned long	used_count, used_total, used_max;
+	unsigned long	used_peak, largest_min, fail;
+	struct dm_slab_class slabs[DM_SLAB_CLASSES];
+
+	if (!dm_sz_all) {
+		len = sprintf(page, "No %s area allocated!\n", DM_NAME);
+		goto out;
+	}
 
 	free_count = 0;
 	free_total = 0;
 	free_max   = 0;
-	for (dm = dm_lst_free; dm; dm = dm->next) {
-		free_count++;
-		free_total += dm->size;
-		if (dm->size > free_max)
-			free_max = dm->size;
-	}
-
 	used_count = 0;
 	used_total = 0;
 	used_max   = 0;
-	for (dm = dm_lst_used; dm; dm = dm->next) {
-		used_count++;
-		used_total += dm->size;
-		if (dm->size > used_max)
-			used_max = dm->size;
-	}
 
-	if (!dm_sz_all) {
-		len = sprintf(page, "No %s area allocated!\n", DM_NAME);
-		goto out;
+	spin_lock_irqsave(&dm_lock, fl);
+	for (n = rb_first(&dm_addr_root); n; n = rb_next(n)) {
+		dm = rb_entry(n, struct dm_blk, addr_node);
+		if (dm->free) {
+			free_count++;
+			free_total += dm->size;
+			free_max = max(free_max, dm->size);
+		} else {
+			used_count++;
+			used_total += dm->size;
+			used_max = max(used_max, dm->size);
+		}
 	}
+	used_peak = dm_used_peak;
+	largest_min = dm_largest_min;
+	fail = dm_fail;
+	memcpy(slabs, dm_slabs, sizeof(slabs));
+	spin_unlock_irqrestore(&dm_lock, fl);
 
 	len = sprintf(page,
 		"%s area, fb mem size %ld kB, gen dma mem size %ld kB\n"
 		"                       free list:             used list:\n"
-		"number of blocks:      %8d               %8d\n"
-		"size of largest block: %8d kB            %8d kB\n"
-		"total:                 %8d kB            %8d kB\n",
+		"number of blocks:      %8ld               %8ld\n"
+		"size of largest block: %8ld kB            %8ld kB\n"
+		"total:                 %8ld kB            %8ld kB\n"
+		"fragmentation:         %8ld %%\n"
+		"used high-water:       %8ld kB\n"
+		"largest free low-water:%8ld kB\n"
+		"failed allocations:    %8ld\n",
 		DM_NAME, dm_sz_fb / 1024, (dm_sz_all - dm_sz_fb) / 1024,
 		free_count, used_count,
 		free_max / 1024, used_max / 1024,
-		free_total / 1024, used_total /1024);
+		free_total / 1024, used_total / 1024,
+		free_total ? 100 - free_max * 100 / free_total : 0,
+		used_peak / 1024, largest_min / 1024, fail);
+
+	len += sprintf(page + len,
+		"slab object size:      pages   objects   high-water\n");
+	for (i = 0; i < DM_SLAB_CLASSES; i++) {
+		len += sprintf(page + len, "%8lu               %5u  %8u     %8u\n",
+			1UL << (i + DM_SLAB_MIN_SHIFT), slabs[i].pages,
+			slabs[i].objs, slabs[i].objs_peak);
+	}
 out:
 	/*
 	 * Calculate /proc metrics
@@ -366,4 +698,3 @@ out:
 
 	return len;
 }
-